@@ -0,0 +1,236 @@
+/* main.cpp - Copyright 2019/2020 Utrecht University
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+	   http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+   Batch renderer: renders a sequence of frames with a CPU core, without a
+   window or OpenGL context, and writes them to disk. Usage:
+
+   batchapp [options] scene
+     -core name     render core DLL (default: RenderCore_Kajiya)
+     -w, -h         frame size (default: 1280x720)
+     -n count       number of frames (default: 1, or the number of keys)
+     -spp count     passes per frame (default: 1)
+     -t seconds     time budget per frame; overrides -spp
+     -fps rate      animation frame rate (default: 24)
+     -c file        camera, as saved by the interactive applications
+     -path file     camera keys, in the format of spline_seq.txt
+     -o pattern     output file names (default: frame%04i.png), with a single
+                    %d or %i for the frame number; .exr and .hdr store the
+                    unclamped radiance, if the core supports it
+     -csv file      per-frame timings
+     -trace file    span trace of the whole run, for chrome://tracing or Perfetto
+*/
+
+#include "platform.h"
+#include "rendersystem.h"
+
+static RenderAPI* renderer = 0;
+static HostTarget* renderTarget = 0;
+
+// command line options
+static const char* coreName = "RenderCore_Kajiya";
+static const char* sceneFile = 0, * cameraFile = 0, * pathFile = 0, * csvFile = 0, * traceFile = 0;
+static const char* outPattern = "frame%04i.png";
+static uint scrwidth = 1280, scrheight = 720, frameCount = 0, passes = 1;
+static float timeBudget = 0, fps = 24;
+
+// camera path
+static vector<float3> camPos, camTarget;
+static vector<float2> camLens; // aperture, focal distance
+
+//  +-----------------------------------------------------------------------------+
+//  |  SameText                                                                   |
+//  |  Case-insensitive string compare; _stricmp is not available on POSIX. LH2'20|
+//  +-----------------------------------------------------------------------------+
+static bool SameText( const char* a, const char* b )
+{
+	for (; *a && *b; a++, b++) if (tolower( (uchar)*a ) != tolower( (uchar)*b )) return false;
+	return *a == *b;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  ValidPattern                                                               |
+//  |  The output pattern is used as a printf format for the frame number,        |
+//  |  so it must hold exactly one %d or %i, optionally with a zero flag and      |
+//  |  a width, and no other conversions.                                   LH2'20|
+//  +-----------------------------------------------------------------------------+
+static bool ValidPattern( const char* pattern )
+{
+	int conversions = 0;
+	for (const char* p = strchr( pattern, '%' ); p; p = strchr( p, '%' ))
+	{
+		p++;
+		if (*p == '0') p++;
+		while (*p >= '0' && *p <= '9') p++;
+		if (*p != 'd' && *p != 'i') return false;
+		conversions++;
+	}
+	return conversions == 1;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  ParseCommandLine                                                           |
+//  |  Read the options; returns false for unknown or incomplete ones.      LH2'20|
+//  +-----------------------------------------------------------------------------+
+bool ParseCommandLine( int argc, char** argv )
+{
+	for (int i = 1; i < argc; i++)
+	{
+		const char* a = argv[i];
+		const bool hasValue = i + 1 < argc;
+		if (a[0] != '-') sceneFile = a;
+		else if (!hasValue) return false;
+		else if (!strcmp( a, "-core" )) coreName = argv[++i];
+		else if (!strcmp( a, "-w" )) scrwidth = atoi( argv[++i] );
+		else if (!strcmp( a, "-h" )) scrheight = atoi( argv[++i] );
+		else if (!strcmp( a, "-n" )) frameCount = atoi( argv[++i] );
+		else if (!strcmp( a, "-spp" )) passes = max( 1, atoi( argv[++i] ) );
+		else if (!strcmp( a, "-t" )) timeBudget = (float)atof( argv[++i] );
+		else if (!strcmp( a, "-fps" )) fps = max( 1.0f, (float)atof( argv[++i] ) );
+		else if (!strcmp( a, "-c" )) cameraFile = argv[++i];
+		else if (!strcmp( a, "-path" )) pathFile = argv[++i];
+		else if (!strcmp( a, "-o" )) { if (!ValidPattern( outPattern = argv[++i] )) return false; }
+		else if (!strcmp( a, "-csv" )) csvFile = argv[++i];
+		else if (!strcmp( a, "-trace" )) traceFile = argv[++i];
+		else return false;
+	}
+	return sceneFile != 0 && scrwidth > 0 && scrheight > 0;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  LoadCameraPath                                                             |
+//  |  Read camera keys: one '(pos) -> (target) aperture focal' per line.   LH2'20|
+//  +-----------------------------------------------------------------------------+
+void LoadCameraPath( const char* file )
+{
+	FILE* f = fopen( file, "r" );
+	if (!f) FATALERROR( "Could not open camera path %s", file );
+	char t[1024];
+	while (fgets( t, sizeof( t ), f ))
+	{
+		if (t[0] == '#') continue;
+		float3 P, T;
+		float aperture, fdist;
+		if (sscanf( t, "(%f,%f,%f) -> (%f,%f,%f) %f %f", &P.x, &P.y, &P.z, &T.x, &T.y, &T.z, &aperture, &fdist ) != 8) continue;
+		camPos.push_back( P );
+		camTarget.push_back( T );
+		camLens.push_back( make_float2( aperture, fdist ) );
+	}
+	fclose( f );
+	if (camPos.size() == 0) FATALERROR( "No camera keys in %s", file );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  PathPoint                                                                  |
+//  |  Catmull-Rom interpolation of a key sequence; the end points are            |
+//  |  extended slightly to obtain the outer control points.                LH2'20|
+//  +-----------------------------------------------------------------------------+
+float3 PathPoint( const vector<float3>& key, const int segment, const float t )
+{
+	const int last = (int)key.size() - 1;
+	float3 p1 = key[segment], p2 = key[min( segment + 1, last )];
+	float3 p0 = segment > 0 ? key[segment - 1] : (p1 - 0.01f * (p2 - p1));
+	float3 p3 = segment < last - 1 ? key[segment + 2] : (p2 + 0.01f * (p2 - p1));
+	return CatmullRom( p0, p1, p2, p3, t );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  PlaceCamera                                                                |
+//  |  Position the camera for a frame; frames are spread evenly over the         |
+//  |  path.                                                                LH2'20|
+//  +-----------------------------------------------------------------------------+
+void PlaceCamera( const uint frame )
+{
+	if (camPos.size() == 0) return;
+	Camera* camera = renderer->GetCamera();
+	const int segments = (int)camPos.size() - 1;
+	const float u = frameCount > 1 ? ((float)frame / (frameCount - 1)) * segments : 0;
+	const int segment = min( (int)u, max( 0, segments - 1 ) );
+	const float t = min( 1.0f, u - segment );
+	camera->LookAt( PathPoint( camPos, segment, t ), PathPoint( camTarget, segment, t ) );
+	const float2 lens = segments > 0 ? lerp( camLens[segment], camLens[segment + 1], t ) : camLens[0];
+	camera->aperture = lens.x;
+	camera->focalDistance = lens.y;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  main                                                                       |
+//  |  Application entry point.                                             LH2'20|
+//  +-----------------------------------------------------------------------------+
+int main( int argc, char** argv )
+{
+	if (!ParseCommandLine( argc, argv ))
+	{
+		printf( "usage: batchapp [-core name] [-w width] [-h height] [-n frames] [-spp passes | -t seconds]\n" );
+		printf( "                [-fps rate] [-c camera.xml] [-path keys.txt] [-o frame%%04i.png] [-csv timing.csv]\n" );
+		printf( "                [-trace trace.json] scene\n" );
+		return 1;
+	}
+	// initialize renderer; no window or OpenGL context is created
+	renderer = RenderAPI::CreateHeadlessRenderAPI( coreName );
+	if (traceFile) renderer->EnableTrace( true );
+	if (cameraFile) renderer->DeserializeCamera( cameraFile );
+	if (pathFile) LoadCameraPath( pathFile );
+	if (frameCount == 0) frameCount = max( 1, (int)camPos.size() );
+	// load the scene: gltf files bring their own node hierarchy and animations
+	const char* ext = strrchr( sceneFile, '.' );
+	if (ext && (SameText( ext, ".gltf" ) || SameText( ext, ".glb" ))) renderer->AddScene( sceneFile );
+	else renderer->AddInstance( renderer->AddMesh( sceneFile ) );
+	// create the target; HDR formats receive floating point pixels
+	const char* outExt = strrchr( outPattern, '.' );
+	const bool hdr = outExt && (SameText( outExt, ".exr" ) || SameText( outExt, ".hdr" ));
+	renderTarget = new HostTarget( scrwidth, scrheight, hdr ? HostTarget::FLOAT : HostTarget::DEFAULT );
+	renderer->SetTarget( renderTarget, 1 );
+	// render the frames
+	FILE* csv = csvFile ? fopen( csvFile, "w" ) : 0;
+	if (csv) fprintf( csv, "frame,passes,render_ms,save_ms\n" );
+	const int animCount = renderer->AnimationCount();
+	float totalRender = 0;
+	Timer timer;
+	for (uint frame = 0; frame < frameCount; frame++)
+	{
+		PROFILE_SPAN( "Frame" );
+		// advance the scene
+		PlaceCamera( frame );
+		if (frame > 0) for (int i = 0; i < animCount; i++) renderer->UpdateAnimation( i, 1.0f / fps );
+		renderer->SynchronizeSceneData();
+		// accumulate passes until the count or the time budget is reached
+		timer.reset();
+		uint pass = 0;
+		do
+		{
+			renderer->Render( pass == 0 ? Restart : Converge );
+			renderer->WaitForRender();
+			pass++;
+		} while (timeBudget > 0 ? timer.elapsed() < timeBudget : pass < passes);
+		const float renderTime = timer.elapsed();
+		// store the frame
+		char fileName[1024];
+		snprintf( fileName, sizeof( fileName ), outPattern, frame );
+		timer.reset();
+		if (!renderTarget->Save( fileName )) printf( "could not save %s\n", fileName );
+		const float saveTime = timer.elapsed();
+		totalRender += renderTime;
+		printf( "frame %4i: %3i passes, %8.2fms render, %6.2fms save -> %s\n", frame, pass, renderTime * 1000, saveTime * 1000, fileName );
+		if (csv) fprintf( csv, "%i,%i,%.3f,%.3f\n", frame, pass, renderTime * 1000, saveTime * 1000 );
+	}
+	printf( "%i frames, %.2fms average render time\n", frameCount, totalRender * 1000 / frameCount );
+	// clean up
+	if (csv) fclose( csv );
+	if (traceFile && !renderer->WriteTrace( traceFile )) printf( "could not write %s\n", traceFile );
+	renderer->Shutdown();
+	delete renderTarget;
+	return 0;
+}
+
+// EOF
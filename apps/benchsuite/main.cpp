@@ -0,0 +1,293 @@
+/* main.cpp - Copyright 2019/2020 Utrecht University
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+	   http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+
+   Benchmark suite: renders a fixed matrix of scenes, cores, resolutions and
+   thread counts with the CPU cores, without a window, and stores the results
+   as CSV and JSON. Usage:
+
+   benchsuite [-matrix benchmark.txt] [-o results] [-ref references] [-update]
+
+   A RenderAPI hosts a single core, so each scene / core pair is measured in a
+   child process, which appends its rows to the CSV file. Per row:
+   - scene load time: loading, plus the first synchronization, which builds
+     the acceleration structure; bvh build time as reported by the core;
+   - frame time statistics over the measured frames;
+   - Mrays/s per ray type over its trace time, and for all rays over the
+     render time, for cores that report ray counts;
+   - RMSE of the last frame against references/scene_core_WxH.png. Missing
+     references are created; -update replaces them. RMSE is -1 for new ones.
+*/
+
+#include "platform.h"
+#include "rendersystem.h"
+
+#include <filesystem>
+
+static RenderAPI* renderer = 0;
+
+// benchmark matrix
+struct BenchScene { string file, camera; };
+static vector<BenchScene> scenes;
+static vector<string> cores;
+static vector<int2> resolutions;
+static vector<int> threadCounts;
+static int frames = 16, warmup = 2;
+
+// command line options
+static string matrixFile = "benchmark.txt", outName = "results", refDir = "references";
+static bool updateReferences = false;
+
+//  +-----------------------------------------------------------------------------+
+//  |  SameText                                                                   |
+//  |  Case-insensitive string compare, for file extensions.                LH2'20|
+//  +-----------------------------------------------------------------------------+
+static bool SameText( const char* a, const char* b )
+{
+	for (; *a && *b; a++, b++) if (tolower( (uchar)*a ) != tolower( (uchar)*b )) return false;
+	return *a == *b;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  LoadMatrix                                                                 |
+//  |  Read the benchmark matrix; one 'keyword values' entry per line.      LH2'20|
+//  +-----------------------------------------------------------------------------+
+void LoadMatrix( const char* file )
+{
+	FILE* f = fopen( file, "r" );
+	if (!f) FATALERROR( "Could not open benchmark matrix %s", file );
+	char line[1024], a[512], b[512];
+	while (fgets( line, sizeof( line ), f ))
+	{
+		int w, h;
+		if (line[0] == '#') continue;
+		if (sscanf( line, "scene %511s %511s", a, b ) == 2) scenes.push_back( { a, b } );
+		else if (sscanf( line, "scene %511s", a ) == 1) scenes.push_back( { a, "" } );
+		else if (sscanf( line, "core %511s", a ) == 1) cores.push_back( a );
+		else if (sscanf( line, "resolution %i %i", &w, &h ) == 2) resolutions.push_back( make_int2( w, h ) );
+		else if (sscanf( line, "threads %i", &w ) == 1) threadCounts.push_back( w );
+		else if (sscanf( line, "frames %i", &w ) == 1) frames = max( 1, w );
+		else if (sscanf( line, "warmup %i", &w ) == 1) warmup = max( 0, w );
+	}
+	fclose( f );
+	if (scenes.size() == 0 || cores.size() == 0) FATALERROR( "Benchmark matrix %s lists no scenes or cores", file );
+	if (resolutions.size() == 0) resolutions.push_back( make_int2( 1280, 720 ) );
+	if (threadCounts.size() == 0) threadCounts.push_back( 0 );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  FrameScene                                                                 |
+//  |  Aim the camera at the bounds of the scene, for scenes without a camera.   |
+//  |                                                                       LH2'20|
+//  +-----------------------------------------------------------------------------+
+void FrameScene()
+{
+	HostScene* scene = renderer->GetScene();
+	float3 bmin = make_float3( 1e34f ), bmax = make_float3( -1e34f );
+	for (HostNode* node : scene->nodePool) if (node && node->meshID > -1)
+	{
+		const mat4& T = node->combinedTransform;
+		for (const float4& v : scene->meshPool[node->meshID]->vertices)
+		{
+			const float3 p = make_float3( T * v );
+			bmin = fminf( bmin, p ), bmax = fmaxf( bmax, p );
+		}
+	}
+	if (bmin.x > bmax.x) return; // empty scene
+	const float3 center = 0.5f * (bmin + bmax);
+	const float extent = length( bmax - bmin );
+	renderer->GetCamera()->LookAt( center + extent * make_float3( 0.3f, 0.25f, 0.9f ), center );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  Percentile                                                                 |
+//  |  Nearest-rank percentile of a sorted list.                            LH2'20|
+//  +-----------------------------------------------------------------------------+
+float Percentile( const vector<float>& sorted, const float p )
+{
+	const int rank = (int)ceilf( p * sorted.size() );
+	return sorted[clamp( rank - 1, 0, (int)sorted.size() - 1 )];
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RunCell                                                                    |
+//  |  Measure one scene with one core, for all resolutions and thread           |
+//  |  counts; rows are appended to the CSV file. Runs in a child process.  LH2'20|
+//  +-----------------------------------------------------------------------------+
+void RunCell( const int sceneIdx, const int coreIdx )
+{
+	const BenchScene& bench = scenes[sceneIdx];
+	const char* core = cores[coreIdx].c_str();
+	renderer = RenderAPI::CreateHeadlessRenderAPI( core );
+	// load the scene; the first synchronization builds the acceleration structure
+	Timer timer;
+	const char* ext = strrchr( bench.file.c_str(), '.' );
+	if (ext && (SameText( ext, ".gltf" ) || SameText( ext, ".glb" ))) renderer->AddScene( bench.file.c_str() );
+	else renderer->AddInstance( renderer->AddMesh( bench.file.c_str() ) );
+	renderer->SynchronizeSceneData();
+	const float loadTime = timer.elapsed();
+	const float bvhTime = renderer->GetCoreStats().bvhBuildTime;
+	if (bench.camera.size() > 0) renderer->DeserializeCamera( bench.camera.c_str() ); else FrameScene();
+	// reference images are named after the scene file, without its path and extension
+	string sceneName = bench.file.substr( bench.file.find_last_of( "/\\" ) + 1 );
+	sceneName = sceneName.substr( 0, sceneName.find_last_of( '.' ) );
+	FILE* csv = fopen( (outName + ".csv").c_str(), "a" );
+	if (!csv) FATALERROR( "Could not open %s.csv", outName.c_str() );
+	for (const int2& res : resolutions)
+	{
+		HostTarget* target = new HostTarget( res.x, res.y );
+		for (const int threads : threadCounts)
+		{
+			// all cells start from an empty target
+			renderer->Setting( "threads", (float)threads );
+			renderer->SetTarget( target, 1 );
+			for (int i = 0; i < warmup; i++) renderer->Render( Converge ), renderer->WaitForRender();
+			vector<float> frameTime;
+			float rays[4] = {}, traceTime[4] = {}, renderTime = 0;
+			for (int i = 0; i < frames; i++)
+			{
+				timer.reset();
+				renderer->Render( Converge );
+				renderer->WaitForRender();
+				frameTime.push_back( timer.elapsed() * 1000 );
+				const CoreStats stats = renderer->GetCoreStats();
+				renderTime += stats.renderTime;
+				rays[0] += stats.primaryRayCount, traceTime[0] += stats.traceTime0;
+				rays[1] += stats.bounce1RayCount, traceTime[1] += stats.traceTime1;
+				rays[2] += stats.deepRayCount, traceTime[2] += stats.traceTimeX;
+				rays[3] += stats.totalShadowRays, traceTime[3] += stats.shadowTraceTime;
+			}
+			// throughput per ray type over its trace time, and over all rays over the render time;
+			// a core that counts rays but reports no time for them yields 0 and a warning
+			static const char* rayType[4] = { "primary", "bounce1", "deep", "shadow" };
+			float Mrays[4], totalRays = 0;
+			for (int i = 0; i < 4; i++)
+			{
+				totalRays += rays[i];
+				Mrays[i] = traceTime[i] > 0 ? rays[i] / (traceTime[i] * 1000000) : 0;
+				if (rays[i] > 0 && traceTime[i] <= 0) printf( "warning: %s reports %s rays but no trace time\n", core, rayType[i] );
+			}
+			if (totalRays > 0 && renderTime <= 0) printf( "warning: %s reports rays but no render time\n", core );
+			const float totalMrays = renderTime > 0 ? totalRays / (renderTime * 1000000) : 0;
+			// frame time statistics
+			float sum = 0;
+			for (const float t : frameTime) sum += t;
+			sort( frameTime.begin(), frameTime.end() );
+			// compare the last frame against the reference, or create it
+			char refFile[1024];
+			snprintf( refFile, sizeof( refFile ), "%s/%s_%s_%ix%i.png", refDir.c_str(), sceneName.c_str(), core, res.x, res.y );
+			float rmse = updateReferences ? -1 : target->RMSE( refFile );
+			if (rmse < 0 && !target->Save( refFile )) printf( "could not save reference %s\n", refFile );
+			fprintf( csv, "%s,%s,%i,%i,%i,%i,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.6f\n",
+				sceneName.c_str(), core, res.x, res.y, threads, frames, loadTime * 1000, bvhTime * 1000,
+				sum / frames, frameTime.front(), Percentile( frameTime, 0.5f ), Percentile( frameTime, 0.9f ), Percentile( frameTime, 0.99f ), frameTime.back(),
+				Mrays[0], Mrays[1], Mrays[2], Mrays[3], totalMrays, rmse );
+			fflush( csv );
+			printf( "%s / %s / %ix%i / %i threads: %.2fms median, rmse %.5f\n", sceneName.c_str(), core, res.x, res.y, threads, Percentile( frameTime, 0.5f ), rmse );
+		}
+		delete target;
+	}
+	fclose( csv );
+	renderer->Shutdown();
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  WriteJSON                                                                  |
+//  |  Convert the CSV results to a JSON array of objects.                  LH2'20|
+//  +-----------------------------------------------------------------------------+
+void WriteJSON()
+{
+	FILE* in = fopen( (outName + ".csv").c_str(), "r" );
+	FILE* out = fopen( (outName + ".json").c_str(), "w" );
+	if (!in || !out) FATALERROR( "Could not convert %s.csv to JSON", outName.c_str() );
+	char line[4096];
+	vector<string> column;
+	int rows = 0;
+	fprintf( out, "[" );
+	while (fgets( line, sizeof( line ), in ))
+	{
+		line[strcspn( line, "\r\n" )] = 0;
+		// split on every comma; empty fields are kept, so the columns stay aligned
+		vector<string> field;
+		for (char* f = line;; f++)
+		{
+			char* end = f + strcspn( f, "," );
+			field.push_back( string( f, end ) );
+			if (!*end) break;
+			f = end;
+		}
+		if (column.size() == 0) { column = field; continue; }
+		fprintf( out, "%s\n\t{", rows++ ? "," : "" );
+		// the scene and core names are strings, all other fields are numbers; empty numbers are null
+		for (size_t i = 0; i < field.size() && i < column.size(); i++)
+			fprintf( out, i < 2 ? "%s\"%s\": \"%s\"" : "%s\"%s\": %s", i ? ", " : " ", column[i].c_str(), i >= 2 && field[i].empty() ? "null" : field[i].c_str() );
+		fprintf( out, " }" );
+	}
+	fprintf( out, "\n]\n" );
+	fclose( in );
+	fclose( out );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  main                                                                       |
+//  |  Application entry point.                                             LH2'20|
+//  +-----------------------------------------------------------------------------+
+int main( int argc, char** argv )
+{
+	int runScene = -1, runCore = -1;
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp( argv[i], "-matrix" ) && i + 1 < argc) matrixFile = argv[++i];
+		else if (!strcmp( argv[i], "-o" ) && i + 1 < argc) outName = argv[++i];
+		else if (!strcmp( argv[i], "-ref" ) && i + 1 < argc) refDir = argv[++i];
+		else if (!strcmp( argv[i], "-update" )) updateReferences = true;
+		else if (!strcmp( argv[i], "-run" ) && i + 2 < argc) runScene = atoi( argv[i + 1] ), runCore = atoi( argv[i + 2] ), i += 2;
+		else
+		{
+			printf( "usage: benchsuite [-matrix benchmark.txt] [-o results] [-ref references] [-update]\n" );
+			return 1;
+		}
+	}
+	LoadMatrix( matrixFile.c_str() );
+	if (runScene > -1)
+	{
+		// child process: a single scene / core pair
+		RunCell( runScene, runCore );
+		return 0;
+	}
+	// write the CSV header, then let a child process measure each scene / core pair
+	FILE* csv = fopen( (outName + ".csv").c_str(), "w" );
+	if (!csv) FATALERROR( "Could not create %s.csv", outName.c_str() );
+	fprintf( csv, "scene,core,width,height,threads,frames,scene_load_ms,bvh_build_ms,frame_ms_mean,frame_ms_min,frame_ms_p50,frame_ms_p90,frame_ms_p99,frame_ms_max,"
+		"primary_mrays,bounce1_mrays,deep_mrays,shadow_mrays,total_mrays,rmse\n" );
+	fclose( csv );
+	std::filesystem::create_directories( refDir );
+	for (int s = 0; s < (int)scenes.size(); s++) for (int c = 0; c < (int)cores.size(); c++)
+	{
+		char command[4096];
+		snprintf( command, sizeof( command ), "\"%s\" -run %i %i -matrix \"%s\" -o \"%s\" -ref \"%s\"%s",
+			argv[0], s, c, matrixFile.c_str(), outName.c_str(), refDir.c_str(), updateReferences ? " -update" : "" );
+	#ifdef _MSC_VER
+		// cmd.exe strips the outer quotes of a command line that starts with a quote
+		const string line = string( "\"" ) + command + "\"";
+	#else
+		const string line = command;
+	#endif
+		if (system( line.c_str() ) != 0) printf( "benchmark of %s with %s failed\n", scenes[s].file.c_str(), cores[c].c_str() );
+	}
+	WriteJSON();
+	printf( "results written to %s.csv and %s.json\n", outName.c_str(), outName.c_str() );
+	return 0;
+}
+
+// EOF
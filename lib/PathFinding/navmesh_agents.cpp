@@ -15,9 +15,52 @@
 
 #pragma once
 
+#include <algorithm> // std::find
+#include <atomic>	 // std::atomic
+
 #include "navmesh_navigator.h"
 #include "navmesh_agents.h"
 
+// SIMD helpers for the steering update: eight lanes with AVX, four with SSE.
+// A block of NavMeshAgents::s_laneBlock agents takes s_laneBlock / LANES steps.
+#ifdef __AVX__
+#define LANES 8
+typedef __m256 vfloat;
+static inline vfloat VSet(const float a) { return _mm256_set1_ps(a); }
+static inline vfloat VLoad(const float* a) { return _mm256_load_ps(a); }
+static inline void VStore(float* a, const vfloat b) { _mm256_store_ps(a, b); }
+static inline vfloat VAdd(const vfloat a, const vfloat b) { return _mm256_add_ps(a, b); }
+static inline vfloat VSub(const vfloat a, const vfloat b) { return _mm256_sub_ps(a, b); }
+static inline vfloat VMul(const vfloat a, const vfloat b) { return _mm256_mul_ps(a, b); }
+static inline vfloat VDiv(const vfloat a, const vfloat b) { return _mm256_div_ps(a, b); }
+static inline vfloat VSqrt(const vfloat a) { return _mm256_sqrt_ps(a); }
+static inline vfloat VMin(const vfloat a, const vfloat b) { return _mm256_min_ps(a, b); }
+static inline vfloat VMax(const vfloat a, const vfloat b) { return _mm256_max_ps(a, b); }
+static inline vfloat VAnd(const vfloat a, const vfloat b) { return _mm256_and_ps(a, b); }
+static inline vfloat VOr(const vfloat a, const vfloat b) { return _mm256_or_ps(a, b); }
+static inline vfloat VLess(const vfloat a, const vfloat b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+static inline vfloat VLessEqual(const vfloat a, const vfloat b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+static inline int VMask(const vfloat a) { return _mm256_movemask_ps(a); }
+#else
+#define LANES 4
+typedef __m128 vfloat;
+static inline vfloat VSet(const float a) { return _mm_set1_ps(a); }
+static inline vfloat VLoad(const float* a) { return _mm_load_ps(a); }
+static inline void VStore(float* a, const vfloat b) { _mm_store_ps(a, b); }
+static inline vfloat VAdd(const vfloat a, const vfloat b) { return _mm_add_ps(a, b); }
+static inline vfloat VSub(const vfloat a, const vfloat b) { return _mm_sub_ps(a, b); }
+static inline vfloat VMul(const vfloat a, const vfloat b) { return _mm_mul_ps(a, b); }
+static inline vfloat VDiv(const vfloat a, const vfloat b) { return _mm_div_ps(a, b); }
+static inline vfloat VSqrt(const vfloat a) { return _mm_sqrt_ps(a); }
+static inline vfloat VMin(const vfloat a, const vfloat b) { return _mm_min_ps(a, b); }
+static inline vfloat VMax(const vfloat a, const vfloat b) { return _mm_max_ps(a, b); }
+static inline vfloat VAnd(const vfloat a, const vfloat b) { return _mm_and_ps(a, b); }
+static inline vfloat VOr(const vfloat a, const vfloat b) { return _mm_or_ps(a, b); }
+static inline vfloat VLess(const vfloat a, const vfloat b) { return _mm_cmplt_ps(a, b); }
+static inline vfloat VLessEqual(const vfloat a, const vfloat b) { return _mm_cmple_ps(a, b); }
+static inline int VMask(const vfloat a) { return _mm_movemask_ps(a); }
+#endif
+
 namespace lighthouse2 {
 
 //  +-----------------------------------------------------------------------------+
@@ -53,6 +96,7 @@ bool Agent::UpdateMovement(float deltaTime)
 	// When current target reached
 	if (m_nextTarDist < m_targetReached)
 	{
+		m_laneDirty = true;
 		// if agent was traversing an OMC, it just finished doing so
 		if (m_onOMC) m_onOMC = false;
 		// if not, but the reached poly is an OMC, it is now traversing the OMC
@@ -101,6 +145,41 @@ bool Agent::UpdateNavigation(float deltaTime)
 	float3 tmpPos = (m_onOMC ? m_path[m_targetIdx].pos : m_rb->m_pos); // can't turn back on an OMC
 	if (m_navmesh->FindPathConstSize(tmpPos, *m_pathEnd, m_path.data(), m_pathCount, m_reachable, m_maxPathCount, &m_filter).Success())
 		m_targetIdx = 0;
+	m_laneDirty = true;
+	for (int i = m_pathCount; i < m_maxPathCount; i++) m_path[i] = m_path[m_pathCount-1];
+	return true;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  Agent::RequestNavigation                                                   |
+//  |  Queues a path recalculation on the navigator, to be answered by the        |
+//  |  next ProcessPathRequests call. Returns whether a request was made.   LH2'20|
+//  +-----------------------------------------------------------------------------+
+bool Agent::RequestNavigation()
+{
+	if (!m_pathEnd) return false;
+	float3 tmpPos = (m_onOMC ? m_path[m_targetIdx].pos : m_rb->m_pos); // can't turn back on an OMC
+	ReleaseNavigation(); // an unanswered request is superseded
+	m_pathTicket = m_navmesh->RequestPath(tmpPos, *m_pathEnd, m_maxPathCount, &m_filter);
+	return true;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  Agent::ReceiveNavigation                                                   |
+//  |  Takes over the answer to the pending path request, if there is one.  LH2'20|
+//  +-----------------------------------------------------------------------------+
+bool Agent::ReceiveNavigation()
+{
+	if (m_pathTicket < 0) return false;
+	NavMeshNavigator::PathResult result;
+	if (!m_navmesh->GetPathResult(m_pathTicket, result)) return false; // not processed yet
+	if (!m_pathEnd || result.status.Failed() || !result.count) { ReleaseNavigation(); return false; }
+	for (int i = 0; i < result.count; i++) m_path[i] = result.path[i];
+	ReleaseNavigation();
+	m_pathCount = result.count;
+	m_reachable = result.reachable;
+	m_targetIdx = 0;
+	m_laneDirty = true;
 	for (int i = m_pathCount; i < m_maxPathCount; i++) m_path[i] = m_path[m_pathCount-1];
 	return true;
 }
@@ -153,28 +232,149 @@ void NavMeshAgents::RemoveAgent(Agent* agent)
 
 //  +-----------------------------------------------------------------------------+
 //  |  NavMeshAgents::UpdateAgentMovement                                         |
-//  |  Called after every physics tick to add all agent movement impulses.  LH2'19|
+//  |  Called after every physics tick to add all agent movement impulses.        |
+//  |  Blocks of agents are steered in parallel on the job system.          LH2'19|
 //  +-----------------------------------------------------------------------------+
 bool NavMeshAgents::UpdateAgentMovement(float deltaTime)
 {
+	const int blocks = (m_agentCount + s_laneBlock - 1) / s_laneBlock;
+	std::atomic<bool> changed(false);
+	JobManager::GetJobManager()->ParallelFor(0, blocks, 0, [&](int first, int last)
+	{
+		bool blockChanged = false;
+		for (int block = first; block < last; block++) blockChanged |= UpdateBlockMovement(block, deltaTime);
+		if (blockChanged) changed = true;
+	});
+	return changed;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  NavMeshAgents::UpdateBlockMovement                                         |
+//  |  Steers one block of agents. The seek, arrival and stop behaviors of        |
+//  |  Agent::UpdateMovement are evaluated for all lanes at once; agents that     |
+//  |  reach their target or an OMC this tick take the scalar path instead. LH2'20|
+//  +-----------------------------------------------------------------------------+
+bool NavMeshAgents::UpdateBlockMovement(int block, float deltaTime)
+{
+	const int first = block * s_laneBlock, last = min(first + s_laneBlock, m_agentCount);
+
+	// Gathering the rigid body state
+	int alive = 0;
+	for (int i = first; i < first + s_laneBlock; i++)
+	{
+		Agent* agent = (i < last ? &m_agents[i] : 0);
+		if (!agent || !agent->isAlive())
+		{
+			Lane(MOVING)[i] = Lane(VELX)[i] = Lane(VELY)[i] = Lane(VELZ)[i] = 0;
+			continue;
+		}
+		alive |= 1 << (i - first);
+		if (agent->m_laneDirty) UpdateLane(i);
+		const RigidBody* rb = agent->m_rb;
+		Lane(POSX)[i] = rb->m_pos.x, Lane(POSY)[i] = rb->m_pos.y, Lane(POSZ)[i] = rb->m_pos.z;
+		Lane(VELX)[i] = rb->m_vel.x, Lane(VELY)[i] = rb->m_vel.y, Lane(VELZ)[i] = rb->m_vel.z;
+	}
+	if (!alive) return false;
+
+	// Steering
+	ALIGN(32) float impulse[3][s_laneBlock], dir[3][s_laneBlock], dist[s_laneBlock];
+	int events = 0;
+	for (int j = 0; j < s_laneBlock; j += LANES)
+	{
+		const int i = first + j;
+		const vfloat dx = VSub(VLoad(Lane(TARX) + i), VLoad(Lane(POSX) + i));
+		const vfloat dy = VSub(VLoad(Lane(TARY) + i), VLoad(Lane(POSY) + i));
+		const vfloat dz = VSub(VLoad(Lane(TARZ) + i), VLoad(Lane(POSZ) + i));
+		const vfloat d = VSqrt(VAdd(VAdd(VMul(dx, dx), VMul(dy, dy)), VMul(dz, dz)));
+		const vfloat moving = VLess(VSet(0), VLoad(Lane(MOVING) + i));
+		events |= VMask(VAnd(moving, VOr(VLess(d, VLoad(Lane(TARGETREACHED) + i)), VLessEqual(d, VLoad(Lane(OMCRADIUS) + i))))) << j;
+
+		// seek, slowing down linearly within the arrival distance; stop when not moving
+		const vfloat speed = VAnd(moving, VDiv(VLoad(Lane(MAXLINVEL) + i), VMax(d, VLoad(Lane(ARRIVAL) + i))));
+		const vfloat sx = VSub(VMul(dx, speed), VLoad(Lane(VELX) + i));
+		const vfloat sy = VSub(VMul(dy, speed), VLoad(Lane(VELY) + i));
+		const vfloat sz = VSub(VMul(dz, speed), VLoad(Lane(VELZ) + i));
+		const vfloat steerLen = VSqrt(VAdd(VAdd(VMul(sx, sx), VMul(sy, sy)), VMul(sz, sz)));
+		const vfloat scale = VMin(VSet(1), VDiv(VLoad(Lane(MAXLINACC) + i), VMax(steerLen, VSet(1e-20f))));
+		VStore(impulse[0] + j, VMul(sx, scale));
+		VStore(impulse[1] + j, VMul(sy, scale));
+		VStore(impulse[2] + j, VMul(sz, scale));
+		const vfloat invDist = VDiv(VSet(1), VMax(d, VSet(1e-20f)));
+		VStore(dir[0] + j, VMul(dx, invDist));
+		VStore(dir[1] + j, VMul(dy, invDist));
+		VStore(dir[2] + j, VMul(dz, invDist));
+		VStore(dist + j, d);
+	}
+
+	// Scattering the impulses
 	bool changed = false;
-	for (std::vector<Agent>::iterator it = m_agents.begin(); it != m_agents.end(); it++)
-		if (it->isAlive()) changed |= it->UpdateMovement(deltaTime);
+	for (int j = 0; j < last - first; j++) if (alive & (1 << j))
+	{
+		Agent& agent = m_agents[first + j];
+		if (events & (1 << j)) { changed |= agent.UpdateMovement(deltaTime); continue; }
+		agent.m_rb->AddImpulse(make_float3(impulse[0][j], impulse[1][j], impulse[2][j]));
+		if (Lane(MOVING)[first + j] == 0) continue;
+		agent.m_moveDir = make_float3(dir[0][j], dir[1][j], dir[2][j]);
+		agent.m_nextTarDist = dist[j];
+		changed = true;
+	}
 	return changed;
 }
 
+//  +-----------------------------------------------------------------------------+
+//  |  NavMeshAgents::UpdateLane                                                  |
+//  |  Copies the path target and steering settings of an agent to its lane.      |
+//  |  Called when the agent's m_laneDirty is set.                          LH2'20|
+//  +-----------------------------------------------------------------------------+
+void NavMeshAgents::UpdateLane(int idx)
+{
+	Agent& agent = m_agents[idx];
+	agent.m_laneDirty = false;
+	Lane(MAXLINVEL)[idx] = agent.m_maxLinVel;
+	Lane(MAXLINACC)[idx] = agent.m_maxLinAcc;
+	Lane(ARRIVAL)[idx] = agent.m_arrival;
+	Lane(TARGETREACHED)[idx] = agent.m_targetReached;
+	Lane(OMCRADIUS)[idx] = -1.0f;
+	Lane(TARX)[idx] = Lane(TARY)[idx] = Lane(TARZ)[idx] = 0;
+	const bool moving = (agent.m_pathEnd && agent.m_pathCount);
+	Lane(MOVING)[idx] = (moving ? 1.0f : 0.0f);
+	if (!moving) return;
+
+	const NavMeshNavigator::PathNode& target = agent.m_path[agent.m_targetIdx];
+	Lane(TARX)[idx] = target.pos.x, Lane(TARY)[idx] = target.pos.y, Lane(TARZ)[idx] = target.pos.z;
+	const dtPoly* poly = agent.m_navmesh->GetPoly(target.poly);
+	if (!agent.m_onOMC && poly && poly->getType() == DT_POLYTYPE_OFFMESH_CONNECTION)
+		Lane(OMCRADIUS)[idx] = agent.m_navmesh->GetOMC(target.poly)->rad;
+}
+
 //  +-----------------------------------------------------------------------------+
 //  |  NavMeshAgents::UpdateAgentBehavior                                         |
-//  |  Called every tick to update all agent plans.                               |
-//  |  Only actually updates at the interval given to the constructor.      LH2'19|
+//  |  Called every tick to update all agent plans. Path requests are batched     |
+//  |  per navigator, and are answered in the next call. Only actually updates    |
+//  |  at the interval given to the constructor.                            LH2'19|
 //  +-----------------------------------------------------------------------------+
 bool NavMeshAgents::UpdateAgentBehavior(float deltaTime)
 {
 	bool changed = false;
+
+	// Answering the requests of the previous update
+	if (!m_pendingNavigators.empty())
+	{
+		for (NavMeshNavigator* navigator : m_pendingNavigators) navigator->ProcessPathRequests();
+		m_pendingNavigators.clear();
+		for (std::vector<Agent>::iterator it = m_agents.begin(); it != m_agents.end(); it++)
+			if (it->isAlive()) changed |= it->ReceiveNavigation();
+	}
+
 	m_timeCounter += deltaTime;
-	if (m_timeCounter < m_updateTimeInterval) return false;
+	if (m_timeCounter < m_updateTimeInterval) return changed;
 	for (std::vector<Agent>::iterator it = m_agents.begin(); it != m_agents.end(); it++)
-		if (it->isAlive()) changed |= it->UpdateNavigation(m_timeCounter);
+		if (it->isAlive() && it->RequestNavigation())
+		{
+			NavMeshNavigator* navigator = it->GetNavigator();
+			if (std::find(m_pendingNavigators.begin(), m_pendingNavigators.end(), navigator) == m_pendingNavigators.end())
+				m_pendingNavigators.push_back(navigator);
+		}
 	m_timeCounter -= m_updateTimeInterval;
 	return changed;
 }
@@ -187,6 +387,7 @@ void NavMeshAgents::Clean()
 {
 	for (int i = 0; i < m_agentCount; i++) if (m_agents[i].isAlive()) m_agents[i].Clean();
 	m_agentCount = 0;
+	m_pendingNavigators.clear();
 }
 
 } // namespace lighthouse2
@@ -43,14 +43,16 @@ public:
 	Agent& operator=(Agent&&) = default;
 	~Agent() {};
 
-	void SetTarget(float3* target) { if (m_pathEndOwner && m_pathEnd) delete m_pathEnd; m_pathEnd = target; m_pathEndOwner = false; }
-	void SetTarget(float3 target) { if (m_pathEndOwner && m_pathEnd) *m_pathEnd = target; else m_pathEnd =  new float3(target);  m_pathEndOwner = true; };
+	void SetTarget(float3* target) { if (m_pathEndOwner && m_pathEnd) delete m_pathEnd; m_pathEnd = target; m_pathEndOwner = false; m_laneDirty = true; }
+	void SetTarget(float3 target) { if (m_pathEndOwner && m_pathEnd) *m_pathEnd = target; else m_pathEnd =  new float3(target);  m_pathEndOwner = true; m_laneDirty = true; };
 	void SetFilter(dtQueryFilter filter) { m_filter = filter; };
 	bool UpdateMovement(float deltaTime);
 	bool UpdateNavigation(float deltaTime);
-	void Clean() { m_pathCount = 0; m_alive = false; };
+	bool RequestNavigation();
+	bool ReceiveNavigation();
+	void Clean() { m_pathCount = 0; ReleaseNavigation(); m_alive = false; };
 
-	void Kill() { m_alive = false; m_rb->Kill(); };
+	void Kill() { ReleaseNavigation(); m_alive = false; m_rb->Kill(); };
 	bool isAlive() const { return m_alive; };
 
 	dtQueryFilter* GetFilter() { return &m_filter; };
@@ -58,6 +60,7 @@ public:
 	const float3* GetPos() const { return &m_rb->m_pos; };
 	const float3* GetDir() const { return &m_moveDir; };
 	float3* GetTarget() const { return m_pathEnd; };
+	NavMeshNavigator* GetNavigator() const { return m_navmesh; };
 	const std::vector<NavMeshNavigator::PathNode>* GetPath() const { if (m_pathEnd) return &m_path; else return 0; };
 
 	const RigidBody* GetRB() const { return m_rb; };
@@ -77,16 +80,21 @@ protected:
 	int m_maxPathCount;				// maximum number of path nodes the agent can hold
 	int m_pathCount; // number of calculated targets in path array
 	int m_targetIdx; // path array index of current target
+	int m_pathTicket = -1; // ticket of the pending batched path request, -1 if none
 	bool m_alive = true;			// whether this agent exists
 	bool m_pathEndOwner = false;	// whether m_pathEnd is owned by this instance or given
 	bool m_onOMC = false;			// whether the Agent is currently traversing an OMC
 	bool m_reachable = false; // whether a path to the given end target seems possible at this point
+	bool m_laneDirty = true;  // whether the steering lanes of NavMeshAgents need to be refreshed
 
 	inline float3 SteeringSeek() const { return m_moveDir * m_maxLinVel; };
 	inline float3 SteeringArrival() const { return m_moveDir * m_maxLinVel * (m_nextTarDist / m_arrival); };
 	inline float3 SteeringStop() const { return float3{ 0, 0, 0 }; };
+	void ReleaseNavigation() { if (m_pathTicket >= 0) m_navmesh->ReleasePathResult(m_pathTicket); m_pathTicket = -1; };
 
 private:
+	friend class NavMeshAgents; // fills the steering lanes
+
 	// Move-only (m_rb reference is killed on Kill())
 	Agent(const Agent& a);
 	Agent& operator=(const Agent& a) = delete;
@@ -94,7 +102,9 @@ private:
 
 //  +-----------------------------------------------------------------------------+
 //  |  NavMeshAgents                                                              |
-//  |  Class responsible for all agents objects.                            LH2'19|
+//  |  Class responsible for all agents objects.                                  |
+//  |  The steering update runs on a structure-of-arrays copy of the agent        |
+//  |  state (the lanes), in blocks of s_laneBlock agents.                  LH2'19|
 //  +-----------------------------------------------------------------------------+
 class NavMeshAgents
 {
@@ -104,8 +114,11 @@ public:
 	{
 		m_agents.reserve(maxAgents);
 		m_agents.resize(maxAgents);
+		m_laneCapacity = (maxAgents + 15) & ~15; // keeps every channel 64-byte aligned
+		m_lanes = (float*)MALLOC64(sizeof(float) * LANECHANNELS * m_laneCapacity);
+		memset(m_lanes, 0, sizeof(float) * LANECHANNELS * m_laneCapacity);
 	};
-	~NavMeshAgents() {};
+	~NavMeshAgents() { FREE64(m_lanes); };
 
 	Agent* AddAgent(NavMeshNavigator* navmesh, RigidBody* rb);
 	void RemoveAgent(Agent* agent);
@@ -117,8 +130,28 @@ protected:
 	std::vector<Agent> m_agents; // should NEVER reallocate, invalidates pointers
 	int m_maxAgents, m_maxPathSize, m_agentCount = 0;
 	std::vector<int> m_removedIdx;
+	std::vector<NavMeshNavigator*> m_pendingNavigators; // navigators with queued path requests
 	float m_updateTimeInterval, m_timeCounter = 0;
 
+	// Steering lanes: one channel of m_laneCapacity floats per agent property.
+	// Positions and velocities are copied from the rigid bodies every update,
+	// the other channels only when the agent's m_laneDirty is set.
+	static const int s_laneBlock = 8; // agents per steering step
+	enum LaneChannel
+	{
+		POSX, POSY, POSZ, VELX, VELY, VELZ,
+		TARX, TARY, TARZ,		// position of the current path target
+		OMCRADIUS,				// teleport radius when the target starts an OMC, -1 otherwise
+		MAXLINVEL, MAXLINACC, ARRIVAL, TARGETREACHED,
+		MOVING,					// 1 when the agent follows a path, 0 when it should stop
+		LANECHANNELS
+	};
+	float* m_lanes = 0;
+	int m_laneCapacity = 0;
+	inline float* Lane(LaneChannel channel) const { return m_lanes + (size_t)channel * m_laneCapacity; };
+	void UpdateLane(int idx);
+	bool UpdateBlockMovement(int block, float deltaTime);
+
 private:
 	// not meant to be copied
 	NavMeshAgents(const NavMeshAgents&) = delete;
@@ -18,6 +18,7 @@
 #include "Recast.h"
 #include "RecastDump.h"			  // duLogBuildTimes
 #include "DetourNavMeshBuilder.h" // dtNavMeshCreateParams, dtCreateNavMeshData
+#include "DetourCommon.h"		  // dtIlog2, dtNextPow2
 
 #include "navmesh_io.h"		 // Serialize/Deserialize
 #include "buildcontext.h"	   // BuildContext
@@ -61,9 +62,55 @@ NavMeshBuilder::NavMeshBuilder( const char* dir ) : m_dir( dir )
 	m_pmesh = 0;
 	m_dmesh = 0;
 	m_navMesh = 0;
+	m_tilesX = m_tilesZ = 0;
 	m_status = NavMeshStatus::SUCCESS;
 };
 
+//  +-----------------------------------------------------------------------------+
+//  |  NavMeshBuilder::ExtractTriangles                                           |
+//  |  Transforms the triangles of all included instances into one triangle       |
+//  |  soup. Instances are counted first, so that they can be transformed in      |
+//  |  parallel, each into its own range of the output.                     LH2'20|
+//  +-----------------------------------------------------------------------------+
+void NavMeshBuilder::ExtractTriangles( std::vector<float3>& vertices, std::vector<int3>& triangles, int& instancesExcluded )
+{
+	const std::vector<HostMesh*>& meshes = HostScene::meshPool;
+	std::vector<const HostNode*> instances;
+	std::vector<int> firstTri;
+	int nTri = 0;
+	instancesExcluded = 0;
+	for (const HostNode* node : HostScene::nodePool) if (node && node->meshID >= 0) // for every instance
+	{
+		if (meshes[node->meshID]->excludeFromNavmesh) // skip if excluded
+		{
+			instancesExcluded++;
+			continue;
+		}
+		instances.push_back( node );
+		firstTri.push_back( nTri );
+		nTri += (int)meshes[node->meshID]->triangles.size();
+	}
+
+	vertices.resize( nTri * 3 );
+	triangles.resize( nTri );
+	JobManager::GetJobManager()->ParallelFor( 0, (int)instances.size(), 1, [&]( int first, int last )
+	{
+		for (int i = first; i < last; i++)
+		{
+			const std::vector<HostTri>& hostTris = meshes[instances[i]->meshID]->triangles;
+			const mat4 transform = instances[i]->combinedTransform;
+			for (int j = 0; j < (int)hostTris.size(); j++) // for every triangle
+			{
+				const int t = firstTri[i] + j;
+				vertices[t * 3 + 0] = make_float3( transform * make_float4( hostTris[j].vertex0, 1 ) );
+				vertices[t * 3 + 1] = make_float3( transform * make_float4( hostTris[j].vertex1, 1 ) );
+				vertices[t * 3 + 2] = make_float3( transform * make_float4( hostTris[j].vertex2, 1 ) );
+				triangles[t] = int3{ t * 3 + 0, t * 3 + 1, t * 3 + 2 };
+			}
+		}
+	} );
+}
+
 //  +-----------------------------------------------------------------------------+
 //  |  NavMeshBuilder::Build                                                      |
 //  |  Builds a navmesh for the given scene.                                LH2'19|
@@ -75,29 +122,10 @@ NavMeshStatus NavMeshBuilder::Build()
 		RECAST_ERROR( NavMeshStatus::RC | NavMeshStatus::INPUT, "HostScene is nullptr\n" );
 
 	// Extracting triangle soup
-	const std::vector<HostMesh*> meshes = HostScene::meshPool;
-	std::vector<HostTri> hostTris;
 	std::vector<float3> vertices;
 	std::vector<int3> triangles;
-	int nTri = 0, instancesExcluded = 0;
-	for (const HostNode* node : HostScene::nodePool) if (node && node->meshID >= 0) // for every instance
-	{
-		if (meshes[node->meshID]->excludeFromNavmesh) // skip if excluded
-		{
-			instancesExcluded++;
-			continue;
-		}
-		hostTris = meshes[node->meshID]->triangles;
-		mat4 transform = node->combinedTransform;
-		for (size_t j = 0; j < hostTris.size(); j++) // for every triangle
-		{
-			vertices.push_back( make_float3( transform * make_float4( hostTris[j].vertex0, 1 ) ) );
-			vertices.push_back( make_float3( transform * make_float4( hostTris[j].vertex1, 1 ) ) );
-			vertices.push_back( make_float3( transform * make_float4( hostTris[j].vertex2, 1 ) ) );
-			triangles.push_back( int3{ nTri * 3 + 0, nTri * 3 + 1, nTri * 3 + 2 } );
-			nTri++;
-		}
-	}
+	int instancesExcluded = 0;
+	ExtractTriangles( vertices, triangles, instancesExcluded );
 
 	// Initializing bounds
 	if (m_config.m_bmin.x == m_config.m_bmax.x ||
@@ -117,6 +145,7 @@ NavMeshStatus NavMeshBuilder::Build()
 	{
 		RECAST_LOG( "===   Building NavMesh '%s'\n", m_config.m_id.c_str() );
 		RECAST_LOG( " - Voxel grid: %d x %d cells\n", m_config.m_width, m_config.m_height );
+		if (IsTiled()) RECAST_LOG( " - Tiles: %d x %d voxels\n", m_config.m_tileSize, m_config.m_tileSize );
 		RECAST_LOG( " - Input mesh: %.1fK verts, %.1fK tris\n",
 			vertices.size() / 1000.0f, triangles.size() / 1000.0f );
 		RECAST_LOG( " - Instances excluded: %i\n", instancesExcluded );
@@ -129,25 +158,30 @@ NavMeshStatus NavMeshBuilder::Build()
 	m_ctx->startTimer( RC_TIMER_TOTAL );
 
 	// NavMesh generation
-	RasterizePolygonSoup(
-		(const int)vertices.size() * 3, (float*)vertices.data(),
-		(const int)triangles.size(), (int*)triangles.data()
-	);
-	if (!m_config.m_keepInterResults) { delete[] m_triareas; m_triareas = 0; }
-	FilterWalkableSurfaces();
-	PartitionWalkableSurface();
-	if (!m_config.m_keepInterResults) { rcFreeHeightField( m_heightField ); m_heightField = 0; }
-	ExtractContours();
-	BuildPolygonMesh();
-	CreateDetailMesh();
-	if (!m_config.m_keepInterResults)
+	if (IsTiled()) BuildTiled( vertices, triangles );
+	else
 	{
-		rcFreeCompactHeightfield( m_chf );
-		m_chf = 0;
-		rcFreeContourSet( m_cset );
-		m_cset = 0;
+		m_tileHashes.clear();
+		RasterizePolygonSoup(
+			(const int)vertices.size() * 3, (float*)vertices.data(),
+			(const int)triangles.size(), (int*)triangles.data()
+		);
+		if (!m_config.m_keepInterResults) { delete[] m_triareas; m_triareas = 0; }
+		FilterWalkableSurfaces();
+		PartitionWalkableSurface();
+		if (!m_config.m_keepInterResults) { rcFreeHeightField( m_heightField ); m_heightField = 0; }
+		ExtractContours();
+		BuildPolygonMesh();
+		CreateDetailMesh();
+		if (!m_config.m_keepInterResults)
+		{
+			rcFreeCompactHeightfield( m_chf );
+			m_chf = 0;
+			rcFreeContourSet( m_cset );
+			m_cset = 0;
+		}
+		CreateDetourData();
 	}
-	CreateDetourData();
 
 	// Logging performance
 	m_ctx->stopTimer( RC_TIMER_TOTAL );
@@ -160,14 +194,346 @@ NavMeshStatus NavMeshBuilder::Build()
 		}
 		else // short single-line duration log
 			RECAST_LOG( "%.3fms\n", m_ctx->getAccumulatedTime( RC_TIMER_TOTAL ) / 1000.0f );
-		RECAST_LOG( "   '%s' polymesh: %d vertices, %d polygons\n",
-			m_config.m_id.c_str(), m_pmesh->nverts, m_pmesh->npolys );
+		if (IsTiled())
+		{
+			int nverts = 0, npolys = 0;
+			for (int i = 0; i < m_navMesh->getMaxTiles(); i++)
+			{
+				const dtMeshTile* tile = ((const dtNavMesh*)m_navMesh)->getTile( i );
+				if (tile->header) nverts += tile->header->vertCount, npolys += tile->header->polyCount;
+			}
+			RECAST_LOG( "   '%s' navmesh: %d vertices, %d polygons\n", m_config.m_id.c_str(), nverts, npolys );
+		}
+		else
+			RECAST_LOG( "   '%s' polymesh: %d vertices, %d polygons\n",
+				m_config.m_id.c_str(), m_pmesh->nverts, m_pmesh->npolys );
 	}
 
 	if (m_status.Failed()) Cleanup();
 	return m_status;
 }
 
+//  +-----------------------------------------------------------------------------+
+//  |  HashBytes                                                                  |
+//  |  FNV-1a, used to detect changes in the input of a navmesh tile.       LH2'20|
+//  +-----------------------------------------------------------------------------+
+static unsigned long long HashBytes( unsigned long long hash, const void* data, const size_t size )
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+	for (size_t i = 0; i < size; i++) hash = (hash ^ bytes[i]) * 1099511628211ull;
+	return hash;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  HashConfig                                                                 |
+//  |  Hashes the settings that affect the contents of a tile, so that a change   |
+//  |  in configuration rebuilds every tile.                                LH2'20|
+//  +-----------------------------------------------------------------------------+
+static unsigned long long HashConfig( const NavMeshConfig& c )
+{
+	const float floats[] = { c.m_cs, c.m_ch, c.m_walkableSlopeAngle, c.m_maxSimplificationError,
+		c.m_detailSampleDist, c.m_detailSampleMaxError };
+	const int ints[] = { c.m_tileSize, c.m_walkableHeight, c.m_walkableClimb, c.m_walkableRadius, c.m_maxEdgeLen,
+		c.m_minRegionArea, c.m_mergeRegionArea, c.m_maxVertsPerPoly, (int)c.m_partitionType,
+		c.m_filterLowHangingObstacles, c.m_filterLedgeSpans, c.m_filterWalkableLowHeightSpans };
+	unsigned long long hash = 14695981039346656037ull;
+	hash = HashBytes( hash, floats, sizeof( floats ) );
+	return HashBytes( hash, ints, sizeof( ints ) );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  NavMeshBuilder::InitTiledNavMesh                                           |
+//  |  (Re)creates an empty multi-tile dtNavMesh for the current tile grid.       |
+//  |  All tiles are marked as unbuilt.                                     LH2'20|
+//  +-----------------------------------------------------------------------------+
+int NavMeshBuilder::InitTiledNavMesh( int tilesX, int tilesZ )
+{
+	if (m_navMesh) dtFreeNavMesh( m_navMesh );
+	m_navMesh = dtAllocNavMesh();
+	if (!m_navMesh)
+		RECAST_ERROR( NavMeshStatus::DT | NavMeshStatus::MEM, "Could not allocate Detour navmesh\n" );
+
+	// Poly refs hold the tile and the polygon index in 22 bits
+	const int tileBits = rcMin( (int)dtIlog2( dtNextPow2( tilesX * tilesZ ) ), 14 );
+	const int polyBits = 22 - tileBits;
+	dtNavMeshParams params;
+	rcVcopy( params.orig, (const float*)&m_config.m_bmin );
+	params.tileWidth = m_config.m_tileSize * m_config.m_cs;
+	params.tileHeight = m_config.m_tileSize * m_config.m_cs;
+	params.maxTiles = 1 << tileBits;
+	params.maxPolys = 1 << polyBits;
+	if (dtStatusFailed( m_navMesh->init( &params ) ))
+		RECAST_ERROR( NavMeshStatus::DT | NavMeshStatus::INIT, "Could not init Detour navmesh\n" );
+
+	m_tilesX = tilesX;
+	m_tilesZ = tilesZ;
+	m_tileHashes.assign( tilesX * tilesZ, 0 );
+	return NavMeshStatus::SUCCESS;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  NavMeshBuilder::BuildTiled                                                 |
+//  |  Splits the voxel grid into tiles and builds each tile with its own Recast  |
+//  |  pipeline, in parallel. A tile is only rebuilt when the hash of its input   |
+//  |  (triangles, off-mesh connections and settings) changed. Tiles are added    |
+//  |  to the dtNavMesh on the calling thread.                              LH2'20|
+//  +-----------------------------------------------------------------------------+
+int NavMeshBuilder::BuildTiled( const std::vector<float3>& vertices, const std::vector<int3>& triangles )
+{
+	if (m_status.Failed()) return NavMeshStatus::INPUT;
+	if (m_config.m_maxVertsPerPoly > DT_VERTS_PER_POLYGON)
+		RECAST_ERROR( NavMeshStatus::RC | NavMeshStatus::INPUT, "MaxVertsPerPoly can't be higher than %i\n", DT_VERTS_PER_POLYGON );
+
+	// Intermediate results of a single-tile build do not apply to tiles
+	if (m_triareas) delete[] m_triareas;
+	m_triareas = 0;
+	if (m_heightField) rcFreeHeightField( m_heightField );
+	m_heightField = 0;
+	if (m_chf) rcFreeCompactHeightfield( m_chf );
+	m_chf = 0;
+	if (m_cset) rcFreeContourSet( m_cset );
+	m_cset = 0;
+	if (m_pmesh) rcFreePolyMesh( m_pmesh );
+	m_pmesh = 0;
+	if (m_dmesh) rcFreePolyMeshDetail( m_dmesh );
+	m_dmesh = 0;
+
+	// Reusing the dtNavMesh when the tile grid is unchanged
+	const int ts = m_config.m_tileSize;
+	const float tcs = ts * m_config.m_cs;
+	m_config.m_borderSize = m_config.m_walkableRadius + 3;
+	const int tilesX = (m_config.m_width + ts - 1) / ts;
+	const int tilesZ = (m_config.m_height + ts - 1) / ts;
+	const dtNavMeshParams* current = m_navMesh ? m_navMesh->getParams() : 0;
+	if (!current || tilesX != m_tilesX || tilesZ != m_tilesZ || (int)m_tileHashes.size() != tilesX * tilesZ ||
+		current->tileWidth != tcs || current->orig[0] != m_config.m_bmin.x || current->orig[2] != m_config.m_bmin.z)
+		if (InitTiledNavMesh( tilesX, tilesZ ) != NavMeshStatus::SUCCESS) return m_status;
+
+	// Binning the triangles into the tiles they overlap, border included
+	std::vector<std::vector<int>> tileTris( tilesX * tilesZ );
+	const float border = m_config.m_borderSize * m_config.m_cs;
+	for (int i = 0; i < (int)triangles.size(); i++)
+	{
+		const float3& a = vertices[triangles[i].x], & b = vertices[triangles[i].y], & c = vertices[triangles[i].z];
+		const int x0 = (int)floorf( (min( a.x, min( b.x, c.x ) ) - border - m_config.m_bmin.x) / tcs );
+		const int x1 = (int)floorf( (max( a.x, max( b.x, c.x ) ) + border - m_config.m_bmin.x) / tcs );
+		const int z0 = (int)floorf( (min( a.z, min( b.z, c.z ) ) - border - m_config.m_bmin.z) / tcs );
+		const int z1 = (int)floorf( (max( a.z, max( b.z, c.z ) ) + border - m_config.m_bmin.z) / tcs );
+		if (x1 < 0 || z1 < 0 || x0 >= tilesX || z0 >= tilesZ) continue; // outside the AABB restraints
+		for (int z = max( z0, 0 ); z <= min( z1, tilesZ - 1 ); z++)
+			for (int x = max( x0, 0 ); x <= min( x1, tilesX - 1 ); x++)
+				tileTris[x + z * tilesX].push_back( i );
+	}
+
+	// Hashing the input of every tile to find the ones that changed
+	const unsigned long long configHash = HashConfig( m_config );
+	std::vector<unsigned long long> hashes( tilesX * tilesZ );
+	JobManager::GetJobManager()->ParallelFor( 0, tilesX * tilesZ, 0, [&]( int first, int last )
+	{
+		for (int t = first; t < last; t++)
+		{
+			unsigned long long hash = HashBytes( configHash, &t, sizeof( t ) );
+			for (const int i : tileTris[t])
+			{
+				hash = HashBytes( hash, &vertices[triangles[i].x], sizeof( float3 ) );
+				hash = HashBytes( hash, &vertices[triangles[i].y], sizeof( float3 ) );
+				hash = HashBytes( hash, &vertices[triangles[i].z], sizeof( float3 ) );
+			}
+			// off-mesh connections are stored in the tile that holds their start point
+			const float tminx = m_config.m_bmin.x + (t % tilesX) * tcs, tminz = m_config.m_bmin.z + (t / tilesX) * tcs;
+			for (size_t i = 0; i < m_offMeshFlags.size(); i++)
+			{
+				const float3& v = m_offMeshVerts[i * 2];
+				if (v.x < tminx || v.x > tminx + tcs || v.z < tminz || v.z > tminz + tcs) continue;
+				hash = HashBytes( hash, &m_offMeshVerts[i * 2], sizeof( float3 ) * 2 );
+				hash = HashBytes( hash, &m_offMeshRadii[i], sizeof( float ) );
+				hash = HashBytes( hash, &m_offMeshFlags[i], sizeof( unsigned short ) );
+				hash = HashBytes( hash, &m_offMeshAreas[i], sizeof( unsigned char ) );
+				hash = HashBytes( hash, &m_offMeshDirection[i], sizeof( unsigned char ) );
+			}
+			hashes[t] = hash;
+		}
+	} );
+	std::vector<int> dirty;
+	for (int t = 0; t < tilesX * tilesZ; t++) if (hashes[t] != m_tileHashes[t]) dirty.push_back( t );
+
+	// Building the changed tiles in parallel; every tile has its own Recast data
+	const int dirtyCount = (int)dirty.size();
+	std::vector<unsigned char*> tileData( dirtyCount, 0 );
+	std::vector<int> tileDataSize( dirtyCount, 0 ), tileStatus( dirtyCount, NavMeshStatus::SUCCESS );
+	JobManager::GetJobManager()->ParallelFor( 0, dirtyCount, 1, [&]( int first, int last )
+	{
+		for (int i = first; i < last; i++)
+		{
+			const int t = dirty[i];
+			tileData[i] = BuildTileData( t % tilesX, t / tilesX, (const float*)vertices.data(), (int)vertices.size(),
+				tileTris[t], tileDataSize[i], tileStatus[i] );
+		}
+	} );
+
+	// Replacing the tiles in the dtNavMesh
+	int failedTile = -1;
+	for (int i = 0; i < dirtyCount; i++)
+	{
+		const int t = dirty[i], tx = t % tilesX, tz = t / tilesX;
+		if (tileStatus[i] != NavMeshStatus::SUCCESS)
+		{
+			if (failedTile < 0) failedTile = i;
+			continue;
+		}
+		m_navMesh->removeTile( m_navMesh->getTileRefAt( tx, tz, 0 ), 0, 0 );
+		if (tileData[i] && dtStatusFailed( m_navMesh->addTile( tileData[i], tileDataSize[i], DT_TILE_FREE_DATA, 0, 0 ) ))
+		{
+			dtFree( tileData[i] );
+			tileStatus[i] = NavMeshStatus::DT | NavMeshStatus::INIT;
+			if (failedTile < 0) failedTile = i;
+			continue;
+		}
+		m_tileHashes[t] = hashes[t];
+	}
+	if (m_config.m_printBuildStats)
+		RECAST_LOG( " - Tiles rebuilt: %d of %d\n", dirtyCount, tilesX * tilesZ );
+	if (failedTile >= 0)
+		RECAST_ERROR( tileStatus[failedTile], "Could not build tile (%d, %d)\n", dirty[failedTile] % tilesX, dirty[failedTile] / tilesX );
+
+	return NavMeshStatus::SUCCESS;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  NavMeshBuilder::BuildTileData                                              |
+//  |  Runs the Recast pipeline for one tile and returns its Detour data, or 0    |
+//  |  when the tile has no walkable surface. Safe to call from several threads:  |
+//  |  it uses a silent rcContext, and reports errors through *status*.     LH2'20|
+//  +-----------------------------------------------------------------------------+
+unsigned char* NavMeshBuilder::BuildTileData( int tx, int tz, const float* verts, const int nverts,
+	const std::vector<int>& tris, int& dataSize, int& status ) const
+{
+	dataSize = 0;
+	status = NavMeshStatus::SUCCESS;
+	if (tris.empty()) return 0;
+
+	rcContext ctx( false );
+	rcConfig cfg;
+	memset( &cfg, 0, sizeof( cfg ) );
+	cfg.cs = m_config.m_cs;
+	cfg.ch = m_config.m_ch;
+	cfg.tileSize = m_config.m_tileSize;
+	cfg.borderSize = m_config.m_borderSize;
+	cfg.width = cfg.tileSize + cfg.borderSize * 2;
+	cfg.height = cfg.tileSize + cfg.borderSize * 2;
+	rcVcopy( cfg.bmin, (const float*)&m_config.m_bmin );
+	rcVcopy( cfg.bmax, (const float*)&m_config.m_bmax );
+	cfg.bmin[0] += tx * cfg.tileSize * cfg.cs - cfg.borderSize * cfg.cs;
+	cfg.bmin[2] += tz * cfg.tileSize * cfg.cs - cfg.borderSize * cfg.cs;
+	cfg.bmax[0] = m_config.m_bmin.x + (tx + 1) * cfg.tileSize * cfg.cs + cfg.borderSize * cfg.cs;
+	cfg.bmax[2] = m_config.m_bmin.z + (tz + 1) * cfg.tileSize * cfg.cs + cfg.borderSize * cfg.cs;
+
+	// The triangles of this tile, as indices into the shared vertex array
+	const int ntris = (int)tris.size();
+	std::vector<int> indices( ntris * 3 );
+	for (int i = 0; i < ntris; i++)
+		indices[i * 3 + 0] = tris[i] * 3 + 0, indices[i * 3 + 1] = tris[i] * 3 + 1, indices[i * 3 + 2] = tris[i] * 3 + 2;
+	std::vector<unsigned char> triareas( ntris, 0 );
+
+	rcHeightfield* hf = rcAllocHeightfield();
+	rcCompactHeightfield* chf = 0;
+	rcContourSet* cset = 0;
+	rcPolyMesh* pmesh = 0;
+	rcPolyMeshDetail* dmesh = 0;
+	unsigned char* navData = 0;
+	do
+	{
+		// Rasterizing and filtering the walkable surfaces
+		if (!hf || !rcCreateHeightfield( &ctx, *hf, cfg.width, cfg.height, cfg.bmin, cfg.bmax, cfg.cs, cfg.ch ))
+		{ status = NavMeshStatus::RC | NavMeshStatus::MEM; break; }
+		rcMarkWalkableTriangles( &ctx, m_config.m_walkableSlopeAngle, verts, nverts, indices.data(), ntris, triareas.data() );
+		if (!rcRasterizeTriangles( &ctx, verts, nverts, indices.data(), triareas.data(), ntris, *hf, m_config.m_walkableClimb ))
+		{ status = NavMeshStatus::RC | NavMeshStatus::INIT; break; }
+		if (m_config.m_filterLowHangingObstacles)
+			rcFilterLowHangingWalkableObstacles( &ctx, m_config.m_walkableClimb, *hf );
+		if (m_config.m_filterLedgeSpans)
+			rcFilterLedgeSpans( &ctx, m_config.m_walkableHeight, m_config.m_walkableClimb, *hf );
+		if (m_config.m_filterWalkableLowHeightSpans)
+			rcFilterWalkableLowHeightSpans( &ctx, m_config.m_walkableHeight, *hf );
+
+		// Partitioning the walkable surface
+		chf = rcAllocCompactHeightfield();
+		if (!chf || !rcBuildCompactHeightfield( &ctx, m_config.m_walkableHeight, m_config.m_walkableClimb, *hf, *chf ))
+		{ status = NavMeshStatus::RC | NavMeshStatus::INIT; break; }
+		if (!rcErodeWalkableArea( &ctx, m_config.m_walkableRadius, *chf ))
+		{ status = NavMeshStatus::RC | NavMeshStatus::INIT; break; }
+		bool partitioned;
+		if (m_config.m_partitionType == NavMeshConfig::SAMPLE_PARTITION_WATERSHED)
+			partitioned = rcBuildDistanceField( &ctx, *chf ) &&
+				rcBuildRegions( &ctx, *chf, cfg.borderSize, m_config.m_minRegionArea, m_config.m_mergeRegionArea );
+		else if (m_config.m_partitionType == NavMeshConfig::SAMPLE_PARTITION_MONOTONE)
+			partitioned = rcBuildRegionsMonotone( &ctx, *chf, cfg.borderSize, m_config.m_minRegionArea, m_config.m_mergeRegionArea );
+		else // SAMPLE_PARTITION_LAYERS
+			partitioned = rcBuildLayerRegions( &ctx, *chf, cfg.borderSize, m_config.m_minRegionArea );
+		if (!partitioned) { status = NavMeshStatus::RC | NavMeshStatus::INIT; break; }
+
+		// Contours, polygon mesh and detail mesh
+		cset = rcAllocContourSet();
+		if (!cset || !rcBuildContours( &ctx, *chf, m_config.m_maxSimplificationError, m_config.m_maxEdgeLen, *cset ))
+		{ status = NavMeshStatus::RC | NavMeshStatus::INIT; break; }
+		if (cset->nconts == 0) break; // nothing walkable in this tile
+		pmesh = rcAllocPolyMesh();
+		if (!pmesh || !rcBuildPolyMesh( &ctx, *cset, m_config.m_maxVertsPerPoly, *pmesh ))
+		{ status = NavMeshStatus::RC | NavMeshStatus::INIT; break; }
+		dmesh = rcAllocPolyMeshDetail();
+		if (!dmesh || !rcBuildPolyMeshDetail( &ctx, *pmesh, *chf, m_config.m_detailSampleDist, m_config.m_detailSampleMaxError, *dmesh ))
+		{ status = NavMeshStatus::RC | NavMeshStatus::INIT; break; }
+		if (pmesh->npolys < 1) break;
+
+		// Creating the Detour data for the tile
+		for (int i = 0; i < pmesh->npolys; ++i) pmesh->flags[i] = 0x1, pmesh->areas[i] = 0;
+		dtNavMeshCreateParams params;
+		memset( &params, 0, sizeof( params ) );
+		params.verts = pmesh->verts;
+		params.vertCount = pmesh->nverts;
+		params.polys = pmesh->polys;
+		params.polyAreas = pmesh->areas;
+		params.polyFlags = pmesh->flags;
+		params.polyCount = pmesh->npolys;
+		params.nvp = pmesh->nvp;
+		params.detailMeshes = dmesh->meshes;
+		params.detailVerts = dmesh->verts;
+		params.detailVertsCount = dmesh->nverts;
+		params.detailTris = dmesh->tris;
+		params.detailTriCount = dmesh->ntris;
+		if (!m_offMeshFlags.empty())
+		{
+			params.offMeshConCount = (int)m_offMeshFlags.size();
+			params.offMeshConVerts = (const float*)m_offMeshVerts.data();
+			params.offMeshConRad = m_offMeshRadii.data();
+			params.offMeshConAreas = m_offMeshAreas.data();
+			params.offMeshConFlags = m_offMeshFlags.data();
+			params.offMeshConUserID = m_offMeshUserIDs.data();
+			params.offMeshConDir = m_offMeshDirection.data();
+		}
+		params.walkableHeight = (float)m_config.m_walkableHeight;
+		params.walkableRadius = (float)m_config.m_walkableRadius;
+		params.walkableClimb = (float)m_config.m_walkableClimb;
+		params.tileX = tx;
+		params.tileY = tz;
+		params.tileLayer = 0;
+		rcVcopy( params.bmin, pmesh->bmin );
+		rcVcopy( params.bmax, pmesh->bmax );
+		params.cs = cfg.cs;
+		params.ch = cfg.ch;
+		params.buildBvTree = true;
+		if (!dtCreateNavMeshData( &params, &navData, &dataSize ))
+		{ status = NavMeshStatus::DT | NavMeshStatus::INIT; navData = 0; dataSize = 0; }
+	} while (false);
+
+	rcFreeHeightField( hf );
+	rcFreeCompactHeightfield( chf );
+	rcFreeContourSet( cset );
+	rcFreePolyMesh( pmesh );
+	rcFreePolyMeshDetail( dmesh );
+	return navData;
+}
+
 //  +-----------------------------------------------------------------------------+
 //  |  NavMeshBuilder::RasterizePolygonSoup                                       |
 //  |  Takes a triangle soup and rasterizes all walkable triangles based          |
@@ -440,8 +806,11 @@ int NavMeshBuilder::Serialize( const char* dir, const char* ID )
 	m_status = SerializeOffMeshConnections(filename + PF_NAVMESH_OMC_FILE_EXTENTION,
 		m_offMeshVerts, m_offMeshRadii, m_offMeshFlags,
 		m_offMeshAreas, m_offMeshUserIDs, m_offMeshDirection);
-	m_status = SerializePolyMesh(filename + PF_NAVMESH_PMESH_FILE_EXTENTION, m_pmesh);
-	m_status = SerializeDetailMesh(filename + PF_NAVMESH_DMESH_FILE_EXTENTION, m_dmesh);
+	if (m_pmesh && m_dmesh) // tiled builds keep no intermediate meshes
+	{
+		m_status = SerializePolyMesh(filename + PF_NAVMESH_PMESH_FILE_EXTENTION, m_pmesh);
+		m_status = SerializeDetailMesh(filename + PF_NAVMESH_DMESH_FILE_EXTENTION, m_dmesh);
+	}
 
 	// Saving dtNavMesh
 	m_status = SerializeNavMesh( dir, ID, m_navMesh );
@@ -471,8 +840,11 @@ int NavMeshBuilder::Deserialize( const char* dir, const char* ID )
 	m_status = DeserializeOffMeshConnections(filename + PF_NAVMESH_OMC_FILE_EXTENTION,
 		m_offMeshVerts, m_offMeshRadii, m_offMeshFlags,
 		m_offMeshAreas, m_offMeshUserIDs, m_offMeshDirection);
-	m_status = DeserializePolyMesh(filename + PF_NAVMESH_PMESH_FILE_EXTENTION, m_pmesh);
-	m_status = DeserializeDetailMesh(filename + PF_NAVMESH_DMESH_FILE_EXTENTION, m_dmesh);
+	if (!IsTiled())
+	{
+		m_status = DeserializePolyMesh(filename + PF_NAVMESH_PMESH_FILE_EXTENTION, m_pmesh);
+		m_status = DeserializeDetailMesh(filename + PF_NAVMESH_DMESH_FILE_EXTENTION, m_dmesh);
+	}
 
 	// Loading dtNavMesh
 	m_status = DeserializeNavMesh( dir, ID, m_navMesh );
@@ -502,6 +874,8 @@ void NavMeshBuilder::Cleanup()
 	m_dmesh = 0;
 	if (m_navMesh) dtFreeNavMesh( m_navMesh );
 	m_navMesh = 0;
+	m_tilesX = m_tilesZ = 0;
+	m_tileHashes.clear();
 
 	m_offMeshVerts.clear();
 	m_offMeshRadii.clear();
@@ -532,7 +906,7 @@ int GetOmcIndexFromPolyRef( const dtPolyRef ref, const dtNavMesh* navMesh, const
 //  +-----------------------------------------------------------------------------+
 int GetPolyMeshIndexFromPolyRef( const dtPolyRef ref, const dtNavMesh* navMesh )
 {
-	// NOTE: This might not work for multi-tile navmeshes
+	// NOTE: tiled navmeshes have no single dtPolyMesh; their edits only apply to the dtNavMesh
 	return navMesh->decodePolyIdPoly(ref);
 }
 
@@ -556,7 +930,7 @@ void NavMeshBuilder::SetPolyFlags( dtPolyRef ref, unsigned short flags )
 	else // normal polygon
 	{
 		int pmeshIdx = GetPolyMeshIndexFromPolyRef( ref, m_navMesh );
-		if (pmeshIdx > -1) m_pmesh->flags[pmeshIdx] = flags;
+		if (pmeshIdx > -1 && m_pmesh) m_pmesh->flags[pmeshIdx] = flags;
 	}
 }
 
@@ -580,7 +954,7 @@ void NavMeshBuilder::SetPolyArea( dtPolyRef ref, unsigned char area )
 	else // normal polygon
 	{
 		int pmeshIdx = GetPolyMeshIndexFromPolyRef( ref, m_navMesh );
-		if (pmeshIdx > -1) m_pmesh->areas[pmeshIdx] = area;
+		if (pmeshIdx > -1 && m_pmesh) m_pmesh->areas[pmeshIdx] = area;
 	}
 }
 
@@ -50,13 +50,14 @@ public:
 	void SetOmcDirected(dtPolyRef ref, bool unidirectional);
 	float3 GetOmcVertex(dtPolyRef ref, int vertexID);
 	void SetOmcVertex(dtPolyRef ref, int vertexID, float3 value);
-	void ApplyChanges() { if (m_pmesh && m_dmesh) CreateDetourData(); };
+	void ApplyChanges() { if (m_pmesh && m_dmesh) CreateDetourData(); else if (IsTiled()) Build(); };
 
 	void SetConfig(NavMeshConfig config) { m_config = config; };
 	void SetID(const char* id) { m_config.m_id = id; };
 
 	bool IsClean() const { if (m_navMesh) return false; else return true; };
 	bool HasIntermediateResults() const { return (m_pmesh && m_dmesh); };
+	bool IsTiled() const { return (m_config.m_tileSize > 0); };
 	const char* GetDir() const { return m_dir; };
 	NavMeshConfig* GetConfig() { return &m_config; };
 	dtNavMesh* GetMesh() const { return m_navMesh; };
@@ -93,7 +94,16 @@ protected:
 	std::vector<unsigned int> m_offMeshUserIDs;
 	std::vector<unsigned char> m_offMeshDirection;
 
+	// Tiled builds
+	int m_tilesX, m_tilesZ;						// Tile grid of the current dtNavMesh
+	std::vector<unsigned long long> m_tileHashes; // Input hash per tile; only tiles whose hash changed are rebuilt
+
 	// Build functions
+	void ExtractTriangles(std::vector<float3>& vertices, std::vector<int3>& triangles, int& instancesExcluded);
+	int BuildTiled(const std::vector<float3>& vertices, const std::vector<int3>& triangles);
+	int InitTiledNavMesh(int tilesX, int tilesZ);
+	unsigned char* BuildTileData(int tx, int tz, const float* verts, const int nverts,
+		const std::vector<int>& tris, int& dataSize, int& status) const;
 	int RasterizePolygonSoup(const int vert_count, const float* verts, const int tri_count, const int* tris);
 	int FilterWalkableSurfaces();
 	int PartitionWalkableSurface();
@@ -178,7 +178,8 @@ struct NavMeshAreaMapping
 struct NavMeshConfig
 {
 
-	int m_width, m_height, m_tileSize, m_borderSize;		 // Automatically computed
+	int m_width, m_height, m_borderSize;					 // Automatically computed
+	int m_tileSize;											 // Tile size in voxels; 0 builds a single tile
 	float m_cs, m_ch;										 // Voxel cell size and -height
 	float3 m_bmin, m_bmax;									 // AABB navmesh restraints
 	float m_walkableSlopeAngle;								 // In degrees
@@ -237,6 +238,7 @@ struct NavMeshConfig
 
 	void SetCellSize(float width, float height) { m_cs = width; m_ch = height; };
 	void SetAABB(float3 min, float3 max) { m_bmin = min; m_bmax = max; }; // if AABB is not 3D, input mesh is used
+	void SetTileSize(int tileSize) { m_tileSize = tileSize; }; // tiles are built in parallel, and rebuilt only when their input changes
 	void SetAgentInfo(float maxWalkableAngle, int minWalkableHeight,
 		int maxClimbableHeight, int minWalkableRadius);
 	void SetPolySettings(int maxEdgeLen, float maxSimplificationError,
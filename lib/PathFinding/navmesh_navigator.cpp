@@ -201,6 +201,289 @@ NavMeshStatus NavMeshNavigator::FindPath(float3 start, float3 end, std::vector<P
 	return NavMeshStatus::SUCCESS;
 }
 
+//  +-----------------------------------------------------------------------------+
+//  |  HashFilter                                                                 |
+//  |  Hashes the flags and area costs of a filter, so that agents with equal     |
+//  |  filters share cached corridors.                                      LH2'20|
+//  +-----------------------------------------------------------------------------+
+static unsigned long long HashFilter(const dtQueryFilter& filter)
+{
+	unsigned long long hash = 14695981039346656037ull;
+	const unsigned short flags[2] = { filter.getIncludeFlags(), filter.getExcludeFlags() };
+	const unsigned char* bytes = (const unsigned char*)flags;
+	for (int i = 0; i < (int)sizeof(flags); i++) hash = (hash ^ bytes[i]) * 1099511628211ull;
+	for (int a = 0; a < DT_MAX_AREAS; a++)
+	{
+		const float cost = filter.getAreaCost(a);
+		bytes = (const unsigned char*)&cost;
+		for (int i = 0; i < (int)sizeof(cost); i++) hash = (hash ^ bytes[i]) * 1099511628211ull;
+	}
+	return hash;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  NavMeshNavigator::RequestPath                                              |
+//  |  Queues a path query for the next ProcessPathRequests call. The filter is   |
+//  |  copied. Returns the ticket with which the result can be retrieved.   LH2'20|
+//  +-----------------------------------------------------------------------------+
+int NavMeshNavigator::RequestPath(float3 start, float3 end, int maxCount, const dtQueryFilter* filter)
+{
+	m_requests.push_back(PathRequest{ start, end, filter ? *filter : s_filter, max(2, maxCount), false });
+	return m_nextTicket++;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  NavMeshNavigator::GetPathResult                                            |
+//  |  Retrieves the answer to a processed request. Returns false when the        |
+//  |  ticket is not processed yet, or has been released. The path stays valid    |
+//  |  until ReleasePathResult is called for the ticket.                    LH2'20|
+//  +-----------------------------------------------------------------------------+
+bool NavMeshNavigator::GetPathResult(int ticket, PathResult& result) const
+{
+	auto it = m_results.find(ticket);
+	if (it == m_results.end()) return false;
+	const StoredPath& stored = it->second;
+	result = PathResult{ stored.path.data(), (int)stored.path.size(), stored.reachable, stored.status };
+	return true;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  NavMeshNavigator::ReleasePathResult                                        |
+//  |  Frees the answer to a request. Requests that are still queued are          |
+//  |  answered, but their answer is not kept.                              LH2'20|
+//  +-----------------------------------------------------------------------------+
+void NavMeshNavigator::ReleasePathResult(int ticket)
+{
+	const int queueIdx = ticket - (m_nextTicket - (int)m_requests.size());
+	if (queueIdx >= 0 && queueIdx < (int)m_requests.size()) m_requests[queueIdx].released = true;
+	else m_results.erase(ticket);
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  NavMeshNavigator::StoreBatchResults                                        |
+//  |  Keeps the answers of the processed batch until they are released.    LH2'20|
+//  +-----------------------------------------------------------------------------+
+void NavMeshNavigator::StoreBatchResults()
+{
+	const int firstTicket = m_nextTicket - (int)m_requests.size();
+	for (int i = 0; i < (int)m_requests.size(); i++) if (!m_requests[i].released)
+	{
+		const PathAnswer& answer = m_answers[i];
+		StoredPath& stored = m_results[firstTicket + i];
+		stored.path.assign(m_answerNodes.begin() + answer.first, m_answerNodes.begin() + answer.first + answer.count);
+		stored.reachable = answer.reachable;
+		stored.status = answer.status;
+	}
+	m_requests.clear();
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  BatchQuery                                                                 |
+//  |  The Detour query for a job of a path batch. Workers have a slot each; all  |
+//  |  non-worker threads report thread index 0, so slot 0 belongs to the thread  |
+//  |  running the batch. Another non-worker thread that picks up one of its jobs |
+//  |  while it waits for its own work gets a private query for that job.   LH2'20|
+//  +-----------------------------------------------------------------------------+
+class BatchQuery
+{
+public:
+	BatchQuery(const std::vector<dtNavMeshQuery*>& queries, std::thread::id batchThread, const dtNavMesh* navmesh)
+	{
+		const int idx = JobManager::ThreadIndex();
+		if (idx > 0 || std::this_thread::get_id() == batchThread) { m_query = queries[idx]; return; }
+		m_own = dtAllocNavMeshQuery();
+		if (m_own && dtStatusSucceed(m_own->init(navmesh, DETOUR_MAX_NAVMESH_NODES))) m_query = m_own;
+	}
+	~BatchQuery() { dtFreeNavMeshQuery(m_own); }
+	dtNavMeshQuery* Get() const { return m_query; } // 0 if a private query could not be created
+private:
+	dtNavMeshQuery* m_query = 0;
+	dtNavMeshQuery* m_own = 0;
+};
+
+//  +-----------------------------------------------------------------------------+
+//  |  NavMeshNavigator::ProcessPathRequests                                      |
+//  |  Answers all queued requests. Start and end polygons are resolved in        |
+//  |  parallel; requests between the same polygons with the same filter share    |
+//  |  one corridor, taken from the cache or found once per batch with            |
+//  |  findPath; the string pulling runs in parallel again. Call this once per    |
+//  |  frame, from the thread that owns the navmesh. Individual failures are      |
+//  |  reported per result; the return value only covers the batch.         LH2'20|
+//  +-----------------------------------------------------------------------------+
+NavMeshStatus NavMeshNavigator::ProcessPathRequests()
+{
+	const int count = (int)m_requests.size();
+	if (count == 0) return NavMeshStatus::SUCCESS;
+	m_answers.resize(count);
+	int nodeCount = 0;
+	for (int i = 0; i < count; i++)
+	{
+		m_answers[i] = PathAnswer{ 0, 0, 0, 0, nodeCount, 0, false, NavMeshStatus::SUCCESS };
+		nodeCount += m_requests[i].maxCount;
+	}
+	m_answerNodes.resize(nodeCount);
+	m_batch++;
+	m_batchThread = std::this_thread::get_id();
+
+	// One query object per job thread; Detour queries keep state and can't be shared
+	JobManager* jm = JobManager::GetJobManager();
+	while ((int)m_threadQueries.size() < (int)jm->GetNumThreads())
+	{
+		dtNavMeshQuery* query = dtAllocNavMeshQuery();
+		if (!query || dtStatusFailed(query->init(m_navmesh, DETOUR_MAX_NAVMESH_NODES)))
+		{
+			dtFreeNavMeshQuery(query);
+			for (int i = 0; i < count; i++) m_answers[i].status = NavMeshStatus::DT | NavMeshStatus::MEM;
+			StoreBatchResults();
+			DETOUR_ERROR(NavMeshStatus::DT | NavMeshStatus::MEM, "Could not init the Detour navmesh queries of a path batch\n");
+		}
+		m_threadQueries.push_back(query);
+	}
+
+	// Resolving the start and end polygons
+	jm->ParallelFor(0, count, 0, [&](int first, int last)
+	{
+		const BatchQuery batchQuery(m_threadQueries, m_batchThread, m_navmesh);
+		const dtNavMeshQuery* query = batchQuery.Get();
+		for (int i = first; i < last; i++)
+		{
+			const PathRequest& request = m_requests[i];
+			PathAnswer& answer = m_answers[i];
+			float3 pos;
+			if (!query) answer.status = NavMeshStatus::DT | NavMeshStatus::MEM;
+			else if (dtStatusFailed(query->findNearestPoly((const float*)&request.start, m_polyFindExtention, &request.filter, &answer.startRef, (float*)&pos)) ||
+				dtStatusFailed(query->findNearestPoly((const float*)&request.end, m_polyFindExtention, &request.filter, &answer.endRef, (float*)&pos)) ||
+				!answer.startRef || !answer.endRef)
+				answer.status = NavMeshStatus::DT | NavMeshStatus::INPUT;
+		}
+	});
+
+	// Evicting corridors that were not used in the last batch when the cache is full
+	if ((int)m_pathCache.size() > m_pathCacheSize)
+	{
+		for (auto it = m_pathCache.begin(); it != m_pathCache.end();)
+			if (it->second.lastUsed < m_batch - 1) it = m_pathCache.erase(it); else it++;
+		if ((int)m_pathCache.size() > m_pathCacheSize) m_pathCache.clear();
+	}
+
+	// Looking up the corridors; the misses are solved once per key
+	std::unordered_map<PathKey, int, PathKeyHash> batchKeys;
+	std::vector<int> misses;			// first request of every unsolved key
+	std::vector<int> missOf(count, -1);	// unsolved key of every request
+	for (int i = 0; i < count; i++)
+	{
+		PathAnswer& answer = m_answers[i];
+		if (answer.status.Failed() || answer.startRef == answer.endRef) continue;
+		const PathKey key{ answer.startRef, answer.endRef, HashFilter(m_requests[i].filter) };
+		auto cached = m_pathCache.find(key);
+		if (cached != m_pathCache.end())
+		{
+			// tiles may have been rebuilt since the corridor was found
+			bool valid = true;
+			for (const dtPolyRef ref : cached->second.corridor) if (!m_navmesh->isValidPolyRef(ref)) { valid = false; break; }
+			if (valid)
+			{
+				cached->second.lastUsed = m_batch;
+				answer.corridor = cached->second.corridor.data();
+				answer.corridorCount = (int)cached->second.corridor.size();
+				continue;
+			}
+			m_pathCache.erase(cached);
+		}
+		auto batchKey = batchKeys.find(key);
+		if (batchKey != batchKeys.end()) missOf[i] = batchKey->second;
+		else
+		{
+			missOf[i] = (int)misses.size();
+			batchKeys[key] = (int)misses.size();
+			misses.push_back(i);
+		}
+	}
+
+	// Finding the missing corridors
+	const int missCount = (int)misses.size();
+	std::vector<dtPolyRef> corridors(missCount * POLYPATH_SIZE);
+	std::vector<int> corridorCounts(missCount, 0);
+	jm->ParallelFor(0, missCount, 1, [&](int first, int last)
+	{
+		const BatchQuery batchQuery(m_threadQueries, m_batchThread, m_navmesh);
+		dtNavMeshQuery* query = batchQuery.Get();
+		for (int m = first; m < last; m++)
+		{
+			const PathRequest& request = m_requests[misses[m]];
+			const PathAnswer& answer = m_answers[misses[m]];
+			if (!query || dtStatusFailed(query->findPath(answer.startRef, answer.endRef, (const float*)&request.start, (const float*)&request.end,
+				&request.filter, &corridors[m * POLYPATH_SIZE], &corridorCounts[m], POLYPATH_SIZE)))
+				corridorCounts[m] = 0;
+		}
+	});
+	for (int i = 0; i < count; i++) if (missOf[i] >= 0)
+	{
+		const int m = missOf[i];
+		if (corridorCounts[m] == 0) m_answers[i].status = NavMeshStatus::DT;
+		m_answers[i].corridor = &corridors[m * POLYPATH_SIZE];
+		m_answers[i].corridorCount = corridorCounts[m];
+	}
+	for (int m = 0; m < missCount; m++)
+	{
+		// partial corridors depend on the search limits, only complete ones are cached
+		const PathAnswer& answer = m_answers[misses[m]];
+		const int n = corridorCounts[m];
+		if (n == 0 || corridors[m * POLYPATH_SIZE + n - 1] != answer.endRef) continue;
+		const PathKey key{ answer.startRef, answer.endRef, HashFilter(m_requests[misses[m]].filter) };
+		CachedPath& cached = m_pathCache[key];
+		cached.corridor.assign(corridors.begin() + m * POLYPATH_SIZE, corridors.begin() + m * POLYPATH_SIZE + n);
+		cached.lastUsed = m_batch;
+	}
+
+	// String pulling from the exact start and end positions
+	jm->ParallelFor(0, count, 0, [&](int first, int last)
+	{
+		const BatchQuery batchQuery(m_threadQueries, m_batchThread, m_navmesh);
+		const dtNavMeshQuery* query = batchQuery.Get();
+		std::vector<float3> straightPath;
+		std::vector<dtPolyRef> spPolys;
+		std::vector<unsigned char> spFlags;
+		for (int i = first; i < last; i++)
+		{
+			const PathRequest& request = m_requests[i];
+			PathAnswer& answer = m_answers[i];
+			PathNode* path = &m_answerNodes[answer.first];
+			if (answer.status.Failed()) continue;
+			if (answer.startRef == answer.endRef) // start & end are on the same poly
+			{
+				path[0] = PathNode{ request.start, answer.startRef };
+				path[1] = PathNode{ request.end, answer.endRef };
+				answer.count = 2;
+				answer.reachable = true;
+				continue;
+			}
+			if (!query)
+			{
+				answer.status = NavMeshStatus::DT | NavMeshStatus::MEM;
+				continue;
+			}
+			answer.reachable = (answer.corridor[answer.corridorCount - 1] == answer.endRef);
+			straightPath.resize(request.maxCount);
+			spPolys.resize(request.maxCount);
+			spFlags.resize(request.maxCount);
+			if (dtStatusFailed(query->findStraightPath((const float*)&request.start, (const float*)&request.end,
+				answer.corridor, answer.corridorCount, (float*)straightPath.data(), spFlags.data(), spPolys.data(), &answer.count, request.maxCount)))
+			{
+				answer.status = NavMeshStatus::DT;
+				answer.count = 0;
+				continue;
+			}
+			for (int n = 0; n < answer.count; n++) path[n] = PathNode{ straightPath[n], spPolys[n] };
+		}
+	});
+
+	// corridors of this batch are only valid during this call
+	for (PathAnswer& answer : m_answers) answer.corridor = 0, answer.corridorCount = 0;
+	StoreBatchResults();
+	return NavMeshStatus::SUCCESS;
+}
+
 //  +-----------------------------------------------------------------------------+
 //  |  NavMeshNavigator::FindNearestPointOnPoly                                   |
 //  |  Finds the nearest pos on the specified *polyID* from the given position.   |
@@ -238,6 +521,12 @@ void NavMeshNavigator::Clean()
 	m_navmesh = 0;
 	dtFreeNavMeshQuery(m_query);
 	if (m_query) m_navmesh = 0;
+	for (dtNavMeshQuery* query : m_threadQueries) dtFreeNavMeshQuery(query);
+	m_threadQueries.clear();
+	m_requests.clear();
+	m_answers.clear();
+	m_results.clear();
+	m_pathCache.clear();
 }
 
 //  +-----------------------------------------------------------------------------+
@@ -16,6 +16,7 @@
 #pragma once
 
 #include <vector>
+#include <unordered_map>
 
 #include "DetourNavMeshQuery.h" // dtNavMesh, dtNavMeshQuery, dtQueryFilter
 
@@ -70,6 +71,19 @@ public:
 	NavMeshStatus FindPathConstSize_Legacy(float3 start, float3 end, PathNode* path, int& count, bool& reachable, int maxCount = 64, const dtQueryFilter* filter=&s_filter) const;
 	NavMeshStatus FindPath(float3 start, float3 end, std::vector<PathNode>& path, bool& reachable, int maxCount=64) const;
 
+	// Batched queries: RequestPath queues a query and returns a ticket. ProcessPathRequests answers the
+	// whole queue in parallel, with a dtNavMeshQuery per job thread; the results can be read with
+	// GetPathResult until ReleasePathResult is called for their ticket. Polygon corridors are cached
+	// by start and end polygon.
+	struct PathResult { const PathNode* path; int count; bool reachable; NavMeshStatus status; };
+	int RequestPath(float3 start, float3 end, int maxCount=64, const dtQueryFilter* filter=&s_filter);
+	NavMeshStatus ProcessPathRequests();
+	bool GetPathResult(int ticket, PathResult& result) const;
+	void ReleasePathResult(int ticket);
+	int GetPendingPathRequests() const { return (int)m_requests.size(); };
+	void SetPathCacheSize(int entries) { m_pathCacheSize = entries; ClearPathCache(); };
+	void ClearPathCache() { m_pathCache.clear(); };
+
 	NavMeshStatus Load(const char* dir, const char* ID);
 	void Clean();
 
@@ -79,8 +93,8 @@ public:
 	inline const dtNavMesh* GetDetourMesh() const { return m_navmesh; };
 	inline const char* GetID() const { return m_ID.c_str(); };
 
-	void SetPolyFlags(dtPolyRef poly, unsigned short flags) { m_navmesh->setPolyFlags(poly, flags); };
-	void SetAreaType(dtPolyRef poly, unsigned char area) { m_navmesh->setPolyArea(poly, area); };
+	void SetPolyFlags(dtPolyRef poly, unsigned short flags) { m_navmesh->setPolyFlags(poly, flags); ClearPathCache(); };
+	void SetAreaType(dtPolyRef poly, unsigned char area) { m_navmesh->setPolyArea(poly, area); ClearPathCache(); };
 
 protected:
 	std::string m_ID;			 // A unique string identifier
@@ -91,7 +105,29 @@ protected:
 	NavMeshAreaMapping m_areas;  // Maps polygon area types to labels
 	const float m_polyFindExtention[3] = { 5.0f, 5.0f, 5.0f }; // Half the search area for FindNearestPoly calls
 
-	int NavMeshNavigator::CreateNavMeshQuery();
+	// Batched queries
+	struct PathRequest { float3 start, end; dtQueryFilter filter; int maxCount; bool released; };
+	struct PathAnswer { dtPolyRef startRef, endRef; const dtPolyRef* corridor; int corridorCount, first, count; bool reachable; NavMeshStatus status; };
+	struct PathKey
+	{
+		dtPolyRef start, end; unsigned long long filter;
+		bool operator==(const PathKey& k) const { return start == k.start && end == k.end && filter == k.filter; };
+	};
+	struct PathKeyHash { size_t operator()(const PathKey& k) const { return (size_t)(k.filter ^ ((unsigned long long)k.start * 0x9e3779b97f4a7c15ull) ^ ((unsigned long long)k.end << 1)); }; };
+	struct CachedPath { std::vector<dtPolyRef> corridor; int lastUsed; };
+	std::vector<PathRequest> m_requests;		// queued since the last ProcessPathRequests
+	struct StoredPath { std::vector<PathNode> path; bool reachable; NavMeshStatus status; };
+	std::vector<PathAnswer> m_answers;			// answers to the batch being processed
+	std::vector<PathNode> m_answerNodes;		// path nodes of these answers
+	std::unordered_map<int, StoredPath> m_results; // unreleased answers by ticket
+	int m_nextTicket = 0, m_batch = 0;
+	std::vector<dtNavMeshQuery*> m_threadQueries; // one per job thread, indexed by JobManager::ThreadIndex
+	std::thread::id m_batchThread;				// thread running ProcessPathRequests; it owns query slot 0
+	std::unordered_map<PathKey, CachedPath, PathKeyHash> m_pathCache;
+	int m_pathCacheSize = 4096;					// number of corridors kept
+
+	int CreateNavMeshQuery();
+	void StoreBatchResults();
 };
 
 } // namespace Lighthouse2
@@ -1,9 +1,13 @@
 #pragma once
 
 #include "core_settings.h"
+#include "tuple"
+#include "ray.h"
 
 class BVHNode;
 class Bin;
+class CompressedBVH;
+class Triangle;
 
 class BVH
 {
@@ -17,6 +21,16 @@ public:
 	BVHNode* root;
 	int poolPtr;
 	int* triangleIndices;
-	BVH(int triangleIndex, int triangleCount);
+	int triangleCount;
+	/** Length of triangleIndices; spatial splits reference a triangle from more than one leaf */
+	int indexCount;
+	/** Compact copy of the nodes; when set, the regular nodes are gone */
+	CompressedBVH* compressed;
+	/** A positive spatial split budget builds an SBVH, with at most that fraction of extra triangle references */
+	BVH(int triangleIndex, int triangleCount, float spatialSplitBudget = 0);
+	~BVH();
+	/** Replaces the nodes by a compressed copy with 8- or 16-bit boxes: slower to traverse, a fraction of the memory */
+	bool Compress(int bits);
+	void Traverse(Ray& ray, tuple<Triangle*, float, Ray::HitType>& intersection) const;
 };
 
@@ -39,7 +39,7 @@ bool BVHNode::PartitionTriangles(BVHNode* pool, int* triangleIndices) {
 	/** Generate bounding box over triangle centroids */
 	aabb centroidBoundingBox = aabb();
 	for (int i = this->first; i < this->first + this->count; i++) {
-		Triangle* triangle = KajiyaPathTracer::scene[triangleIndices[i]];
+		Triangle* triangle = &KajiyaPathTracer::triangles[triangleIndices[i]];
 		centroidBoundingBox.Grow(triangle->centroid);
 	}
 
@@ -64,7 +64,7 @@ bool BVHNode::PartitionTriangles(BVHNode* pool, int* triangleIndices) {
 
 	/** Fill the bins with Triangles */
 	for (int i = this->first; i < this->first + this->count; i++) {
-		Triangle* triangle = KajiyaPathTracer::scene[triangleIndices[i]];
+		Triangle* triangle = &KajiyaPathTracer::triangles[triangleIndices[i]];
 		float ci = GetTriangleAxisValue(axis, triangle);
 
 		int binID = (int)(k1 * (ci - cbmin));
@@ -123,7 +123,7 @@ bool BVHNode::PartitionTriangles(BVHNode* pool, int* triangleIndices) {
 
 	int j = this->first;
 	for (int i = this->first; i < this->first + this->count; i++) {
-		Triangle* triangle = KajiyaPathTracer::scene[triangleIndices[i]];
+		Triangle* triangle = &KajiyaPathTracer::triangles[triangleIndices[i]];
 		float ci = GetTriangleAxisValue(axis, triangle);
 		int binID = (int)(k1 * (ci - cbmin));
 
@@ -154,7 +154,7 @@ void BVHNode::UpdateBounds(int* triangleIndices) {
 	this->bounds.Reset();
 
 	for (int i = 0; i < this->count; i++) {
-		Triangle* triangle = KajiyaPathTracer::scene[triangleIndices[this->first + i]];
+		Triangle* triangle = &KajiyaPathTracer::triangles[triangleIndices[this->first + i]];
 		this->bounds.Grow(triangle->bounds);
 	}
 }
@@ -202,7 +202,7 @@ void BVHNode::IntersectTriangles(Ray &ray, int* triangleIndices,  tuple<Triangle
 	Ray::HitType hitType = get<2>(intersection);
 
 	for (int i = 0; i < this->count; i++) {
-		Triangle* triangle = KajiyaPathTracer::scene[triangleIndices[this->first + i]];
+		Triangle* triangle = &KajiyaPathTracer::triangles[triangleIndices[this->first + i]];
 		float distance = triangle->Intersect(ray);
 
 		if (
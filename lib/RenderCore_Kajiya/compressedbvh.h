@@ -0,0 +1,52 @@
+#pragma once
+
+#include "core_settings.h"
+#include "tuple"
+#include "ray.h"
+
+class BVH;
+class BVHNode;
+class Triangle;
+
+/**
+  * Compact BVH layout for huge meshes. A node stores the boxes of both of its children, quantized to 8 or 16 bits
+  * relative to its own (decoded) box, and one 32-bit word per child. The quantization step of each axis is a power
+  * of two, chosen at build time and stored as a float exponent byte, so decoding needs no division or search.
+  * Quantized boxes are rounded outwards, so a decoded box always contains the exact one and traversal stays
+  * conservative. A node takes 24 (8-bit) or 36 (16-bit) bytes for two children, against 64 bytes per child for
+  * a BVHNode.
+  */
+class CompressedBVH
+{
+public:
+	/** Child word: internal nodes store their node index; leaves set LEAF, then count - 1 and the first triangle index */
+	static const uint LEAF = 0x80000000;
+	static const int LEAFSIZE = 16;
+	static const int FIRSTBITS = 27;
+	static const int STACKSIZE = 64;
+
+	CompressedBVH(int bits);
+	~CompressedBVH();
+	/** Encodes the nodes of a BVH; fails when a triangle index or the depth does not fit the encoding */
+	bool Build(const BVH* bvh, int indexCount);
+	void Traverse(Ray& ray, const int* triangleIndices, tuple<Triangle*, float, Ray::HitType>& intersection) const;
+	size_t MemoryUsage() const;
+private:
+	int bits;
+	int nodeSize;
+	int maxLevel;
+	vector<uchar> nodes;
+	aabb rootBounds;
+	uint rootChild;
+	const int* buildIndices;
+
+	uint EncodeNode(const BVHNode* node, const BVHNode* pool, const aabb& bounds, int depth);
+	uint EncodeRange(int first, int count, const aabb& bounds, int depth);
+	uint EncodeChildren(const aabb& bounds, const aabb childBounds[2], aabb decoded[2]);
+	void Quantize(const aabb& parent, const uchar exponents[3], const aabb& child, uint qmin[3], uint qmax[3]) const;
+	void Decode(const uchar* node, int child, const aabb& parent, aabb& bounds) const;
+	float Dequantize(float parentMin, float scale, uint q) const;
+	uchar ScaleExponent(float parentMin, float parentMax) const;
+	static float Scale(uchar exponent);
+	aabb RangeBounds(int first, int count) const;
+};
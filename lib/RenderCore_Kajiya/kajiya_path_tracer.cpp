@@ -3,11 +3,15 @@
 #include "ray.h"
 #include "material.h"
 #include "triangle.h"
+#include "bvh.h"
 #include "light.h"
 #include "tuple"
 #include "vector"
 
-vector<Triangle*> KajiyaPathTracer::scene = vector<Triangle*>();
+Triangle* KajiyaPathTracer::triangles = 0;
+int KajiyaPathTracer::triangleCount = 0;
+int KajiyaPathTracer::triangleCapacity = 0;
+vector<int2> KajiyaPathTracer::meshRanges;
 vector<Triangle*> KajiyaPathTracer::lights = vector<Triangle*>();
 vector<CoreMaterial> KajiyaPathTracer::materials;
 vector<BVH*> KajiyaPathTracer::bvhs;
@@ -36,17 +40,24 @@ float3 KajiyaPathTracer::oldCameraP3 = make_float3(0, 0, 0);
 float KajiyaPathTracer::samplingThreshold = 8;
 float KajiyaPathTracer::targetVariance = 0.05;
 
+int KajiyaPathTracer::pixelCount = SCRHEIGHT * SCRWIDTH;
 uint* KajiyaPathTracer::numberOfSamples = new uint[SCRHEIGHT * SCRWIDTH];
 float4* KajiyaPathTracer::sums = new float4[SCRHEIGHT * SCRWIDTH];
 float4* KajiyaPathTracer::sumSquared = new float4[SCRHEIGHT * SCRWIDTH];
 
 int KajiyaPathTracer::recursionThreshold = 3;
-Ray KajiyaPathTracer::primaryRay = Ray(make_float4(0, 0, 0, 0), make_float4(0, 0, 0, 0));
-Ray KajiyaPathTracer::shadowRay = Ray(make_float4(0, 0, 0, 0), make_float4(0, 0, 0, 0));
+thread_local Ray KajiyaPathTracer::primaryRay = Ray(make_float4(0, 0, 0, 0), make_float4(0, 0, 0, 0));
+thread_local Ray KajiyaPathTracer::shadowRay = Ray(make_float4(0, 0, 0, 0), make_float4(0, 0, 0, 0));
+thread_local PhaseStats::Counters KajiyaPathTracer::phaseCounters;
 
 
 
 void KajiyaPathTracer::Render(const ViewPyramid& view, const Bitmap* screen) {
+	/** The first mesh holds the scene; meshes may arrive out of order */
+	if (bvhs.empty() || bvhs[0] == NULL) {
+		return;
+	}
+
 	bool cameraStill = (
 		view.pos == KajiyaPathTracer::oldCameraPos && 
 		view.p1 == KajiyaPathTracer::oldCameraP1 && 
@@ -58,30 +69,34 @@ void KajiyaPathTracer::Render(const ViewPyramid& view, const Bitmap* screen) {
 		KajiyaPathTracer::ResetAdaptiveSampling();
 	}
 
-	int varianceCount = 0;
-
-	for (int y = 0; y < screen->height; y++) {
-		for (int x = 0; x < screen->width; x++) {
-			int index = x + y * screen->width;
-			KajiyaPathTracer::TraceRay(view, screen, x, y, cameraStill);
-			if (cameraStill) {
-				float variance = KajiyaPathTracer::EstimateSampleVariance(index);
-				if (variance > targetVariance) {
-					float samples = variance / targetVariance;
-					int amountSamples = min(samples * samples, KajiyaPathTracer::samplingThreshold) ;
-					varianceCount += amountSamples;
-
-					for (int i = 0; i < amountSamples; i++) {
-						KajiyaPathTracer::TraceRay(view, screen, x, y, cameraStill);
+	/** Trace rows in parallel using the shared job system */
+	JobManager::GetJobManager()->ParallelFor(0, screen->height, 1, [&](int firstRow, int lastRow) {
+		Timer timer;
+		PhaseStats::Counters& counters = KajiyaPathTracer::phaseCounters;
+		for (int y = firstRow; y < lastRow; y++) {
+			for (int x = 0; x < screen->width; x++) {
+				/** Time the rays of a subset of the pixels only */
+				counters.BeginSample(PhaseStats::Sampled(x, y));
+				int index = x + y * screen->width;
+				KajiyaPathTracer::TraceRay(view, screen, x, y, cameraStill);
+				if (cameraStill) {
+					float variance = KajiyaPathTracer::EstimateSampleVariance(index);
+					if (variance > targetVariance) {
+						float samples = variance / targetVariance;
+						int amountSamples = min(samples * samples, KajiyaPathTracer::samplingThreshold) ;
+
+						for (int i = 0; i < amountSamples; i++) {
+							KajiyaPathTracer::TraceRay(view, screen, x, y, cameraStill);
+						}
 					}
 				}
+				/** Update Screen */
+				screen->pixels[index] = KajiyaPathTracer::ConvertColorToInt(KajiyaPathTracer::sums[index] / KajiyaPathTracer::numberOfSamples[index]);
+				counters.EndSample();
 			}
-			/** Update Screen */
-			screen->pixels[index] = KajiyaPathTracer::ConvertColorToInt(KajiyaPathTracer::sums[index] / KajiyaPathTracer::numberOfSamples[index]);
 		}
-	}
-
-	cout << "Variance Count: " << varianceCount << endl;
+		PhaseStats::Flush(counters, timer.elapsed());
+	});
 
 	/** Update the old position of the camera */
 	KajiyaPathTracer::oldCameraPos = view.pos;
@@ -96,8 +111,6 @@ void KajiyaPathTracer::Render(const ViewPyramid& view, const Bitmap* screen) {
 	else {
 		KajiyaPathTracer::stillFrames = 1;
 	}
-
-	cout << "Amount of still frames: " << KajiyaPathTracer::stillFrames << endl;
 }
 
 void KajiyaPathTracer::TraceRay(const ViewPyramid& view, const Bitmap* screen, int x, int y, bool cameraStill) {
@@ -119,9 +132,48 @@ void KajiyaPathTracer::TraceRay(const ViewPyramid& view, const Bitmap* screen, i
 	KajiyaPathTracer::sumSquared[index] += color * color;
 }
 
-void KajiyaPathTracer::AddTriangle(float4 v0, float4 v1, float4 v2, uint materialIndex) {
-	Triangle* triangle = new Triangle(v0, v1, v2, materialIndex);
-	scene.push_back(triangle);
+int KajiyaPathTracer::SetMeshTriangles(int meshIdx, const CoreTri* triangleData, int count) {
+	/** Meshes may arrive in any order; the ranges of meshes that were not set yet are empty */
+	if (meshIdx >= (int)meshRanges.size()) {
+		meshRanges.resize(meshIdx + 1, make_int2(0, 0));
+	}
+	int2 range = meshRanges[meshIdx];
+	if (range.y != count) {
+		if (range.y > 0) {
+			/** Close the gap of the old triangles; the meshes after it, and their BVHs, move down */
+			memmove(triangles + range.x, triangles + range.x + range.y, (triangleCount - range.x - range.y) * sizeof(Triangle));
+			triangleCount -= range.y;
+			for (int m = 0; m < (int)meshRanges.size(); m++) {
+				if (meshRanges[m].y == 0 || meshRanges[m].x <= range.x) { continue; }
+				meshRanges[m].x -= range.y;
+				if (m < (int)bvhs.size() && bvhs[m] != NULL) {
+					for (int i = 0; i < bvhs[m]->indexCount; i++) { bvhs[m]->triangleIndices[i] -= range.y; }
+				}
+			}
+		}
+		/** The new or resized mesh is placed at the end; a mesh of the same size is rebuilt in place */
+		KajiyaPathTracer::ReserveTriangles(triangleCount + count);
+		meshRanges[meshIdx] = make_int2(triangleCount, count);
+		triangleCount += count;
+	}
+
+	int first = meshRanges[meshIdx].x;
+	for (int i = 0; i < count; i++) {
+		const CoreTri& triangle = triangleData[i];
+		new (&triangles[first + i]) Triangle(make_float4(triangle.vertex0, 0), make_float4(triangle.vertex1, 0), make_float4(triangle.vertex2, 0), triangle.material);
+	}
+	return first;
+}
+
+/** Grows the triangle storage by doubling, or shrinks it when mostly unused */
+void KajiyaPathTracer::ReserveTriangles(int count) {
+	if (count <= triangleCapacity && count >= triangleCapacity / 4) { return; }
+	int capacity = max(count, count > triangleCapacity ? triangleCapacity * 2 : count);
+	Triangle* storage = (Triangle*)MALLOC64(capacity * sizeof(Triangle));
+	if (triangleCount > 0) { memcpy(storage, triangles, triangleCount * sizeof(Triangle)); }
+	FREE64(triangles);
+	triangles = storage;
+	triangleCapacity = capacity;
 }
 
 /** Calculates the point on the camera screen given the x and y position */
@@ -155,14 +207,33 @@ float4 KajiyaPathTracer::ConvertIntToColor(int color) {
 
 
 
+void KajiyaPathTracer::GetRadiance(float4* pixels, int pixelCount) {
+	for (int i = 0; i < pixelCount; i++) {
+		/** Pixels without samples yet are black, rather than a division by zero */
+		pixels[i] = KajiyaPathTracer::numberOfSamples[i] ? KajiyaPathTracer::sums[i] / KajiyaPathTracer::numberOfSamples[i] : make_float4(0);
+	}
+}
+
+void KajiyaPathTracer::Resize(int width, int height) {
+	if (width * height != KajiyaPathTracer::pixelCount) {
+		delete[] KajiyaPathTracer::numberOfSamples;
+		delete[] KajiyaPathTracer::sums;
+		delete[] KajiyaPathTracer::sumSquared;
+		KajiyaPathTracer::pixelCount = width * height;
+		KajiyaPathTracer::numberOfSamples = new uint[KajiyaPathTracer::pixelCount];
+		KajiyaPathTracer::sums = new float4[KajiyaPathTracer::pixelCount];
+		KajiyaPathTracer::sumSquared = new float4[KajiyaPathTracer::pixelCount];
+	}
+	/** Start over: the old samples belong to other pixels */
+	KajiyaPathTracer::ResetAdaptiveSampling();
+	KajiyaPathTracer::stillFrames = 1;
+}
+
 void KajiyaPathTracer::ResetAdaptiveSampling() {
-	for (int y = 0; y < SCRHEIGHT; y++) {
-		for (int x = 0; x < SCRWIDTH; x++) {
-			int index = x + y * SCRWIDTH;
-			KajiyaPathTracer::sums[index] = make_float4(0);
-			KajiyaPathTracer::sumSquared[index] = make_float4(0);
-			KajiyaPathTracer::numberOfSamples[index] = 0;
-		}
+	for (int index = 0; index < KajiyaPathTracer::pixelCount; index++) {
+		KajiyaPathTracer::sums[index] = make_float4(0);
+		KajiyaPathTracer::sumSquared[index] = make_float4(0);
+		KajiyaPathTracer::numberOfSamples[index] = 0;
 	}
 }
 
@@ -11,21 +11,34 @@ class KajiyaPathTracer
 {
 public:
 	static int recursionThreshold;
-	static vector<Triangle*> scene;
+	/** Contiguous, 64-byte aligned triangle storage; each mesh owns a consecutive range */
+	static Triangle* triangles;
+	static int triangleCount;
+	static vector<int2> meshRanges;
 	static vector<Triangle*> lights;
 	static vector<CoreMaterial> materials;
 	static vector<BVH*> bvhs;
 
-	static Ray primaryRay;
-	static Ray shadowRay;
+	/** Per-thread rays, rows are traced in parallel */
+	static thread_local Ray primaryRay;
+	static thread_local Ray shadowRay;
+	/** Per-thread ray counts and sampled trace times, added to the phase statistics once per render job */
+	static thread_local PhaseStats::Counters phaseCounters;
 
 	static float4 globalIllumination;
 
 	static void Initialise();
-	static void AddTriangle(float4 v0, float4 v1, float4 v2, uint materialIndex);
+	/** Stores the triangles of a mesh, replacing its old ones; returns the index of the first */
+	static int SetMeshTriangles(int meshIdx, const CoreTri* triangleData, int count);
 	static void Render(const ViewPyramid& view, const Bitmap* screen);
 	static void TraceRay(const lighthouse2::ViewPyramid& view, const lighthouse2::Bitmap* screen, int x, int y, bool cameraStill);
+	/** Average radiance per pixel, for HDR render targets */
+	static void GetRadiance(float4* pixels, int pixelCount);
+	/** Reallocate the adaptive sampling buffers for a new screen size */
+	static void Resize(int width, int height);
 private:
+	static int triangleCapacity;
+	static void ReserveTriangles(int count);
 
 	/** Old camera position */
 	static int stillFrames;
@@ -37,6 +50,7 @@ private:
 	/** Adaptive sampling */
 	static float samplingThreshold;
 	static float targetVariance;
+	static int pixelCount;
 	static uint* numberOfSamples;
 	static float4* sums;
 	static float4* sumSquared;
@@ -46,7 +46,12 @@ float4 Ray::Trace(BVH* bvh, bool lastSpecular, uint recursionDepth) {
 
 	/** Intersect BVH */
 	tuple<Triangle*, float, Ray::HitType> nearestIntersection = make_tuple<Triangle*, float, Ray::HitType>(NULL, NULL, Ray::HitType::Nothing);
-	bvh->root->Traverse(*this, bvh->pool, bvh->triangleIndices, nearestIntersection);
+	PhaseStats::Counters& counters = KajiyaPathTracer::phaseCounters;
+	const int phase = PhaseStats::TracePhase(recursionDepth);
+	const int64_t traceStart = counters.Start();
+	counters.count[phase]++;
+	bvh->Traverse(*this, nearestIntersection);
+	counters.Stop(phase, traceStart);
 	/** Intersect Lights */
 	nearestIntersection = IntersectLights(nearestIntersection);
 
@@ -101,7 +106,10 @@ float4 Ray::Trace(BVH* bvh, bool lastSpecular, uint recursionDepth) {
 			nldotl > 0
 		) {
 			tuple<Triangle*, float, Ray::HitType> lightIntersection = make_tuple<Triangle*, float, Ray::HitType>(NULL, NULL, Ray::HitType::Nothing);
-			bvh->root->Traverse(KajiyaPathTracer::shadowRay, bvh->pool, bvh->triangleIndices, lightIntersection);
+			const int64_t shadowStart = counters.Start();
+			counters.count[PhaseStats::SHADOW]++;
+			bvh->Traverse(KajiyaPathTracer::shadowRay, lightIntersection);
+			counters.Stop(PhaseStats::SHADOW, shadowStart);
 			Triangle* intersect = get<0>(lightIntersection);
 			float directIntersectionDist = get<1>(lightIntersection);
 
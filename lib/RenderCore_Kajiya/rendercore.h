@@ -40,6 +40,7 @@ public:
 	// methods
 	void Init();
 	void SetTarget( GLTexture* target, const uint spp );
+	void SetTarget( HostTarget* target, const uint spp );
 	void SetGeometry( const int meshIdx, const float4* vertexData, const int vertexCount, const int triangleCount, const CoreTri* triangles );
 	void SetMaterials(CoreMaterial* mat, const int materialCount);
 	void Render( const ViewPyramid& view, const Convergence converge, bool async );
@@ -49,7 +50,15 @@ public:
 
 	// unimplemented for the minimal core
 	inline void SetProbePos( const int2 pos ) override {}
-	inline void Setting( const char* name, float value ) override {}
+	inline void Setting( const char* name, float value ) override
+	{
+		if (!strcmp( name, "threads" )) JobManager::SetNumThreads( (uint)value );
+		// compressed BVH nodes (0: off, 8 or 16 bits) for meshes of at least the threshold size passed after this
+		if (!strcmp( name, "bvhCompression" )) bvhCompression = (int)value;
+		if (!strcmp( name, "bvhCompressionThreshold" )) bvhCompressionThreshold = (int)value;
+		// spatial split (SBVH) build for final-frame quality; the value is the budget of extra triangle references
+		if (!strcmp( name, "bvhSpatialSplits" )) bvhSpatialSplits = value;
+	}
 	inline void SetTextures( const CoreTexDesc* tex, const int textureCount ) override {}
 	inline void SetLights( const CoreLightTri* triLights, const int triLightCount,
 		const CorePointLight* pointLights, const int pointLightCount,
@@ -66,8 +75,12 @@ private:
 
 	// data members
 	Bitmap* screen = 0;								// temporary storage of RenderCore output; will be copied to render target
-	int targetTextureID = 0;						// ID of the target OpenGL texture
+	GLTexture* glTarget = 0;						// the target OpenGL texture
+	HostTarget* hostTarget = 0;						// host memory render target, instead of the OpenGL texture
 	vector<Mesh> meshes;							// mesh data storage
+	int bvhCompression = 0;							// bits per quantized BVH box coordinate; 0 for regular nodes
+	int bvhCompressionThreshold = 0;				// minimum triangle count of meshes that get compressed nodes
+	float bvhSpatialSplits = 0;						// extra triangle references allowed by the SBVH build, per triangle; 0 for object splits only
 public:
 	CoreStats coreStats;							// rendering statistics
 };
@@ -33,7 +33,20 @@ void RenderCore::Init()
 void RenderCore::SetTarget( GLTexture* target, const uint )
 {
 	// synchronize OpenGL viewport
-	targetTextureID = target->ID;
+	glTarget = target, hostTarget = 0;
+	if (screen != 0 && target->width == screen->width && target->height == screen->height) return; // nothing changed
+	delete screen;
+	screen = new Bitmap( target->width, target->height );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::SetTarget                                                      |
+//  |  Set the host memory buffer that serves as the render target.         LH2'20|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::SetTarget( HostTarget* target, const uint )
+{
+	// headless rendering: the image is copied to the target, without OpenGL
+	glTarget = 0, hostTarget = target;
 	if (screen != 0 && target->width == screen->width && target->height == screen->height) return; // nothing changed
 	delete screen;
 	screen = new Bitmap( target->width, target->height );
@@ -63,18 +76,36 @@ void RenderCore::SetGeometry( const int meshIdx, const float4* vertexData, const
 //  +-----------------------------------------------------------------------------+
 void RenderCore::Render( const ViewPyramid& view, const Convergence converge, bool async )
 {
-	// render
+	// render; for OpenGL targets, straight into the mapped pixel buffer of the texture
+	uint* ownPixels = screen->pixels;
+	if (glTarget) if (uint* mapped = glTarget->MapPixels()) screen->pixels = mapped;
+	Timer timer;
 	screen->Clear();
-	for (Mesh& mesh : meshes) for (int i = 0; i < mesh.vcount; i++)
 	{
-		// convert a vertex position to a screen coordinate
-		int screenx = mesh.vertices[i].x / 80 * (float)screen->width + screen->width / 2;
-		int screeny = mesh.vertices[i].z / 80 * (float)screen->height + screen->height / 2;
-		screen->Plot( screenx, screeny, 0xffffff /* white */ );
+		// each plotted vertex counts as a primary 'ray'
+		ScopedTimer phase( PhaseStats::PRIMARY );
+		for (Mesh& mesh : meshes)
+		{
+			for (int i = 0; i < mesh.vcount; i++)
+			{
+				// convert a vertex position to a screen coordinate
+				int screenx = mesh.vertices[i].x / 80 * (float)screen->width + screen->width / 2;
+				int screeny = mesh.vertices[i].z / 80 * (float)screen->height + screen->height / 2;
+				screen->Plot( screenx, screeny, 0xffffff /* white */ );
+			}
+			PhaseStats::Count( PhaseStats::PRIMARY, mesh.vcount );
+		}
 	}
-	// copy pixel buffer to OpenGL render target texture
-	glBindTexture( GL_TEXTURE_2D, targetTextureID );
-	glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA, screen->width, screen->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, screen->pixels );
+	coreStats.renderTime = timer.elapsed();
+	PhaseStats::AddTime( PhaseStats::RENDER, coreStats.renderTime );
+	coreStats.SetPhaseStats( PhaseStats::Merge() );
+	// copy pixel buffer to the host target or the OpenGL render target texture
+	PROFILE_SPAN( "Upload" );
+	if (hostTarget) { hostTarget->CopyFrom( screen->pixels ); return; }
+	// without persistent mapping, the pixels are copied to the texture
+	if (screen->pixels == ownPixels) { glTarget->CopyFrom( screen ); return; }
+	screen->pixels = ownPixels;
+	glTarget->UploadPixels();
 }
 
 //  +-----------------------------------------------------------------------------+
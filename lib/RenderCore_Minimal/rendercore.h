@@ -40,6 +40,7 @@ public:
 	// methods
 	void Init();
 	void SetTarget( GLTexture* target, const uint spp );
+	void SetTarget( HostTarget* target, const uint spp );
 	void SetGeometry( const int meshIdx, const float4* vertexData, const int vertexCount, const int triangleCount, const CoreTri* triangles );
 	void Render( const ViewPyramid& view, const Convergence converge, bool async );
 	void WaitForRender() { /* this core does not support asynchronous rendering yet */ }
@@ -66,7 +67,8 @@ private:
 
 	// data members
 	Bitmap* screen = 0;								// temporary storage of RenderCore output; will be copied to render target
-	int targetTextureID = 0;						// ID of the target OpenGL texture
+	GLTexture* glTarget = 0;						// the target OpenGL texture
+	HostTarget* hostTarget = 0;						// host memory render target, instead of the OpenGL texture
 	vector<Mesh> meshes;							// mesh data storage
 public:
 	CoreStats coreStats;							// rendering statistics
@@ -22,6 +22,13 @@
 
 // core-specific settings
 // #define NOTEXTURES		// all texture reads will be white
+#define TILESIZE	64		// screen tile size for binned rasterization
+#define BINCHUNK	4096	// triangles per binning job; small meshes are packed into one job; must be a multiple of CLUSTERSIZE
+#define CLUSTERSIZE	256		// triangles per occlusion culling cluster
+#define OCCLUDERSHARE	0.25f	// share of the triangles drawn before occlusion culling starts
+#define GUARDBAND	2048.0f	// pixels beyond the screen edges that triangles may extend to without clipping
+#define VERTEXCHUNK	4096	// vertices per transform job; must be a multiple of eight
+#define MSAASAMPLES	4		// samples per pixel in MSAA mode; the sample pattern is a rotated grid
 
 #include "platform.h"
 
@@ -25,23 +25,105 @@ uint ScaleColor( uint c, int scale )
 	return rb + g;
 }
 
+inline int LowestBit( const uint64_t mask )
+{
+#ifdef _MSC_VER
+	unsigned long idx;
+	_BitScanForward64( &idx, mask );
+	return (int)idx;
+#else
+	return __builtin_ctzll( mask );
+#endif
+}
+
+// -----------------------------------------------------------
+// SIMD helpers for the vertex and pixel loops: eight lanes
+// with AVX, four with SSE. a row of an 8x8 block takes
+// 8 / LANES steps.
+// -----------------------------------------------------------
+#ifdef __AVX__
+#define LANES 8
+typedef __m256 vfloat;
+static inline vfloat VSet( const float a ) { return _mm256_set1_ps( a ); }
+static inline vfloat VRamp( const float a ) { return _mm256_add_ps( _mm256_set1_ps( a ), _mm256_setr_ps( 0, 1, 2, 3, 4, 5, 6, 7 ) ); }
+static inline vfloat VLoad( const float* a ) { return _mm256_loadu_ps( a ); }
+static inline void VStore( float* a, const vfloat b ) { _mm256_store_ps( a, b ); }
+static inline vfloat VAdd( const vfloat a, const vfloat b ) { return _mm256_add_ps( a, b ); }
+static inline vfloat VMul( const vfloat a, const vfloat b ) { return _mm256_mul_ps( a, b ); }
+static inline vfloat VDiv( const vfloat a, const vfloat b ) { return _mm256_div_ps( a, b ); }
+static inline uint VPositive( const vfloat a ) { return _mm256_movemask_ps( _mm256_cmp_ps( a, _mm256_setzero_ps(), _CMP_GT_OQ ) ); }
+static inline uint VNonNegative( const vfloat a ) { return _mm256_movemask_ps( _mm256_cmp_ps( a, _mm256_setzero_ps(), _CMP_GE_OQ ) ); }
+static inline uint VLess( const vfloat a, const vfloat b ) { return _mm256_movemask_ps( _mm256_cmp_ps( a, b, _CMP_LT_OQ ) ); }
+static inline vfloat VSub( const vfloat a, const vfloat b ) { return _mm256_sub_ps( a, b ); }
+static inline vfloat VMax( const vfloat a, const vfloat b ) { return _mm256_max_ps( a, b ); }
+static inline vfloat VNeg( const vfloat a ) { return _mm256_xor_ps( a, _mm256_set1_ps( -0.0f ) ); }
+static inline float VHorizontalMax( const vfloat a )
+{
+	__m128 m = _mm_max_ps( _mm256_castps256_ps128( a ), _mm256_extractf128_ps( a, 1 ) );
+	m = _mm_max_ps( m, _mm_movehl_ps( m, m ) );
+	return _mm_cvtss_f32( _mm_max_ss( m, _mm_shuffle_ps( m, m, 1 ) ) );
+}
+static inline uint VNegative( const vfloat a ) { return _mm256_movemask_ps( _mm256_cmp_ps( a, _mm256_setzero_ps(), _CMP_LT_OQ ) ); }
+#else
+#define LANES 4
+typedef __m128 vfloat;
+static inline vfloat VSet( const float a ) { return _mm_set1_ps( a ); }
+static inline vfloat VRamp( const float a ) { return _mm_add_ps( _mm_set1_ps( a ), _mm_setr_ps( 0, 1, 2, 3 ) ); }
+static inline vfloat VLoad( const float* a ) { return _mm_loadu_ps( a ); }
+static inline void VStore( float* a, const vfloat b ) { _mm_store_ps( a, b ); }
+static inline vfloat VAdd( const vfloat a, const vfloat b ) { return _mm_add_ps( a, b ); }
+static inline vfloat VMul( const vfloat a, const vfloat b ) { return _mm_mul_ps( a, b ); }
+static inline vfloat VDiv( const vfloat a, const vfloat b ) { return _mm_div_ps( a, b ); }
+static inline uint VPositive( const vfloat a ) { return _mm_movemask_ps( _mm_cmpgt_ps( a, _mm_setzero_ps() ) ); }
+static inline uint VNonNegative( const vfloat a ) { return _mm_movemask_ps( _mm_cmpge_ps( a, _mm_setzero_ps() ) ); }
+static inline uint VLess( const vfloat a, const vfloat b ) { return _mm_movemask_ps( _mm_cmplt_ps( a, b ) ); }
+static inline vfloat VSub( const vfloat a, const vfloat b ) { return _mm_sub_ps( a, b ); }
+static inline vfloat VMax( const vfloat a, const vfloat b ) { return _mm_max_ps( a, b ); }
+static inline vfloat VNeg( const vfloat a ) { return _mm_xor_ps( a, _mm_set1_ps( -0.0f ) ); }
+static inline float VHorizontalMax( const vfloat a )
+{
+	const __m128 m = _mm_max_ps( a, _mm_movehl_ps( a, a ) );
+	return _mm_cvtss_f32( _mm_max_ss( m, _mm_shuffle_ps( m, m, 1 ) ) );
+}
+static inline uint VNegative( const vfloat a ) { return _mm_movemask_ps( _mm_cmplt_ps( a, _mm_setzero_ps() ) ); }
+#endif
+#define LANEMASK ((1u << LANES) - 1)
+
 // -----------------------------------------------------------
 // static data for the rasterizer
 // -----------------------------------------------------------
 Surface* Mesh::screen = 0;
-float* Mesh::xleft, *Mesh::xright, *Mesh::uleft, *Mesh::uright;
-float* Mesh::vleft, *Mesh::vright, *Mesh::zleft, *Mesh::zright;
 Scene Rasterizer::scene;
 float* Rasterizer::zbuffer;
+float* Rasterizer::hiz = 0;
+float* Rasterizer::tileZMax = 0;
+uint2* Rasterizer::visibility = 0;
+float* Rasterizer::barycentric[2] = {};
+uint* Rasterizer::sampleColor = 0;
+uchar* Rasterizer::expanded = 0;
 float4 Rasterizer::frustum[5];
+float4 Rasterizer::guardBand[4];
 static float3 raxis[3] = { make_float3( 1, 0, 0 ), make_float3( 0, 1, 0 ), make_float3( 0, 0, 1 ) };
 
+// -----------------------------------------------------------
+// Texture::InitLevels
+// input: number of MIP levels stored in the pixel buffer.
+// levels that would be smaller than a pixel are ignored.
+// -----------------------------------------------------------
+void Texture::InitLevels( const int count )
+{
+	uint* p = pixels;
+	levels = 0;
+	for (int w = width, h = height; levels < min( count, MIPLEVELCOUNT ) && w > 0 && h > 0; w >>= 1, h >>= 1)
+		level[levels++] = p, p += w * h;
+	pow2 = (width & (width - 1)) == 0 && (height & (height - 1)) == 0;
+}
+
 // -----------------------------------------------------------
 // Mesh constructor
 // input: vertex count & face count
 // allocates room for mesh data:
 // - pos:  vertex positions
-// - tpos: transformed vertex positions
 // - norm: vertex normals
 // - spos: vertex screen space positions
 // - uv:   vertex uv coordinates
@@ -50,121 +132,563 @@ static float3 raxis[3] = { make_float3( 1, 0, 0 ), make_float3( 0, 1, 0 ), make_
 // -----------------------------------------------------------
 Mesh::Mesh( int vcount, int tcount ) : verts( vcount ), tris( tcount )
 {
-	pos = new float3[vcount * 3], tpos = pos + vcount, norm = pos + 2 * vcount;
+	pos = new float3[vcount * 2], norm = pos + vcount;
 	spos = new float2[vcount * 2], uv = spos + vcount, N = new float3[tcount];
 	tri = new int[tcount * 3];
 	material = new int[tcount];
 }
 
 // -----------------------------------------------------------
-// Mesh render function
+// Mesh::Finalize
+// derives the data that the renderer uses from the vertex
+// positions: SoA position streams for the vertex transform,
+// and object space bounds for each group of CLUSTERSIZE
+// triangles. call after changing vertex positions.
+// -----------------------------------------------------------
+void Mesh::Finalize()
+{
+	const int stride = (verts + 7) & ~7;
+	FREE64( px );
+	px = (float*)MALLOC64( (stride * 3 * sizeof( float ) + 63) & ~63 ), py = px + stride, pz = py + stride;
+	for (int i = 0; i < stride; i++)
+	{
+		const float3 p = i < verts ? pos[i] : make_float3( 0, 0, 0 );
+		px[i] = p.x, py[i] = p.y, pz[i] = p.z;
+	}
+	clusterBounds.resize( ((tris + CLUSTERSIZE - 1) / CLUSTERSIZE) * 2 );
+	for (int c = 0; c * CLUSTERSIZE < tris; c++)
+	{
+		float3 bmin = make_float3( 1e34f ), bmax = -bmin;
+		for (int i = c * CLUSTERSIZE; i < min( tris, (c + 1) * CLUSTERSIZE ); i++) for (int v = 0; v < 3; v++)
+			bmin = fminf( bmin, pos[tri[i * 3 + v]] ), bmax = fmaxf( bmax, pos[tri[i * 3 + v]] );
+		clusterBounds[c * 2] = bmin, clusterBounds[c * 2 + 1] = bmax;
+	}
+}
+
+// -----------------------------------------------------------
+// TransformedVertices::Init
+// prepares the set for a mesh and final matrix; the streams
+// are reused if they are large enough, and reallocated if they
+// are more than twice the size needed.
+// -----------------------------------------------------------
+void TransformedVertices::Init( const Mesh* m, const mat4& T )
+{
+	const int stride = (m->verts + 7) & ~7;
+	if (stride > capacity || stride * 2 < capacity)
+	{
+		FREE64( x );
+		x = (float*)MALLOC64( (stride * (6 * sizeof( float ) + 1) + 63) & ~63 );
+		capacity = stride;
+	}
+	y = x + stride, z = y + stride, sx = z + stride, sy = sx + stride, rz = sy + stride, clip = (uchar*)(rz + stride);
+	mesh = m, transform = T;
+}
+
+// -----------------------------------------------------------
+// TransformedVertices::Transform
+// input: vertex range; first must be a multiple of eight.
+// transforms vertices to camera space and projects them, LANES
+// at a time. a vertex is flagged for each plane it is outside
+// of: the near plane, and the four planes of the guard band.
+// Safe to call for disjoint ranges in parallel.
+// -----------------------------------------------------------
+void TransformedVertices::Transform( const int first, const int last )
+{
+	const mat4& T = transform;
+	const Surface* screen = Mesh::screen;
+	const float W = (float)screen->width;
+	const vfloat m[12] = { VSet( T.cell[0] ), VSet( T.cell[1] ), VSet( T.cell[2] ), VSet( T.cell[3] ), VSet( T.cell[4] ), VSet( T.cell[5] ),
+		VSet( T.cell[6] ), VSet( T.cell[7] ), VSet( T.cell[8] ), VSet( T.cell[9] ), VSet( T.cell[10] ), VSet( T.cell[11] ) };
+	const vfloat width = VSet( W ), halfWidth = VSet( W * 0.5f ), halfHeight = VSet( screen->height * 0.5f ), one = VSet( 1 );
+	const vfloat guardX = VSet( W * 0.5f + GUARDBAND ), guardY = VSet( screen->height * 0.5f + GUARDBAND );
+	const vfloat nearZ = VSet( -Rasterizer::frustum[0].w );
+	const float* px = mesh->px, * py = mesh->py, * pz = mesh->pz;
+	for (int i = first; i < last; i += LANES)
+	{
+		const vfloat ox = VLoad( px + i ), oy = VLoad( py + i ), oz = VLoad( pz + i );
+		const vfloat cx = VAdd( VAdd( VAdd( VMul( m[0], ox ), VMul( m[1], oy ) ), VMul( m[2], oz ) ), m[3] );
+		const vfloat cy = VAdd( VAdd( VAdd( VMul( m[4], ox ), VMul( m[5], oy ) ), VMul( m[6], oz ) ), m[7] );
+		const vfloat cz = VAdd( VAdd( VAdd( VMul( m[8], ox ), VMul( m[9], oy ) ), VMul( m[10], oz ) ), m[11] );
+		VStore( x + i, cx ), VStore( y + i, cy ), VStore( z + i, cz );
+		// projection; lanes that are behind the camera get flagged below and are never used
+		const vfloat nz = VNeg( cz ), scaledX = VMul( cx, width ), scaledY = VMul( cy, width );
+		VStore( sx + i, VAdd( VDiv( scaledX, nz ), halfWidth ) );
+		VStore( sy + i, VAdd( VDiv( scaledY, cz ), halfHeight ) );
+		VStore( rz + i, VDiv( one, cz ) );
+		// clip flags
+		const vfloat limitX = VMul( guardX, nz ), limitY = VMul( guardY, nz );
+		const uint outside[5] = { VLess( nearZ, cz ), VLess( limitX, scaledX ), VLess( scaledX, VNeg( limitX ) ),
+			VLess( limitY, scaledY ), VLess( scaledY, VNeg( limitY ) ) };
+		for (int lane = 0; lane < LANES; lane++)
+		{
+			uint flags = 0;
+			for (int p = 0; p < 5; p++) flags |= ((outside[p] >> lane) & 1) << p;
+			clip[i + lane] = (uchar)flags;
+		}
+	}
+}
+
+// -----------------------------------------------------------
+// Mesh::InFrustum
 // input: final matrix for scene graph node
-// renders a mesh using software rasterization.
-// stages:
-// 1. mesh culling: checks the mesh against the view frustum
-// 2. vertex transform: calculates world space coordinates
-// 3. triangle rendering loop. substages:
-//    a) backface culling
-//    b) clipping (Sutherland-Hodgeman)
-//    c) shading (using pre-scaled palettes for speed)
-//    d) projection: world-space to 2D screen-space
-//    e) span construction
-//    f) span filling
-// -----------------------------------------------------------
-void Mesh::Render( const mat4& T )
-{
-	// cull mesh
+// checks the mesh bounds against the view frustum; returns
+// false if all eight corners are outside a single plane.
+// -----------------------------------------------------------
+bool Mesh::InFrustum( const mat4& T )
+{
 	float3 c[8];
 	for (int i = 0; i < 8; i++) c[i] = make_float3( T * make_float4( bounds[i & 1].x, bounds[(i >> 1) & 1].y, bounds[i >> 2].z, 1 ) );
 	for (int i, p = 0; p < 5; p++)
 	{
 		for (i = 0; i < 8; i++) if ((dot( make_float3( Rasterizer::frustum[p] ), c[i] ) - Rasterizer::frustum[p].w) > 0) break;
-		if (i == 8) return;
-	}
-	// transform vertices
-	for (int i = 0; i < verts; i++) tpos[i] = make_float3( make_float4( pos[i], 1 ) * T );
-	// draw triangles
-	for (int i = 0; i < tris; i++)
-	{
-		Material* mat = Rasterizer::scene.matList[material[i]];
-		static uint p;
-		uint* src = mat->texture ? mat->texture->pixels : &p;
-		if (!mat->texture) p = mat->diffuse;
-		float* zbuffer = Rasterizer::zbuffer, f;
-		const float tw = mat->texture ? (float)mat->texture->width : 1;
-		const float th = mat->texture ? (float)mat->texture->height : 1;
-		const int umask = (int)tw, vmask = (int)th;
+		if (i == 8) return false;
+	}
+	return true;
+}
+
+// -----------------------------------------------------------
+// SetupTriangle
+// converts three projected vertices to edge functions and
+// attribute planes. pixels are sampled at integer coordinates;
+// a pixel exactly on an edge shared by two triangles belongs
+// to the one for which the edge is a 'top-left' edge. the
+// margin extends the pixel bounds for samples that are offset
+// from the pixel center.
+// returns false if the triangle does not cover any pixel.
+// -----------------------------------------------------------
+static bool SetupTriangle( const ScreenVertex& a, const ScreenVertex& b, const ScreenVertex& c, RasterTri& t, const float margin )
+{
+	const Surface* screen = Mesh::screen;
+	const float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+	if (area == 0) return false;
+	// pixel and depth bounds
+	t.zmin = min( a.z, min( b.z, c.z ) );
+	t.x0 = max( 0, (int)ceilf( min( a.x, min( b.x, c.x ) ) - margin ) );
+	t.y0 = max( 0, (int)ceilf( min( a.y, min( b.y, c.y ) ) - margin ) );
+	t.x1 = min( screen->width - 1, (int)floorf( max( a.x, max( b.x, c.x ) ) + margin ) );
+	t.y1 = min( screen->height - 1, (int)floorf( max( a.y, max( b.y, c.y ) ) + margin ) );
+	if (t.x0 > t.x1 || t.y0 > t.y1) return false;
+	// edge functions; the origin of an edge does not depend on its direction, so a shared
+	// edge yields exactly the negated function for the neighbouring triangle. this makes
+	// the top-left rule watertight, regardless of rounding.
+	const ScreenVertex* v[3] = { &a, area > 0 ? &b : &c, area > 0 ? &c : &b };
+	t.topLeft = 0;
+	for (int i = 0; i < 3; i++)
+	{
+		const ScreenVertex& p = *v[i], & q = *v[(i + 1) % 3];
+		const ScreenVertex& o = (p.y < q.y || (p.y == q.y && p.x < q.x)) ? p : q;
+		t.A[i] = p.y - q.y, t.B[i] = q.x - p.x, t.X[i] = o.x, t.Y[i] = o.y;
+		if (t.A[i] > 0 || (t.A[i] == 0 && t.B[i] > 0)) t.topLeft |= 1 << i;
+	}
+	// attribute planes
+	const float rarea = 1.0f / area, dx1 = b.x - a.x, dy1 = b.y - a.y, dx2 = c.x - a.x, dy2 = c.y - a.y;
+	const float va[3] = { a.z, a.u, a.v }, vb[3] = { b.z, b.u, b.v }, vc[3] = { c.z, c.u, c.v };
+	float* plane[3] = { t.zPlane, t.uPlane, t.vPlane };
+	for (int i = 0; i < 3; i++)
+	{
+		const float d1 = vb[i] - va[i], d2 = vc[i] - va[i];
+		const float ddx = (d1 * dy2 - d2 * dy1) * rarea, ddy = (d2 * dx1 - d1 * dx2) * rarea;
+		plane[i][0] = ddx, plane[i][1] = ddy, plane[i][2] = va[i] - ddx * a.x - ddy * a.y;
+	}
+	return true;
+}
+
+// -----------------------------------------------------------
+// TileOutside
+// conservative test of a screen tile against the edges of a
+// triangle; true if the tile is well outside one of them.
+// -----------------------------------------------------------
+static bool TileOutside( const RasterTri& t, const int x, const int y )
+{
+	for (int i = 0; i < 3; i++)
+	{
+		const float xmax = (float)(t.A[i] > 0 ? x + TILESIZE - 1 : x), ymax = (float)(t.B[i] > 0 ? y + TILESIZE - 1 : y);
+		if (t.A[i] * (xmax - t.X[i]) + t.B[i] * (ymax - t.Y[i]) < -0.5f * (fabsf( t.A[i] ) + fabsf( t.B[i] ))) return true;
+	}
+	return false;
+}
+
+// -----------------------------------------------------------
+// Occluded
+// tests a box against the coarse depth of the tiles that were
+// drawn so far. returns true if the box is in front of the
+// near plane, and every tile it projects to already contains
+// nearer geometry at all of its pixels.
+// input: object space box, final matrix for its node
+// -----------------------------------------------------------
+static bool Occluded( const float3& bmin, const float3& bmax, const mat4& T )
+{
+	const Surface* screen = Mesh::screen;
+	float minx = 1e34f, maxx = -1e34f, miny = 1e34f, maxy = -1e34f, zmin = 1e34f;
+	for (int i = 0; i < 8; i++)
+	{
+		const float3 c = make_float3( T * make_float4( i & 1 ? bmax.x : bmin.x, i & 2 ? bmax.y : bmin.y, i & 4 ? bmax.z : bmin.z, 1 ) );
+		if ((dot( make_float3( Rasterizer::frustum[0] ), c ) - Rasterizer::frustum[0].w) <= 0) return false;
+		const float x = ((c.x * screen->width) / -c.z) + screen->width / 2;
+		const float y = ((c.y * screen->width) / c.z) + screen->height / 2;
+		minx = min( minx, x ), maxx = max( maxx, x ), miny = min( miny, y ), maxy = max( maxy, y );
+		zmin = min( zmin, 1.0f / c.z );
+	}
+	const int x0 = max( 0, (int)floorf( minx ) ), x1 = min( screen->width - 1, (int)ceilf( maxx ) );
+	const int y0 = max( 0, (int)floorf( miny ) ), y1 = min( screen->height - 1, (int)ceilf( maxy ) );
+	if (x0 > x1 || y0 > y1) return false;
+	const int tilesX = (screen->width + TILESIZE - 1) / TILESIZE;
+	for (int ty = y0 / TILESIZE; ty <= y1 / TILESIZE; ty++) for (int tx = x0 / TILESIZE; tx <= x1 / TILESIZE; tx++)
+		if (zmin < Rasterizer::tileZMax[tx + ty * tilesX]) return false;
+	return true;
+}
+
+// -----------------------------------------------------------
+// Mesh::Bin
+// input: transformed vertices for this mesh, draw index,
+// triangle range, bin to store the results in, flags: CULL
+// for occlusion culling, DEFERRED to interpolate barycentrics
+// instead of texture coordinates, MULTISAMPLE to include the
+// pixels that only have samples inside the triangle.
+// prepares a range of triangles for rasterization. stages:
+// 0. occlusion culling, per cluster of CLUSTERSIZE triangles
+// 1. trivial reject: all vertices outside the same plane
+// 2. backface culling
+// 3. clipping (Sutherland-Hodgeman), only for triangles that
+//    cross the near plane or the guard band; others use the
+//    projected vertices directly
+// 4. shading (using pre-scaled palettes for speed)
+// 5. triangle setup: the clipped polygon is split into a fan
+//    of triangles in half-space form
+// 6. binning: each triangle is added to the list of each tile
+//    that its screen bounds overlap, unless the tile is
+//    completely outside one of its edges.
+// Safe to call for disjoint ranges and bins in parallel.
+// -----------------------------------------------------------
+void Mesh::Bin( const TransformedVertices& tv, const int instance, const int first, const int last, TriangleBin& bin, const uint flags )
+{
+	const bool cull = (flags & CULL) != 0, deferred = (flags & DEFERRED) != 0;
+	const float margin = flags & MULTISAMPLE ? 0.5f : 0;
+	static const float2 bary[3] = { make_float2( 0, 0 ), make_float2( 1, 0 ), make_float2( 0, 1 ) };
+	const mat4& T = tv.transform;
+	const int tilesX = (screen->width + TILESIZE - 1) / TILESIZE;
+	for (int i = first; i < last; i++)
+	{
+		// skip clusters that are hidden behind geometry that was drawn before
+		if (cull && (i % CLUSTERSIZE) == 0)
+		{
+			const int c = i / CLUSTERSIZE;
+			if (Occluded( clusterBounds[c * 2], clusterBounds[c * 2 + 1], T )) { i += CLUSTERSIZE - 1; continue; }
+		}
+		const int* idx = tri + i * 3;
+		const uint clip0 = tv.clip[idx[0]], clip1 = tv.clip[idx[1]], clip2 = tv.clip[idx[2]];
+		if (clip0 & clip1 & clip2) continue;
 		// cull triangle
-		float3 Nt = make_float3( make_float4( N[i], 0 ) * T );
-		if (dot( tpos[tri[i * 3 + 0]], Nt ) > 0) continue;
-		// clip
-		float3 cpos[2][8], *pos;
-		float2 cuv[2][8], *tuv;
-		int nin = 3, nout = 0, from = 0, to = 1, miny = screen->height - 1, maxy = 0, h;
-		for (int v = 0; v < 3; v++) cpos[0][v] = tpos[tri[i * 3 + v]], cuv[0][v] = uv[tri[i * 3 + v]];
-		for (int p = 0; p < 2; p++, from = 1 - from, to = 1 - to, nin = nout, nout = 0) for (int v = 0; v < nin; v++)
-		{
-			const float3 A = cpos[from][v], B = cpos[from][(v + 1) % nin];
-			const float2 Auv = cuv[from][v], Buv = cuv[from][(v + 1) % nin];
-			const float4 plane = Rasterizer::frustum[p];
-			const float t1 = dot( make_float3( plane ), A ) - plane.w, t2 = dot( make_float3( plane ), B ) - plane.w;
-			if ((t1 < 0) && (t2 >= 0))
-				f = t1 / (t1 - t2),
-				cuv[to][nout] = Auv + (Buv - Auv) * f, cpos[to][nout++] = A + f * (B - A),
-				cuv[to][nout] = Buv, cpos[to][nout++] = B;
-			else if ((t1 >= 0) && (t2 >= 0)) cuv[to][nout] = Buv, cpos[to][nout++] = B;
-			else if ((t1 >= 0) && (t2 < 0))
-				f = t1 / (t1 - t2),
-				cuv[to][nout] = Auv + (Buv - Auv) * f, cpos[to][nout++] = A + f * (B - A);
-		}
-		if (nin == 0) continue;
-		// project
-		pos = cpos[from], tuv = cuv[from];
-		for (int v = 0; v < nin; v++)
-			pos[v].x = ((pos[v].x * screen->width) / -pos[v].z) + screen->width / 2,
-			pos[v].y = ((pos[v].y * screen->width) / pos[v].z) + screen->height / 2;
-		// draw
-		uint shade = (uint)((N[i].z + 1) * 64.0f + 127.9f);
-		for (int j = 0; j < nin; j++)
-		{
-			int vert0 = j, vert1 = (j + 1) % nin;
-			if (pos[vert0].y > pos[vert1].y) h = vert0, vert0 = vert1, vert1 = h;
-			const float y0 = pos[vert0].y, y1 = pos[vert1].y, rydiff = 1.0f / (y1 - y0);
-			if ((y0 == y1) || (y0 >= screen->height) || (y1 < 1)) continue;
-			const int iy0 = max( 1, (int)y0 + 1 ), iy1 = min( screen->height - 2, (int)y1 );
-			float x0 = pos[vert0].x, dx = (pos[vert1].x - x0) * rydiff;
-			float z0 = 1.0f / pos[vert0].z, z1 = 1.0f / pos[vert1].z, dz = (z1 - z0) * rydiff;
-			float u0 = tuv[vert0].x * z0, du = (tuv[vert1].x * z1 - u0) * rydiff;
-			float v0 = tuv[vert0].y * z0, dv = (tuv[vert1].y * z1 - v0) * rydiff;
-			const float f = (float)iy0 - y0;
-			x0 += dx * f, u0 += du * f, v0 += dv * f, z0 += dz * f;
-			for (int y = iy0; y <= iy1; y++)
+		const float3 n = N[i];
+		const float3 Nt = make_float3( T.cell[0] * n.x + T.cell[1] * n.y + T.cell[2] * n.z, T.cell[4] * n.x + T.cell[5] * n.y + T.cell[6] * n.z, T.cell[8] * n.x + T.cell[9] * n.y + T.cell[10] * n.z );
+		if (tv.x[idx[0]] * Nt.x + tv.y[idx[0]] * Nt.y + tv.z[idx[0]] * Nt.z > 0) continue;
+		ScreenVertex sv[8];
+		int count = 3;
+		const uint planes = clip0 | clip1 | clip2;
+		if (!planes)
+		{
+			// completely inside the guard band: use the projected vertices
+			for (int v = 0; v < 3; v++)
 			{
-				if (x0 < xleft[y]) xleft[y] = x0, uleft[y] = u0, vleft[y] = v0, zleft[y] = z0;
-				if (x0 > xright[y]) xright[y] = x0, uright[y] = u0, vright[y] = v0, zright[y] = z0;
-				x0 += dx, u0 += du, v0 += dv, z0 += dz;
+				const int j = idx[v];
+				const float rz = tv.rz[j];
+				const float2 a = deferred ? bary[v] : uv[j];
+				sv[v].x = tv.sx[j], sv[v].y = tv.sy[j], sv[v].z = rz, sv[v].u = a.x * rz, sv[v].v = a.y * rz;
 			}
-			miny = min( miny, iy0 ), maxy = max( maxy, iy1 );
-		}
-		for (int y = miny; y <= maxy; xleft[y] = screen->width - 1, xright[y++] = 0)
-		{
-			float x0 = xleft[y], x1 = xright[y], rxdiff = 1.0f / (x1 - x0);
-			float u0 = uleft[y], du = (uright[y] - u0) * rxdiff;
-			float v0 = vleft[y], dv = (vright[y] - v0) * rxdiff;
-			float z0 = zleft[y], dz = (zright[y] - z0) * rxdiff;
-			const int ix0 = (int)x0 + 1, ix1 = min( screen->width - 2, (int)x1 );
-			const float f = (float)ix0 - x0;
-			u0 += f * du, v0 += f * dv, z0 += f * dz;
-			uint* dest = screen->pixels + y * screen->width;
-			float* zbuf = zbuffer + y * screen->width;
-			for (int x = ix0; x <= ix1; x++, u0 += du, v0 += dv, z0 += dz) // plot span
+		}
+		else
+		{
+			// clip against the planes that the triangle crosses
+			float3 cpos[2][8], * cp;
+			float2 cuv[2][8], * tuv;
+			int nin = 3, nout = 0, from = 0, to = 1;
+			float f;
+			for (int v = 0; v < 3; v++) cpos[0][v] = make_float3( tv.x[idx[v]], tv.y[idx[v]], tv.z[idx[v]] ), cuv[0][v] = deferred ? bary[v] : uv[idx[v]];
+			for (int p = 0; p < 5; p++) if (planes & (1 << p))
+			{
+				const float4 plane = p == 0 ? Rasterizer::frustum[0] : Rasterizer::guardBand[p - 1];
+				for (int v = 0; v < nin; v++)
+				{
+					const float3 A = cpos[from][v], B = cpos[from][(v + 1) % nin];
+					const float2 Auv = cuv[from][v], Buv = cuv[from][(v + 1) % nin];
+					const float t1 = dot( make_float3( plane ), A ) - plane.w, t2 = dot( make_float3( plane ), B ) - plane.w;
+					if ((t1 < 0) && (t2 >= 0))
+						f = t1 / (t1 - t2),
+						cuv[to][nout] = Auv + (Buv - Auv) * f, cpos[to][nout++] = A + f * (B - A),
+						cuv[to][nout] = Buv, cpos[to][nout++] = B;
+					else if ((t1 >= 0) && (t2 >= 0)) cuv[to][nout] = Buv, cpos[to][nout++] = B;
+					else if ((t1 >= 0) && (t2 < 0))
+						f = t1 / (t1 - t2),
+						cuv[to][nout] = Auv + (Buv - Auv) * f, cpos[to][nout++] = A + f * (B - A);
+				}
+				from = 1 - from, to = 1 - to, nin = nout, nout = 0;
+			}
+			if (nin < 3) continue;
+			// project
+			cp = cpos[from], tuv = cuv[from], count = nin;
+			for (int v = 0; v < nin; v++)
+			{
+				const float rz = 1.0f / cp[v].z;
+				sv[v].x = ((cp[v].x * screen->width) / -cp[v].z) + screen->width / 2;
+				sv[v].y = ((cp[v].y * screen->width) / cp[v].z) + screen->height / 2;
+				sv[v].z = rz, sv[v].u = tuv[v].x * rz, sv[v].v = tuv[v].y * rz;
+			}
+		}
+		// setup and bin
+		const uint shade = (uint)((n.z + 1) * 64.0f + 127.9f);
+		for (int v = 1; v < count - 1; v++)
+		{
+			RasterTri t;
+			if (!SetupTriangle( sv[0], sv[v], sv[v + 1], t, margin )) continue;
+			t.material = material[i], t.shade = shade, t.instance = instance, t.triangle = i;
+			for (int ty = t.y0 / TILESIZE; ty <= t.y1 / TILESIZE; ty++)
+				for (int tx = t.x0 / TILESIZE; tx <= t.x1 / TILESIZE; tx++)
+					if (!TileOutside( t, tx * TILESIZE, ty * TILESIZE )) bin.tile[tx + ty * tilesX].push_back( t );
+		}
+	}
+}
+
+// -----------------------------------------------------------
+// BlockSetup struct
+// local copy of the edge functions and depth plane of a
+// triangle, clipped to a tile, for the pixel loops; stores to
+// the buffers then do not force reloads.
+// -----------------------------------------------------------
+struct BlockSetup
+{
+	BlockSetup( const RasterTri& t, const int x0_, const int y0_, const int x1_, const int y1_ ) : x0( x0_ ), y0( y0_ ), x1( x1_ ), y1( y1_ )
+	{
+		for (int i = 0; i < 3; i++) A[i] = t.A[i], B[i] = t.B[i], X[i] = t.X[i], Y[i] = t.Y[i], zPlane[i] = t.zPlane[i];
+		for (int i = 0; i < 3; i++) onEdge[i] = t.topLeft & (1 << i) ? LANEMASK : 0;
+		pitch = Mesh::screen->width;
+	}
+	float A[3], B[3], X[3], Y[3], zPlane[3];
+	uint onEdge[3];					// per edge: lanes where a zero edge function value counts as inside
+	int x0, y0, x1, y1, pitch;		// clipped pixel bounds, inclusive
+};
+
+// -----------------------------------------------------------
+// CoverBlock
+// coverage and depth test for an 8x8 block of samples, each at
+// the same offset from its pixel center. the block is rejected
+// if it is completely outside one of the edges, and accepted
+// without per-sample edge tests if it is completely inside all
+// three. edge functions and z are evaluated for LANES samples
+// at a time, without branches.
+// input: triangle, block position, sample offset, depth plane
+// of the sample.
+// output: 64-bit mask of samples that pass the z-test, and
+// their depth in zs.
+// -----------------------------------------------------------
+static inline uint64_t CoverBlock( const BlockSetup& e, const int bx, const int by, const float dx, const float dy, const float* zplane, float* zs )
+{
+	// the x-dependent terms are the same for each row of the block
+	vfloat ex[3][8 / LANES], zx[8 / LANES];
+	for (int c = 0; c < 8 / LANES; c++)
+	{
+		const vfloat xs = VRamp( (float)(bx + c * LANES) + dx );
+		for (int i = 0; i < 3; i++) ex[i][c] = VMul( VSet( e.A[i] ), VSub( xs, VSet( e.X[i] ) ) );
+		zx[c] = VMul( VSet( e.zPlane[0] ), xs );
+	}
+	// classify the block using its first and last row. rounding is monotonic, so
+	// the extreme values of the edge functions occur at the corners of the block.
+	bool accept = true;
+	for (int i = 0; i < 3; i++)
+	{
+		const vfloat ey0 = VSet( e.B[i] * (((float)by + dy) - e.Y[i]) ), ey7 = VSet( e.B[i] * (((float)(by + 7) + dy) - e.Y[i]) );
+		uint outside = 0xff, inside = 0xff;
+		for (int c = 0; c < 8 / LANES; c++)
+		{
+			const vfloat e0 = VAdd( ex[i][c], ey0 ), e7 = VAdd( ex[i][c], ey7 );
+			outside &= (VNegative( e0 ) & VNegative( e7 )) << (c * LANES);
+			inside &= (VPositive( e0 ) & VPositive( e7 )) << (c * LANES);
+		}
+		if (outside == 0xff) return 0;
+		accept &= inside == 0xff;
+	}
+	// coverage and depth test; pixels outside the clipped bounds are masked out
+	const uint colMask = (0xffu << max( 0, e.x0 - bx )) & (0xffu >> max( 0, bx + 7 - e.x1 )) & 0xff;
+	uint64_t mask = 0;
+	for (int r = 0; r < 8; r++)
+	{
+		const int y = by + r;
+		const float fy = (float)y + dy;
+		const uint rowMask = (y >= e.y0 && y <= e.y1) ? colMask : 0;
+		const float* zbuf = zplane + min( y, e.y1 ) * e.pitch + bx;
+		const vfloat zy = VSet( e.zPlane[1] * fy + e.zPlane[2] );
+		const vfloat ey[3] = { VSet( e.B[0] * (fy - e.Y[0]) ), VSet( e.B[1] * (fy - e.Y[1]) ), VSet( e.B[2] * (fy - e.Y[2]) ) };
+		for (int c = 0; c < 8 / LANES; c++)
+		{
+			uint m = (rowMask >> (c * LANES)) & LANEMASK;
+			if (!accept) for (int i = 0; i < 3; i++)
+			{
+				const vfloat ev = VAdd( ex[i][c], ey[i] );
+				m &= (VNonNegative( ev ) & e.onEdge[i]) | VPositive( ev );
+			}
+			const vfloat z = VAdd( zx[c], zy );
+			m &= VLess( z, VLoad( zbuf + c * LANES ) );
+			VStore( zs + r * 8 + c * LANES, z );
+			mask |= (uint64_t)m << (r * 8 + c * LANES);
+		}
+	}
+	return mask;
+}
+
+// -----------------------------------------------------------
+// UpdateBlockZ
+// recalculates the farthest depth of a block after drawing;
+// blocks that extend beyond the screen keep the clear value.
+// -----------------------------------------------------------
+static inline void UpdateBlockZ( float& blockZMax, const int bx, const int by, const int samples )
+{
+	const Surface* screen = Mesh::screen;
+	const int pitch = screen->width, planeSize = screen->width * screen->height;
+	if (bx + 8 > pitch || by + 8 > screen->height) return;
+	vfloat zfar = VLoad( Rasterizer::zbuffer + by * pitch + bx );
+	for (int s = 0; s < samples; s++)
+	{
+		const float* zplane = Rasterizer::zbuffer + s * planeSize + by * pitch + bx;
+		for (int r = 0; r < 8; r++) for (int c = 0; c < 8 / LANES; c++) zfar = VMax( zfar, VLoad( zplane + r * pitch + c * LANES ) );
+	}
+	blockZMax = VHorizontalMax( zfar );
+}
+
+// -----------------------------------------------------------
+// RasterizeTriangle
+// draws the part of a triangle that overlaps a tile.
+// input: triangle, tile rectangle (inclusive).
+// the rectangle is processed in 8x8 pixel blocks, aligned to
+// the tile, which yields a 64-bit mask of pixels that pass
+// the z-test; only those pixels are textured, or, in deferred
+// mode, stored in the visibility buffer. blocks that are
+// behind the farthest depth stored for them are skipped.
+// -----------------------------------------------------------
+static void RasterizeTriangle( const RasterTri& t, const int tx0, const int ty0, const int tx1, const int ty1, const bool deferred )
+{
+	const int x0 = max( t.x0, tx0 ), y0 = max( t.y0, ty0 ), x1 = min( t.x1, tx1 ), y1 = min( t.y1, ty1 );
+	if (x0 > x1 || y0 > y1) return;
+	const BlockSetup e( t, x0, y0, x1, y1 );
+	const Surface* screen = Mesh::screen;
+	const int pitch = screen->width;
+	uint* pixels = screen->pixels;
+	float* zbuffer = Rasterizer::zbuffer, * hiz = Rasterizer::hiz;
+	const int blocksX = (pitch + 7) >> 3;
+	const Material* mat = Rasterizer::scene.matList[t.material];
+	uint diffuse = mat->diffuse;
+	const uint* src = mat->texture ? mat->texture->pixels : &diffuse;
+	const float tw = mat->texture ? (float)mat->texture->width : 1;
+	const float th = mat->texture ? (float)mat->texture->height : 1;
+	const uint uwrap = (uint)tw, vwrap = (uint)th;
+	const bool pow2 = !mat->texture || mat->texture->pow2;
+	uint2* visibility = Rasterizer::visibility;
+	float* bary0 = Rasterizer::barycentric[0], * bary1 = Rasterizer::barycentric[1];
+	const uint2 id = make_uint2( t.instance, t.triangle );
+	const float uPlane[3] = { t.uPlane[0], t.uPlane[1], t.uPlane[2] };
+	const float vPlane[3] = { t.vPlane[0], t.vPlane[1], t.vPlane[2] };
+	const uint shade = t.shade;
+	const float zmin = t.zmin;
+	ALIGN( 32 ) float zs[64];
+	for (int by = y0 & ~7; by <= y1; by += 8) for (int bx = x0 & ~7; bx <= x1; bx += 8)
+	{
+		// coarse depth test
+		float& blockZMax = hiz[(bx >> 3) + (by >> 3) * blocksX];
+		if (zmin >= blockZMax) continue;
+		uint64_t mask = CoverBlock( e, bx, by, 0, 0, zbuffer, zs );
+		if (!mask) continue;
+		// texture and shade the pixels that passed
+		if (deferred) for (; mask; mask &= mask - 1)
+		{
+			// store what is needed to shade the pixel later; the divide by z happens there
+			const int idx = LowestBit( mask ), x = bx + (idx & 7), y = by + (idx >> 3), p = x + y * pitch;
+			const float fx = (float)x, fy = (float)y;
+			visibility[p] = id, zbuffer[p] = zs[idx];
+			bary0[p] = uPlane[0] * fx + (uPlane[1] * fy + uPlane[2]);
+			bary1[p] = vPlane[0] * fx + (vPlane[1] * fy + vPlane[2]);
+		}
+		else for (; mask; mask &= mask - 1)
+		{
+			const int idx = LowestBit( mask ), x = bx + (idx & 7), y = by + (idx >> 3);
+			const float fx = (float)x, fy = (float)y, z = 1.0f / zs[idx];
+			uint u = (uint)((uPlane[0] * fx + (uPlane[1] * fy + uPlane[2])) * z * tw);
+			uint v = (uint)((vPlane[0] * fx + (vPlane[1] * fy + vPlane[2])) * z * th);
+			if (pow2) u &= uwrap - 1, v &= vwrap - 1; else u %= uwrap, v %= vwrap;
+			pixels[x + y * pitch] = ScaleColor( src[u + v * uwrap], shade ), zbuffer[x + y * pitch] = zs[idx];
+		}
+		UpdateBlockZ( blockZMax, bx, by, 1 );
+	}
+}
+
+// -----------------------------------------------------------
+// RasterizeTriangleMSAA
+// multi-sampled version of RasterizeTriangle: coverage and
+// depth are evaluated for each of the MSAASAMPLES samples of
+// a pixel, but the pixel is shaded once, at its center.
+// colors are stored compressed: a pixel that is completely
+// covered by one triangle keeps a single color; only pixels
+// on edges expand to one color per sample. the samples are
+// averaged in Rasterizer::Resolve.
+// -----------------------------------------------------------
+static void RasterizeTriangleMSAA( const RasterTri& t, const int tx0, const int ty0, const int tx1, const int ty1 )
+{
+	static_assert( MSAASAMPLES == 4, "the sample pattern is defined for four samples" );
+	static const float sampleOffset[MSAASAMPLES][2] = { { -0.125f, -0.375f }, { 0.375f, -0.125f }, { -0.375f, 0.125f }, { 0.125f, 0.375f } };
+	const int x0 = max( t.x0, tx0 ), y0 = max( t.y0, ty0 ), x1 = min( t.x1, tx1 ), y1 = min( t.y1, ty1 );
+	if (x0 > x1 || y0 > y1) return;
+	const BlockSetup e( t, x0, y0, x1, y1 );
+	const Surface* screen = Mesh::screen;
+	const int pitch = screen->width, planeSize = screen->width * screen->height;
+	uint* pixels = screen->pixels, * samples = Rasterizer::sampleColor;
+	uchar* expanded = Rasterizer::expanded;
+	float* zbuffer = Rasterizer::zbuffer, * hiz = Rasterizer::hiz;
+	const int blocksX = (pitch + 7) >> 3;
+	const Material* mat = Rasterizer::scene.matList[t.material];
+	uint diffuse = mat->diffuse;
+	const uint* src = mat->texture ? mat->texture->pixels : &diffuse;
+	const float tw = mat->texture ? (float)mat->texture->width : 1;
+	const float th = mat->texture ? (float)mat->texture->height : 1;
+	const uint uwrap = (uint)tw, vwrap = (uint)th;
+	const bool pow2 = !mat->texture || mat->texture->pow2;
+	const float uPlane[3] = { t.uPlane[0], t.uPlane[1], t.uPlane[2] };
+	const float vPlane[3] = { t.vPlane[0], t.vPlane[1], t.vPlane[2] };
+	const float zPlane[3] = { t.zPlane[0], t.zPlane[1], t.zPlane[2] };
+	const uint shade = t.shade;
+	const float zmin = t.zmin;
+	ALIGN( 32 ) float zs[MSAASAMPLES][64];
+	for (int by = y0 & ~7; by <= y1; by += 8) for (int bx = x0 & ~7; bx <= x1; bx += 8)
+	{
+		// coarse depth test
+		float& blockZMax = hiz[(bx >> 3) + (by >> 3) * blocksX];
+		if (zmin >= blockZMax) continue;
+		uint64_t mask[MSAASAMPLES], any = 0;
+		for (int s = 0; s < MSAASAMPLES; s++)
+			any |= mask[s] = CoverBlock( e, bx, by, sampleOffset[s][0], sampleOffset[s][1], zbuffer + s * planeSize, zs[s] );
+		if (!any) continue;
+		// shade each pixel with at least one visible sample once; pixels with all samples
+		// visible come first, as they are the common case and need no per-sample work
+		uint64_t full = mask[0];
+		for (int s = 1; s < MSAASAMPLES; s++) full &= mask[s];
+		for (int pass = 0; pass < 2; pass++)
+		{
+			for (uint64_t bits = pass ? any & ~full : full; bits; bits &= bits - 1)
 			{
-				if (z0 >= zbuf[x]) continue;
-				const float z = 1.0f / z0;
-				const uint u = (uint)(u0 * z * tw) % umask, v = (uint)(v0 * z * th) % vmask;
-				dest[x] = ScaleColor( src[u + v * umask], shade ), zbuf[x] = z0;
+				const int idx = LowestBit( bits ), x = bx + (idx & 7), y = by + (idx >> 3), p = x + y * pitch;
+				const float fx = (float)x, fy = (float)y, z = 1.0f / (zPlane[0] * fx + (zPlane[1] * fy + zPlane[2]));
+				uint u = (uint)((uPlane[0] * fx + (uPlane[1] * fy + uPlane[2])) * z * tw);
+				uint v = (uint)((vPlane[0] * fx + (vPlane[1] * fy + vPlane[2])) * z * th);
+				if (pow2) u &= uwrap - 1, v &= vwrap - 1; else u %= uwrap, v %= vwrap;
+				const uint color = ScaleColor( src[u + v * uwrap], shade );
+				if (!pass)
+				{
+					for (int s = 0; s < MSAASAMPLES; s++) zbuffer[s * planeSize + p] = zs[s][idx];
+					pixels[p] = color, expanded[p] = 0;
+					continue;
+				}
+				if (!expanded[p]) for (int s = 0; s < MSAASAMPLES; s++) samples[s * planeSize + p] = pixels[p];
+				for (int s = 0; s < MSAASAMPLES; s++) if ((mask[s] >> idx) & 1) samples[s * planeSize + p] = color, zbuffer[s * planeSize + p] = zs[s][idx];
+				expanded[p] = 1;
 			}
 		}
+		UpdateBlockZ( blockZMax, bx, by, MSAASAMPLES );
 	}
 }
 
@@ -174,42 +698,83 @@ void Mesh::Render( const mat4& T )
 Scene::~Scene()
 {
 	delete root;
+	for (auto mesh : meshList) delete mesh;
 	for (auto tex : texList) delete tex;
 	for (auto mat : matList) delete mat;
 }
 
 // -----------------------------------------------------------
-// SGNode::Render
-// recursive rendering of a scene graph node and its child nodes
-// input: (inverse) camera transform
+// SGNode::Gather
+// recursive traversal of a scene graph node and its child
+// nodes; collects meshes that overlap the view frustum.
+// input: (inverse) camera transform, draw list
 // -----------------------------------------------------------
-void SGNode::Render( const mat4& transform )
+void SGNode::Gather( const mat4& transform, vector<DrawCall>& draws )
 {
 	mat4 M = transform * localTransform;
-	if (GetType() == SG_MESH) ((Mesh*)this)->Render( M );
-	for (uint s = (uint)child.size(), i = 0; i < s; i++) child[i]->Render( M );
+	if (GetType() == SG_MESH) if (((Mesh*)this)->InFrustum( M )) draws.push_back( { (Mesh*)this, M } );
+	for (uint s = (uint)child.size(), i = 0; i < s; i++) child[i]->Gather( M, draws );
+}
+
+// -----------------------------------------------------------
+// Rasterizer::GatherInstances
+// tests each instance against the view frustum and appends
+// the visible ones to the draw list, grouped per mesh.
+// input: inverse camera transform
+// -----------------------------------------------------------
+void Rasterizer::GatherInstances( const mat4& view )
+{
+	// cull, and count the visible instances per mesh
+	const int meshCount = (int)scene.meshList.size();
+	groupStart.assign( meshCount + 1, 0 );
+	visibleInstances.clear();
+	for (int i = 0; i < (int)scene.instances.size(); i++)
+	{
+		const Instance& instance = scene.instances[i];
+		if (!scene.meshList[instance.mesh]->InFrustum( view * instance.transform )) continue;
+		visibleInstances.push_back( i );
+		groupStart[instance.mesh + 1]++;
+	}
+	// append the draws in mesh order
+	for (int m = 0; m < meshCount; m++) groupStart[m + 1] += groupStart[m];
+	const int base = (int)draws.size();
+	draws.resize( base + visibleInstances.size() );
+	for (const int i : visibleInstances)
+	{
+		const Instance& instance = scene.instances[i];
+		DrawCall& draw = draws[base + groupStart[instance.mesh]++];
+		draw.mesh = scene.meshList[instance.mesh], draw.transform = view * instance.transform;
+	}
 }
 
 // -----------------------------------------------------------
 // Rasterizer::Init
 // initialization of the rasterizer
-// input: surface to draw to
 // -----------------------------------------------------------
 void Rasterizer::Init()
 {
-	// setup outline tables & zbuffer
-	Mesh::xleft = new float[8192], Mesh::xright = new float[8192]; // that should do for pretty much any resolution
-	Mesh::uleft = new float[8192], Mesh::uright = new float[8192];
-	Mesh::vleft = new float[8192], Mesh::vright = new float[8192];
-	Mesh::zleft = new float[8192], Mesh::zright = new float[8192];
+	// make sure the worker threads exist before the first frame
+	JobManager::GetJobManager();
 }
 
 void Rasterizer::Reinit( int w, int h, Surface* screen )
 {
 	// initialization that depends on screen size
-	for (int y = 0; y < h; y++) Mesh::xleft[y] = w - 1, Mesh::xright[y] = 0;
-	delete zbuffer;
-	zbuffer = new float[w * h];
+	tilesX = (w + TILESIZE - 1) / TILESIZE;
+	tilesY = (h + TILESIZE - 1) / TILESIZE;
+	const int samples = msaa ? MSAASAMPLES : 1;
+	delete[] zbuffer;
+	zbuffer = new float[w * h * samples + 8]; // one plane per sample; padded: rows are read in blocks of eight pixels
+	FREE64( sampleColor ), delete[] expanded;
+	sampleColor = msaa ? (uint*)MALLOC64( w * h * MSAASAMPLES * sizeof( uint ) ) : 0;
+	expanded = msaa ? new uchar[w * h + 16] : 0;
+	delete[] hiz;
+	hiz = new float[((w + 7) / 8) * ((h + 7) / 8)];
+	delete[] tileZMax;
+	tileZMax = new float[tilesX * tilesY];
+	delete[] visibility;
+	visibility = new uint2[w * h];
+	for (int i = 0; i < 2; i++) FREE64( barycentric[i] ), barycentric[i] = (float*)MALLOC64( (w * h + 8) * sizeof( float ) );
 	// calculate view frustum planes
 	float C = -1.0f, x1 = 0.5f, x2 = w - 1.5f, y1 = 0.5f, y2 = h - 1.5f;
 	float3 p0 = { 0, 0, 0 };
@@ -222,10 +787,316 @@ void Rasterizer::Reinit( int w, int h, Surface* screen )
 	float3 b( normalize( cross( p2 - p0, p1 - p2 ) ) ); frustum[2] = make_float4( b, 0 ); // top plane
 	float3 c( normalize( cross( p3 - p0, p2 - p3 ) ) ); frustum[3] = make_float4( c, 0 ); // right plane
 	float3 d( normalize( cross( p4 - p0, p3 - p4 ) ) ); frustum[4] = make_float4( d, 0 ); // bottom plane
+	// guard band planes, matching the clip flags of TransformedVertices::Transform
+	const float gx = w * 0.5f + GUARDBAND, gy = h * 0.5f + GUARDBAND;
+	guardBand[0] = make_float4( normalize( make_float3( (float)-w, 0, -gx ) ), 0 );
+	guardBand[1] = make_float4( normalize( make_float3( (float)w, 0, -gx ) ), 0 );
+	guardBand[2] = make_float4( normalize( make_float3( 0, (float)-w, -gy ) ), 0 );
+	guardBand[3] = make_float4( normalize( make_float3( 0, (float)w, -gy ) ), 0 );
 	// store screen pointer
 	Mesh::screen = screen;
 }
 
+// -----------------------------------------------------------
+// Rasterizer::RasterizeTile
+// draws the triangles binned for a tile, in submission order,
+// and updates the farthest depth of the tile.
+// input: tile index, number of bins filled for this pass,
+// flag to clear the tile first.
+// -----------------------------------------------------------
+void Rasterizer::RasterizeTile( const int tileIdx, const int binCount, const bool clear )
+{
+	Surface* screen = Mesh::screen;
+	const int x0 = (tileIdx % tilesX) * TILESIZE, y0 = (tileIdx / tilesX) * TILESIZE;
+	const int x1 = min( screen->width, x0 + TILESIZE ), y1 = min( screen->height, y0 + TILESIZE );
+	const int blocksX = (screen->width + 7) >> 3;
+	const int bx0 = x0 >> 3, by0 = y0 >> 3, bx1 = (x1 + 7) >> 3, by1 = (y1 + 7) >> 3;
+	// clear
+	if (clear)
+	{
+		const int planeSize = screen->width * screen->height;
+		for (int y = y0; y < y1; y++)
+		{
+			memset( screen->pixels + y * screen->width + x0, 0, (x1 - x0) * sizeof( uint ) );
+			for (int s = 0; s < (msaa ? MSAASAMPLES : 1); s++) memset( zbuffer + s * planeSize + y * screen->width + x0, 0, (x1 - x0) * sizeof( float ) );
+			if (msaa) memset( expanded + y * screen->width + x0, 0, x1 - x0 );
+		}
+		for (int by = by0; by < by1; by++) memset( hiz + by * blocksX + bx0, 0, (bx1 - bx0) * sizeof( float ) );
+	}
+	// draw
+	for (int i = 0; i < binCount; i++)
+	{
+		if (msaa) for (const RasterTri& t : bins[i]->tile[tileIdx]) RasterizeTriangleMSAA( t, x0, y0, x1 - 1, y1 - 1 );
+		else for (const RasterTri& t : bins[i]->tile[tileIdx]) RasterizeTriangle( t, x0, y0, x1 - 1, y1 - 1, deferred );
+	}
+	// farthest depth of the tile, for occlusion culling of later draws
+	float zfar = -1e34f;
+	for (int by = by0; by < by1; by++) for (int bx = bx0; bx < bx1; bx++) zfar = max( zfar, hiz[bx + by * blocksX] );
+	tileZMax[tileIdx] = zfar;
+}
+
+// -----------------------------------------------------------
+// ShadeTri struct
+// per-triangle data for the deferred shading pass: texture
+// coordinates in the form u0 + b1 * du1 + b2 * du2, and the
+// constant part of the MIP level. the level itself depends on
+// the depth of the pixels.
+// -----------------------------------------------------------
+struct ShadeTri
+{
+	float u0, du1, du2, v0, dv1, dv2;
+	float lodBias;					// MIP level at unit distance
+	const Texture* texture;			// 0 for a flat color
+	uint color, shade;
+};
+
+// -----------------------------------------------------------
+// FastLog2
+// piecewise linear approximation of log2, exact at powers of
+// two; the error is below 0.09, which is fine for MIP level
+// selection.
+// -----------------------------------------------------------
+static inline float FastLog2( const float x )
+{
+	union { float f; uint u; } bits = { x };
+	const float exponent = (float)(int)((bits.u >> 23) & 255) - 128;
+	bits.u = (bits.u & 0x7fffff) | 0x3f800000; // mantissa, in [1..2)
+	return exponent + bits.f;
+}
+
+// -----------------------------------------------------------
+// SetupShadeTri
+// gathers the shading data for a visibility buffer entry. the
+// MIP level follows from the ratio of texel area to world
+// space area of the triangle, and the footprint of a pixel at
+// the triangle, including the angle under which it is seen.
+// -----------------------------------------------------------
+static void SetupShadeTri( const DrawCall& draw, const int triangle, ShadeTri& s )
+{
+	const Mesh* mesh = draw.mesh;
+	const TransformedVertices& tv = *draw.verts;
+	const int* idx = mesh->tri + triangle * 3;
+	const Material* mat = Rasterizer::scene.matList[mesh->material[triangle]];
+	const float2 t0 = mesh->uv[idx[0]], t1 = mesh->uv[idx[1]], t2 = mesh->uv[idx[2]];
+	s.u0 = t0.x, s.du1 = t1.x - t0.x, s.du2 = t2.x - t0.x;
+	s.v0 = t0.y, s.dv1 = t1.y - t0.y, s.dv2 = t2.y - t0.y;
+	s.texture = mat->texture, s.color = mat->diffuse;
+	s.shade = (uint)((mesh->N[triangle].z + 1) * 64.0f + 127.9f);
+	s.lodBias = 0;
+	if (!s.texture) return;
+	const float3 p0 = make_float3( tv.x[idx[0]], tv.y[idx[0]], tv.z[idx[0]] );
+	const float3 p1 = make_float3( tv.x[idx[1]], tv.y[idx[1]], tv.z[idx[1]] );
+	const float3 p2 = make_float3( tv.x[idx[2]], tv.y[idx[2]], tv.z[idx[2]] );
+	const float3 N = cross( p1 - p0, p2 - p0 ), centroid = (p0 + p1 + p2) * (1.0f / 3.0f);
+	const float worldArea = length( N ), distance = length( centroid );
+	const float texelArea = fabsf( s.du1 * s.dv2 - s.du2 * s.dv1 ) * s.texture->width * s.texture->height;
+	if (worldArea == 0 || distance == 0 || texelArea == 0) return;
+	const float cosine = max( 0.01f, fabsf( dot( N, centroid ) ) / (worldArea * distance) );
+	s.lodBias = 0.5f * FastLog2( texelArea / worldArea ) - FastLog2( Mesh::screen->width * cosine );
+}
+
+// -----------------------------------------------------------
+// Bilinear4
+// SSE2 helpers for the deferred shading pass, four pixels at
+// a time: interpolates the channels of four texels per pixel
+// with 7-bit weights, and scales the result by the shade.
+// 256-bit integer operations would require AVX2.
+// -----------------------------------------------------------
+static inline __m128i Lerp16( const __m128i a, const __m128i b, const __m128i w )
+{
+	return _mm_add_epi16( a, _mm_srai_epi16( _mm_mullo_epi16( _mm_sub_epi16( b, a ), w ), 7 ) );
+}
+static inline __m128i Bilinear2( const __m128i t00, const __m128i t01, const __m128i t10, const __m128i t11, const __m128i wu, const __m128i wv, const __m128i shade )
+{
+	const __m128i top = Lerp16( t00, t01, wu ), bottom = Lerp16( t10, t11, wu );
+	return _mm_srli_epi16( _mm_mullo_epi16( Lerp16( top, bottom, wv ), shade ), 8 );
+}
+static inline __m128i Bilinear4( const __m128i t00, const __m128i t01, const __m128i t10, const __m128i t11, const __m128i wu, const __m128i wv, const uint shade )
+{
+	const __m128i zero = _mm_setzero_si128(), s = _mm_set1_epi16( (short)shade );
+	// per-channel weights: one 16-bit weight per channel, for pixels 0 and 1, and 2 and 3
+	const __m128i wu16 = _mm_packs_epi32( wu, wu ), wv16 = _mm_packs_epi32( wv, wv );
+	const __m128i wuPair = _mm_unpacklo_epi16( wu16, wu16 ), wvPair = _mm_unpacklo_epi16( wv16, wv16 );
+	const __m128i lo = Bilinear2( _mm_unpacklo_epi8( t00, zero ), _mm_unpacklo_epi8( t01, zero ), _mm_unpacklo_epi8( t10, zero ), _mm_unpacklo_epi8( t11, zero ),
+		_mm_unpacklo_epi32( wuPair, wuPair ), _mm_unpacklo_epi32( wvPair, wvPair ), s );
+	const __m128i hi = Bilinear2( _mm_unpackhi_epi8( t00, zero ), _mm_unpackhi_epi8( t01, zero ), _mm_unpackhi_epi8( t10, zero ), _mm_unpackhi_epi8( t11, zero ),
+		_mm_unpackhi_epi32( wuPair, wuPair ), _mm_unpackhi_epi32( wvPair, wvPair ), s );
+	return _mm_and_si128( _mm_packus_epi16( lo, hi ), _mm_set1_epi32( 0xffffff ) );
+}
+static inline __m128i Floor4( const __m128 a )
+{
+	const __m128i t = _mm_cvttps_epi32( a );
+	return _mm_add_epi32( t, _mm_castps_si128( _mm_cmpgt_ps( _mm_cvtepi32_ps( t ), a ) ) );
+}
+
+// -----------------------------------------------------------
+// ShadeSpan
+// textures and shades up to eight consecutive pixels that
+// show the same triangle, four at a time, using barycentrics
+// and depth from the visibility buffer.
+// -----------------------------------------------------------
+static void ShadeSpan( const ShadeTri& s, const int p, const int count )
+{
+	uint* dst = Mesh::screen->pixels + p;
+	if (!s.texture)
+	{
+		const uint color = ScaleColor( s.color, s.shade );
+		for (int i = 0; i < count; i++) dst[i] = color;
+		return;
+	}
+	// MIP level, from the depth of the first pixel; the span is too short for it to vary
+	const Texture* tex = s.texture;
+	const float lod = s.lodBias + FastLog2( -1.0f / Rasterizer::zbuffer[p] );
+	const int level = min( tex->levels - 1, max( 0, (int)lod ) );
+	const int w = max( 1, tex->width >> level ), h = max( 1, tex->height >> level );
+	const uint* texels = tex->level[level];
+	const __m128 u0 = _mm_set1_ps( s.u0 * w - 0.5f ), du1 = _mm_set1_ps( s.du1 * w ), du2 = _mm_set1_ps( s.du2 * w );
+	const __m128 v0 = _mm_set1_ps( s.v0 * h - 0.5f ), dv1 = _mm_set1_ps( s.dv1 * h ), dv2 = _mm_set1_ps( s.dv2 * h );
+	const __m128 one = _mm_set1_ps( 1 ), weightScale = _mm_set1_ps( 128.0f );
+	const __m128i umask = _mm_set1_epi32( w - 1 ), vmask = _mm_set1_epi32( h - 1 ), ione = _mm_set1_epi32( 1 );
+	const __m128i rowShift = _mm_cvtsi32_si128( (int)FastLog2( (float)w ) ); // exact for powers of two
+	for (int first = 0; first < count; first += 4)
+	{
+		// perspective-correct barycentrics, texel coordinates and bilinear weights
+		const __m128 z = _mm_div_ps( one, _mm_loadu_ps( Rasterizer::zbuffer + p + first ) );
+		const __m128 b1 = _mm_mul_ps( _mm_loadu_ps( Rasterizer::barycentric[0] + p + first ), z );
+		const __m128 b2 = _mm_mul_ps( _mm_loadu_ps( Rasterizer::barycentric[1] + p + first ), z );
+		const __m128 fu = _mm_add_ps( u0, _mm_add_ps( _mm_mul_ps( b1, du1 ), _mm_mul_ps( b2, du2 ) ) );
+		const __m128 fv = _mm_add_ps( v0, _mm_add_ps( _mm_mul_ps( b1, dv1 ), _mm_mul_ps( b2, dv2 ) ) );
+		const __m128i iu = Floor4( fu ), iv = Floor4( fv );
+		const __m128i wu = _mm_cvttps_epi32( _mm_mul_ps( _mm_sub_ps( fu, _mm_cvtepi32_ps( iu ) ), weightScale ) );
+		const __m128i wv = _mm_cvttps_epi32( _mm_mul_ps( _mm_sub_ps( fv, _mm_cvtepi32_ps( iv ) ), weightScale ) );
+		// fetch the four texels per pixel; coordinates wrap
+		ALIGN( 16 ) int xa[4], xb[4], ya[4], yb[4];
+		ALIGN( 16 ) uint t00[4], t01[4], t10[4], t11[4], result[4];
+		const int lanes = min( 4, count - first );
+		if (tex->pow2)
+		{
+			// offsets of the rows and columns, using masks and shifts
+			_mm_store_si128( (__m128i*)xa, _mm_and_si128( iu, umask ) );
+			_mm_store_si128( (__m128i*)xb, _mm_and_si128( _mm_add_epi32( iu, ione ), umask ) );
+			_mm_store_si128( (__m128i*)ya, _mm_sll_epi32( _mm_and_si128( iv, vmask ), rowShift ) );
+			_mm_store_si128( (__m128i*)yb, _mm_sll_epi32( _mm_and_si128( _mm_add_epi32( iv, ione ), vmask ), rowShift ) );
+		}
+		else
+		{
+			_mm_store_si128( (__m128i*)xa, iu ), _mm_store_si128( (__m128i*)ya, iv );
+			for (int i = 0; i < lanes; i++)
+			{
+				xa[i] = ((xa[i] % w) + w) % w, xb[i] = (xa[i] + 1) % w;
+				const int y = ((ya[i] % h) + h) % h;
+				ya[i] = y * w, yb[i] = ((y + 1) % h) * w;
+			}
+		}
+		for (int i = 0; i < lanes; i++)
+		{
+			const uint* rowA = texels + ya[i], * rowB = texels + yb[i];
+			t00[i] = rowA[xa[i]], t01[i] = rowA[xb[i]], t10[i] = rowB[xa[i]], t11[i] = rowB[xb[i]];
+		}
+		_mm_store_si128( (__m128i*)result, Bilinear4( _mm_load_si128( (__m128i*)t00 ), _mm_load_si128( (__m128i*)t01 ),
+			_mm_load_si128( (__m128i*)t10 ), _mm_load_si128( (__m128i*)t11 ), wu, wv, s.shade ) );
+		for (int i = 0; i < lanes; i++) dst[first + i] = result[i];
+	}
+}
+
+// -----------------------------------------------------------
+// Rasterizer::ShadeTile
+// deferred shading: textures each visible pixel of a tile
+// once. consecutive pixels that show the same triangle are
+// shaded together; the data for the most recent triangle is
+// kept, as it is likely to be needed on the next row too.
+// -----------------------------------------------------------
+void Rasterizer::ShadeTile( const int tileIdx )
+{
+	const Surface* screen = Mesh::screen;
+	const int pitch = screen->width;
+	const int x0 = (tileIdx % tilesX) * TILESIZE, y0 = (tileIdx / tilesX) * TILESIZE;
+	const int x1 = min( screen->width, x0 + TILESIZE ), y1 = min( screen->height, y0 + TILESIZE );
+	ShadeTri s;
+	uint2 current = make_uint2( ~0u, ~0u );
+	for (int y = y0; y < y1; y++) for (int x = x0; x < x1;)
+	{
+		const int p = x + y * pitch;
+		if (zbuffer[p] == 0) { x++; continue; }
+		const uint2 id = visibility[p];
+		if (id.x != current.x || id.y != current.y) SetupShadeTri( draws[id.x], id.y, s ), current = id;
+		int count = 1;
+		while (count < 8 && x + count < x1 && zbuffer[p + count] != 0 && visibility[p + count].x == id.x && visibility[p + count].y == id.y) count++;
+		ShadeSpan( s, p, count );
+		x += count;
+	}
+}
+
+// -----------------------------------------------------------
+// Rasterizer::RenderPass
+// bins and rasterizes a range of the draw list.
+// input: draw range, flag to clear the screen first, flag to
+// test meshes and clusters against the tiles drawn so far.
+// -----------------------------------------------------------
+void Rasterizer::RenderPass( const int firstDraw, const int lastDraw, const bool clear, const bool cull )
+{
+	JobManager* jm = JobManager::GetJobManager();
+	PROFILE_SPAN( "RenderPass" );
+	// find the transformed vertices for each draw; draws are grouped per mesh, so a
+	// draw with the same mesh and matrix as the previous one shares its vertices.
+	binJobs.clear(), transformJobs.clear();
+	const DrawCall* prev = 0;
+	int packed = BINCHUNK, packedVerts = VERTEXCHUNK;
+	for (int i = firstDraw; i < lastDraw; i++)
+	{
+		DrawCall& draw = draws[i];
+		const Mesh* mesh = draw.mesh;
+		draw.verts = 0;
+		if (mesh->verts == 0 || mesh->tris == 0) continue; // nothing to transform or bin
+		if (cull && Occluded( mesh->bounds[0], mesh->bounds[1], draw.transform )) { culledDraws++; continue; }
+		if (prev && prev->mesh == mesh && prev->transform == draw.transform) draw.verts = prev->verts; else
+		{
+			if (vertexSetCount == (int)vertexSets.size()) vertexSets.push_back( new TransformedVertices() );
+			const int set = vertexSetCount++;
+			vertexSets[set]->Init( mesh, draw.transform ), draw.verts = vertexSets[set];
+			// small meshes share transform jobs, like the binning jobs below
+			if (packedVerts + mesh->verts <= VERTEXCHUNK) transformJobs.back().y = set + 1, packedVerts += mesh->verts;
+			else if (mesh->verts < VERTEXCHUNK) transformJobs.push_back( make_int3( set, set + 1, 0 ) ), packedVerts = mesh->verts;
+			else for (int first = 0; first < mesh->verts; first += VERTEXCHUNK) transformJobs.push_back( make_int3( set, set + 1, first ) ), packedVerts = VERTEXCHUNK;
+		}
+		prev = &draw;
+		// small meshes are appended to the previous job while it has room; larger
+		// meshes get jobs of their own, of BINCHUNK triangles each
+		if (packed + mesh->tris <= BINCHUNK) binJobs.back().y = i + 1, packed += mesh->tris;
+		else if (mesh->tris < BINCHUNK) binJobs.push_back( make_int3( i, i + 1, 0 ) ), packed = mesh->tris;
+		else for (int first = 0; first < mesh->tris; first += BINCHUNK) binJobs.push_back( make_int3( i, i + 1, first ) ), packed = BINCHUNK;
+	}
+	// phase 1: transform vertices, in fixed-size batches
+	jm->ParallelFor( 0, (int)transformJobs.size(), 1, [&]( int first, int last ) {
+		PROFILE_SPAN( "Transform" );
+		for (int i = first; i < last; i++)
+		{
+			const int3 job = transformJobs[i];
+			for (int s = job.x; s < job.y; s++) vertexSets[s]->Transform( job.z, min( vertexSets[s]->mesh->verts, job.z + VERTEXCHUNK ) );
+		}
+	} );
+	// phase 2: clip and bin triangles, in fixed-size batches
+	const uint flags = (cull ? Mesh::CULL : 0) | (deferred && !msaa ? Mesh::DEFERRED : 0) | (msaa ? Mesh::MULTISAMPLE : 0);
+	while (bins.size() < binJobs.size()) bins.push_back( new TriangleBin() );
+	const int tileCount = tilesX * tilesY, binCount = (int)binJobs.size();
+	jm->ParallelFor( 0, binCount, 1, [&]( int first, int last ) {
+		PROFILE_SPAN( "Bin" );
+		for (int i = first; i < last; i++)
+		{
+			const int3 job = binJobs[i];
+			bins[i]->Reset( tileCount );
+			for (int d = job.x; d < job.y; d++) if (draws[d].verts)
+				draws[d].mesh->Bin( *draws[d].verts, d, job.z, min( draws[d].mesh->tris, job.z + BINCHUNK ), *bins[i], flags );
+		}
+	} );
+	// phase 3: rasterize tiles
+	jm->ParallelFor( 0, tileCount, 1, [&]( int first, int last ) {
+		PROFILE_SPAN( "Rasterize" );
+		ScopedTimer timer( PhaseStats::RENDER );
+		for (int i = first; i < last; i++) RasterizeTile( i, binCount, clear );
+	} );
+}
+
 // -----------------------------------------------------------
 // Rasterizer::Render
 // render the scene
@@ -233,9 +1104,111 @@ void Rasterizer::Reinit( int w, int h, Surface* screen )
 // -----------------------------------------------------------
 void Rasterizer::Render( const mat4& transform )
 {
-	memset( Mesh::screen->pixels, 0, Mesh::screen->width * Mesh::screen->height * sizeof( uint ) );
-	memset( zbuffer, 0, Mesh::screen->width * Mesh::screen->height * sizeof( float ) );
-	scene.root->Render( transform.Inverted() );
+	PROFILE_SPAN( "Rasterizer::Render" );
+	// collect visible meshes
+	const mat4 view = transform.Inverted();
+	draws.clear();
+	{
+		PROFILE_SPAN( "Gather" );
+		scene.root->Gather( view, draws );
+		GatherInstances( view );
+	}
+	if (sortDraws)
+	{
+		// front to back, per group of draws of the same mesh: each group is sorted,
+		// then the groups are ordered by their nearest draw
+		groupStart.clear();
+		for (int i = 0; i < (int)draws.size(); i++)
+		{
+			DrawCall& d = draws[i];
+			d.depth = (d.transform * make_float4( 0.5f * (d.mesh->bounds[0] + d.mesh->bounds[1]), 1 )).z;
+			if (i == 0 || d.mesh != draws[i - 1].mesh) groupStart.push_back( i );
+		}
+		const int groups = (int)groupStart.size();
+		groupStart.push_back( (int)draws.size() );
+		for (int g = 0; g < groups; g++) std::sort( draws.begin() + groupStart[g], draws.begin() + groupStart[g + 1],
+			[]( const DrawCall& a, const DrawCall& b ) { return a.depth > b.depth; } );
+		std::sort( groupStart.begin(), groupStart.end() - 1, [&]( const int a, const int b ) { return draws[a].depth > draws[b].depth; } );
+		sortedDraws.clear();
+		for (int g = 0; g < groups; g++)
+		{
+			const int first = groupStart[g];
+			int last = first + 1;
+			while (last < (int)draws.size() && draws[last].mesh == draws[first].mesh) last++;
+			sortedDraws.insert( sortedDraws.end(), draws.begin() + first, draws.begin() + last );
+		}
+		draws.swap( sortedDraws );
+	}
+	// draw the first share of the triangles; with occlusion culling enabled, the
+	// remaining draws are tested against the depth these leave in the tiles.
+	int split = (int)draws.size();
+	if (occlusionCulling)
+	{
+		int total = 0, drawn = 0;
+		for (const DrawCall& d : draws) total += d.mesh->tris;
+		for (split = 0; split < (int)draws.size() && drawn < total * OCCLUDERSHARE; split++) drawn += draws[split].mesh->tris;
+	}
+	culledDraws = 0, vertexSetCount = 0;
+	RenderPass( 0, split, true, false );
+	if (split < (int)draws.size()) RenderPass( split, (int)draws.size(), false, true );
+	// deferred shading of the visible pixels
+	if (deferred && !msaa) JobManager::GetJobManager()->ParallelFor( 0, tilesX * tilesY, 1, [&]( int first, int last ) {
+		PROFILE_SPAN( "Shade" );
+		ScopedTimer timer( PhaseStats::SHADE );
+		for (int i = first; i < last; i++) ShadeTile( i );
+	} );
+	// free the sets that this frame did not use, so memory follows the visible draws
+	for (int i = vertexSetCount; i < (int)vertexSets.size(); i++) delete vertexSets[i];
+	vertexSets.resize( vertexSetCount );
+}
+
+// -----------------------------------------------------------
+// Rasterizer::Resolve
+// replaces the color of each pixel that has per-sample colors
+// by the average of its samples, four pixels at a time.
+// pixels with a single color are left alone.
+// -----------------------------------------------------------
+void Rasterizer::Resolve()
+{
+	if (!msaa) return;
+	Surface* screen = Mesh::screen;
+	const int planeSize = screen->width * screen->height;
+	JobManager::GetJobManager()->ParallelFor( 0, screen->height, 16, [&]( int first, int last ) {
+		PROFILE_SPAN( "Resolve" );
+		// the 16-bit sums are divided by the sample count with a shift
+		static_assert( (MSAASAMPLES & (MSAASAMPLES - 1)) == 0 && MSAASAMPLES <= 256, "MSAASAMPLES must be a power of two" );
+		constexpr int shift = []() { int bits = 0; while ((1 << bits) < MSAASAMPLES) bits++; return bits; }();
+		const __m128i zero = _mm_setzero_si128();
+		const int end = last * screen->width;
+		int p = first * screen->width;
+		for (; p + 4 <= end; p += 4)
+		{
+			const int flags = *(const int*)(expanded + p);
+			if (!flags) continue;
+			__m128i lo = zero, hi = zero;
+			for (int s = 0; s < MSAASAMPLES; s++)
+			{
+				const __m128i c = _mm_loadu_si128( (const __m128i*)(sampleColor + s * planeSize + p) );
+				lo = _mm_add_epi16( lo, _mm_unpacklo_epi8( c, zero ) ), hi = _mm_add_epi16( hi, _mm_unpackhi_epi8( c, zero ) );
+			}
+			const __m128i average = _mm_packus_epi16( _mm_srli_epi16( lo, shift ), _mm_srli_epi16( hi, shift ) );
+			// expand the flag bytes to lane masks, and keep the single color where the flag is zero
+			const __m128i bytes = _mm_cvtsi32_si128( flags );
+			const __m128i mask = _mm_cmpgt_epi32( _mm_unpacklo_epi16( _mm_unpacklo_epi8( bytes, zero ), zero ), zero );
+			__m128i* dst = (__m128i*)(screen->pixels + p);
+			_mm_storeu_si128( dst, _mm_or_si128( _mm_and_si128( mask, average ), _mm_andnot_si128( mask, _mm_loadu_si128( dst ) ) ) );
+		}
+		for (; p < end; p++) if (expanded[p])
+		{
+			uint r = 0, g = 0, b = 0;
+			for (int s = 0; s < MSAASAMPLES; s++)
+			{
+				const uint c = sampleColor[s * planeSize + p];
+				r += (c >> 16) & 255, g += (c >> 8) & 255, b += c & 255;
+			}
+			screen->pixels[p] = ((r / MSAASAMPLES) << 16) + ((g / MSAASAMPLES) << 8) + b / MSAASAMPLES;
+		}
+	} );
 }
 
 // EOF
\ No newline at end of file
@@ -36,19 +36,24 @@ public:
 
 // -----------------------------------------------------------
 // Texture class
-// encapsulates a palettized pixel surface with pre-scaled
-// palettes for fast shading
+// encapsulates a pixel surface and its MIP levels, which are
+// stored consecutively in the same buffer
 // -----------------------------------------------------------
 class Texture
 {
 public:
 	// constructor / destructor
 	Texture() = default;
-	Texture( int w, int h ) : width( w ), height( h ) { pixels = (uint*)MALLOC64( w * h * sizeof( uint ) ); }
+	Texture( int w, int h ) : width( w ), height( h ) { pixels = (uint*)MALLOC64( w * h * sizeof( uint ) ); InitLevels( 1 ); }
 	~Texture() { FREE64( pixels ); }
+	// methods
+	void InitLevels( const int count );
 	// data members
 	int width = 0, height = 0;
 	uint* pixels = 0;
+	uint* level[MIPLEVELCOUNT] = {};	// first pixel of each MIP level; level 0 is pixels
+	int levels = 0;					// number of MIP levels in pixels
+	bool pow2 = false;				// width and height are powers of two; coordinates wrap using masks
 };
 
 // -----------------------------------------------------------
@@ -65,6 +70,92 @@ public:
 	Texture* texture = 0;			// texture
 };
 
+// -----------------------------------------------------------
+// RasterTri struct
+// a projected triangle in half-space form: three edge
+// functions that are positive inside the triangle, and screen
+// space planes for the interpolated values. z, u and v are
+// divided by view depth for perspective-correct interpolation.
+// -----------------------------------------------------------
+struct ScreenVertex { float x, y, z, u, v; };
+struct RasterTri
+{
+	float A[3], B[3];				// edge functions: A * (x - X) + B * (y - Y)
+	float X[3], Y[3];				// edge origin: the lower of its two vertices
+	float zPlane[3];				// 1 / z: zPlane[0] * x + zPlane[1] * y + zPlane[2]
+	float uPlane[3], vPlane[3];		// u / z, v / z
+	float zmin;						// nearest 1 / z of the three vertices
+	int x0, y0, x1, y1;				// covered pixel bounds, inclusive
+	int material;					// material index
+	uint shade;						// flat shading scale
+	uint topLeft;					// one bit per edge: pixels exactly on the edge are inside
+	uint instance, triangle;		// draw and triangle index, for the visibility buffer
+};
+
+// -----------------------------------------------------------
+// TriangleBin class
+// output of a single binning job: for each screen tile, the
+// projected triangles that overlap it, in order. triangles
+// are stored by value, so a tile reads its list sequentially.
+// -----------------------------------------------------------
+class TriangleBin
+{
+public:
+	void Reset( const int tileCount )
+	{
+		if ((int)tile.size() != tileCount) tile.resize( tileCount );
+		for (auto& t : tile) t.clear();
+	}
+	vector<vector<RasterTri>> tile;
+};
+
+// -----------------------------------------------------------
+// TransformedVertices class
+// the vertices of a mesh after transformation by a final
+// matrix, in SoA layout: camera space positions, projected
+// positions and clip flags. consecutive draws of the same mesh
+// with the same matrix share a single set.
+// -----------------------------------------------------------
+class Mesh;
+class TransformedVertices
+{
+public:
+	enum { CLIP_NEAR = 1, CLIP_GUARDBAND = 30 };	// clip flags: bit 0 is the near plane, bits 1..4 the guard band
+	~TransformedVertices() { FREE64( x ); }
+	void Init( const Mesh* mesh, const mat4& transform );
+	void Transform( const int first, const int last );
+	// data members
+	const Mesh* mesh = 0;
+	mat4 transform;
+	float* x = 0, * y = 0, * z = 0;	// camera space position
+	float* sx = 0, * sy = 0, * rz = 0;	// screen position and 1 / z
+	uchar* clip = 0;				// vertex is outside the near plane or the guard band
+	int capacity = 0;				// allocated vertices per stream
+};
+
+// -----------------------------------------------------------
+// Instance struct
+// a placement of a mesh in the scene; many instances may
+// refer to the same mesh
+// -----------------------------------------------------------
+struct Instance
+{
+	int mesh;						// index in Scene::meshList
+	mat4 transform;					// object to world
+};
+
+// -----------------------------------------------------------
+// DrawCall struct
+// a mesh that survived frustum culling, with its final matrix
+// -----------------------------------------------------------
+struct DrawCall
+{
+	Mesh* mesh = 0;
+	mat4 transform;
+	float depth = 0;				// camera space z of the bounds center, for sorting
+	TransformedVertices* verts = 0;	// transformed vertices, assigned when the draw is binned; 0 if it was culled
+};
+
 // -----------------------------------------------------------
 // SGNode class
 // scene graph node, with convenience functions for translate
@@ -75,18 +166,11 @@ class SGNode
 public:
 	enum { SG_TRANSFORM = 0, SG_MESH };
 	// constructor / destructor
-	~SGNode()
-	{
-		for (int s = (int)child.size(), i = 0; i < s; i++)
-		{
-			for (int j = i + 1; j < s; j++) if (child[j] == child[i]) child[j] = 0;
-			delete child[i];
-		}
-	}
+	virtual ~SGNode() { for (auto node : child) delete node; }
 	// methods
 	void SetPosition( float3& pos ) { mat4& M = localTransform; M[3] = pos.x, M[7] = pos.y, M[11] = pos.z; }
 	float3 GetPosition() { mat4& M = localTransform; return make_float3( M[3], M[7], M[11] ); }
-	void Render( const mat4& transform );
+	void Gather( const mat4& transform, vector<DrawCall>& draws );
 	virtual int GetType() { return SG_TRANSFORM; }
 	// data members
 	mat4 localTransform;
@@ -101,15 +185,18 @@ class Mesh : public SGNode
 {
 public:
 	// constructor / destructor
-	Mesh() : verts( 0 ), tris( 0 ), pos( 0 ), uv( 0 ), spos( 0 ) {}
+	Mesh() : pos( 0 ), uv( 0 ), spos( 0 ), verts( 0 ), tris( 0 ) {}
 	Mesh( int vcount, int tcount );
-	~Mesh() { delete pos; delete N; delete spos; delete tri; }
+	~Mesh() { delete pos; delete N; delete spos; delete tri; FREE64( px ); }
 	// methods
-	void Render( const mat4& transform );
+	void Finalize();
+	enum { CULL = 1, DEFERRED = 2, MULTISAMPLE = 4 };	// flags for Bin
+	bool InFrustum( const mat4& transform );
+	void Bin( const TransformedVertices& tv, const int instance, const int first, const int last, TriangleBin& bin, const uint flags );
 	virtual int GetType() { return SG_MESH; }
 	// data members
 	float3* pos = 0;				// object-space vertex positions
-	float3* tpos = 0;				// world-space positions
+	float* px = 0, * py = 0, * pz = 0;	// object-space vertex positions in SoA layout, padded to eight
 	float2* uv = 0;					// vertex uv coordinates
 	float2* spos = 0;				// screen positions
 	float3* norm = 0;				// vertex normals
@@ -118,16 +205,14 @@ public:
 	int verts = 0, tris = 0;		// vertex & triangle count
 	int* material = 0;				// per-face material ID
 	float3 bounds[2];				// mesh bounds
+	vector<float3> clusterBounds;	// min and max per CLUSTERSIZE triangles, for occlusion culling
 	static Surface* screen;
-	static float* xleft, *xright;	// outline tables for rasterization
-	static float* uleft, *uright;
-	static float* vleft, *vright;
-	static float* zleft, *zright;
 };
 
 // -----------------------------------------------------------
 // Scene class
-// owner of the scene graph;
+// owner of the scene graph and the meshes; instances refer
+// to the meshes by index;
 // owner of the material and texture list
 // -----------------------------------------------------------
 class Scene
@@ -139,6 +224,8 @@ public:
 	// data members
 public:
 	SGNode* root = 0;
+	vector<Mesh*> meshList;
+	vector<Instance> instances;
 	vector<Material*> matList;
 	vector<Texture*> texList;
 };
@@ -146,21 +233,71 @@ public:
 // -----------------------------------------------------------
 // Rasterizer class
 // rasterizer
-// implements a basic, but fast & accurate software rasterizer
+// implements a basic, but fast & accurate software rasterizer.
+// rendering happens in two phases: triangles are transformed,
+// clipped and binned into screen tiles by parallel jobs; tiles
+// are then rasterized in parallel, each by a single thread,
+// using edge functions on blocks of 8x8 pixels. vertices are
+// transformed eight at a time, once per mesh and matrix; only
+// triangles that cross the near plane or the guard band around
+// the screen are clipped.
+// a coarse z-buffer holds the farthest depth per block; blocks
+// of triangles that are behind it are skipped. with occlusion
+// culling enabled, the nearest draws are rendered first; the
+// remaining meshes and triangle clusters are then tested
+// against the farthest depth per tile before they are binned.
+// the visible instances of a mesh are drawn as a group; small
+// meshes are binned many instances per job.
+// in deferred mode, the tiles store draw and triangle indices
+// and barycentrics instead of colors; visible pixels are then
+// textured once, with MIP mapping and bilinear filtering.
+// with MSAA enabled, coverage and depth are evaluated for
+// MSAASAMPLES samples per pixel, while each pixel is shaded
+// once per triangle; Resolve averages the samples.
 // -----------------------------------------------------------
 class Rasterizer
 {
 public:
 	// constructor / destructor
 	Rasterizer() = default;
+	~Rasterizer() { for (auto bin : bins) delete bin; for (auto set : vertexSets) delete set; }
 	// methods
 	void Init();
 	void Reinit( int w, int h, Surface* screen );
 	void Render( const mat4& transform );
+	void Resolve();
+private:
+	void GatherInstances( const mat4& view );
+	void RenderPass( const int firstDraw, const int lastDraw, const bool clear, const bool cull );
+	void RasterizeTile( const int tileIdx, const int binCount, const bool clear );
+	void ShadeTile( const int tileIdx );
 	// data members
+public:
 	static Scene scene;
 	static float* zbuffer;
+	static float* hiz;				// farthest z per 8x8 pixel block
+	static float* tileZMax;			// farthest z per tile, updated when a tile finishes
+	static uint2* visibility;		// deferred mode: draw and triangle index per pixel; valid where z is not 0
+	static float* barycentric[2];	// deferred mode: barycentrics of the second and third vertex, divided by z
+	static uint* sampleColor;		// MSAA: one plane per sample; valid for expanded pixels only
+	static uchar* expanded;			// MSAA: pixel has per-sample colors, instead of a single color in the screen
 	static float4 frustum[5];
+	static float4 guardBand[4];		// camera space planes at GUARDBAND pixels beyond the screen edges
+	bool occlusionCulling = true;	// draw the nearest geometry first and cull the rest against it
+	bool sortDraws = true;			// sort draws front to back
+	bool deferred = true;			// shade visible pixels in a separate pass
+	bool msaa = false;				// multi-sampled anti-aliasing; uses forward shading. call Reinit after changing
+	int culledDraws = 0;			// meshes skipped by occlusion culling in the last frame
+	int tilesX = 0, tilesY = 0;		// screen size in tiles
+	vector<DrawCall> draws;			// visible meshes for the current frame, grouped per mesh
+	vector<DrawCall> sortedDraws;	// reordering buffer for draws
+	vector<int> groupStart;			// first draw per group
+	vector<int> visibleInstances;	// instances that passed frustum culling
+	vector<TransformedVertices*> vertexSets;	// transformed vertices; unused sets are freed after each frame
+	int vertexSetCount = 0;			// sets in use for the current frame
+	vector<int3> transformJobs;		// set range and first vertex per transform job
+	vector<int3> binJobs;			// draw range and first triangle per binning job
+	vector<TriangleBin*> bins;		// binning output, one per job; reused between frames
 };
 
 } // namespace lh2core
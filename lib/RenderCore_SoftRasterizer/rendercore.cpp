@@ -49,10 +49,30 @@ void RenderCore::Init()
 void RenderCore::SetTarget( GLTexture* target, const uint spp )
 {
 	// synchronize OpenGL viewport
-	scrwidth = target->width;
-	scrheight = target->height;
+	glTarget = target, hostTarget = 0;
+	Resize( target->width, target->height );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::SetTarget                                                      |
+//  |  Set the host memory buffer that serves as the render target.         LH2'20|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::SetTarget( HostTarget* target, const uint spp )
+{
+	// headless rendering: the image is copied to the target, without OpenGL
+	glTarget = 0, hostTarget = target;
+	Resize( target->width, target->height );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::Resize                                                         |
+//  |  Adapt the screen buffers to the size of the render target.           LH2'20|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::Resize( const int width, const int height )
+{
+	scrwidth = width;
+	scrheight = height;
 	// see if we need to reallocate our buffers
-	bool reallocate = false;
 	if (scrwidth * scrheight > maxPixels)
 	{
 		maxPixels = scrwidth * scrheight;
@@ -63,7 +83,6 @@ void RenderCore::SetTarget( GLTexture* target, const uint spp )
 	}
 	renderTarget->width = scrwidth;
 	renderTarget->height = scrheight;
-	targetTextureID = target->ID;
 	// inform rasterizer
 	rasterizer.Reinit( scrwidth, scrheight, renderTarget );
 }
@@ -75,12 +94,13 @@ void RenderCore::SetTarget( GLTexture* target, const uint spp )
 void RenderCore::SetGeometry( const int meshIdx, const float4* vertexData, const int vertexCount, const int triangleCount, const CoreTri* triangles )
 {
 	// Note: for first-time setup, meshes are expected to be passed in sequential order.
-	// This will result in new Mesh pointers being pushed into the meshes vector.
+	// This will result in new Mesh pointers being pushed into the scene's mesh list.
 	// Subsequent mesh changes will be applied to existing Meshes. This is deliberately
 	// minimalistic; RenderSystem is responsible for a proper (fault-tolerant) interface.
 	assert( vertexCount == 3 * triangleCount );
+	vector<Mesh*>& meshes = rasterizer.scene.meshList;
 	Mesh* mesh;
-	if (meshIdx >= meshes.size()) meshes.push_back( mesh = new Mesh( vertexCount, triangleCount ) );
+	if (meshIdx >= (int)meshes.size()) meshes.push_back( mesh = new Mesh( vertexCount, triangleCount ) );
 	else mesh = meshes[meshIdx]; // overwrite geometry data; assume vertex/face count does not change
 	float3 bmin = make_float3( 1e34f ), bmax = -bmin;
 	for (int i = 0; i < vertexCount; i++)
@@ -89,6 +109,7 @@ void RenderCore::SetGeometry( const int meshIdx, const float4* vertexData, const
 		bmax.x = max( bmax.x, vertexData[i].x ), bmax.y = max( bmax.y, vertexData[i].y ), bmax.z = max( bmax.z, vertexData[i].z );
 	mesh->bounds[0] = bmin, mesh->bounds[1] = bmax;
 	for (int i = 0; i < triangleCount * 3; i++) mesh->tri[i] = i;
+	mesh->Finalize();
 	for (int i = 0; i < triangleCount; i++)
 		mesh->norm[i * 3 + 0] = triangles[i].vN0, mesh->norm[i * 3 + 1] = triangles[i].vN1, mesh->norm[i * 3 + 2] = triangles[i].vN2,
 		mesh->uv[i * 3 + 0] = make_float2( triangles[i].u0, triangles[i].v0 ),
@@ -106,24 +127,22 @@ void RenderCore::SetInstance( const int instanceIdx, const int meshIdx, const ma
 {
 	// A '-1' mesh denotes the end of the instance stream;
 	// adjust the instances vector if we have more.
+	vector<Instance>& instances = rasterizer.scene.instances;
 	if (meshIdx == -1)
 	{
-		if (rasterizer.scene.root->child.size() > instanceIdx)
-			rasterizer.scene.root->child.resize( instanceIdx );
+		if ((int)instances.size() > instanceIdx) instances.resize( instanceIdx );
 		return;
 	}
 	// For the first frame, instances are added to the instances vector.
 	// For subsequent frames existing slots are overwritten / updated.
-	if (instanceIdx >= rasterizer.scene.root->child.size())
+	if (instanceIdx >= (int)instances.size())
 	{
-		// Note: for first-time setup, meshes are expected to be passed in sequential order.
-		// This will result in new CoreInstance pointers being pushed into the instances vector.
-		// Subsequent instance changes (typically: transforms) will be applied to existing CoreInstances.
-		assert( instanceIdx == rasterizer.scene.root->child.size() );
-		rasterizer.scene.root->child.push_back( meshes[meshIdx] );
+		// Note: for first-time setup, instances are expected to be passed in sequential order.
+		// Subsequent instance changes (typically: transforms) will be applied to existing records.
+		assert( instanceIdx == (int)instances.size() );
+		instances.push_back( { meshIdx, matrix } );
 	}
-	else rasterizer.scene.root->child[instanceIdx] = meshes[meshIdx];
-	rasterizer.scene.root->child[instanceIdx]->localTransform = matrix;
+	else instances[instanceIdx] = { meshIdx, matrix };
 }
 
 //  +-----------------------------------------------------------------------------+
@@ -136,12 +155,14 @@ void RenderCore::SetTextures( const CoreTexDesc* tex, const int textures )
 	for (int i = 0; i < textures; i++)
 	{
 		Texture* t;
-		if (i < rasterizer.scene.texList.size()) t = rasterizer.scene.texList[i];
+		if (i < (int)rasterizer.scene.texList.size()) t = rasterizer.scene.texList[i];
 		else rasterizer.scene.texList.push_back( t = new Texture() );
+		FREE64( t->pixels );
 		t->pixels = (uint*)MALLOC64( tex[i].pixelCount * sizeof( uint ) );
 		if (tex[i].idata) memcpy( t->pixels, tex[i].idata, tex[i].pixelCount * sizeof( uint ) );
-		else memcpy( t->pixels, 0, tex[i].pixelCount * sizeof( uint ) /* assume integer textures */ );
+		else memset( t->pixels, 0, tex[i].pixelCount * sizeof( uint ) /* assume integer textures */ );
 		t->width = tex[i].width, t->height = tex[i].height;
+		t->InitLevels( tex[i].MIPlevels );
 	}
 }
 
@@ -155,7 +176,7 @@ void RenderCore::SetMaterials( CoreMaterial* mat, const int materialCount )
 	for (int i = 0; i < materialCount; i++)
 	{
 		Material* m;
-		if (i < rasterizer.scene.matList.size()) m = rasterizer.scene.matList[i];
+		if (i < (int)rasterizer.scene.matList.size()) m = rasterizer.scene.matList[i];
 		else rasterizer.scene.matList.push_back( m = new Material() );
 		m->texture = 0;
 		int texID = mat[i].color.textureID;
@@ -200,7 +221,16 @@ void RenderCore::SetSkyData( const float3* pixels, const uint width, const uint
 //  +-----------------------------------------------------------------------------+
 void RenderCore::Setting( const char* name, const float value )
 {
-	// we have no settings yet
+	if (!strcmp( name, "occlusion" )) rasterizer.occlusionCulling = value != 0;
+	else if (!strcmp( name, "sortInstances" )) rasterizer.sortDraws = value != 0;
+	else if (!strcmp( name, "deferred" )) rasterizer.deferred = value != 0;
+	else if (!strcmp( name, "msaa" ))
+	{
+		// sample buffers depend on the mode
+		rasterizer.msaa = value != 0;
+		if (renderTarget) rasterizer.Reinit( scrwidth, scrheight, renderTarget );
+	}
+	else if (!strcmp( name, "threads" )) JobManager::SetNumThreads( (uint)value );
 }
 
 //  +-----------------------------------------------------------------------------+
@@ -209,7 +239,10 @@ void RenderCore::Setting( const char* name, const float value )
 //  +-----------------------------------------------------------------------------+
 void RenderCore::Render( const ViewPyramid& view, const Convergence converge, bool async )
 {
-	// render
+	// render; for OpenGL targets, straight into the mapped pixel buffer of the texture
+	uint* ownPixels = renderTarget->pixels;
+	if (glTarget) if (uint* mapped = glTarget->MapPixels()) renderTarget->pixels = mapped;
+	Timer timer;
 	mat4 transform;
 	const float3 X = normalize( view.p2 - view.p1 ), Y = normalize( view.p1 - view.p3 );
 	const float3 Z = normalize( view.pos - 0.5f * (view.p2 + view.p3) );
@@ -217,9 +250,22 @@ void RenderCore::Render( const ViewPyramid& view, const Convergence converge, bo
 	transform[1] = Y.x, transform[5] = Y.y, transform[9] = Y.z;
 	transform[2] = Z.x, transform[6] = Z.y, transform[10] = Z.z;
 	rasterizer.Render( mat4::Translate( view.pos ) * transform );
-	// copy cpu surface to OpenGL render target texture
-	glBindTexture( GL_TEXTURE_2D, targetTextureID );
-	glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA, scrwidth, scrheight, 0, GL_RGBA, GL_UNSIGNED_BYTE, renderTarget->pixels );
+	rasterizer.Resolve();
+	// gather the per-thread counters; shading time is reported for deferred mode
+	coreStats.SetPhaseStats( PhaseStats::Merge() );
+	coreStats.renderTime = timer.elapsed();
+	// copy cpu surface to the host target or the OpenGL render target texture
+	PROFILE_SPAN( "Upload" );
+	if (hostTarget) { hostTarget->CopyFrom( renderTarget->pixels ); return; }
+	// without persistent mapping, the pixels are copied to the texture
+	if (renderTarget->pixels == ownPixels)
+	{
+		glBindTexture( GL_TEXTURE_2D, glTarget->ID );
+		glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA, scrwidth, scrheight, 0, GL_RGBA, GL_UNSIGNED_BYTE, renderTarget->pixels );
+		return;
+	}
+	renderTarget->pixels = ownPixels;
+	glTarget->UploadPixels();
 }
 
 //  +-----------------------------------------------------------------------------+
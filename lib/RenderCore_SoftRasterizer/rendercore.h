@@ -42,6 +42,7 @@ public:
 	void WaitForRender() { /* this core does not support asynchronous rendering yet */ }
 	void Setting( const char* name, const float value );
 	void SetTarget( GLTexture* target, const uint spp );
+	void SetTarget( HostTarget* target, const uint spp );
 	void Shutdown();
 	// passing data. Note: RenderCore always copies what it needs; the passed data thus remains the
 	// property of the caller, and can be safely deleted or modified as soon as these calls return.
@@ -63,16 +64,17 @@ public:
 	CoreStats GetCoreStats() const override;
 	// internal methods
 private:
+	void Resize( const int width, const int height );
 	// data members
 	int scrwidth = 0, scrheight = 0;				// current screen width and height
 	Surface* renderTarget = 0;						// screen pixels
-	int targetTextureID = 0;						// ID of the target OpenGL texture
+	GLTexture* glTarget = 0;						// the target OpenGL texture
+	HostTarget* hostTarget = 0;						// host memory render target, instead of the OpenGL texture
 	int skywidth = 0, skyheight = 0;				// size of the skydome texture
 	int maxPixels = 0;								// max screen size buffers can accomodate without a realloc
 	int2 probePos = make_int2( 0 );					// triangle picking; primary ray for this pixel copies its triid to coreStats.probedTriid
 	int textureCount = 0;							// size of texture descriptor array
 	Rasterizer rasterizer;							// rasterization functionality
-	vector<Mesh*> meshes;							// list of meshes, for easy access in SetGeometry
 public:
 	CoreStats coreStats;							// rendering statistics
 };
@@ -1,6 +1,10 @@
 #include "bvh.h"
 #include "bvhnode.h"
 #include "bin.h"
+#include "compressedbvh.h"
+#include "sbvhbuilder.h"
+#include "whitted_ray_tracer.h"
+#include "triangle.h"
 #include "vector"
 
 int BVH::binCount = 4;
@@ -9,10 +13,21 @@ Bin* BVH::bins = new Bin[BVH::binCount];
 Bin* BVH::binsLeft = new Bin[BVH::binCount - 1];
 Bin* BVH::binsRight = new Bin[BVH::binCount - 1];
 
-BVH::BVH(int triangleIndex, int triangleCount) {
+BVH::BVH(int triangleIndex, int triangleCount, float spatialSplitBudget) {
+	this->triangleCount = triangleCount;
+	this->compressed = NULL;
+
+	if (spatialSplitBudget > 0) {
+		SBVHBuilder<Triangle, BVHNode> builder(WhittedRayTracer::triangles, triangleIndex, triangleCount, spatialSplitBudget);
+		builder.Build(this->pool, this->poolPtr, this->triangleIndices, this->indexCount);
+		this->root = &this->pool[0];
+		return;
+	}
+
 	this->pool = new BVHNode[triangleCount * 2 - 1];
 	this->root = &this->pool[0];
 	this->poolPtr = 1;
+	this->indexCount = triangleCount;
 
 	this->triangleIndices = new int[triangleCount];
 	for (int i = 0; i < triangleCount; i++) {
@@ -23,4 +38,33 @@ BVH::BVH(int triangleIndex, int triangleCount) {
 	this->root->count = triangleCount;
 	this->root->UpdateBounds(this->triangleIndices);
 	this->root->SubdivideNode(this->pool, this->triangleIndices, this->poolPtr);
-}
\ No newline at end of file
+}
+
+BVH::~BVH() {
+	delete[] this->pool;
+	delete[] this->triangleIndices;
+	delete this->compressed;
+}
+
+bool BVH::Compress(int bits) {
+	if (this->compressed != NULL || (bits != 8 && bits != 16)) { return false; }
+	CompressedBVH* compressed = new CompressedBVH(bits);
+	if (!compressed->Build(this, this->indexCount)) {
+		delete compressed;
+		return false;
+	}
+	this->compressed = compressed;
+	delete[] this->pool;
+	this->pool = NULL;
+	this->root = NULL;
+	return true;
+}
+
+void BVH::Traverse(Ray& ray, tuple<Triangle*, float>& intersection) const {
+	if (this->compressed != NULL) {
+		this->compressed->Traverse(ray, this->triangleIndices, intersection);
+	}
+	else {
+		this->root->Traverse(ray, this->pool, this->triangleIndices, intersection);
+	}
+}
@@ -40,7 +40,7 @@ bool BVHNode::PartitionTriangles(BVHNode* pool, int* triangleIndices) {
 	/** Generate bounding box over triangle centroids */
 	aabb centroidBoundingBox = aabb();
 	for (int i = this->first; i < this->first + this->count; i++) {
-		Triangle* triangle = WhittedRayTracer::scene[triangleIndices[i]];
+		Triangle* triangle = &WhittedRayTracer::triangles[triangleIndices[i]];
 		centroidBoundingBox.Grow(triangle->centroid);
 	}
 
@@ -65,7 +65,7 @@ bool BVHNode::PartitionTriangles(BVHNode* pool, int* triangleIndices) {
 
 	/** Fill the bins with Triangles */
 	for (int i = this->first; i < this->first + this->count; i++) {
-		Triangle* triangle = WhittedRayTracer::scene[triangleIndices[i]];
+		Triangle* triangle = &WhittedRayTracer::triangles[triangleIndices[i]];
 		float ci = GetTriangleAxisValue(axis, triangle);
 
 		int binID = (int)(k1 * (ci - cbmin));
@@ -124,7 +124,7 @@ bool BVHNode::PartitionTriangles(BVHNode* pool, int* triangleIndices) {
 
 	int j = this->first;
 	for (int i = this->first; i < this->first + this->count; i++) {
-		Triangle* triangle = WhittedRayTracer::scene[triangleIndices[i]];
+		Triangle* triangle = &WhittedRayTracer::triangles[triangleIndices[i]];
 		float ci = GetTriangleAxisValue(axis, triangle);
 		int binID = (int)(k1 * (ci - cbmin));
 
@@ -155,7 +155,7 @@ void BVHNode::UpdateBounds(int* triangleIndices) {
 	this->bounds.Reset();
 
 	for (int i = 0; i < this->count; i++) {
-		Triangle* triangle = WhittedRayTracer::scene[triangleIndices[this->first + i]];
+		Triangle* triangle = &WhittedRayTracer::triangles[triangleIndices[this->first + i]];
 		this->bounds.Grow(triangle->bounds);
 	}
 }
@@ -202,7 +202,7 @@ void BVHNode::IntersectTriangles(Ray &ray, int* triangleIndices, tuple<Triangle*
 	float minDistance = get<1>(intersection);
 
 	for (int i = 0; i < this->count; i++) {
-		Triangle* triangle = WhittedRayTracer::scene[triangleIndices[this->first + i]];
+		Triangle* triangle = &WhittedRayTracer::triangles[triangleIndices[this->first + i]];
 		float distance = triangle->Intersect(ray);
 
 		if (
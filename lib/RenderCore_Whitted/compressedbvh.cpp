@@ -0,0 +1,231 @@
+#include "compressedbvh.h"
+#include "bvh.h"
+#include "bvhnode.h"
+#include "whitted_ray_tracer.h"
+#include "triangle.h"
+#include "ray.h"
+#include "tuple"
+
+CompressedBVH::CompressedBVH(int bits) {
+	this->bits = bits;
+	/** Two child words, the scale exponents of the three axes and one padding byte, then the minimum and maximum of both children */
+	this->nodeSize = 2 * sizeof(uint) + 4 + 12 * (bits / 8);
+	this->maxLevel = 0;
+	this->rootChild = 0;
+	this->buildIndices = NULL;
+}
+
+CompressedBVH::~CompressedBVH() {
+}
+
+bool CompressedBVH::Build(const BVH* bvh, int indexCount) {
+	if (indexCount > (1 << FIRSTBITS)) { return false; }
+	this->buildIndices = bvh->triangleIndices;
+	this->nodes.clear();
+	this->maxLevel = 0;
+	this->rootBounds = bvh->root->bounds;
+	this->rootChild = this->EncodeNode(bvh->root, bvh->pool, this->rootBounds, 0);
+	this->nodes.shrink_to_fit();
+	this->buildIndices = NULL;
+	/** Traversal keeps at most one sibling per level on its stack */
+	return this->maxLevel < STACKSIZE - 1;
+}
+
+uint CompressedBVH::EncodeNode(const BVHNode* node, const BVHNode* pool, const aabb& bounds, int depth) {
+	if (node->isLeaf) { return this->EncodeRange(node->first, node->count, bounds, depth); }
+	this->maxLevel = max(this->maxLevel, depth + 1);
+
+	const BVHNode* children[2] = { &pool[node->left], &pool[node->left + 1] };
+	aabb childBounds[2] = { children[0]->bounds, children[1]->bounds };
+	aabb decoded[2];
+	uint index = this->EncodeChildren(bounds, childBounds, decoded);
+
+	uint childWords[2];
+	for (int i = 0; i < 2; i++) {
+		childWords[i] = this->EncodeNode(children[i], pool, decoded[i], depth + 1);
+	}
+	memcpy(&this->nodes[(size_t)index * this->nodeSize], childWords, sizeof(childWords));
+	return index;
+}
+
+uint CompressedBVH::EncodeRange(int first, int count, const aabb& bounds, int depth) {
+	if (count <= LEAFSIZE) { return LEAF | ((count - 1) << FIRSTBITS) | first; }
+	this->maxLevel = max(this->maxLevel, depth + 1);
+
+	/** Large leaves are split in halves, so that the count fits the child word */
+	int half = count / 2;
+	aabb childBounds[2] = { this->RangeBounds(first, half), this->RangeBounds(first + half, count - half) };
+	aabb decoded[2];
+	uint index = this->EncodeChildren(bounds, childBounds, decoded);
+
+	uint childWords[2];
+	childWords[0] = this->EncodeRange(first, half, decoded[0], depth + 1);
+	childWords[1] = this->EncodeRange(first + half, count - half, decoded[1], depth + 1);
+	memcpy(&this->nodes[(size_t)index * this->nodeSize], childWords, sizeof(childWords));
+	return index;
+}
+
+uint CompressedBVH::EncodeChildren(const aabb& bounds, const aabb childBounds[2], aabb decoded[2]) {
+	uint index = (uint)(this->nodes.size() / this->nodeSize);
+	this->nodes.resize(this->nodes.size() + this->nodeSize, 0);
+	uchar* node = &this->nodes[(size_t)index * this->nodeSize];
+
+	/** The scales depend on the box of this node only, so they are stored once for both children */
+	uchar* exponents = node + 2 * sizeof(uint);
+	for (int axis = 0; axis < 3; axis++) {
+		exponents[axis] = this->ScaleExponent(bounds.bmin[axis], bounds.bmax[axis]);
+	}
+	for (int i = 0; i < 2; i++) {
+		uint qmin[3], qmax[3];
+		this->Quantize(bounds, exponents, childBounds[i], qmin, qmax);
+		for (int axis = 0; axis < 3; axis++) {
+			int slot = i * 6 + axis;
+			if (this->bits == 8) {
+				uchar* q = node + 2 * sizeof(uint) + 4;
+				q[slot] = (uchar)qmin[axis];
+				q[slot + 3] = (uchar)qmax[axis];
+			}
+			else {
+				ushort* q = (ushort*)(node + 2 * sizeof(uint) + 4);
+				q[slot] = (ushort)qmin[axis];
+				q[slot + 3] = (ushort)qmax[axis];
+			}
+		}
+		/** Children are encoded relative to the box that traversal will decode, not the exact one */
+		this->Decode(node, i, bounds, decoded[i]);
+	}
+	return index;
+}
+
+float CompressedBVH::Dequantize(float parentMin, float scale, uint q) const {
+	return parentMin + scale * (float)q;
+}
+
+/** The biased float exponent of the smallest power of two step for which the top level reaches the maximum of the parent; 0 for a flat axis */
+uchar CompressedBVH::ScaleExponent(float parentMin, float parentMax) const {
+	if (!(parentMax > parentMin)) { return 0; }
+	uint levels = (1 << this->bits) - 1;
+	int exponent;
+	frexpf((parentMax - parentMin) / (float)levels, &exponent);
+	int biased = clamp(exponent + 127, 1, 254);
+	while (biased < 254 && this->Dequantize(parentMin, Scale((uchar)biased), levels) < parentMax) { biased++; }
+	return (uchar)biased;
+}
+
+/** A biased exponent is the exponent field of the float, so the step is built without a conversion; 0 yields 0.0f */
+float CompressedBVH::Scale(uchar exponent) {
+	uint bits = (uint)exponent << 23;
+	float scale;
+	memcpy(&scale, &bits, sizeof(scale));
+	return scale;
+}
+
+void CompressedBVH::Quantize(const aabb& parent, const uchar exponents[3], const aabb& child, uint qmin[3], uint qmax[3]) const {
+	uint levels = (1 << this->bits) - 1;
+	for (int axis = 0; axis < 3; axis++) {
+		float pmin = parent.bmin[axis];
+		float scale = Scale(exponents[axis]);
+		if (scale <= 0) {
+			qmin[axis] = qmax[axis] = 0;
+			continue;
+		}
+		/** Round outwards, then correct for the rounding of the float math */
+		float lo = floorf((child.bmin[axis] - pmin) / scale);
+		float hi = ceilf((child.bmax[axis] - pmin) / scale);
+		qmin[axis] = (uint)clamp(lo, 0.0f, (float)levels);
+		qmax[axis] = (uint)clamp(hi, 0.0f, (float)levels);
+		while (qmin[axis] > 0 && this->Dequantize(pmin, scale, qmin[axis]) > child.bmin[axis]) { qmin[axis]--; }
+		while (qmax[axis] < levels && this->Dequantize(pmin, scale, qmax[axis]) < child.bmax[axis]) { qmax[axis]++; }
+	}
+}
+
+void CompressedBVH::Decode(const uchar* node, int child, const aabb& parent, aabb& bounds) const {
+	const uchar* exponents = node + 2 * sizeof(uint);
+	for (int axis = 0; axis < 3; axis++) {
+		int slot = child * 6 + axis;
+		uint qmin, qmax;
+		if (this->bits == 8) {
+			const uchar* q = node + 2 * sizeof(uint) + 4;
+			qmin = q[slot];
+			qmax = q[slot + 3];
+		}
+		else {
+			const ushort* q = (const ushort*)(node + 2 * sizeof(uint) + 4);
+			qmin = q[slot];
+			qmax = q[slot + 3];
+		}
+		float pmin = parent.bmin[axis];
+		float scale = Scale(exponents[axis]);
+		bounds.bmin[axis] = this->Dequantize(pmin, scale, qmin);
+		bounds.bmax[axis] = this->Dequantize(pmin, scale, qmax);
+	}
+	bounds.bmin[3] = bounds.bmax[3] = 0;
+}
+
+aabb CompressedBVH::RangeBounds(int first, int count) const {
+	aabb bounds;
+	bounds.Reset();
+	for (int i = first; i < first + count; i++) {
+		bounds.Grow(WhittedRayTracer::triangles[this->buildIndices[i]].bounds);
+	}
+	return bounds;
+}
+
+void CompressedBVH::Traverse(Ray& ray, const int* triangleIndices, tuple<Triangle*, float>& intersection) const {
+	struct Entry {
+		aabb bounds;
+		float distance;
+		uint child;
+	};
+	Entry stack[STACKSIZE];
+	int stackPtr = 0;
+
+	aabb rootBounds = this->rootBounds;
+	float rootDistance;
+	if (!ray.IntersectionBounds(rootBounds, rootDistance)) { return; }
+	stack[stackPtr++] = { rootBounds, rootDistance, this->rootChild };
+
+	while (stackPtr > 0) {
+		Entry entry = stack[--stackPtr];
+
+		/** Skip boxes behind the nearest intersection found so far */
+		Triangle* nearestPrimitive = get<0>(intersection);
+		float minDistance = get<1>(intersection);
+		bool found = nearestPrimitive != NULL;
+		if (found && entry.distance > minDistance) { continue; }
+
+		if (entry.child & LEAF) {
+			int first = entry.child & ((1 << FIRSTBITS) - 1);
+			int count = ((entry.child >> FIRSTBITS) & (LEAFSIZE - 1)) + 1;
+			for (int i = 0; i < count; i++) {
+				Triangle* triangle = &WhittedRayTracer::triangles[triangleIndices[first + i]];
+				float distance = triangle->Intersect(ray);
+				if ((!found || distance < minDistance) && distance > EPSILON) {
+					found = true;
+					minDistance = distance;
+					nearestPrimitive = triangle;
+				}
+			}
+			intersection = make_tuple(nearestPrimitive, minDistance);
+			continue;
+		}
+
+		/** Decode and test both children; the nearer one is visited first */
+		const uchar* node = &this->nodes[(size_t)entry.child * this->nodeSize];
+		const uint* childWords = (const uint*)node;
+		Entry children[2];
+		bool hit[2];
+		for (int i = 0; i < 2; i++) {
+			this->Decode(node, i, entry.bounds, children[i].bounds);
+			children[i].child = childWords[i];
+			hit[i] = ray.IntersectionBounds(children[i].bounds, children[i].distance);
+		}
+		int nearest = (hit[0] && hit[1] && children[1].distance < children[0].distance) ? 1 : 0;
+		if (hit[1 - nearest]) { stack[stackPtr++] = children[1 - nearest]; }
+		if (hit[nearest]) { stack[stackPtr++] = children[nearest]; }
+	}
+}
+
+size_t CompressedBVH::MemoryUsage() const {
+	return sizeof(CompressedBVH) + this->nodes.capacity();
+}
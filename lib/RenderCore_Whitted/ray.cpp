@@ -43,7 +43,12 @@ float4 Ray::Trace(BVH* bvh, uint recursionDepth) {
 	}
 	
 	tuple<Triangle*, float> intersection = make_tuple<Triangle*, float>(NULL, NULL);
-	bvh->root->Traverse(*this, bvh->pool, bvh->triangleIndices, intersection);
+	PhaseStats::Counters& counters = WhittedRayTracer::phaseCounters;
+	const int phase = PhaseStats::TracePhase(recursionDepth);
+	const int64_t traceStart = counters.Start();
+	counters.count[phase]++;
+	bvh->Traverse(*this, intersection);
+	counters.Stop(phase, traceStart);
 
 	Triangle* nearestTriangle = get<0>(intersection);
 	float intersectionDistance = get<1>(intersection);
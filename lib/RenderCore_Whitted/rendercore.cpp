@@ -17,7 +17,6 @@
 #include "whitted_ray_tracer.h"
 #include "bvh.h"
 #include "vector"
-#include "chrono"
 
 using namespace lh2core;
 
@@ -37,7 +36,20 @@ void RenderCore::Init()
 void RenderCore::SetTarget( GLTexture* target, const uint )
 {
 	// synchronize OpenGL viewport
-	targetTextureID = target->ID;
+	glTarget = target, hostTarget = 0;
+	if (screen != 0 && target->width == screen->width && target->height == screen->height) return; // nothing changed
+	delete screen;
+	screen = new Bitmap( target->width, target->height );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderCore::SetTarget                                                      |
+//  |  Set the host memory buffer that serves as the render target.         LH2'20|
+//  +-----------------------------------------------------------------------------+
+void RenderCore::SetTarget( HostTarget* target, const uint )
+{
+	// headless rendering: the image is copied to the target, without OpenGL
+	glTarget = 0, hostTarget = target;
 	if (screen != 0 && target->width == screen->width && target->height == screen->height) return; // nothing changed
 	delete screen;
 	screen = new Bitmap( target->width, target->height );
@@ -49,29 +61,19 @@ void RenderCore::SetTarget( GLTexture* target, const uint )
 //  +-----------------------------------------------------------------------------+
 void RenderCore::SetGeometry( const int meshIdx, const float4* vertexData, const int vertexCount, const int triangleCount, const CoreTri* triangleData )
 {
-	int triangleIndex = max((int) WhittedRayTracer::scene.size() - 1, 0);
-	for (int i = 0; i < triangleCount; i++) {
-		CoreTri triangle = triangleData[i];
-
-		float4 v0 = make_float4(triangle.vertex0, 0);
-		float4 v1 = make_float4(triangle.vertex1, 0);
-		float4 v2 = make_float4(triangle.vertex2, 0);
-		uint materialIndex = triangle.material;
-
-		WhittedRayTracer::AddTriangle(v0, v1, v2, materialIndex);
+	/** Triangles live in one contiguous array; a replaced mesh releases its old range */
+	int triangleIndex = WhittedRayTracer::SetMeshTriangles(meshIdx, triangleData, triangleCount);
+
+	ProfileSpan timer( "BuildBVH" );
+	BVH* bvh = new BVH(triangleIndex, triangleCount, bvhSpatialSplits);
+	if (bvhCompression > 0 && triangleCount >= bvhCompressionThreshold) bvh->Compress(bvhCompression);
+	coreStats.bvhBuildTime += timer.elapsed();
+	/** Meshes may arrive in any order; slots of meshes that were not set yet stay empty */
+	if (meshIdx >= (int)WhittedRayTracer::bvhs.size()) {
+		WhittedRayTracer::bvhs.resize(meshIdx + 1, NULL);
 	}
-	auto start = std::chrono::high_resolution_clock::now();
-
-	BVH* bvh = new BVH(triangleIndex, triangleCount);
-
-	auto finish = std::chrono::high_resolution_clock::now();
-	std::chrono::duration<float> elapsed = finish - start;
-	auto durationMs = std::chrono::duration_cast<std::chrono::milliseconds>(elapsed);
-	std::cout << "Building BVH Time: " << durationMs.count() << "ms\n";
-	
-	cout << "Amount of splits: " << (bvh->poolPtr + 1) / 2 << "\n";
-
-	WhittedRayTracer::bvhs.push_back(bvh);
+	delete WhittedRayTracer::bvhs[meshIdx];
+	WhittedRayTracer::bvhs[meshIdx] = bvh;
 }
 
 //  +-----------------------------------------------------------------------------+
@@ -88,19 +90,27 @@ void RenderCore::SetMaterials(CoreMaterial* mat, const int materialCount) {
 //  +-----------------------------------------------------------------------------+
 void RenderCore::Render( const ViewPyramid& view, const Convergence converge, bool async )
 {
-	// render
-	auto start = std::chrono::high_resolution_clock::now();
-
-	WhittedRayTracer::Render(view, screen);
-	
-	auto finish = std::chrono::high_resolution_clock::now();
-	std::chrono::duration<float> elapsed = finish - start;
-	auto durationMs = std::chrono::duration_cast<std::chrono::milliseconds>(elapsed);
-	std::cout << "Render Time: " << durationMs.count() << "ms\n";
-	
-	// copy pixel buffer to OpenGL render target texture
-	glBindTexture( GL_TEXTURE_2D, targetTextureID );
-	glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA, screen->width, screen->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, screen->pixels);
+	// render; for OpenGL targets, straight into the mapped pixel buffer of the texture
+	uint* ownPixels = screen->pixels;
+	if (glTarget) if (uint* mapped = glTarget->MapPixels()) screen->pixels = mapped;
+	Timer timer;
+	{
+		PROFILE_SPAN( "Trace" );
+		WhittedRayTracer::Render(view, screen);
+	}
+	// gather the per-thread counters
+	coreStats.SetPhaseStats( PhaseStats::Merge() );
+	coreStats.renderTime = timer.elapsed();
+	// release the scratch memory of this frame
+	FrameMemory::EndFrame();
+
+	// copy pixel buffer to the host target or the OpenGL render target texture
+	PROFILE_SPAN( "Upload" );
+	if (hostTarget) { hostTarget->CopyFrom( screen->pixels ); return; }
+	// without persistent mapping, the pixels are copied to the texture
+	if (screen->pixels == ownPixels) { glTarget->CopyFrom( screen ); return; }
+	screen->pixels = ownPixels;
+	glTarget->UploadPixels();
 }
 
 //  +-----------------------------------------------------------------------------+
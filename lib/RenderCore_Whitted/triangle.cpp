@@ -15,6 +15,7 @@ Triangle::Triangle(float4 _v0, float4 _v1, float4 _v2, uint _material) {
 	this->v0v1 = v1 - v0;
 	this->materialIndex = _material;
 	this->centroid = (this->v0 + this->v1 + this->v2) / 3.0;
+	this->bounds.Reset();
 	this->bounds.Grow(this->v0);
 	this->bounds.Grow(this->v1);
 	this->bounds.Grow(this->v2);
@@ -48,7 +49,11 @@ float Triangle::Intersect(Ray& ray) {
 
 bool Triangle::IsLightBlocked(const BVH* bvh, float shadowRayLength) {
 	tuple<Triangle*, float> intersection = make_tuple<Triangle*, float>(NULL, NULL);
-	bvh->root->Traverse(WhittedRayTracer::shadowRay, bvh->pool, bvh->triangleIndices, intersection);
+	PhaseStats::Counters& counters = WhittedRayTracer::phaseCounters;
+	const int64_t shadowStart = counters.Start();
+	counters.count[PhaseStats::SHADOW]++;
+	bvh->Traverse(WhittedRayTracer::shadowRay, intersection);
+	counters.Stop(PhaseStats::SHADOW, shadowStart);
 
 	Triangle* intersectionTriangle = get<0>(intersection);
 	float intersectionDist = get<1>(intersection);
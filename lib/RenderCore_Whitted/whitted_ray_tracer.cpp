@@ -3,6 +3,7 @@
 #include "ray.h"
 #include "light.h"
 #include "triangle.h";
+#include "bvh.h"
 #include "tuple"
 #include "vector"
 
@@ -11,7 +12,10 @@
   */
 
 /** Scene */
-vector<Triangle*> WhittedRayTracer::scene = vector<Triangle*>();
+Triangle* WhittedRayTracer::triangles = 0;
+int WhittedRayTracer::triangleCount = 0;
+int WhittedRayTracer::triangleCapacity = 0;
+vector<int2> WhittedRayTracer::meshRanges;
 vector<Light*> WhittedRayTracer::lights = vector<Light*>();
 vector<CoreMaterial> WhittedRayTracer::materials;
 vector<BVH*> WhittedRayTracer::bvhs;
@@ -20,8 +24,9 @@ vector<BVH*> WhittedRayTracer::bvhs;
 float4 WhittedRayTracer::globalIllumination = make_float4(0.2, 0.2, 0.2, 0);
 
 /** Rays */
-Ray WhittedRayTracer::primaryRay = Ray(make_float4(0, 0, 0, 0), make_float4(0, 0, 0, 0));
-Ray WhittedRayTracer::shadowRay = Ray(make_float4(0, 0, 0, 0), make_float4(0, 0, 0, 0));
+thread_local Ray WhittedRayTracer::primaryRay = Ray(make_float4(0, 0, 0, 0), make_float4(0, 0, 0, 0));
+thread_local Ray WhittedRayTracer::shadowRay = Ray(make_float4(0, 0, 0, 0), make_float4(0, 0, 0, 0));
+thread_local PhaseStats::Counters WhittedRayTracer::phaseCounters;
 
 /** Whitted Ray Tracer Settings */
 int WhittedRayTracer::recursionThreshold = 3;
@@ -43,9 +48,48 @@ void WhittedRayTracer::Initialise() {
 	));
 }
 
-void WhittedRayTracer::AddTriangle(float4 v0, float4 v1, float4 v2, uint materialIndex) {
-	Triangle* triangle = new Triangle(v0, v1, v2, materialIndex);
-	scene.push_back(triangle);
+int WhittedRayTracer::SetMeshTriangles(int meshIdx, const CoreTri* triangleData, int count) {
+	/** Meshes may arrive in any order; the ranges of meshes that were not set yet are empty */
+	if (meshIdx >= (int)meshRanges.size()) {
+		meshRanges.resize(meshIdx + 1, make_int2(0, 0));
+	}
+	int2 range = meshRanges[meshIdx];
+	if (range.y != count) {
+		if (range.y > 0) {
+			/** Close the gap of the old triangles; the meshes after it, and their BVHs, move down */
+			memmove(triangles + range.x, triangles + range.x + range.y, (triangleCount - range.x - range.y) * sizeof(Triangle));
+			triangleCount -= range.y;
+			for (int m = 0; m < (int)meshRanges.size(); m++) {
+				if (meshRanges[m].y == 0 || meshRanges[m].x <= range.x) { continue; }
+				meshRanges[m].x -= range.y;
+				if (m < (int)bvhs.size() && bvhs[m] != NULL) {
+					for (int i = 0; i < bvhs[m]->indexCount; i++) { bvhs[m]->triangleIndices[i] -= range.y; }
+				}
+			}
+		}
+		/** The new or resized mesh is placed at the end; a mesh of the same size is rebuilt in place */
+		WhittedRayTracer::ReserveTriangles(triangleCount + count);
+		meshRanges[meshIdx] = make_int2(triangleCount, count);
+		triangleCount += count;
+	}
+
+	int first = meshRanges[meshIdx].x;
+	for (int i = 0; i < count; i++) {
+		const CoreTri& triangle = triangleData[i];
+		new (&triangles[first + i]) Triangle(make_float4(triangle.vertex0, 0), make_float4(triangle.vertex1, 0), make_float4(triangle.vertex2, 0), triangle.material);
+	}
+	return first;
+}
+
+/** Grows the triangle storage by doubling, or shrinks it when mostly unused */
+void WhittedRayTracer::ReserveTriangles(int count) {
+	if (count <= triangleCapacity && count >= triangleCapacity / 4) { return; }
+	int capacity = max(count, count > triangleCapacity ? triangleCapacity * 2 : count);
+	Triangle* storage = (Triangle*)MALLOC64(capacity * sizeof(Triangle));
+	if (triangleCount > 0) { memcpy(storage, triangles, triangleCount * sizeof(Triangle)); }
+	FREE64(triangles);
+	triangles = storage;
+	triangleCapacity = capacity;
 }
 
 /**
@@ -68,35 +112,49 @@ float4 WhittedRayTracer::GetRayDirection(const ViewPyramid& view, float3 point)
 }
 
 void WhittedRayTracer::Render(const ViewPyramid& view, const Bitmap* screen) {
-	for (int y = 0; y < screen->height; y++) {
-		for (int x = 0; x < screen->width; x++) {
-			float4 pixelColor = make_float4(0, 0, 0, 0);
-
-			/** Loop additionally for anti aliasing */
-			for (int j = 0; j < WhittedRayTracer::antiAliasingAmount; j++) {
-				for (int i = 0; i < WhittedRayTracer::antiAliasingAmount; i++) {
-					/** Setup the ray from the screen */
-					float u = (float)x + ((float)i / WhittedRayTracer::antiAliasingAmount);
-					float v = (float)y + ((float)j / WhittedRayTracer::antiAliasingAmount);
-					float3 point = WhittedRayTracer::GetPointOnScreen(view, screen, u, v);
-					float4 rayDirection = WhittedRayTracer::GetRayDirection(view, point);
-
-					/** Reset the primary, it can be used as a reflective ray */
-					primaryRay.origin = make_float4(view.pos, 0);
-					primaryRay.direction = rayDirection;
-
-					/** Trace the ray */
-					pixelColor += primaryRay.Trace(WhittedRayTracer::bvhs[0], 0);
+	/** The first mesh holds the scene; meshes may arrive out of order */
+	if (bvhs.empty() || bvhs[0] == NULL) {
+		return;
+	}
+
+	/** Trace rows in parallel using the shared job system */
+	JobManager::GetJobManager()->ParallelFor(0, screen->height, 1, [&](int firstRow, int lastRow) {
+		Timer timer;
+		PhaseStats::Counters& counters = WhittedRayTracer::phaseCounters;
+		for (int y = firstRow; y < lastRow; y++) {
+			for (int x = 0; x < screen->width; x++) {
+				/** Time the rays of a subset of the pixels only */
+				counters.BeginSample(PhaseStats::Sampled(x, y));
+				float4 pixelColor = make_float4(0, 0, 0, 0);
+
+				/** Loop additionally for anti aliasing */
+				for (int j = 0; j < WhittedRayTracer::antiAliasingAmount; j++) {
+					for (int i = 0; i < WhittedRayTracer::antiAliasingAmount; i++) {
+						/** Setup the ray from the screen */
+						float u = (float)x + ((float)i / WhittedRayTracer::antiAliasingAmount);
+						float v = (float)y + ((float)j / WhittedRayTracer::antiAliasingAmount);
+						float3 point = WhittedRayTracer::GetPointOnScreen(view, screen, u, v);
+						float4 rayDirection = WhittedRayTracer::GetRayDirection(view, point);
+
+						/** Reset the primary, it can be used as a reflective ray */
+						primaryRay.origin = make_float4(view.pos, 0);
+						primaryRay.direction = rayDirection;
+
+						/** Trace the ray */
+						pixelColor += primaryRay.Trace(WhittedRayTracer::bvhs[0], 0);
+					}
 				}
-			}
 
-			/** Divide the color by the amount of extra anti aliasing rays */
-			pixelColor /= WhittedRayTracer::antiAliasingAmount * WhittedRayTracer::antiAliasingAmount;
+				/** Divide the color by the amount of extra anti aliasing rays */
+				pixelColor /= WhittedRayTracer::antiAliasingAmount * WhittedRayTracer::antiAliasingAmount;
 			
-			int index = x + y * screen->width;
-			screen->pixels[index] = WhittedRayTracer::ConvertColorToInt(pixelColor);
+				int index = x + y * screen->width;
+				screen->pixels[index] = WhittedRayTracer::ConvertColorToInt(pixelColor);
+				counters.EndSample();
+			}
 		}
-	}
+		PhaseStats::Flush(counters, timer.elapsed());
+	});
 
 
 	if (WhittedRayTracer::applyPostProcessing) {
@@ -135,26 +193,29 @@ void WhittedRayTracer::Vignetting(float4& color, float u, float v) {
 }
 
 void WhittedRayTracer::ApplyPostProcessing(const Bitmap* screen) {
-	/** Copy the screen pixels to prevent changing the screen while reading from it */
-	uint* pixels = new uint[screen->width * screen->height];
-	memcpy(pixels, screen->pixels, screen->width * screen->height * sizeof(uint));
+	/** Rows are independent: chromatic abberation only reads pixels from the same row */
+	JobManager::GetJobManager()->ParallelFor(0, screen->height, 8, [&](int firstRow, int lastRow) {
+		/** Copy the rows to prevent changing the screen while reading from it; the scratch memory is released at the end of the frame */
+		uint* rows = FrameMemory::Scratch().Alloc<uint>((lastRow - firstRow) * screen->width);
+		memcpy(rows, screen->pixels + firstRow * screen->width, (lastRow - firstRow) * screen->width * sizeof(uint));
 
-	for (int y = 0; y < screen->height; y++) {
-		for (int x = 0; x < screen->width; x++) {
-			int index = x + y * screen->width;
-			float u = ((float) x / (float) screen->width);
-			float v = ((float) y / (float) screen->height);
-			float4 color = WhittedRayTracer::ConvertIntToColor(screen->pixels[index]);
+		for (int y = firstRow; y < lastRow; y++) {
+			for (int x = 0; x < screen->width; x++) {
+				int index = x + y * screen->width;
+				float u = ((float) x / (float) screen->width);
+				float v = ((float) y / (float) screen->height);
+				float4 color = WhittedRayTracer::ConvertIntToColor(screen->pixels[index]);
 
-			WhittedRayTracer::ChromaticAbberation(screen, color, pixels, x, y, u, v);
+				WhittedRayTracer::ChromaticAbberation(screen, color, rows, x, y - firstRow, u, v);
 
-			WhittedRayTracer::GammaCorrection(color);
+				WhittedRayTracer::GammaCorrection(color);
 
-			WhittedRayTracer::Vignetting(color, u, v);
+				WhittedRayTracer::Vignetting(color, u, v);
 
-			screen->pixels[index] = WhittedRayTracer::ConvertColorToInt(color);
+				screen->pixels[index] = WhittedRayTracer::ConvertColorToInt(color);
+			}
 		}
-	}
+	});
 }
 
 /**
@@ -11,7 +11,10 @@ class Triangle;
 class WhittedRayTracer
 {
 public:
-	static vector<Triangle*> scene;
+	/** Contiguous, 64-byte aligned triangle storage; each mesh owns a consecutive range */
+	static Triangle* triangles;
+	static int triangleCount;
+	static vector<int2> meshRanges;
 	static vector<Light*> lights;
 	static vector<CoreMaterial> materials;
 	static vector<BVH*> bvhs;
@@ -19,15 +22,21 @@ public:
 	
 	static float4 globalIllumination;
 
-	static Ray primaryRay;
-	static Ray shadowRay;
+	/** Per-thread rays, rows are traced in parallel */
+	static thread_local Ray primaryRay;
+	static thread_local Ray shadowRay;
+	/** Per-thread ray counts and sampled trace times, added to the phase statistics once per render job */
+	static thread_local PhaseStats::Counters phaseCounters;
 
 	static int recursionThreshold;
 
 	static void Initialise();
-	static void AddTriangle(float4 v0, float4 v1, float4 v2, uint materialIndex);
+	/** Stores the triangles of a mesh, replacing its old ones; returns the index of the first */
+	static int SetMeshTriangles(int meshIdx, const CoreTri* triangleData, int count);
 	static void Render(const ViewPyramid& view, const Bitmap* screen);
 private:
+	static int triangleCapacity;
+	static void ReserveTriangles(int count);
 	static int antiAliasingAmount;
 	static bool applyPostProcessing;
 	static float gammaCorrection;
@@ -57,7 +57,8 @@
 #define MIPLEVELCOUNT		5
 
 // file format versions
-#define BINTEXFILEVERSION	0x10001001
+#define BINTEXFILEVERSION	0x10001003
+#define COMPILEDSCENEVERSION	0x10000003
 
 // tools
 
@@ -30,6 +30,22 @@ namespace lighthouse2
 struct CoreStats
 {
 	void SetProbeInfo( int inst, int prim, float t ) { probedInstid = inst, probedTriid = prim, probedDist = t; }
+	// CPU cores: ray counts and timers from the per-thread counters. Times are averaged over the
+	// threads, so rays / time is the throughput of the whole machine. Trace times may be estimates
+	// from sampled pixels; shading time is only derived when the trace phases were timed.
+	void SetPhaseStats( const PhaseStats::Totals& t )
+	{
+		const float threads = (float)max( 1u, t.threads );
+		primaryRayCount = (uint)t.count[PhaseStats::PRIMARY], traceTime0 = t.seconds[PhaseStats::PRIMARY] / threads;
+		bounce1RayCount = (uint)t.count[PhaseStats::BOUNCE1], traceTime1 = t.seconds[PhaseStats::BOUNCE1] / threads;
+		deepRayCount = (uint)t.count[PhaseStats::DEEP], traceTimeX = t.seconds[PhaseStats::DEEP] / threads;
+		totalShadowRays = (uint)t.count[PhaseStats::SHADOW], shadowTraceTime = t.seconds[PhaseStats::SHADOW] / threads;
+		totalExtensionRays = bounce1RayCount + deepRayCount;
+		totalRays = primaryRayCount + totalExtensionRays + totalShadowRays;
+		// without an explicit shading phase, shading is the render time that was not spent tracing
+		const float traceTime = traceTime0 + traceTime1 + traceTimeX + shadowTraceTime;
+		shadeTime = t.seconds[PhaseStats::SHADE] > 0 ? t.seconds[PhaseStats::SHADE] / threads : traceTime > 0 ? max( 0.0f, t.seconds[PhaseStats::RENDER] / threads - traceTime ) : 0;
+	}
 	// device
 	char* deviceName = 0;				// device name; TODO: will leak
 	uint SMcount = 0;					// number of shading multiprocessors on device
@@ -45,16 +61,16 @@ struct CoreStats
 	uint totalRays = 0;					// total number of rays cast
 	uint totalExtensionRays = 0;		// total extension rays cast
 	uint totalShadowRays = 0;			// total shadow rays cast
-	float renderTime;					// overall render time
+	float renderTime = 0;				// overall render time
 	float frameOverhead = 0;			// frame time not spent rendering
-	uint primaryRayCount;				// # primary rays
-	float traceTime0;					// time spent tracing primary rays
-	uint bounce1RayCount;				// # rays after first bounce
-	float traceTime1;					// time spent tracing first bounce
-	uint deepRayCount;					// # rays after multiple bounces
-	float traceTimeX;					// time spent tracing subsequent bounces
-	float shadowTraceTime;				// time spent tracing shadow rays
-	float shadeTime;					// time spent in shading code
+	uint primaryRayCount = 0;			// # primary rays
+	float traceTime0 = 0;				// time spent tracing primary rays
+	uint bounce1RayCount = 0;			// # rays after first bounce
+	float traceTime1 = 0;				// time spent tracing first bounce
+	uint deepRayCount = 0;				// # rays after multiple bounces
+	float traceTimeX = 0;				// time spent tracing subsequent bounces
+	float shadowTraceTime = 0;			// time spent tracing shadow rays
+	float shadeTime = 0;				// time spent in shading code
 	float filterTime = 0;				// time spent in filter code
 	// probe
 	int probedInstid;					// id of the instance at probe position
@@ -91,6 +107,9 @@ public:
 	virtual void SetProbePos( const int2 pos ) = 0;
 	// SetTarget: specify an OpenGL texture as a render target for the path tracer.
 	virtual void SetTarget( GLTexture* target, const uint spp ) = 0;
+	// SetTarget: specify a host memory render target, for rendering without an OpenGL context.
+	// The target receives the image at the end of Render (or WaitForRender, for asynchronous renders).
+	virtual void SetTarget( HostTarget* /* target */, const uint /* spp */ ) { FATALERROR( "This core does not support headless rendering." ); }
 	// Setting: modify a render setting
 	virtual void Setting( const char* name, float value ) = 0;
 	// Render: produce one frame. Convergence can be 'Converge' or 'Restart'.
@@ -116,6 +135,8 @@ public:
 	virtual void SetInstance( const int instanceIdx, const int modelIdx, const mat4& transform = mat4::Identity() ) = 0;
 	// FinalizeInstances: allow the core to do any finalizing work after receiving all geometry and instances.
 	virtual void FinalizeInstances() = 0;
+	// AttachProfiler: record spans in the profiler of the application; the core links its own copy of the platform code.
+	virtual void AttachProfiler( Profiler::State* state ) { Profiler::Attach( state ); }
 };
 
 } // namespace lighthouse2
@@ -48,17 +48,16 @@ void HostMaterial::ConvertFrom( const tinyobjMaterial& original )
 	}
 	if (original.normal_texname != "")
 	{
-		normals.textureID = HostScene::FindOrCreateTexture( original.normal_texname, HostTexture::FLIPPED );
-		HostScene::textures[normals.textureID]->flags |= HostTexture::NORMALMAP; // TODO: what if it's also used as regular texture?
+		// note: textures load asynchronously; flags are applied when loading completes
+		normals.textureID = HostScene::FindOrCreateTexture( original.normal_texname, HostTexture::FLIPPED, HostTexture::NORMALMAP ); // TODO: what if it's also used as regular texture?
 	}
 	else if (original.bump_texname != "")
 	{
-		int bumpMapID = normals.textureID = HostScene::CreateTexture( original.bump_texname, HostTexture::FLIPPED ); // cannot reuse, height scale may differ
 		float heightScaler = 1.0f;
 		auto heightScalerIt = original.unknown_parameter.find( "bump_height" );
 		if (heightScalerIt != original.unknown_parameter.end()) heightScaler = static_cast<float>(atof( (*heightScalerIt).second.c_str() ));
-		HostScene::textures[bumpMapID]->BumpToNormalMap( heightScaler );
-		HostScene::textures[bumpMapID]->flags |= HostTexture::NORMALMAP; // TODO: what if it's also used as regular texture?
+		normals.textureID = HostScene::CreateTexture( original.bump_texname, HostTexture::FLIPPED, HostTexture::NORMALMAP, // cannot reuse, height scale may differ
+			[heightScaler]( HostTexture* texture ) { texture->BumpToNormalMap( heightScaler ); } );
 	}
 	if (original.specular_texname != "")
 	{
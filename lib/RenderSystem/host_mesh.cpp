@@ -124,27 +124,205 @@ void HostMesh::LoadGeometry( const char* file, const char* dir, const float scal
 	}
 }
 
+//  +-----------------------------------------------------------------------------+
+//  |  OBJ parsing helpers.                                                       |
+//  |  The obj file is memory mapped and split in line-aligned chunks, which are  |
+//  |  parsed concurrently. Each chunk gathers its own attributes and triangle    |
+//  |  corners; prefix sums over the chunks then yield the final offsets.   LH2'20|
+//  +-----------------------------------------------------------------------------+
+namespace {
+
+static const int OBJ_RELATIVE = 1 << 30;	// marks a negative (relative) index; resolved after all chunks are parsed
+static const int OBJ_INHERIT = -2;			// face uses the material that was active at the end of the previous chunk
+
+struct OBJChunk
+{
+	const char* start = 0, *end = 0;
+	vector<float3> v, vn;
+	vector<float2> vt;
+	vector<int3> corners;					// v / vt / vn index per triangle corner, -1 if absent
+	vector<int> faceMaterial;				// per triangle: index in usemtl, or OBJ_INHERIT
+	vector<string> usemtl;					// material names referenced in this chunk
+	string mtllib;
+	int vBase = 0, vtBase = 0, vnBase = 0, triBase = 0;
+};
+
+static inline uint FloatBits( const float f ) { uint u; memcpy( &u, &f, 4 ); return u; }
+static inline float BitsToFloat( const uint u ) { float f; memcpy( &f, &u, 4 ); return f; }
+static inline const char* SkipSpace( const char* p, const char* end ) { while (p < end && (*p == ' ' || *p == '\t')) p++; return p; }
+static inline const char* SkipLine( const char* p, const char* end ) { while (p < end && *p != '\n') p++; return p < end ? p + 1 : end; }
+static inline bool EndOfLine( const char* p, const char* end ) { return p >= end || *p == '\n' || *p == '\r' || *p == '#'; }
+
+static const char* ParseOBJFloat( const char* p, const char* end, float& value )
+{
+	p = SkipSpace( p, end );
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+')) negative = (*p++ == '-');
+	double mantissa = 0, scale = 1;
+	while (p < end && *p >= '0' && *p <= '9') mantissa = mantissa * 10 + (*p++ - '0');
+	if (p < end && *p == '.') { p++; while (p < end && *p >= '0' && *p <= '9') mantissa = mantissa * 10 + (*p++ - '0'), scale *= 0.1; }
+	if (p < end && (*p == 'e' || *p == 'E'))
+	{
+		int exponent = 0, sign = 1;
+		if (++p < end && (*p == '-' || *p == '+')) sign = (*p++ == '-') ? -1 : 1;
+		while (p < end && *p >= '0' && *p <= '9') exponent = exponent * 10 + (*p++ - '0');
+		scale *= pow( 10.0, sign * exponent );
+	}
+	value = (float)(negative ? -mantissa * scale : mantissa * scale);
+	return p;
+}
+
+static const char* ParseOBJInt( const char* p, const char* end, int& value )
+{
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+')) negative = (*p++ == '-');
+	value = 0;
+	while (p < end && *p >= '0' && *p <= '9') value = value * 10 + (*p++ - '0');
+	if (negative) value = -value;
+	return p;
+}
+
+// convert an obj index (1-based, or negative for relative) to a 0-based index; relative
+// indices are stored relative to the chunk and resolved once all chunks have been counted.
+static inline int OBJIndex( const int idx, const int localCount )
+{
+	if (idx > 0) return idx - 1;
+	if (idx < 0) return OBJ_RELATIVE + localCount + idx;
+	return -1;
+}
+static inline int ResolveOBJIndex( const int idx, const int base )
+{
+	return idx >= (OBJ_RELATIVE >> 1) ? (idx - OBJ_RELATIVE + base) : idx;
+}
+
+static void ParseOBJChunk( OBJChunk& chunk )
+{
+	const char* p = chunk.start, *end = chunk.end;
+	int activeMaterial = OBJ_INHERIT;
+	vector<int3> poly;
+	while (p < end)
+	{
+		p = SkipSpace( p, end );
+		if (EndOfLine( p, end )) { p = SkipLine( p, end ); continue; }
+		if (p[0] == 'v' && p + 1 < end)
+		{
+			float3 f;
+			if (p[1] == ' ' || p[1] == '\t')
+			{
+				p = ParseOBJFloat( p + 1, end, f.x ), p = ParseOBJFloat( p, end, f.y ), p = ParseOBJFloat( p, end, f.z );
+				chunk.v.push_back( f );
+			}
+			else if (p[1] == 'n')
+			{
+				p = ParseOBJFloat( p + 2, end, f.x ), p = ParseOBJFloat( p, end, f.y ), p = ParseOBJFloat( p, end, f.z );
+				chunk.vn.push_back( f );
+			}
+			else if (p[1] == 't')
+			{
+				p = ParseOBJFloat( p + 2, end, f.x ), p = ParseOBJFloat( p, end, f.y );
+				chunk.vt.push_back( make_float2( f.x, f.y ) );
+			}
+		}
+		else if (p[0] == 'f' && p + 1 < end && (p[1] == ' ' || p[1] == '\t'))
+		{
+			// gather polygon corners: v, v/vt, v//vn or v/vt/vn
+			poly.clear();
+			p += 2;
+			while (true)
+			{
+				p = SkipSpace( p, end );
+				if (EndOfLine( p, end )) break;
+				int vi = 0, ti = 0, ni = 0;
+				p = ParseOBJInt( p, end, vi );
+				if (p < end && *p == '/')
+				{
+					if (++p < end && *p != '/') p = ParseOBJInt( p, end, ti );
+					if (p < end && *p == '/') p = ParseOBJInt( p + 1, end, ni );
+				}
+				while (p < end && !EndOfLine( p, end ) && *p != ' ' && *p != '\t') p++; // skip malformed remainder
+				poly.push_back( make_int3( OBJIndex( vi, (int)chunk.v.size() ), OBJIndex( ti, (int)chunk.vt.size() ), OBJIndex( ni, (int)chunk.vn.size() ) ) );
+			}
+			// triangulate as a fan, like tinyobj
+			for (int i = 2; i < (int)poly.size(); i++)
+			{
+				chunk.corners.push_back( poly[0] );
+				chunk.corners.push_back( poly[i - 1] );
+				chunk.corners.push_back( poly[i] );
+				chunk.faceMaterial.push_back( activeMaterial );
+			}
+		}
+		else if (end - p > 6 && !strncmp( p, "usemtl", 6 ) && (p[6] == ' ' || p[6] == '\t'))
+		{
+			const char* name = SkipSpace( p + 6, end ), *nameEnd = name;
+			while (!EndOfLine( nameEnd, end )) nameEnd++;
+			while (nameEnd > name && (nameEnd[-1] == ' ' || nameEnd[-1] == '\t')) nameEnd--;
+			chunk.usemtl.push_back( string( name, nameEnd - name ) );
+			activeMaterial = (int)chunk.usemtl.size() - 1;
+		}
+		else if (end - p > 6 && !strncmp( p, "mtllib", 6 ) && (p[6] == ' ' || p[6] == '\t') && chunk.mtllib.size() == 0)
+		{
+			const char* name = SkipSpace( p + 6, end ), *nameEnd = name;
+			while (!EndOfLine( nameEnd, end )) nameEnd++;
+			while (nameEnd > name && (nameEnd[-1] == ' ' || nameEnd[-1] == '\t')) nameEnd--;
+			chunk.mtllib = string( name, nameEnd - name );
+		}
+		p = SkipLine( p, end );
+	}
+}
+
+} // namespace
+
 //  +-----------------------------------------------------------------------------+
 //  |  HostMesh::LoadGeometryFromObj                                              |
-//  |  Load an obj file using tinyobj.                                      LH2'19|
+//  |  Load an obj file. The file is memory mapped and parsed in parallel; the    |
+//  |  triangles are written directly to the final vertex and triangle arrays.    |
+//  |  Materials are still read using tinyobj.                              LH2'20|
 //  +-----------------------------------------------------------------------------+
 void HostMesh::LoadGeometryFromOBJ( const string& fileName, const char* directory, const mat4& transform, const bool flatShaded )
 {
-	// load obj file
-	tinyobj::attrib_t attrib;
-	vector<tinyobj::shape_t> shapes;
-	vector<tinyobj::material_t> materials;
-	map<string, GLuint> textures;
-	string err, warn;
+	// map the obj file
 	Timer timer;
 	timer.reset();
-	tinyobj::LoadObj( &attrib, &shapes, &materials, &err, &warn, fileName.c_str(), directory );
-	FATALERROR_IF( err.size() > 0 || shapes.size() == 0, "tinyobj failed to load %s: %s", fileName.c_str(), err.c_str() );
+	MappedFile file( fileName.c_str() );
+	FATALERROR_IF( file.data == 0, "failed to open %s", fileName.c_str() );
+	// split the file in line-aligned chunks of at least 256KB and parse these concurrently
+	JobManager* jm = JobManager::GetJobManager();
+	const size_t minChunkSize = 256 * 1024;
+	const int chunkCount = (int)max( (size_t)1, min( (size_t)jm->GetNumThreads() * 4, file.size / minChunkSize ) );
+	vector<OBJChunk> chunks( chunkCount );
+	const char* fileEnd = file.data + file.size;
+	for (int i = 0; i < chunkCount; i++)
+	{
+		chunks[i].start = i == 0 ? file.data : chunks[i - 1].end;
+		chunks[i].end = i == chunkCount - 1 ? fileEnd : max( chunks[i].start, file.data + (file.size * (i + 1)) / chunkCount );
+		while (chunks[i].end < fileEnd && chunks[i].end > file.data && chunks[i].end[-1] != '\n') chunks[i].end++;
+	}
+	jm->ParallelFor( 0, chunkCount, 1, [&]( int first, int last ) { for (int i = first; i < last; i++) ParseOBJChunk( chunks[i] ); } );
+	// prefix sums over the chunks; resolve material inheritance across chunk boundaries
+	int vCount = 0, vtCount = 0, vnCount = 0, triCount = 0;
+	string mtllib;
+	for (auto& chunk : chunks)
+	{
+		chunk.vBase = vCount, chunk.vtBase = vtCount, chunk.vnBase = vnCount, chunk.triBase = triCount;
+		vCount += (int)chunk.v.size(), vtCount += (int)chunk.vt.size(), vnCount += (int)chunk.vn.size();
+		triCount += (int)chunk.faceMaterial.size();
+		if (mtllib.size() == 0) mtllib = chunk.mtllib;
+	}
+	FATALERROR_IF( triCount == 0, "failed to load %s: no faces found", fileName.c_str() );
 	printf( "loaded mesh in %5.3fs\n", timer.elapsed() );
 	// material offset: if we loaded an object before this one, material indices should not start at 0.
 	int matIdxOffset = (int)HostScene::materials.size();
 	// process materials
 	timer.reset();
+	vector<tinyobj::material_t> materials;
+	map<string, int> materialMap;
+	if (mtllib.size() > 0)
+	{
+		string mtlFile = string( directory ) + (directory[strlen( directory ) - 1] == '/' ? "" : "/") + mtllib, warn, err;
+		std::ifstream mtlStream( mtlFile );
+		if (mtlStream) tinyobj::LoadMtl( &materialMap, &materials, &mtlStream, &warn, &err );
+		else printf( "material file %s not found\n", mtlFile.c_str() );
+	}
 	char currDir[1024];
 	getcwd( currDir, 1024 ); // GetCurrentDirectory( 1024, currDir );
 	chdir( directory ); // SetCurrentDirectory( directory );
@@ -162,145 +340,169 @@ void HostMesh::LoadGeometryFromOBJ( const string& fileName, const char* director
 		materialList.push_back( material->ID );
 	}
 	chdir( currDir ); // SetCurrentDirectory( currDir );
+	// translate usemtl names to material ids; a chunk starts with the material that the previous chunk ended with
+	int activeMaterial = -1;
+	for (auto& chunk : chunks)
+	{
+		vector<int> ids;
+		for (auto& name : chunk.usemtl)
+		{
+			auto m = materialMap.find( name );
+			ids.push_back( m == materialMap.end() ? -1 : m->second );
+		}
+		for (auto& m : chunk.faceMaterial) m = m == OBJ_INHERIT ? activeMaterial : ids[m];
+		if (chunk.faceMaterial.size() > 0) activeMaterial = chunk.faceMaterial.back();
+		if (ids.size() > 0) activeMaterial = ids.back();
+	}
 	printf( "materials finalized in %5.3fs\n", timer.elapsed() );
-	// calculate values for consistent normal interpolation
-	const uint verts = (uint)attrib.normals.size() / 3;
-	vector<float> alphas;
+	// gather attributes in continuous arrays so that faces can index them directly;
+	// this overlaps with the texture loads that were started by the material conversion.
+	vector<float3> positions( vCount ), normals( vnCount );
+	vector<float2> uvs( vtCount );
+	jm->ParallelFor( 0, chunkCount, 1, [&]( int first, int last ) {
+		for (int i = first; i < last; i++)
+		{
+			OBJChunk& chunk = chunks[i];
+			if (chunk.v.size()) memcpy( positions.data() + chunk.vBase, chunk.v.data(), chunk.v.size() * sizeof( float3 ) );
+			if (chunk.vn.size()) memcpy( normals.data() + chunk.vnBase, chunk.vn.data(), chunk.vn.size() * sizeof( float3 ) );
+			if (chunk.vt.size()) memcpy( uvs.data() + chunk.vtBase, chunk.vt.data(), chunk.vt.size() * sizeof( float2 ) );
+			for (auto& c : chunk.corners)
+			{
+				c = make_int3( ResolveOBJIndex( c.x, chunk.vBase ), ResolveOBJIndex( c.y, chunk.vtBase ), ResolveOBJIndex( c.z, chunk.vnBase ) );
+				FATALERROR_IF( (uint)c.x >= (uint)vCount, "invalid vertex index in %s", fileName.c_str() );
+				if ((uint)c.y >= (uint)vtCount) c.y = -1; // ignore invalid texcoord and normal references
+				if ((uint)c.z >= (uint)vnCount) c.z = -1;
+			}
+			vector<float3>().swap( chunk.v ), vector<float3>().swap( chunk.vn ), vector<float2>().swap( chunk.vt );
+		}
+	} );
+	// calculate values for consistent normal interpolation; one alpha value per unique vertex normal.
+	// Alphas are positive floats, so their bit patterns can be compared as integers for an atomic min.
 	timer.reset();
-	alphas.resize( verts, 1.0f ); // we will have one alpha value per unique vertex normal
-	for (uint s = (uint)shapes.size(), i = 0; i < s; i++)
-	{
-		vector<tinyobj::index_t>& indices = shapes[i].mesh.indices;
-		if (flatShaded) for (uint s = (uint)indices.size(), f = 0; f < s; f++) alphas[indices[f].normal_index] = 1; else
-			for (uint s = (uint)indices.size(), f = 0; f < s; f += 3)
+	vector<std::atomic<uint>> minDots( vnCount );
+	jm->ParallelFor( 0, vnCount, 0, [&]( int first, int last ) { for (int i = first; i < last; i++) minDots[i] = FloatBits( 1.0f ); } );
+	if (!flatShaded) jm->ParallelFor( 0, chunkCount, 1, [&]( int first, int last ) {
+		for (int i = first; i < last; i++) for (int s = (int)chunks[i].corners.size(), f = 0; f < s; f += 3)
+		{
+			const int3* c = chunks[i].corners.data() + f;
+			if (c[0].z < 0 || c[1].z < 0 || c[2].z < 0) continue;
+			const float3 vert0 = positions[c[0].x], vert1 = positions[c[1].x], vert2 = positions[c[2].x];
+			const float3 vN0 = normals[c[0].z], vN1 = normals[c[1].z], vN2 = normals[c[2].z];
+			float3 N = normalize( cross( vert1 - vert0, vert2 - vert0 ) );
+			if (dot( N, vN0 ) < 0 && dot( N, vN1 ) < 0 && dot( N, vN2 ) < 0) N *= -1.0f; // flip if not consistent with vertex normals
+			// loop over vertices
+			// Note: we clamp at approx. 45 degree angles; beyond this the approach fails.
+			for (int j = 0; j < 3; j++)
 			{
-				const int idx0 = indices[f + 0].vertex_index, nidx0 = indices[f + 0].normal_index;
-				const int idx1 = indices[f + 1].vertex_index, nidx1 = indices[f + 1].normal_index;
-				const int idx2 = indices[f + 2].vertex_index, nidx2 = indices[f + 2].normal_index;
-				const float3 vert0 = make_float3( attrib.vertices[idx0 * 3 + 0], attrib.vertices[idx0 * 3 + 1], attrib.vertices[idx0 * 3 + 2] );
-				const float3 vert1 = make_float3( attrib.vertices[idx1 * 3 + 0], attrib.vertices[idx1 * 3 + 1], attrib.vertices[idx1 * 3 + 2] );
-				const float3 vert2 = make_float3( attrib.vertices[idx2 * 3 + 0], attrib.vertices[idx2 * 3 + 1], attrib.vertices[idx2 * 3 + 2] );
-				const float3 vN0 = make_float3( attrib.normals[nidx0 * 3 + 0], attrib.normals[nidx0 * 3 + 1], attrib.normals[nidx0 * 3 + 2] );
-				const float3 vN1 = make_float3( attrib.normals[nidx1 * 3 + 0], attrib.normals[nidx1 * 3 + 1], attrib.normals[nidx1 * 3 + 2] );
-				const float3 vN2 = make_float3( attrib.normals[nidx2 * 3 + 0], attrib.normals[nidx2 * 3 + 1], attrib.normals[nidx2 * 3 + 2] );
-				float3 N = normalize( cross( vert1 - vert0, vert2 - vert0 ) );
-				if (dot( N, vN0 ) < 0 && dot( N, vN1 ) < 0 && dot( N, vN2 ) < 0) N *= -1.0f; // flip if not consistent with vertex normals
-				// loop over vertices
-				// Note: we clamp at approx. 45 degree angles; beyond this the approach fails.
-				alphas[nidx0] = min( alphas[nidx0], max( 0.7f, dot( vN0, N ) ) );
-				alphas[nidx1] = min( alphas[nidx1], max( 0.7f, dot( vN1, N ) ) );
-				alphas[nidx2] = min( alphas[nidx2], max( 0.7f, dot( vN2, N ) ) );
+				const uint d = FloatBits( max( 0.7f, dot( normals[c[j].z], N ) ) );
+				std::atomic<uint>& a = minDots[c[j].z];
+				for (uint cur = a.load( std::memory_order_relaxed ); d < cur && !a.compare_exchange_weak( cur, d, std::memory_order_relaxed ););
 			}
-	}
+		}
+	} );
 	// finalize alpha values based on max dots
 	const float w = 0.03632f;
-	for (uint i = 0; i < verts; i++)
-	{
-		const float nnv = alphas[i]; // temporarily stored there
-		alphas[i] = acosf( nnv ) * (1 + w * (1 - nnv) * (1 - nnv));
-	}
+	vector<float> alphas( vnCount );
+	jm->ParallelFor( 0, vnCount, 0, [&]( int first, int last ) {
+		for (int i = first; i < last; i++)
+		{
+			const float nnv = BitsToFloat( minDots[i].load( std::memory_order_relaxed ) );
+			alphas[i] = acosf( nnv ) * (1 + w * (1 - nnv) * (1 - nnv));
+		}
+	} );
+	vector<std::atomic<uint>>().swap( minDots );
 	printf( "calculated vertex alphas in %5.3fs\n", timer.elapsed() );
-	// extract data for ray tracing: raw vertex and index data
-	aabb sceneBounds;
-	int toReserve = 0;
+	// extract data for ray tracing and full model data, directly into the final arrays;
+	// the triangle LOD calculation needs the texture dimensions.
 	timer.reset();
-	for (auto& shape : shapes) toReserve += (int)shape.mesh.indices.size();
-	vertices.reserve( toReserve );
-	for (auto& shape : shapes) for (int f = 0; f < shape.mesh.indices.size(); f += 3)
-	{
-		const uint idx0 = shape.mesh.indices[f + 0].vertex_index;
-		const uint idx1 = shape.mesh.indices[f + 1].vertex_index;
-		const uint idx2 = shape.mesh.indices[f + 2].vertex_index;
-		const float3 v0 = make_float3( attrib.vertices[idx0 * 3 + 0], attrib.vertices[idx0 * 3 + 1], attrib.vertices[idx0 * 3 + 2] );
-		const float3 v1 = make_float3( attrib.vertices[idx1 * 3 + 0], attrib.vertices[idx1 * 3 + 1], attrib.vertices[idx1 * 3 + 2] );
-		const float3 v2 = make_float3( attrib.vertices[idx2 * 3 + 0], attrib.vertices[idx2 * 3 + 1], attrib.vertices[idx2 * 3 + 2] );
-		const float4 tv0 = make_float4( v0, 1 ) * transform;
-		const float4 tv1 = make_float4( v1, 1 ) * transform;
-		const float4 tv2 = make_float4( v2, 1 ) * transform;
-		vertices.push_back( tv0 );
-		vertices.push_back( tv1 );
-		vertices.push_back( tv2 );
-		sceneBounds.Grow( make_float3( tv0 ) );
-		sceneBounds.Grow( make_float3( tv1 ) );
-		sceneBounds.Grow( make_float3( tv2 ) );
-	}
-	printf( "created polygon soup for %i triangles in %5.3fs\n", (int)vertices.size() / 3, timer.elapsed() );
-	printf( "scene bounds: (%5.2f,%5.2f,%5.2f)-(%5.2f,%5.2f,%5.2f)\n",
-		sceneBounds.bmin3.x, sceneBounds.bmin3.y, sceneBounds.bmin3.z,
-		sceneBounds.bmax3.x, sceneBounds.bmax3.y, sceneBounds.bmax3.z );
-	// extract full model data and materials
-	timer.reset();
-	triangles.resize( vertices.size() / 3 );
-	for (int s = (int)shapes.size(), face = 0, i = 0; i < s; i++)
-	{
-		vector<tinyobj::index_t>& indices = shapes[i].mesh.indices;
-		for (int s = (int)shapes[i].mesh.indices.size(), f = 0; f < s; f += 3, face++)
+	HostScene::WaitForTextures();
+	vertices.resize( triCount * 3 );
+	triangles.resize( triCount );
+	vector<aabb> chunkBounds( chunkCount );
+	jm->ParallelFor( 0, chunkCount, 1, [&]( int first, int last ) {
+		for (int i = first; i < last; i++)
 		{
-			HostTri& tri = triangles[face];
-			tri.vertex0 = make_float3( vertices[face * 3 + 0] );
-			tri.vertex1 = make_float3( vertices[face * 3 + 1] );
-			tri.vertex2 = make_float3( vertices[face * 3 + 2] );
-			const int tidx0 = indices[f + 0].texcoord_index, nidx0 = indices[f + 0].normal_index, idx0 = indices[f + 0].vertex_index;
-			const int tidx1 = indices[f + 1].texcoord_index, nidx1 = indices[f + 1].normal_index, idx1 = indices[f + 1].vertex_index;
-			const int tidx2 = indices[f + 2].texcoord_index, nidx2 = indices[f + 2].normal_index, idx2 = indices[f + 2].vertex_index;
-			tri.vN0 = make_float3( attrib.normals[nidx0 * 3 + 0], attrib.normals[nidx0 * 3 + 1], attrib.normals[nidx0 * 3 + 2] );
-			tri.vN1 = make_float3( attrib.normals[nidx1 * 3 + 0], attrib.normals[nidx1 * 3 + 1], attrib.normals[nidx1 * 3 + 2] );
-			tri.vN2 = make_float3( attrib.normals[nidx2 * 3 + 0], attrib.normals[nidx2 * 3 + 1], attrib.normals[nidx2 * 3 + 2] );
-			const float3 e1 = tri.vertex1 - tri.vertex0;
-			const float3 e2 = tri.vertex2 - tri.vertex0;
-			float3 N = normalize( cross( e1, e2 ) );
-			if (dot( N, tri.vN0 ) < 0) N *= -1.0f; // flip face normal if not consistent with vertex normal
-			if (flatShaded) tri.vN0 = tri.vN1 = tri.vN2 = N;
-			if (tidx0 > -1)
+			const OBJChunk& chunk = chunks[i];
+			aabb& bounds = chunkBounds[i];
+			bounds.Reset();
+			for (int s = (int)chunk.faceMaterial.size(), t = 0; t < s; t++)
 			{
-				tri.u0 = attrib.texcoords[tidx0 * 2 + 0], tri.v0 = attrib.texcoords[tidx0 * 2 + 1];
-				tri.u1 = attrib.texcoords[tidx1 * 2 + 0], tri.v1 = attrib.texcoords[tidx1 * 2 + 1];
-				tri.u2 = attrib.texcoords[tidx2 * 2 + 0], tri.v2 = attrib.texcoords[tidx2 * 2 + 1];
-				// calculate tangent vectors
-				float2 uv01 = make_float2( tri.u1 - tri.u0, tri.v1 - tri.v0 );
-				float2 uv02 = make_float2( tri.u2 - tri.u0, tri.v2 - tri.v0 );
-				if (dot( uv01, uv01 ) == 0 || dot( uv02, uv02 ) == 0)
+				const int face = chunk.triBase + t;
+				const int3* c = chunk.corners.data() + t * 3;
+				const float4 tv0 = make_float4( positions[c[0].x], 1 ) * transform;
+				const float4 tv1 = make_float4( positions[c[1].x], 1 ) * transform;
+				const float4 tv2 = make_float4( positions[c[2].x], 1 ) * transform;
+				vertices[face * 3 + 0] = tv0;
+				vertices[face * 3 + 1] = tv1;
+				vertices[face * 3 + 2] = tv2;
+				bounds.Grow( make_float3( tv0 ) );
+				bounds.Grow( make_float3( tv1 ) );
+				bounds.Grow( make_float3( tv2 ) );
+				HostTri& tri = triangles[face];
+				tri.vertex0 = make_float3( tv0 );
+				tri.vertex1 = make_float3( tv1 );
+				tri.vertex2 = make_float3( tv2 );
+				const float3 e1 = tri.vertex1 - tri.vertex0;
+				const float3 e2 = tri.vertex2 - tri.vertex0;
+				float3 N = normalize( cross( e1, e2 ) );
+				const bool hasNormals = c[0].z > -1 && c[1].z > -1 && c[2].z > -1;
+				if (hasNormals)
 				{
-					tri.T = normalize( tri.vertex1 - tri.vertex0 );
-					tri.B = normalize( cross( N, tri.T ) );
+					tri.vN0 = normals[c[0].z], tri.vN1 = normals[c[1].z], tri.vN2 = normals[c[2].z];
+					if (dot( N, tri.vN0 ) < 0) N *= -1.0f; // flip face normal if not consistent with vertex normal
+				}
+				if (flatShaded || !hasNormals) tri.vN0 = tri.vN1 = tri.vN2 = N;
+				if (c[0].y > -1 && c[1].y > -1 && c[2].y > -1)
+				{
+					tri.u0 = uvs[c[0].y].x, tri.v0 = uvs[c[0].y].y;
+					tri.u1 = uvs[c[1].y].x, tri.v1 = uvs[c[1].y].y;
+					tri.u2 = uvs[c[2].y].x, tri.v2 = uvs[c[2].y].y;
+					// calculate tangent vectors
+					float2 uv01 = make_float2( tri.u1 - tri.u0, tri.v1 - tri.v0 );
+					float2 uv02 = make_float2( tri.u2 - tri.u0, tri.v2 - tri.v0 );
+					if (dot( uv01, uv01 ) == 0 || dot( uv02, uv02 ) == 0)
+					{
+						tri.T = normalize( tri.vertex1 - tri.vertex0 );
+						tri.B = normalize( cross( N, tri.T ) );
+					}
+					else
+					{
+						tri.T = normalize( e1 * uv02.y - e2 * uv01.y );
+						tri.B = normalize( e2 * uv01.x - e1 * uv02.x );
+					}
 				}
 				else
 				{
-					tri.T = normalize( e1 * uv02.y - e2 * uv01.y );
-					tri.B = normalize( e2 * uv01.x - e1 * uv02.x );
+					tri.T = normalize( e1 );
+					tri.B = normalize( cross( N, tri.T ) );
+				}
+				tri.Nx = N.x, tri.Ny = N.y, tri.Nz = N.z;
+				tri.material = chunk.faceMaterial[t] + matIdxOffset;
+				tri.area = 0; // we don't actually use it, except for lights, where it is also calculated
+				tri.invArea = 0; // todo
+				if (hasNormals) tri.alpha = make_float3( alphas[c[0].z], alphas[c[1].z], alphas[c[2].z] );
+				else tri.alpha = make_float3( 0 );
+				// calculate triangle LOD data
+				if (tri.material >= (uint)HostScene::materials.size()) continue; // an unset material (-1) wraps to a large index
+				HostMaterial* mat = HostScene::materials[tri.material];
+				int textureID = mat->color.textureID;
+				if (textureID > -1)
+				{
+					HostTexture* texture = HostScene::textures[textureID];
+					float Ta = (float)(texture->width * texture->height) * fabs( (tri.u1 - tri.u0) * (tri.v2 - tri.v0) - (tri.u2 - tri.u0) * (tri.v1 - tri.v0) );
+					float Pa = length( cross( tri.vertex1 - tri.vertex0, tri.vertex2 - tri.vertex0 ) );
+					tri.LOD = 0.5f * log2f( Ta / Pa );
 				}
-			}
-			else
-			{
-				tri.T = normalize( e1 );
-				tri.B = normalize( cross( N, tri.T ) );
-			}
-			tri.Nx = N.x, tri.Ny = N.y, tri.Nz = N.z;
-			tri.material = shapes[i].mesh.material_ids[f / 3] + matIdxOffset;
-		#if 0
-			const float a = (tri.vertex1 - tri.vertex0).length();
-			const float b = (tri.vertex2 - tri.vertex1).length();
-			const float c = (tri.vertex0 - tri.vertex2).length();
-			const float s = (a + b + c) * 0.5f;
-			tri.area = sqrtf( s * (s - a) * (s - b) * (s - c) ); // Heron's formula
-		#else
-			tri.area = 0; // we don't actually use it, except for lights, where it is also calculated
-		#endif
-			tri.invArea = 0; // todo
-			tri.alpha = make_float3( alphas[nidx0], tri.alpha.y = alphas[nidx1], tri.alpha.z = alphas[nidx2] );
-			// calculate triangle LOD data
-			HostMaterial* mat = HostScene::materials[tri.material];
-			int textureID = mat->color.textureID;
-			if (textureID > -1)
-			{
-				HostTexture* texture = HostScene::textures[textureID];
-				float Ta = (float)(texture->width * texture->height) * fabs( (tri.u1 - tri.u0) * (tri.v2 - tri.v0) - (tri.u2 - tri.u0) * (tri.v1 - tri.v0) );
-				float Pa = length( cross( tri.vertex1 - tri.vertex0, tri.vertex2 - tri.vertex0 ) );
-				tri.LOD = 0.5f * log2f( Ta / Pa );
 			}
 		}
-	}
-	printf( "verbose triangle data in %5.3fs\n", timer.elapsed() );
+	} );
+	aabb sceneBounds;
+	sceneBounds.Reset();
+	for (auto& bounds : chunkBounds) sceneBounds.Grow( bounds );
+	printf( "created %i triangles in %5.3fs\n", triCount, timer.elapsed() );
+	printf( "scene bounds: (%5.2f,%5.2f,%5.2f)-(%5.2f,%5.2f,%5.2f)\n",
+		sceneBounds.bmin3.x, sceneBounds.bmin3.y, sceneBounds.bmin3.z,
+		sceneBounds.bmax3.x, sceneBounds.bmax3.y, sceneBounds.bmax3.z );
 }
 
 //  +-----------------------------------------------------------------------------+
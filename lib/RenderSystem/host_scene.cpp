@@ -14,6 +14,12 @@
 */
 
 #include "rendersystem.h"
+#ifdef _MSC_VER
+#include <direct.h>
+#define getcwd _getcwd
+#else
+#include <unistd.h>
+#endif
 
 // forward declaration of the PBRT scene loader functions
 void PBRTInit();
@@ -33,10 +39,12 @@ HostScene::HostScene()
 //  +-----------------------------------------------------------------------------+
 HostScene::~HostScene()
 {
+	WaitForTextures();
 	// clean up allocated objects
 	for (auto mesh : meshPool) delete mesh;
 	for (auto material : materials) delete material;
 	for (auto texture : textures) delete texture;
+	for (auto file : mappedFiles) delete file;
 	delete sky;
 	delete camera;
 }
@@ -144,6 +152,272 @@ void HostScene::DeserializeMaterials( const char* xmlFile )
 	}
 }
 
+//  +-----------------------------------------------------------------------------+
+//  |  Compiled scene file helpers.                                               |
+//  |  A compiled scene stores the scene data in the layout used at run time.     |
+//  |  Bulk data (vertices, triangles, texels) is 64-byte aligned in the file,    |
+//  |  so that it can be used directly from a memory-mapped view.           LH2'20|
+//  +-----------------------------------------------------------------------------+
+namespace {
+
+struct CompiledSceneHeader
+{
+	uint version = COMPILEDSCENEVERSION;
+	uint coreMaterialSize = sizeof( CoreMaterial );		// layout check: the file is only valid for identical structs
+	uint hostTriSize = sizeof( HostTri );
+	uint textureCount = 0, materialCount = 0, meshCount = 0, nodeCount = 0, rootNodeCount = 0;
+	uint pointLightCount = 0, spotLightCount = 0, directionalLightCount = 0;
+};
+
+struct CompiledSceneWriter
+{
+	FILE* f = 0;
+	void Write( const void* data, const size_t size ) { if (size > 0) fwrite( data, 1, size, f ); }
+	template <class T> void Write( const T& value ) { Write( &value, sizeof( T ) ); }
+	void WriteString( const string& s ) { Write( (uint)s.size() ); Write( s.data(), s.size() ); }
+	template <class T> void WriteVector( const vector<T>& v ) { Write( (uint)v.size() ); Write( v.data(), v.size() * sizeof( T ) ); }
+	void Align() { static const char zeroes[64] = {}; Write( zeroes, (64 - (ftell( f ) & 63)) & 63 ); }
+};
+
+struct CompiledSceneReader
+{
+	const char* data = 0, *pos = 0, *end = 0;
+	const char* Skip( const size_t size ) { FATALERROR_IF( (size_t)(end - pos) < size, "compiled scene file is truncated" ); const char* p = pos; pos += size; return p; }
+	template <class T> T Read() { T value; memcpy( &value, Skip( sizeof( T ) ), sizeof( T ) ); return value; }
+	string ReadString() { const uint size = Read<uint>(); return string( Skip( size ), size ); }
+	template <class T> void ReadVector( vector<T>& v ) { const uint size = Read<uint>(); v.resize( size ); if (size) memcpy( v.data(), Skip( size * sizeof( T ) ), size * sizeof( T ) ); }
+	void Align() { Skip( (64 - ((pos - data) & 63)) & 63 ); }
+};
+
+// offset the texture references of a material that was appended to an existing scene
+static void OffsetTextureIDs( HostMaterial* m, const int texBase )
+{
+	HostMaterial::Vec3Value* vec3s[] = { &m->color, &m->detailColor, &m->normals, &m->detailNormals, &m->absorption,
+		&m->Ks, &m->eta_rgb, &m->scatterDistance, &m->Kr, &m->opacity };
+	HostMaterial::ScalarValue* scalars[] = { &m->metallic, &m->subsurface, &m->specular, &m->roughness, &m->specularTint,
+		&m->anisotropic, &m->sheen, &m->sheenTint, &m->clearcoat, &m->clearcoatGloss, &m->transmission, &m->eta,
+		&m->reflection, &m->refraction, &m->ior, &m->urough, &m->vrough, &m->sigma, &m->specTrans, &m->diffTrans, &m->flatness };
+	for (auto v : vec3s) if (v->textureID > -1) v->textureID += texBase;
+	for (auto s : scalars) if (s->textureID > -1) s->textureID += texBase;
+}
+
+} // namespace
+
+//  +-----------------------------------------------------------------------------+
+//  |  HostScene::ExportCompiledScene                                             |
+//  |  Write the scene to a single binary file, which can be loaded without any   |
+//  |  parsing or conversion: meshes are stored as final vertex and triangle      |
+//  |  arrays, textures include their MIP chains. Skins and animations are not    |
+//  |  stored; skinned meshes are exported in their current pose.           LH2'20|
+//  +-----------------------------------------------------------------------------+
+void HostScene::ExportCompiledScene( const char* sceneFile )
+{
+	CompiledSceneWriter out;
+#ifdef _MSC_VER
+	fopen_s( &out.f, sceneFile, "wb" );
+#else
+	out.f = fopen( sceneFile, "wb" );
+#endif
+	FATALERROR_IF( !out.f, "could not create compiled scene file %s", sceneFile );
+	WaitForTextures();
+	if (skins.size() > 0 || animations.size() > 0) printf( "warning: skins and animations are not stored in %s\n", sceneFile );
+	CompiledSceneHeader header;
+	header.textureCount = (uint)textures.size();
+	header.materialCount = (uint)materials.size();
+	header.meshCount = (uint)meshPool.size();
+	header.nodeCount = (uint)nodePool.size();
+	header.rootNodeCount = (uint)rootNodes.size();
+	header.pointLightCount = (uint)pointLights.size();
+	header.spotLightCount = (uint)spotLights.size();
+	header.directionalLightCount = (uint)directionalLights.size();
+	out.Write( header );
+	// textures, including MIP levels
+	for (auto texture : textures)
+	{
+		const int dataType = texture->fdata ? 0 : 1;
+		out.Write( dataType );
+		out.Write( texture->width ), out.Write( texture->height ), out.Write( texture->MIPlevels );
+		out.Write( texture->flags ), out.Write( texture->mods ), out.Write( texture->refCount );
+		out.WriteString( texture->name );
+		out.WriteString( texture->origin );
+		out.Align();
+		const int pixelCount = texture->PixelsNeeded( texture->width, texture->height, MIPLEVELCOUNT );
+		if (dataType == 0) out.Write( texture->fdata, sizeof( float4 ) * pixelCount ); else out.Write( texture->idata, sizeof( uchar4 ) * pixelCount );
+	}
+	// materials: the part that is sent to the cores is stored as-is
+	for (auto material : materials)
+	{
+		out.WriteString( material->name );
+		out.WriteString( material->origin );
+		out.Write( material->refCount );
+		out.Write( material, sizeof( CoreMaterial ) );
+	}
+	// meshes
+	for (auto mesh : meshPool)
+	{
+		out.WriteString( mesh->name );
+		out.WriteVector( mesh->materialList );
+		out.Write( mesh->excludeFromNavmesh );
+		out.Write( (uint)mesh->vertices.size() );
+		out.Write( (uint)mesh->triangles.size() );
+		out.Align();
+		out.Write( mesh->vertices.data(), mesh->vertices.size() * sizeof( float4 ) );
+		out.Align();
+		// light triangle indices are rebuilt when the nodes are created
+		vector<HostTri> tris( mesh->triangles );
+		for (auto& tri : tris) tri.ltriIdx = -1;
+		out.Write( tris.data(), tris.size() * sizeof( HostTri ) );
+	}
+	// nodes; deleted nodes are kept as holes so that node indices remain valid
+	for (auto node : nodePool)
+	{
+		out.Write( (uint)(node != 0) );
+		if (!node) continue;
+		out.WriteString( node->name );
+		out.Write( node->meshID );
+		out.Write( node->localTransform ), out.Write( node->matrix );
+		out.Write( node->translation ), out.Write( node->rotation ), out.Write( node->scale );
+		out.WriteVector( node->weights );
+		out.WriteVector( node->childIdx );
+	}
+	for (int nodeIdx : rootNodes) out.Write( nodeIdx );
+	// lights; light triangles are derived from emissive materials
+	for (auto light : pointLights) out.Write( light->position ), out.Write( light->radiance ), out.Write( light->enabled );
+	for (auto light : spotLights)
+		out.Write( light->position ), out.Write( light->direction ), out.Write( light->radiance ),
+		out.Write( light->cosInner ), out.Write( light->cosOuter ), out.Write( light->enabled );
+	for (auto light : directionalLights) out.Write( light->direction ), out.Write( light->radiance ), out.Write( light->enabled );
+	fclose( out.f );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  HostScene::LoadCompiledScene                                               |
+//  |  Add the contents of a compiled scene file to the scene. The file is        |
+//  |  memory mapped; texture data is used directly from the mapped view, mesh    |
+//  |  data is copied to the meshes in a single pass. Like AddScene for glTF      |
+//  |  files, an extra node holds the supplied transform.                   LH2'20|
+//  +-----------------------------------------------------------------------------+
+int HostScene::LoadCompiledScene( const char* sceneFile, const mat4& transform )
+{
+	Timer timer;
+	// copy-on-write: texture data may be modified in place without affecting the file
+	MappedFile* file = new MappedFile( sceneFile, true );
+	FATALERROR_IF( file->data == 0, "could not open compiled scene file %s", sceneFile );
+	CompiledSceneReader in;
+	in.data = in.pos = file->data;
+	in.end = file->data + file->size;
+	const CompiledSceneHeader header = in.Read<CompiledSceneHeader>();
+	FATALERROR_IF( header.version != COMPILEDSCENEVERSION || header.coreMaterialSize != sizeof( CoreMaterial ) || header.hostTriSize != sizeof( HostTri ),
+		"compiled scene %s was created by an incompatible version; please export it again", sceneFile );
+	// offsets: if we loaded a scene before this one, indices should not start at 0.
+	const int texBase = (int)textures.size();
+	const int matBase = (int)materials.size();
+	const int meshBase = (int)meshPool.size();
+	const int nodeBase = (int)nodePool.size() + 1;
+	// textures
+	for (uint i = 0; i < header.textureCount; i++)
+	{
+		HostTexture* texture = new HostTexture();
+		const int dataType = in.Read<int>();
+		texture->width = in.Read<uint>(), texture->height = in.Read<uint>(), texture->MIPlevels = in.Read<uint>();
+		texture->flags = in.Read<uint>(), texture->mods = in.Read<uint>(), texture->refCount = in.Read<uint>();
+		texture->name = in.ReadString();
+		texture->origin = in.ReadString();
+		in.Align();
+		const int pixelCount = texture->PixelsNeeded( texture->width, texture->height, MIPLEVELCOUNT );
+		if (dataType == 0) texture->fdata = (float4*)in.Skip( sizeof( float4 ) * pixelCount );
+		else texture->idata = (uchar4*)in.Skip( sizeof( uchar4 ) * pixelCount );
+		texture->ID = (uint)textures.size();
+		textures.push_back( texture );
+	}
+	// materials
+	for (uint i = 0; i < header.materialCount; i++)
+	{
+		HostMaterial* material = new HostMaterial();
+		material->name = in.ReadString();
+		material->origin = in.ReadString();
+		material->refCount = in.Read<uint>();
+		memcpy( material, in.Skip( sizeof( CoreMaterial ) ), sizeof( CoreMaterial ) );
+		if (texBase > 0) OffsetTextureIDs( material, texBase );
+		material->ID = (int)materials.size();
+		materials.push_back( material );
+	}
+	// meshes
+	for (uint i = 0; i < header.meshCount; i++)
+	{
+		HostMesh* mesh = new HostMesh();
+		mesh->name = in.ReadString();
+		in.ReadVector( mesh->materialList );
+		for (auto& m : mesh->materialList) m += matBase;
+		mesh->excludeFromNavmesh = in.Read<bool>();
+		mesh->isAnimated = false;
+		const uint vertexCount = in.Read<uint>(), triCount = in.Read<uint>();
+		in.Align();
+		const float4* vertices = (const float4*)in.Skip( vertexCount * sizeof( float4 ) );
+		in.Align();
+		const HostTri* tris = (const HostTri*)in.Skip( triCount * sizeof( HostTri ) );
+		mesh->vertices.assign( vertices, vertices + vertexCount );
+		mesh->triangles.assign( tris, tris + triCount );
+		if (matBase > 0) JobManager::GetJobManager()->ParallelFor( 0, triCount, 0, [&]( int first, int last ) {
+			for (int t = first; t < last; t++) mesh->triangles[t].material += matBase;
+		} );
+		mesh->ID = (int)meshPool.size();
+		meshPool.push_back( mesh );
+	}
+	// push an extra node that holds a transform for the compiled scene
+	HostNode* rootNode = new HostNode();
+	rootNode->localTransform = transform;
+	rootNode->ID = nodeBase - 1;
+	nodePool.push_back( rootNode );
+	// nodes
+	for (uint i = 0; i < header.nodeCount; i++)
+	{
+		if (in.Read<uint>() == 0)
+		{
+			nodePool.push_back( 0 );
+			nodeListHoles++;
+			continue;
+		}
+		HostNode* node = new HostNode();
+		node->name = in.ReadString();
+		const int meshID = in.Read<int>();
+		node->meshID = meshID == -1 ? -1 : (meshID + meshBase);
+		node->localTransform = in.Read<mat4>(), node->matrix = in.Read<mat4>();
+		node->translation = in.Read<float3>(), node->rotation = in.Read<quat>(), node->scale = in.Read<float3>();
+		in.ReadVector( node->weights );
+		in.ReadVector( node->childIdx );
+		for (auto& c : node->childIdx) c += nodeBase;
+		node->ID = (int)nodePool.size();
+		nodePool.push_back( node );
+		// process light emitting surfaces
+		node->PrepareLights();
+	}
+	for (uint i = 0; i < header.rootNodeCount; i++) rootNode->childIdx.push_back( in.Read<int>() + nodeBase );
+	rootNodes.push_back( nodeBase - 1 );
+	// lights
+	for (uint i = 0; i < header.pointLightCount; i++)
+	{
+		const float3 pos = in.Read<float3>(), radiance = in.Read<float3>();
+		AddPointLight( pos, radiance, in.Read<bool>() );
+	}
+	for (uint i = 0; i < header.spotLightCount; i++)
+	{
+		const float3 pos = in.Read<float3>(), direction = in.Read<float3>(), radiance = in.Read<float3>();
+		const float cosInner = in.Read<float>(), cosOuter = in.Read<float>();
+		AddSpotLight( pos, direction, cosInner, cosOuter, radiance, in.Read<bool>() );
+	}
+	for (uint i = 0; i < header.directionalLightCount; i++)
+	{
+		const float3 direction = in.Read<float3>(), radiance = in.Read<float3>();
+		AddDirectionalLight( direction, radiance, in.Read<bool>() );
+	}
+	// keep the mapping alive; textures refer to it
+	mappedFiles.push_back( file );
+	printf( "loaded compiled scene in %5.3fs\n", timer.elapsed() );
+	// return index of first created node
+	return nodeBase - 1;
+}
+
 //  +-----------------------------------------------------------------------------+
 //  |  HostScene::Init                                                            |
 //  |  Prepare scene geometry for rendering.                                LH2'19|
@@ -253,9 +527,14 @@ int HostScene::AddScene( const char* sceneFile, const mat4& transform )
 		PBRTInit();
 		ParsePBRTScene( sceneFile );
 	}
+	else if (strstr( lastSlash + 1, ".lh2scene" ))
+	{
+		// load a compiled scene
+		retVal = LoadCompiledScene( sceneFile, transform );
+	}
 	else
 	{
-		// not a .pbrt file; must be a .gltf file
+		// not a .pbrt or .lh2scene file; must be a .gltf file
 		retVal = AddScene( lastSlash + 1, tmp, transform );
 	}
 	delete tmp;
@@ -287,7 +566,15 @@ int HostScene::AddScene( const char* sceneFile, const char* dir, const mat4& tra
 	if (!warn.empty()) printf( "Warn: %s\n", warn.c_str() );
 	if (!err.empty()) printf( "Err: %s\n", err.c_str() );
 	FATALERROR_IF( !ret, "could not load glTF file:\n%s", cleanFileName.c_str() );
-	// convert textures
+	// convert textures; only color textures hold sRGB data, the others are marked as linear
+	// so that their MIP levels are not averaged in linear space
+	vector<bool> colorTexture( gltfModel.textures.size(), false );
+	for (const tinygltf::Material& m : gltfModel.materials)
+	{
+		auto baseColor = m.values.find( "baseColorTexture" );
+		const int idx = baseColor != m.values.end() ? baseColor->second.TextureIndex() : m.pbrMetallicRoughness.baseColorTexture.index;
+		if (idx >= 0 && idx < (int)colorTexture.size()) colorTexture[idx] = true;
+	}
 	vector<int> texIdx;
 	for (size_t s = gltfModel.textures.size(), i = 0; i < s; i++)
 	{
@@ -312,8 +599,10 @@ int HostScene::AddScene( const char* sceneFile, const char* dir, const mat4& tra
 			texture->idata = (uchar4*)MALLOC64( texture->PixelsNeeded( image.width, image.height, MIPLEVELCOUNT ) * sizeof( uint ) );
 			texture->ID = (uint)textures.size();
 			texture->flags |= HostTexture::LDR;
+			if (!colorTexture[i]) texture->mods |= HostTexture::LINEARIZED;
 			memcpy( texture->idata, image.image.data(), size );
-			texture->ConstructMIPmaps();
+			// MIP levels are built on a worker thread while the meshes are converted
+			JobManager::GetJobManager()->Submit( [texture]() { texture->ConstructMIPmaps(); }, &textureJobs );
 			textures.push_back( texture );
 			texIdx.push_back( texture->ID );
 		}
@@ -523,16 +812,22 @@ int HostScene::FindTextureID( const char* name )
 //  |  increasing its refCount), otherwise, create a new texture and return its   |
 //  |  ID.                                                                  LH2'19|
 //  +-----------------------------------------------------------------------------+
-int HostScene::FindOrCreateTexture( const string& origin, const uint modFlags )
+int HostScene::FindOrCreateTexture( const string& origin, const uint modFlags, const uint flags )
 {
 	// search list for existing texture
 	for (auto texture : textures) if (texture->Equals( origin, modFlags ))
 	{
 		texture->refCount++;
+		if (flags)
+		{
+			// the texture may still be loading, and loading sets the flags
+			if (!texture->loading.Done()) JobManager::GetJobManager()->Wait( texture->loading );
+			texture->flags |= flags;
+		}
 		return texture->ID;
 	}
 	// nothing found, create a new texture
-	return CreateTexture( origin, modFlags );
+	return CreateTexture( origin, modFlags, flags );
 }
 
 //  +-----------------------------------------------------------------------------+
@@ -674,16 +969,44 @@ void HostScene::UpdateAnimation( const int animId, const float dt )
 //  +-----------------------------------------------------------------------------+
 //  |  HostScene::CreateTexture                                                   |
 //  |  Return a texture. Create it anew, even if a texture with the same origin   |
-//  |  already exists.                                                      LH2'19|
+//  |  already exists. The texture is loaded on a worker thread; 'flags' and      |
+//  |  'postLoad' are applied once loading completed. Use WaitForTextures        |
+//  |  before accessing the texture data.                                   LH2'20|
 //  +-----------------------------------------------------------------------------+
-int HostScene::CreateTexture( const string& origin, const uint modFlags )
+int HostScene::CreateTexture( const string& origin, const uint modFlags, const uint flags, const std::function<void( HostTexture* )>& postLoad )
 {
-	// create a new texture
-	HostTexture* newTexture = new HostTexture( origin.c_str(), modFlags );
+	// create a new texture; origin and mods are set in advance so it can be reused while loading
+	HostTexture* newTexture = new HostTexture();
+	newTexture->origin = origin;
+	newTexture->mods = modFlags;
 	textures.push_back( newTexture );
+	// resolve relative file names now; the current directory may change before the job runs
+	string path = origin;
+	if (path.size() > 0 && path[0] != '/' && path[0] != '\\' && path.find( ':' ) == string::npos)
+	{
+		char currDir[1024];
+		if (getcwd( currDir, 1024 )) path = string( currDir ) + "/" + path;
+	}
+	newTexture->loading.pending.fetch_add( 1, std::memory_order_relaxed );
+	JobManager::GetJobManager()->Submit( [newTexture, path, flags, postLoad]() {
+		newTexture->Load( path.c_str(), newTexture->mods );
+		if (postLoad) postLoad( newTexture );
+		newTexture->flags |= flags;
+		newTexture->loading.pending.fetch_sub( 1, std::memory_order_release );
+	}, &textureJobs );
 	return newTexture->ID = (int)textures.size() - 1;
 }
 
+//  +-----------------------------------------------------------------------------+
+//  |  HostScene::WaitForTextures                                                 |
+//  |  Block until all pending texture loads completed. The calling thread helps  |
+//  |  executing the pending jobs.                                          LH2'20|
+//  +-----------------------------------------------------------------------------+
+void HostScene::WaitForTextures()
+{
+	if (!textureJobs.Done()) JobManager::GetJobManager()->Wait( textureJobs );
+}
+
 //  +-----------------------------------------------------------------------------+
 //  |  HostScene::AddMaterial                                                     |
 //  |  Adds an existing HostMaterial* and returns the ID. If the material         |
@@ -62,12 +62,15 @@ public:
 	// serialization / deserialization
 	static void SerializeMaterials( const char* xmlFile );
 	static void DeserializeMaterials( const char* xmlFile );
+	static void ExportCompiledScene( const char* sceneFile );
+	static int LoadCompiledScene( const char* sceneFile, const mat4& transform = mat4::Identity() );
 	// methods
 	static void Init();
 	static void SetSkyDome( HostSkyDome* );
-	static int FindOrCreateTexture( const string& origin, const uint modFlags = 0 );
+	static int FindOrCreateTexture( const string& origin, const uint modFlags = 0, const uint flags = 0 );
 	static int FindTextureID( const char* name );
-	static int CreateTexture( const string& origin, const uint modFlags = 0 );
+	static int CreateTexture( const string& origin, const uint modFlags = 0, const uint flags = 0, const std::function<void( HostTexture* )>& postLoad = nullptr );
+	static void WaitForTextures();
 	static int FindOrCreateMaterial( const string& name );
 	static int FindOrCreateMaterialCopy( const int matID, const uint color );
 	static int FindMaterialID( const char* name );
@@ -110,6 +113,8 @@ public:
 	static inline vector<HostDirectionalLight*> directionalLights;
 	static inline HostSkyDome* sky;
 	static inline Camera* camera;
+	static inline vector<MappedFile*> mappedFiles;	// compiled scene files; textures use their data directly
+	static inline JobCounter textureJobs;			// textures that are being loaded on worker threads
 private:
 	static inline int nodeListHoles;	// zero if no instance deletions occurred; adding instances will be faster.
 };
@@ -51,8 +51,8 @@ CoreTexDesc HostTexture::ConvertToCoreTexDesc() const
 	{
 		gpuTex.fdata = fdata;
 		gpuTex.storage = TexelStorage::ARGB128;
-		gpuTex.pixelCount = PixelsNeeded( width, height, 1 );
-		gpuTex.MIPlevels = 1;
+		gpuTex.pixelCount = PixelsNeeded( width, height, MIPLEVELCOUNT );
+		gpuTex.MIPlevels = MIPLEVELCOUNT;
 		assert( (flags & NORMALMAP) == 0 );
 	}
 	else
@@ -121,32 +121,131 @@ int HostTexture::PixelsNeeded( const int width, const int height, const int MIPl
 	return needed;
 }
 
+//  +-----------------------------------------------------------------------------+
+//  |  MIP level reduction helpers.                                               |
+//  |  Each function produces one row of a MIP level from two rows of the level   |
+//  |  above it. Color channels are averaged, alpha uses the minimum.       LH2'20|
+//  +-----------------------------------------------------------------------------+
+static inline uint ReducePixel( const uint src0, const uint src1, const uint src2, const uint src3 )
+{
+	const uint a = min( min( (src0 >> 24) & 255, (src1 >> 24) & 255 ), min( (src2 >> 24) & 255, (src3 >> 24) & 255 ) );
+	const uint r = ((src0 >> 16) & 255) + ((src1 >> 16) & 255) + ((src2 >> 16) & 255) + ((src3 >> 16) & 255);
+	const uint g = ((src0 >> 8) & 255) + ((src1 >> 8) & 255) + ((src2 >> 8) & 255) + ((src3 >> 8) & 255);
+	const uint b = (src0 & 255) + (src1 & 255) + (src2 & 255) + (src3 & 255);
+	return (a << 24) + ((r >> 2) << 16) + ((g >> 2) << 8) + (b >> 2);
+}
+
+// 4 source pixels of two rows (a: top, b: bottom) to 2 destination pixels, as 16-bit channel sums
+static inline __m128i SumPairs( const __m128i a, const __m128i b )
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i lo = _mm_add_epi16( _mm_unpacklo_epi8( a, zero ), _mm_unpacklo_epi8( b, zero ) ); // pixels 0, 1
+	const __m128i hi = _mm_add_epi16( _mm_unpackhi_epi8( a, zero ), _mm_unpackhi_epi8( b, zero ) ); // pixels 2, 3
+	return _mm_unpacklo_epi64( _mm_add_epi16( lo, _mm_srli_si128( lo, 8 ) ), _mm_add_epi16( hi, _mm_srli_si128( hi, 8 ) ) );
+}
+// 4 source pixels of two rows to 2 destination pixels, byte-wise minimum in the lower 64 bits
+static inline __m128i MinPairs( const __m128i a, const __m128i b )
+{
+	__m128i m = _mm_min_epu8( a, b );
+	m = _mm_min_epu8( m, _mm_srli_epi64( m, 32 ) );
+	return _mm_shuffle_epi32( m, _MM_SHUFFLE( 2, 0, 2, 0 ) );
+}
+
+static void ReduceRow( const uint* row0, const uint* row1, uint* dst, const int w )
+{
+	int x = 0;
+	// 4 destination pixels (2 x 8 source pixels) per iteration
+	const __m128i alphaMask = _mm_set1_epi32( 0xff000000 );
+	for (; x + 4 <= w; x += 4)
+	{
+		const __m128i a0 = _mm_loadu_si128( (const __m128i*)(row0 + x * 2) ), a1 = _mm_loadu_si128( (const __m128i*)(row0 + x * 2 + 4) );
+		const __m128i b0 = _mm_loadu_si128( (const __m128i*)(row1 + x * 2) ), b1 = _mm_loadu_si128( (const __m128i*)(row1 + x * 2 + 4) );
+		const __m128i color = _mm_packus_epi16( _mm_srli_epi16( SumPairs( a0, b0 ), 2 ), _mm_srli_epi16( SumPairs( a1, b1 ), 2 ) );
+		const __m128i alpha = _mm_unpacklo_epi64( MinPairs( a0, b0 ), MinPairs( a1, b1 ) );
+		_mm_storeu_si128( (__m128i*)(dst + x), _mm_or_si128( _mm_andnot_si128( alphaMask, color ), _mm_and_si128( alphaMask, alpha ) ) );
+	}
+	for (; x < w; x++) dst[x] = ReducePixel( row0[x * 2], row0[x * 2 + 1], row1[x * 2], row1[x * 2 + 1] );
+}
+
+// sRGB tables: 8-bit sRGB to 14-bit linear, and 14-bit linear back to 8-bit sRGB. Four
+// 14-bit values sum to at most 16 bits, so the averaging fits in 16-bit SSE lanes
+struct SRGBTables
+{
+	SRGBTables()
+	{
+		for (int i = 0; i < 256; i++) toLinear[i] = (ushort)(HostTexture::InverseGammaCorrect( i / 255.0f ) * 16383 + 0.5f);
+		for (int i = 0; i < 16384; i++)
+		{
+			const float v = i / 16383.0f;
+			toSRGB[i] = (uchar)((v <= 0.0031308f ? v * 12.92f : 1.055f * powf( v, 1 / 2.4f ) - 0.055f) * 255 + 0.5f);
+		}
+	}
+	ushort toLinear[256];
+	uchar toSRGB[16384];
+};
+static const SRGBTables& GetSRGBTables() { static const SRGBTables tables; return tables; }
+// 2 source pixels to linear channels, one pixel per 64 bits
+static inline __m128i DecodePair( const uint p0, const uint p1, const ushort* lin )
+{
+	return _mm_set_epi16( 0, lin[(p1 >> 16) & 255], lin[(p1 >> 8) & 255], lin[p1 & 255], 0, lin[(p0 >> 16) & 255], lin[(p0 >> 8) & 255], lin[p0 & 255] );
+}
+
+// gamma-correct variant for sRGB-encoded textures: colors are decoded, averaged in linear
+// space and encoded again; alpha uses the minimum, as in ReduceRow
+static void ReduceRowSRGB( const uint* row0, const uint* row1, uint* dst, const int w )
+{
+	const SRGBTables& t = GetSRGBTables();
+	const __m128i half = _mm_set1_epi16( 2 );
+	for (int x = 0; x < w; x++)
+	{
+		const uint a0 = row0[x * 2], a1 = row0[x * 2 + 1], b0 = row1[x * 2], b1 = row1[x * 2 + 1];
+		const __m128i sum = _mm_add_epi16( DecodePair( a0, a1, t.toLinear ), DecodePair( b0, b1, t.toLinear ) );
+		const __m128i average = _mm_srli_epi16( _mm_add_epi16( _mm_add_epi16( sum, _mm_srli_si128( sum, 8 ) ), half ), 2 );
+		const uint alpha = min( min( a0 >> 24, a1 >> 24 ), min( b0 >> 24, b1 >> 24 ) );
+		dst[x] = (alpha << 24) + ((uint)t.toSRGB[_mm_extract_epi16( average, 2 )] << 16) +
+			((uint)t.toSRGB[_mm_extract_epi16( average, 1 )] << 8) + t.toSRGB[_mm_extract_epi16( average, 0 )];
+	}
+}
+
+static void ReduceRowHDR( const float4* row0, const float4* row1, float4* dst, const int w )
+{
+	const __m128 quarter = _mm_set1_ps( 0.25f );
+	for (int x = 0; x < w; x++)
+	{
+		const __m128 top = _mm_add_ps( _mm_loadu_ps( &row0[x * 2].x ), _mm_loadu_ps( &row0[x * 2 + 1].x ) );
+		const __m128 bottom = _mm_add_ps( _mm_loadu_ps( &row1[x * 2].x ), _mm_loadu_ps( &row1[x * 2 + 1].x ) );
+		_mm_storeu_ps( &dst[x].x, _mm_mul_ps( _mm_add_ps( top, bottom ), quarter ) );
+	}
+}
+
 //  +-----------------------------------------------------------------------------+
 //  |  HostTexture::ConstructMIPmaps                                              |
-//  |  Generate MIP levels for a loaded texture.                            LH2'19|
+//  |  Generate MIP levels for a loaded texture, for 32-bit and for float4        |
+//  |  textures. Rows of a level are reduced in parallel. 32-bit textures         |
+//  |  that still hold sRGB colors (not linearized, not a normal map) are         |
+//  |  averaged in linear space.                                            LH2'20|
 //  +-----------------------------------------------------------------------------+
 void HostTexture::ConstructMIPmaps()
 {
-	uint* src = (uint*)idata;
-	uint* dst = src + width * height;
-	int pw = width, w = width >> 1, ph = height, h = height >> 1;
+	JobManager* jm = JobManager::GetJobManager();
+	const bool sRGB = !(mods & (LINEARIZED | GAMMACORRECTION)) && !(flags & NORMALMAP);
+	int pw = width, w = width >> 1, h = height >> 1;
+	size_t srcOffset = 0, dstOffset = (size_t)width * height;
 	for (int i = 1; i < MIPLEVELCOUNT; i++)
 	{
-		// reduce
-		for (int y = 0; y < h; y++) for (int x = 0; x < w; x++)
-		{
-			const uint src0 = src[x * 2 + (y * 2) * pw];
-			const uint src1 = src[x * 2 + 1 + (y * 2) * pw];
-			const uint src2 = src[x * 2 + (y * 2 + 1) * pw];
-			const uint src3 = src[x * 2 + 1 + (y * 2 + 1) * pw];
-			const uint a = min( min( (src0 >> 24) & 255, (src1 >> 24) & 255 ), min( (src2 >> 24) & 255, (src3 >> 24) & 255 ) );
-			const uint r = ((src0 >> 16) & 255) + ((src1 >> 16) & 255) + ((src2 >> 16) & 255) + ((src3 >> 16) & 255);
-			const uint g = ((src0 >> 8) & 255) + ((src1 >> 8) & 255) + ((src2 >> 8) & 255) + ((src3 >> 8) & 255);
-			const uint b = (src0 & 255) + (src1 & 255) + (src2 & 255) + (src3 & 255);
-			dst[x + y * w] = (a << 24) + ((r >> 2) << 16) + ((g >> 2) << 8) + (b >> 2);
-		}
+		// reduce; small levels are not worth distributing
+		auto reduceRows = [&]( int firstRow, int lastRow ) {
+			for (int y = firstRow; y < lastRow; y++)
+			{
+				const size_t row0 = srcOffset + (size_t)(y * 2) * pw, row1 = row0 + pw, out = dstOffset + (size_t)y * w;
+				if (fdata) ReduceRowHDR( fdata + row0, fdata + row1, fdata + out, w );
+				else if (sRGB) ReduceRowSRGB( (uint*)idata + row0, (uint*)idata + row1, (uint*)idata + out, w );
+				else ReduceRow( (uint*)idata + row0, (uint*)idata + row1, (uint*)idata + out, w );
+			}
+		};
+		if (w * h < 256 * 256) reduceRows( 0, h ); else jm->ParallelFor( 0, h, 16, reduceRows );
 		// next layer
-		src = dst, dst += w * h, pw = w, ph = h, w >>= 1, h >>= 1;
+		srcOffset = dstOffset, dstOffset += (size_t)w * h, pw = w, w >>= 1, h >>= 1;
 	}
 }
 
@@ -158,6 +257,9 @@ void HostTexture::Load( const char* fileName, const uint modFlags, bool normalMa
 {
 	// check if texture exists
 	FATALERROR_IF( !FileExists( fileName ), "File %s not found", fileName );
+	// note: HostScene::CreateTexture sets mods before loading on a worker thread, so that the
+	// texture can be found while it is loading; we only write the field if it differs.
+	if (mods != modFlags) mods = modFlags;
 
 #ifdef CACHEIMAGES
 	// see if we can fetch a binary blob; faster than most FreeImage formats
@@ -175,20 +277,24 @@ void HostTexture::Load( const char* fileName, const uint modFlags, bool normalMa
 	#endif
 		if (f)
 		{
-			uint version;
+			// only use the cached data if it was produced with the same modifications
+			uint version = 0, fileMods = 0;
+			int dataType = 0;
 			fread( &version, 1, 4, f );
 			if (version == BINTEXFILEVERSION)
 			{
 				fread( &width, 4, 1, f );
 				fread( &height, 4, 1, f );
-				int dataType;
 				fread( &dataType, 4, 1, f );
-				fread( &mods, 4, 1, f );
+				fread( &fileMods, 4, 1, f );
+			}
+			if (version == BINTEXFILEVERSION && fileMods == modFlags)
+			{
 				fread( &flags, 4, 1, f );
 				fread( &MIPlevels, 4, 1, f );
 				if (dataType == 0)
 				{
-					int pixelCount = PixelsNeeded( width, height, 1 /* no MIPS for HDR textures */ );
+					int pixelCount = PixelsNeeded( width, height, MIPLEVELCOUNT );
 					fdata = (float4*)MALLOC64( sizeof( float4 ) * pixelCount );
 					fread( fdata, sizeof( float4 ), pixelCount, f );
 				}
@@ -199,9 +305,10 @@ void HostTexture::Load( const char* fileName, const uint modFlags, bool normalMa
 					fread( idata, 4, pixelCount, f );
 				}
 				fclose( f );
-				mods = modFlags;
+				if (normalMap) flags |= NORMALMAP;
 				return;
 			}
+			fclose( f );
 		}
 	}
 #endif
@@ -215,7 +322,6 @@ void HostTexture::Load( const char* fileName, const uint modFlags, bool normalMa
 	if (!img) img = tmp;
 	width = FreeImage_GetWidth( img );
 	height = FreeImage_GetHeight( img );
-	mods = modFlags;
 	uint pitch = FreeImage_GetPitch( img );
 	BYTE* bytes = (BYTE*)FreeImage_GetBits( img );
 	uint bpp = FreeImage_GetBPP( img );
@@ -236,12 +342,10 @@ void HostTexture::Load( const char* fileName, const uint modFlags, bool normalMa
 		}
 		// perform sRGB -> linear conversion if requested
 		if (mods & LINEARIZED) sRGBtoLinear( (uchar*)idata, width * height, 4 );
-		// produce the MIP maps
-		ConstructMIPmaps();
 	}
 	else // HDR
 	{
-		fdata = (float4*)MALLOC64( sizeof( float4 ) * PixelsNeeded( width, height, 1 /* no MIPs for HDR for now */ ) );
+		fdata = (float4*)MALLOC64( sizeof( float4 ) * PixelsNeeded( width, height, MIPLEVELCOUNT ) );
 		flags |= HDR;
 		for (uint y = 0; y < height; y++, bytes += pitch) for (uint x = 0; x < width; x++)
 		{
@@ -279,6 +383,9 @@ void HostTexture::Load( const char* fileName, const uint modFlags, bool normalMa
 		}
 	}
 
+	// produce the MIP maps
+	ConstructMIPmaps();
+
 #ifdef CACHEIMAGES
 	// prepare binary blob to be faster next time
 	if (strlen( fileName ) > 4) if (fileName[strlen( fileName ) - 4] == '.')
@@ -287,11 +394,16 @@ void HostTexture::Load( const char* fileName, const uint modFlags, bool normalMa
 		memcpy( binFile, fileName, strlen( fileName ) + 1 );
 		binFile[strlen( fileName ) - 4] = 0;
 		strcat_s( binFile, ".bin" );
+		// textures load concurrently: write to a file of our own and rename it when it is
+		// complete, so that no load ever reads a cache file that is still being written
+		static std::atomic<uint> tempId = 0;
+		char tempFile[1100];
+		snprintf( tempFile, sizeof( tempFile ), "%s.%u.tmp", binFile, tempId++ );
 		FILE* f;
 	#ifdef _MSC_VER
-		fopen_s( &f, binFile, "rb" );
+		fopen_s( &f, tempFile, "wb" );
 	#else
-		f = fopen( binFile, "rb" );
+		f = fopen( tempFile, "wb" );
 	#endif
 		if (f)
 		{
@@ -304,9 +416,13 @@ void HostTexture::Load( const char* fileName, const uint modFlags, bool normalMa
 			fwrite( &mods, 4, 1, f );
 			fwrite( &flags, 4, 1, f );
 			fwrite( &MIPlevels, 4, 1, f );
-			if (dataType == 0) fwrite( fdata, sizeof( float4 ), PixelsNeeded( width, height, 1 ), f );
+			if (dataType == 0) fwrite( fdata, sizeof( float4 ), PixelsNeeded( width, height, MIPLEVELCOUNT ), f );
 			else fwrite( idata, 4, PixelsNeeded( width, height, MIPLEVELCOUNT ), f );
+			const bool written = !ferror( f );
 			fclose( f );
+			// rename does not replace an existing file on Windows; the cache is optional, so
+			// if another load holds it open we simply keep the one that is there
+			if (!written || (rename( tempFile, binFile ) != 0 && (remove( binFile ), rename( tempFile, binFile ) != 0))) remove( tempFile );
 		}
 	}
 #endif
@@ -340,6 +456,8 @@ void HostTexture::BumpToNormalMap( float heightScale )
 	}
 	if (width * height > 0) memcpy( idata, normalMap, width * height * 4 );
 	delete normalMap;
+	// the MIP levels still hold the height data
+	ConstructMIPmaps();
 }
 
 // EOF
\ No newline at end of file
@@ -76,6 +76,7 @@ public:
 	uint flags = 0;						// flags
 	uint mods = 0;						// modifications to original data
 	uint refCount = 1;					// the number of materials that use this texture
+	JobCounter loading;					// pending load job of this texture, see HostScene::CreateTexture
 	uchar4* idata = nullptr;			// pointer to a 32-bit ARGB bitmap
 	float4* fdata = nullptr;			// pointer to a 128-bit ARGB bitmap
 	TRACKCHANGES;						// add Changed(), MarkAsDirty() methods, see system.h
@@ -31,6 +31,16 @@ RenderAPI* RenderAPI::CreateRenderAPI( const char* dllName )
 	return &api;
 }
 
+RenderAPI* RenderAPI::CreateHeadlessRenderAPI( const char* dllName )
+{
+	if (!renderer)
+	{
+		renderer = new RenderSystem();
+		renderer->Init( dllName, true );
+	}
+	return &api;
+}
+
 void RenderAPI::SerializeMaterials( const char* xmlFile )
 {
 	renderer->scene->SerializeMaterials( xmlFile );
@@ -41,6 +51,11 @@ void RenderAPI::DeserializeMaterials( const char* xmlFile )
 	renderer->scene->DeserializeMaterials( xmlFile );
 }
 
+void RenderAPI::ExportCompiledScene( const char* sceneFile )
+{
+	renderer->scene->ExportCompiledScene( sceneFile );
+}
+
 void RenderAPI::Shutdown()
 {
 	renderer->Shutdown();
@@ -227,6 +242,11 @@ void RenderAPI::SetTarget( GLTexture* tex, const uint spp )
 	renderer->SetTarget( tex, spp );
 }
 
+void RenderAPI::SetTarget( HostTarget* target, const uint spp )
+{
+	renderer->SetTarget( target, spp );
+}
+
 void RenderAPI::SetProbePos( const int2 pos )
 {
 	renderer->SetProbePos( pos );
@@ -242,4 +262,14 @@ SystemStats RenderAPI::GetSystemStats()
 	return renderer->GetSystemStats();
 }
 
+void RenderAPI::EnableTrace( const bool enabled )
+{
+	Profiler::Enable( enabled );
+}
+
+bool RenderAPI::WriteTrace( const char* fileName )
+{
+	return Profiler::WriteTrace( fileName );
+}
+
 // EOF
\ No newline at end of file
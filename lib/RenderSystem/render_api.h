@@ -30,9 +30,13 @@ class RenderAPI
 public:
 	// CreateRenderAPI: instantiate and initialize a RenderSystem object and obtain an interface to it.
 	static RenderAPI* CreateRenderAPI( const char* dllName );
+	// CreateHeadlessRenderAPI: same, for use without a window or OpenGL context: the application does not
+	// initialize GLFW or glad, and renders to a HostTarget. Only cores that render on the CPU support this.
+	static RenderAPI* CreateHeadlessRenderAPI( const char* dllName );
 	// Methods
 	void SerializeMaterials( const char* xmlFile );
 	void DeserializeMaterials( const char* xmlFile );
+	void ExportCompiledScene( const char* sceneFile );
 	void Shutdown();
 	void DeserializeCamera( const char* camera );
 	void SerializeCamera( const char* camera );
@@ -70,9 +74,14 @@ public:
 	int AddSpotLight( const float3 pos, const float3 direction, const float inner, const float outer, const float3 radiance, bool enabled = true );
 	int AddDirectionalLight( const float3 direction, const float3 radiance, bool enabled = true );
 	void SetTarget( GLTexture* tex, const uint spp );
+	void SetTarget( HostTarget* target, const uint spp );
 	void SetProbePos( const int2 pos );
 	CoreStats GetCoreStats() const;
 	SystemStats GetSystemStats();
+	// trace profiling: spans of the render system and the core, written as a Chrome trace
+	// (chrome://tracing, ui.perfetto.dev); write the trace before calling Shutdown.
+	void EnableTrace( const bool enabled );
+	bool WriteTrace( const char* fileName );
 };
 
 } // namespace lighthouse2
@@ -19,10 +19,12 @@
 //  |  RenderSystem::Init                                                         |
 //  |  Initialize the rendering system.                                     LH2'19|
 //  +-----------------------------------------------------------------------------+
-void RenderSystem::Init( const char* dllName )
+void RenderSystem::Init( const char* dllName, const bool headlessMode )
 {
 	// create core
+	headless = headlessMode;
 	core = CoreAPI_Base::CreateCoreAPI( dllName );
+	core->AttachProfiler( Profiler::GetState() );
 	// create scene - load a scene using tinyobjloader
 	scene = new HostScene();
 	scene->Init();
@@ -33,6 +35,20 @@ void RenderSystem::Init( const char* dllName )
 //  |  Use the specified render target.                                     LH2'19|
 //  +-----------------------------------------------------------------------------+
 void RenderSystem::SetTarget( GLTexture* target, const uint spp )
+{
+	FATALERROR_IF( headless, "OpenGL render targets cannot be used in headless mode." );
+	// forward to core
+	core->SetTarget( target, spp );
+	// update camera aspect ratio
+	scene->camera->aspectRatio = (float)target->width / (float)target->height;
+	scene->camera->pixelCount = make_int2( target->width, target->height );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  RenderSystem::SetTarget                                                    |
+//  |  Use the specified host memory render target.                         LH2'20|
+//  +-----------------------------------------------------------------------------+
+void RenderSystem::SetTarget( HostTarget* target, const uint spp )
 {
 	// forward to core
 	core->SetTarget( target, spp );
@@ -49,6 +65,7 @@ void RenderSystem::SetTarget( GLTexture* target, const uint spp )
 //  +-----------------------------------------------------------------------------+
 void RenderSystem::SynchronizeSky()
 {
+	PROFILE_SPAN( "SynchronizeSky" );
 	if (scene->sky && scene->sky->Changed())
 	{
 		// send sky data to core
@@ -64,14 +81,18 @@ void RenderSystem::SynchronizeSky()
 //  +-----------------------------------------------------------------------------+
 void RenderSystem::SynchronizeTextures()
 {
+	PROFILE_SPAN( "SynchronizeTextures" );
+	// textures may still be loading on worker threads
+	HostScene::WaitForTextures();
 	bool texturesDirty = false;
 	for (auto texture : scene->textures) if (texture->Changed()) texturesDirty = true;
 	if (texturesDirty)
 	{
-		// send texture data to core
-		vector<CoreTexDesc> gpuTex;
-		for (auto texture : scene->textures) gpuTex.push_back( texture->ConvertToCoreTexDesc() );
-		core->SetTextures( gpuTex.data(), (int)gpuTex.size() );
+		// send texture data to core; the descriptors live until the end of the frame
+		const int count = (int)scene->textures.size();
+		CoreTexDesc* gpuTex = FrameMemory::Frame().Alloc<CoreTexDesc>( count );
+		for (int i = 0; i < count; i++) gpuTex[i] = scene->textures[i]->ConvertToCoreTexDesc();
+		core->SetTextures( gpuTex, count );
 	}
 }
 
@@ -82,18 +103,15 @@ void RenderSystem::SynchronizeTextures()
 //  +-----------------------------------------------------------------------------+
 void RenderSystem::SynchronizeMaterials()
 {
+	PROFILE_SPAN( "SynchronizeMaterials" );
 	bool materialsDirty = false;
 	for (auto material : scene->materials) if (material->Changed())
 	{
 		// send all material data to core
-		vector<CoreMaterial> gpuMaterial;
-		for (auto sceneMat : scene->materials)
-		{
-			CoreMaterial m;
-			memcpy( &m, sceneMat, sizeof( CoreMaterial ) );
-			gpuMaterial.push_back( m );
-		}
-		core->SetMaterials( gpuMaterial.data(), (int)gpuMaterial.size() );
+		const int count = (int)scene->materials.size();
+		CoreMaterial* gpuMaterial = FrameMemory::Frame().Alloc<CoreMaterial>( count );
+		for (int i = 0; i < count; i++) memcpy( &gpuMaterial[i], scene->materials[i], sizeof( CoreMaterial ) );
+		core->SetMaterials( gpuMaterial, count );
 		break;
 	}
 }
@@ -107,6 +125,7 @@ void RenderSystem::SynchronizeMaterials()
 //  +-----------------------------------------------------------------------------+
 void RenderSystem::SynchronizeMeshes()
 {
+	PROFILE_SPAN( "SynchronizeMeshes" );
 	for (int s = (int)scene->meshPool.size(), modelIdx = 0; modelIdx < s; modelIdx++)
 	{
 		HostMesh* mesh = scene->meshPool[modelIdx];
@@ -128,6 +147,7 @@ void RenderSystem::SynchronizeMeshes()
 //  +-----------------------------------------------------------------------------+
 void RenderSystem::UpdateSceneGraph()
 {
+	PROFILE_SPAN( "UpdateSceneGraph" );
 	// walk the scene graph to update matrices
 	Timer timer;
 	int instanceCount = 0;
@@ -166,6 +186,7 @@ void RenderSystem::UpdateSceneGraph()
 //  +-----------------------------------------------------------------------------+
 void RenderSystem::SynchronizeLights()
 {
+	PROFILE_SPAN( "SynchronizeLights" );
 	bool lightsDirty = false;
 	for (auto light : scene->triLights) if (light->Changed()) lightsDirty = true;
 	for (auto light : scene->pointLights) if (light->Changed()) lightsDirty = true;
@@ -174,18 +195,18 @@ void RenderSystem::SynchronizeLights()
 	if (lightsDirty)
 	{
 		// send lights to core
-		vector<CoreLightTri> gpuTriLights;
-		vector<CorePointLight> gpuPointLights;
-		vector<CoreSpotLight> gpuSpotLights;
-		vector<CoreDirectionalLight> gpuDirectionalLights;
-		for (auto light : scene->triLights) if (light->enabled) gpuTriLights.push_back( light->ConvertToCoreLightTri() );
-		for (auto light : scene->pointLights) if (light->enabled) gpuPointLights.push_back( light->ConvertToCorePointLight() );
-		for (auto light : scene->spotLights) if (light->enabled) gpuSpotLights.push_back( light->ConvertToCoreSpotLight() );
-		for (auto light : scene->directionalLights) if (light->enabled) gpuDirectionalLights.push_back( light->ConvertToCoreDirectionalLight() );
-		core->SetLights( gpuTriLights.data(), (int)gpuTriLights.size(),
-			gpuPointLights.data(), (int)gpuPointLights.size(),
-			gpuSpotLights.data(), (int)gpuSpotLights.size(),
-			gpuDirectionalLights.data(), (int)gpuDirectionalLights.size() );
+		Arena& arena = FrameMemory::Frame();
+		CoreLightTri* gpuTriLights = arena.Alloc<CoreLightTri>( scene->triLights.size() );
+		CorePointLight* gpuPointLights = arena.Alloc<CorePointLight>( scene->pointLights.size() );
+		CoreSpotLight* gpuSpotLights = arena.Alloc<CoreSpotLight>( scene->spotLights.size() );
+		CoreDirectionalLight* gpuDirectionalLights = arena.Alloc<CoreDirectionalLight>( scene->directionalLights.size() );
+		int triLightCount = 0, pointLightCount = 0, spotLightCount = 0, directionalLightCount = 0;
+		for (auto light : scene->triLights) if (light->enabled) gpuTriLights[triLightCount++] = light->ConvertToCoreLightTri();
+		for (auto light : scene->pointLights) if (light->enabled) gpuPointLights[pointLightCount++] = light->ConvertToCorePointLight();
+		for (auto light : scene->spotLights) if (light->enabled) gpuSpotLights[spotLightCount++] = light->ConvertToCoreSpotLight();
+		for (auto light : scene->directionalLights) if (light->enabled) gpuDirectionalLights[directionalLightCount++] = light->ConvertToCoreDirectionalLight();
+		core->SetLights( gpuTriLights, triLightCount, gpuPointLights, pointLightCount,
+			gpuSpotLights, spotLightCount, gpuDirectionalLights, directionalLightCount );
 	}
 }
 
@@ -199,6 +220,7 @@ void RenderSystem::SynchronizeLights()
 //  +-----------------------------------------------------------------------------+
 void RenderSystem::SynchronizeSceneData()
 {
+	PROFILE_SPAN( "SynchronizeSceneData" );
 	SynchronizeSky();
 	SynchronizeTextures();
 	SynchronizeMaterials();
@@ -213,6 +235,7 @@ void RenderSystem::SynchronizeSceneData()
 //  +-----------------------------------------------------------------------------+
 void RenderSystem::Render( const ViewPyramid& view, Convergence converge, bool async )
 {
+	PROFILE_SPAN( "Render" );
 	// forward to core; core may ignore or accept a setting
 	core->Setting( "epsilon", settings.geometryEpsilon );
 	core->Setting( "clampValue", scene->camera->clampValue );
@@ -221,6 +244,8 @@ void RenderSystem::Render( const ViewPyramid& view, Convergence converge, bool a
 	core->Setting( "filter", settings.filterEnabled );
 	core->Setting( "TAA", settings.TAAEnabled );
 	core->Render( view, converge, async );
+	// the core copied what it needs; release the transient data of this frame
+	FrameMemory::EndFrame();
 }
 
 //  +-----------------------------------------------------------------------------+
@@ -229,6 +254,7 @@ void RenderSystem::Render( const ViewPyramid& view, Convergence converge, bool a
 //  +-----------------------------------------------------------------------------+
 void RenderSystem::WaitForRender()
 {
+	PROFILE_SPAN( "WaitForRender" );
 	core->WaitForRender();
 }
 
@@ -79,11 +79,12 @@ class RenderSystem
 {
 public:
 	// methods
-	void Init( const char* dllName );
+	void Init( const char* dllName, const bool headlessMode = false );
 	void SynchronizeSceneData();
 	void Render( const ViewPyramid& view, Convergence converge, bool async = false );
 	void WaitForRender();
 	void SetTarget( GLTexture* target, const uint spp );
+	void SetTarget( HostTarget* target, const uint spp );
 	void SetProbePos( int2 pos ) { if (core) core->SetProbePos( pos ); }
 	void Setting( const char* name, const float value ) { if (core) core->Setting( name, value ); }
 	int GetTriangleMaterial( const int coreInstId, const int coreTriId );
@@ -105,6 +106,7 @@ private:
 	CoreAPI_Base* core = nullptr;			// low-level rendering functionality
 	GLTexture* renderTarget = nullptr;		// CUDA will render to this OpenGL texture
 	bool meshesChanged = false;				// rebuild scene graph if a mesh was rebuilt / refit
+	bool headless = false;					// no OpenGL context; only HostTargets can be used
 	SystemStats stats;						// performance counters
 	vector<int> instances;					// node indices that have been sent to the core as instances
 public:
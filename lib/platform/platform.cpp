@@ -27,168 +27,6 @@
 
 #pragma comment( linker, "/subsystem:windows /ENTRY:mainCRTStartup" )
 
-//  +-----------------------------------------------------------------------------+
-//  |  Minimalistic Windows thread.                                         LH2'20|
-//  +-----------------------------------------------------------------------------+
-extern "C" unsigned int sthread_proc( void* param ) { WinThread* tp = (WinThread*)param; tp->run(); return 0; }
-
-void WinThread::setPriority( int tp ) 
-{ 
-	SetThreadPriority( t, tp ); 
-}
-
-void WinThread::start() 
-{
-	DWORD id = 0;	
-	t = (unsigned long*)CreateThread( NULL, 0, (LPTHREAD_START_ROUTINE)sthread_proc, this, 0, &id );
-	setPriority( THREAD_PRIORITY_ABOVE_NORMAL );
-}
-
-//  +-----------------------------------------------------------------------------+
-//  |  Jobmanager.                                                          LH2'20|
-//  +-----------------------------------------------------------------------------+
-
-DWORD JobThreadProc( LPVOID lpParameter )
-{
-	JobThread* JobThreadInstance = (JobThread*)lpParameter;
-	JobThreadInstance->BackgroundTask();
-	return 0;
-}
-
-void JobThread::CreateAndStartThread( unsigned int threadId )
-{
-	m_GoSignal = CreateEvent( 0, FALSE, FALSE, 0 );
-	m_ThreadHandle = CreateThread( 0, 0, (LPTHREAD_START_ROUTINE)&JobThreadProc, (LPVOID)this, 0, 0 );
-	m_ThreadID = threadId;
-}
-void JobThread::BackgroundTask()
-{
-	while (1)
-	{
-		WaitForSingleObject( m_GoSignal, INFINITE );
-		while (1)
-		{
-			Job* job = JobManager::GetJobManager()->GetNextJob();
-			if (!job)
-			{
-				JobManager::GetJobManager()->ThreadDone( m_ThreadID );
-				break;
-			}
-			job->RunCodeWrapper();
-		}
-	}
-}
-
-void JobThread::Go()
-{
-	SetEvent( m_GoSignal );
-}
-
-void Job::RunCodeWrapper()
-{
-	Main();
-}
-
-JobManager* JobManager::m_JobManager = 0;
-
-JobManager::JobManager( unsigned int threads ) : m_NumThreads( threads )
-{
-	InitializeCriticalSection( &m_CS );
-}
-
-JobManager::~JobManager()
-{
-	DeleteCriticalSection( &m_CS );
-}
-
-void JobManager::CreateJobManager( unsigned int numThreads )
-{
-	m_JobManager = new JobManager( numThreads );
-	m_JobManager->m_JobThreadList = new JobThread[numThreads];
-	for (unsigned int i = 0; i < numThreads; i++)
-	{
-		m_JobManager->m_JobThreadList[i].CreateAndStartThread( i );
-		m_JobManager->m_ThreadDone[i] = CreateEvent( 0, FALSE, FALSE, 0 );
-	}
-	m_JobManager->m_JobCount = 0;
-}
-
-void JobManager::AddJob2( Job* a_Job )
-{
-	m_JobList[m_JobCount++] = a_Job;
-}
-
-Job* JobManager::GetNextJob()
-{
-	Job* job = 0;
-	EnterCriticalSection( &m_CS );
-	if (m_JobCount > 0) job = m_JobList[--m_JobCount];
-	LeaveCriticalSection( &m_CS );
-	return job;
-}
-
-void JobManager::RunJobs()
-{
-	for (unsigned int i = 0; i < m_NumThreads; i++) m_JobThreadList[i].Go();
-	WaitForMultipleObjects( m_NumThreads, m_ThreadDone, TRUE, INFINITE );
-}
-
-void JobManager::ThreadDone( unsigned int n )
-{
-	SetEvent( m_ThreadDone[n] );
-}
-
-DWORD CountSetBits( ULONG_PTR bitMask )
-{
-	DWORD LSHIFT = sizeof( ULONG_PTR ) * 8 - 1, bitSetCount = 0;
-	ULONG_PTR bitTest = (ULONG_PTR)1 << LSHIFT;
-	for (DWORD i = 0; i <= LSHIFT; ++i) bitSetCount += ((bitMask & bitTest) ? 1 : 0), bitTest /= 2;
-	return bitSetCount;
-}
-
-void JobManager::GetProcessorCount( uint& cores, uint& logical )
-{
-	// https://github.com/GPUOpen-LibrariesAndSDKs/cpu-core-counts
-	cores = logical = 0;
-	char* buffer = NULL;
-	DWORD len = 0;
-	if (FALSE == GetLogicalProcessorInformationEx( RelationAll, (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)buffer, &len ))
-	{
-		if (GetLastError() == ERROR_INSUFFICIENT_BUFFER)
-		{
-			buffer = (char*)malloc( len );
-			if (GetLogicalProcessorInformationEx( RelationAll, (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)buffer, &len ))
-			{
-				DWORD offset = 0;
-				char* ptr = buffer;
-				while (ptr < buffer + len)
-				{
-					PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX pi = (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)ptr;
-					if (pi->Relationship == RelationProcessorCore)
-					{
-						cores++;
-						for (size_t g = 0; g < pi->Processor.GroupCount; ++g)
-							logical += CountSetBits( pi->Processor.GroupMask[g].Mask );
-					}
-					ptr += pi->Size;
-				}
-			}
-			free( buffer );
-		}
-	}
-}
-
-JobManager* JobManager::GetJobManager()
-{ 
-	if (!m_JobManager) 
-	{
-		uint c, l;
-		GetProcessorCount( c, l );
-		CreateJobManager( l ); 
-	}
-	return m_JobManager; 
-}
-
 //  +-----------------------------------------------------------------------------+
 //  |  OpenGL helper functions.                                             LH2'19|
 //  +-----------------------------------------------------------------------------+
@@ -378,6 +216,14 @@ void GLTexture::Load( const char* fileName, int filter )
 
 GLTexture::~GLTexture()
 {
+	for (int i = 0; i < 2; i++) if (pbo[i])
+	{
+		if (fence[i]) glDeleteSync( fence[i] );
+		glBindBuffer( GL_PIXEL_UNPACK_BUFFER, pbo[i] );
+		glUnmapBuffer( GL_PIXEL_UNPACK_BUFFER );
+		glDeleteBuffers( 1, &pbo[i] );
+	}
+	glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
 	glDeleteTextures( 1, &ID );
 	CheckGL();
 }
@@ -402,6 +248,52 @@ void GLTexture::CopyTo( Bitmap* dst )
 	CheckGL();
 }
 
+uint* GLTexture::MapPixels()
+{
+	if (!GLAD_GL_VERSION_4_4) return 0;
+	if (!pbo[0])
+	{
+		// the buffers stay mapped for their lifetime. Client storage keeps them in cached
+		// host memory, so cores can also read back what they wrote (e.g. post-processing).
+		// The small margin accommodates cores that write pixels in blocks.
+		const GLsizeiptr size = (GLsizeiptr)width * height * sizeof( uint ) + 256;
+		const GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glGenBuffers( 2, pbo );
+		for (int i = 0; i < 2; i++)
+		{
+			glBindBuffer( GL_PIXEL_UNPACK_BUFFER, pbo[i] );
+			glBufferStorage( GL_PIXEL_UNPACK_BUFFER, size, 0, flags | GL_CLIENT_STORAGE_BIT );
+			mapped[i] = (uint*)glMapBufferRange( GL_PIXEL_UNPACK_BUFFER, 0, size, flags );
+		}
+		glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+		// allocate the texture storage once; uploads only replace its contents
+		glBindTexture( GL_TEXTURE_2D, ID );
+		glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0 );
+		CheckGL();
+	}
+	// wait until the upload that last read from this buffer has completed
+	if (fence[current])
+	{
+		while (glClientWaitSync( fence[current], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000 ) == GL_TIMEOUT_EXPIRED);
+		glDeleteSync( fence[current] );
+		fence[current] = 0;
+	}
+	return mapped[current];
+}
+
+void GLTexture::UploadPixels()
+{
+	// the buffer is coherently mapped, so the texture can be updated straight from it;
+	// the fence guards it against writes of the next-but-one frame
+	glBindBuffer( GL_PIXEL_UNPACK_BUFFER, pbo[current] );
+	glBindTexture( GL_TEXTURE_2D, ID );
+	glTexSubImage2D( GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0 );
+	glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+	fence[current] = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+	current ^= 1;
+	CheckGL();
+}
+
 //  +-----------------------------------------------------------------------------+
 //  |  Shader class implementation.                                         LH2'19|
 //  +-----------------------------------------------------------------------------+
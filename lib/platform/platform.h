@@ -84,65 +84,6 @@ public:
 	uint ID = 0;		// shader program identifier
 };
 
-// Low-level thread class
-class WinThread 
-{
-public:
-	WinThread() { t = 0; }
-	unsigned long* handle() { return t; }
-	void start();
-	virtual void run() {};
-	void setPriority( int p );
-private:
-	unsigned long* t;
-};
-extern "C" { unsigned int sthread_proc( void* param ); }
-
-// Nils's jobmanager
-class Job
-{
-public:
-	virtual void Main() = 0;
-protected:
-	friend class JobThread;
-	void RunCodeWrapper();
-};
-class JobThread
-{
-public:
-	void CreateAndStartThread( unsigned int threadId );
-	void WaitForThreadToStop();
-	void Go();
-	void BackgroundTask();
-	HANDLE m_GoSignal, m_ThreadHandle;
-	int m_ThreadID;
-};
-class JobManager	// singleton class!
-{
-protected:
-	JobManager( unsigned int numThreads );
-public:
-	~JobManager();
-	static void CreateJobManager( unsigned int numThreads );
-	static JobManager* GetJobManager(); 
-	static void GetProcessorCount( uint& cores, uint& logical );
-	void AddJob2( Job* a_Job );
-	unsigned int GetNumThreads() { return m_NumThreads; }
-	void RunJobs();
-	void ThreadDone( unsigned int n );
-	int MaxConcurrent() { return m_NumThreads; }
-protected:
-	friend class JobThread;
-	Job* GetNextJob();
-	Job* FindNextJob();
-	static JobManager* m_JobManager;
-	Job* m_JobList[256];
-	CRITICAL_SECTION m_CS;
-	HANDLE m_ThreadDone[64];
-	unsigned int m_NumThreads, m_JobCount;
-	JobThread* m_JobThreadList;
-};
-
 } // namespace lighthouse2
 
 // forward declarations of platform-specific helpers
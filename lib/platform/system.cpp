@@ -36,6 +36,8 @@ extern "C"
 #include <sys/stat.h>
 #ifndef WIN32
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #endif
 #include <ft2build.h>
 #include FT_FREETYPE_H
@@ -43,7 +45,9 @@ extern "C"
 //  +-----------------------------------------------------------------------------+
 //  |  RNG - Marsaglia's xor32.                                             LH2'19|
 //  +-----------------------------------------------------------------------------+
-static uint seed = 0x12345678;
+// the global seed is per-thread, so that the job system can safely call RandomUInt.
+static thread_local uint seed = 0x12345678;
+void SeedRandom( uint s ) { seed = s ? s : 0x12345678; }
 uint RandomUInt() { seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5; return seed; }
 float RandomFloat() { return RandomUInt() * 2.3283064365387e-10f; }
 float Rand( float range ) { return RandomFloat() * range; }
@@ -124,6 +128,624 @@ Bitmap::Bitmap( const char* f )
 	FreeImage_Unload( dib );
 }
 
+//  +-----------------------------------------------------------------------------+
+//  |  HostTarget functions.                                                LH2'20|
+//  +-----------------------------------------------------------------------------+
+// the trimmed FreeImage.h in lib/FreeImage only declares what the loaders use; these are
+// exported by the same FreeImage library
+extern "C"
+{
+	DLL_API FIBITMAP* DLL_CALLCONV FreeImage_Allocate( int width, int height, int bpp, unsigned red_mask FI_DEFAULT( 0 ), unsigned green_mask FI_DEFAULT( 0 ), unsigned blue_mask FI_DEFAULT( 0 ) );
+	DLL_API FIBITMAP* DLL_CALLCONV FreeImage_AllocateT( FREE_IMAGE_TYPE type, int width, int height, int bpp FI_DEFAULT( 8 ), unsigned red_mask FI_DEFAULT( 0 ), unsigned green_mask FI_DEFAULT( 0 ), unsigned blue_mask FI_DEFAULT( 0 ) );
+	DLL_API BOOL DLL_CALLCONV FreeImage_Save( FREE_IMAGE_FORMAT fif, FIBITMAP* dib, const char* filename, int flags FI_DEFAULT( 0 ) );
+	DLL_API BOOL DLL_CALLCONV FreeImage_FIFSupportsExportType( FREE_IMAGE_FORMAT fif, FREE_IMAGE_TYPE type );
+}
+static uint ClampToRGBA8( const float4& c )
+{
+	const uint r = (uint)(255.0f * min( 1.0f, max( 0.0f, c.x ) ));
+	const uint g = (uint)(255.0f * min( 1.0f, max( 0.0f, c.y ) ));
+	const uint b = (uint)(255.0f * min( 1.0f, max( 0.0f, c.z ) ));
+	return r + (g << 8) + (b << 16) + 0xff000000;
+}
+
+HostTarget::HostTarget( uint w, uint h, uint t ) : width( w ), height( h ), type( t )
+{
+	if (type == FLOAT) hdrPixels = (float4*)MALLOC64( width * height * sizeof( float4 ) );
+	else pixels = (uint*)MALLOC64( width * height * sizeof( uint ) );
+}
+
+void HostTarget::CopyFrom( const uint* src )
+{
+	// 8-bit RGBA, as uploaded to a GLTexture by the cores
+	if (type == DEFAULT) { memcpy( pixels, src, width * height * sizeof( uint ) ); return; }
+	const float scale = 1.0f / 255.0f;
+	for (uint i = 0; i < width * height; i++) hdrPixels[i] = make_float4(
+		(float)(src[i] & 255) * scale, (float)((src[i] >> 8) & 255) * scale, (float)((src[i] >> 16) & 255) * scale, 1 );
+}
+
+void HostTarget::CopyFrom( const float4* src )
+{
+	// linear color; clamped for DEFAULT targets
+	if (type == FLOAT) { memcpy( hdrPixels, src, width * height * sizeof( float4 ) ); return; }
+	for (uint i = 0; i < width * height; i++) pixels[i] = ClampToRGBA8( src[i] );
+}
+
+bool HostTarget::Save( const char* fileName ) const
+{
+	// file format follows from the extension; HDR data is clamped for 8-bit formats
+	FREE_IMAGE_FORMAT fif = FreeImage_GetFIFFromFilename( fileName );
+	if (fif == FIF_UNKNOWN) return false;
+	FIBITMAP* dib;
+	if (type == FLOAT && FreeImage_FIFSupportsExportType( fif, FIT_RGBF ))
+	{
+		dib = FreeImage_AllocateT( FIT_RGBF, width, height );
+		for (uint y = 0; y < height; y++)
+		{
+			FIRGBF* line = (FIRGBF*)FreeImage_GetScanLine( dib, height - 1 - y );
+			const float4* src = hdrPixels + y * width;
+			for (uint x = 0; x < width; x++) line[x].red = src[x].x, line[x].green = src[x].y, line[x].blue = src[x].z;
+		}
+	}
+	else
+	{
+		dib = FreeImage_Allocate( width, height, 24 );
+		for (uint y = 0; y < height; y++)
+		{
+			BYTE* line = FreeImage_GetScanLine( dib, height - 1 - y );
+			for (uint x = 0; x < width; x++, line += 3)
+			{
+				const uint c = type == DEFAULT ? pixels[x + y * width] : ClampToRGBA8( hdrPixels[x + y * width] );
+				line[FI_RGBA_RED] = c & 255, line[FI_RGBA_GREEN] = (c >> 8) & 255, line[FI_RGBA_BLUE] = (c >> 16) & 255;
+			}
+		}
+	}
+	const bool saved = FreeImage_Save( fif, dib, fileName ) != 0;
+	FreeImage_Unload( dib );
+	return saved;
+}
+
+float HostTarget::RMSE( const char* referenceFile ) const
+{
+	// compare against a reference image; colors are in the range 0..1, HDR data is clamped
+	FREE_IMAGE_FORMAT fif = FreeImage_GetFileType( referenceFile, 0 );
+	if (fif == FIF_UNKNOWN) fif = FreeImage_GetFIFFromFilename( referenceFile );
+	if (fif == FIF_UNKNOWN) return -1;
+	FIBITMAP* tmp = FreeImage_Load( fif, referenceFile );
+	if (!tmp) return -1;
+	FIBITMAP* ref = FreeImage_ConvertTo24Bits( tmp );
+	FreeImage_Unload( tmp );
+	if (!ref) return -1;
+	if (FreeImage_GetWidth( ref ) != width || FreeImage_GetHeight( ref ) != height) { FreeImage_Unload( ref ); return -1; }
+	double sum = 0;
+	for (uint y = 0; y < height; y++)
+	{
+		const BYTE* line = FreeImage_GetScanLine( ref, height - 1 - y );
+		for (uint x = 0; x < width; x++, line += 3)
+		{
+			const uint c = type == DEFAULT ? pixels[x + y * width] : ClampToRGBA8( hdrPixels[x + y * width] );
+			const int dr = (int)(c & 255) - line[FI_RGBA_RED];
+			const int dg = (int)((c >> 8) & 255) - line[FI_RGBA_GREEN];
+			const int db = (int)((c >> 16) & 255) - line[FI_RGBA_BLUE];
+			sum += dr * dr + dg * dg + db * db;
+		}
+	}
+	FreeImage_Unload( ref );
+	return (float)sqrt( sum / (3.0 * width * height) ) / 255.0f;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  PhaseStats implementation.                                           LH2'20|
+//  +-----------------------------------------------------------------------------+
+PhaseStats::Slot* PhaseStats::Register()
+{
+	Slot* slot = (Slot*)MALLOC64( sizeof( Slot ) );
+	memset( slot, 0, sizeof( Slot ) );
+	std::lock_guard<std::mutex> lock( slotLock );
+	slots.push_back( slot );
+	return slot;
+}
+
+void PhaseStats::Flush( Counters& c, const float renderSeconds )
+{
+	// renderSeconds: measured time of the job that filled c; the sampled phases receive
+	// their share of it, and the remainder is left to the (derived) shading phase
+	Slot& s = Local();
+	s.seconds[RENDER] += renderSeconds;
+	for (int i = 0; i < PHASES; i++)
+	{
+		s.count[i] += c.count[i];
+		if (c.sampleTicks > 0) s.seconds[i] += renderSeconds * min( 1.0, (double)c.ticks[i] / c.sampleTicks );
+		c.count[i] = c.ticks[i] = 0;
+	}
+	c.sampleTicks = 0, c.sampling = false;
+}
+
+PhaseStats::Totals PhaseStats::Merge()
+{
+	// call when no jobs are in flight
+	Totals totals = {};
+	std::lock_guard<std::mutex> lock( slotLock );
+	for (Slot* slot : slots)
+	{
+		bool active = false;
+		for (int i = 0; i < PHASES; i++)
+		{
+			totals.count[i] += slot->count[i], totals.seconds[i] += (float)slot->seconds[i];
+			active |= slot->count[i] > 0 || slot->seconds[i] > 0;
+		}
+		if (active) totals.threads++;
+		memset( slot, 0, sizeof( Slot ) );
+	}
+	return totals;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  Profiler implementation.                                             LH2'20|
+//  +-----------------------------------------------------------------------------+
+void Profiler::Record( const char* name, const int64_t start, const int64_t end )
+{
+	if (!ring)
+	{
+		// first span of this thread in this module
+		ring = new Ring();
+		State* s = GetState();
+		std::lock_guard<std::mutex> lock( s->lock );
+		auto id = s->threadIds.insert( std::make_pair( std::this_thread::get_id(), (int)s->threadIds.size() ) );
+		ring->thread = id.first->second;
+		s->rings.push_back( ring );
+	}
+	// only this thread writes the ring; the release store publishes the span
+	const uint head = ring->head.load( std::memory_order_relaxed );
+	ring->span[head % RINGSIZE] = { name, start, end };
+	ring->head.store( head + 1, std::memory_order_release );
+}
+
+bool Profiler::WriteTrace( const char* fileName )
+{
+	FILE* f = fopen( fileName, "w" );
+	if (!f) return false;
+	State* s = GetState();
+	std::lock_guard<std::mutex> lock( s->lock );
+	fprintf( f, "{\"traceEvents\":[\n" );
+	bool first = true;
+	for (const auto& id : s->threadIds)
+	{
+		fprintf( f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%i,\"args\":{\"name\":\"thread %i\"}}",
+			first ? "" : ",\n", id.second, id.second );
+		first = false;
+	}
+	for (const Ring* r : s->rings)
+	{
+		// the newest RINGSIZE spans, oldest first; timestamps are in microseconds
+		const uint head = r->head.load( std::memory_order_acquire );
+		for (uint i = head - min( head, (uint)RINGSIZE ); i < head; i++)
+		{
+			const Span& span = r->span[i % RINGSIZE];
+			fprintf( f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%i,\"ts\":%.3f,\"dur\":%.3f}",
+				span.name, r->thread, span.start * 0.001, (span.end - span.start) * 0.001 );
+		}
+	}
+	fprintf( f, "\n]}\n" );
+	fclose( f );
+	return true;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  Arena implementation.                                                LH2'20|
+//  +-----------------------------------------------------------------------------+
+void* Arena::Alloc( const size_t bytes, const size_t alignment )
+{
+	// blocks are 64-byte aligned, which limits the supported alignment
+	assert( alignment <= 64 && (alignment & (alignment - 1)) == 0 );
+	size_t offset = (used + alignment - 1) & ~(alignment - 1);
+	if (blocks.size() == 0 || offset + bytes > blocks.back().size)
+	{
+		// chain a new block, at least twice the size of the previous one
+		size_t size = max( bytes, blocks.size() == 0 ? initialSize : blocks.back().size * 2 );
+		size = (size + 63) & ~(size_t)63;
+		blocks.push_back( { (uchar*)MALLOC64( size ), size } );
+		offset = 0;
+	}
+	used = offset + bytes;
+	return blocks.back().data + offset;
+}
+
+void Arena::Reset()
+{
+	if (blocks.size() > 1)
+	{
+		// replace the chain by a single block that holds all of it
+		const size_t size = Capacity();
+		for (Block& b : blocks) FREE64( b.data );
+		blocks.clear();
+		blocks.push_back( { (uchar*)MALLOC64( size ), size } );
+	}
+	used = 0;
+}
+
+Arena& FrameMemory::Scratch()
+{
+	if (!scratch.arena)
+	{
+		// first use on this thread in this module
+		scratch.arena = new Arena( 64 * 1024 );
+		std::lock_guard<std::mutex> lock( scratchLock );
+		scratchArenas.push_back( scratch.arena );
+	}
+	return *scratch.arena;
+}
+
+FrameMemory::ScratchOwner::~ScratchOwner()
+{
+	// thread exit: unregister the arena before it is deleted, so EndFrame never sees it
+	if (!arena) return;
+	std::lock_guard<std::mutex> lock( scratchLock );
+	scratchArenas.erase( std::remove( scratchArenas.begin(), scratchArenas.end(), arena ), scratchArenas.end() );
+	delete arena;
+}
+
+void FrameMemory::EndFrame()
+{
+	Frame().Reset();
+	std::lock_guard<std::mutex> lock( scratchLock );
+	for (Arena* arena : scratchArenas) arena->Reset();
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  Minimalistic portable thread.                                        LH2'20|
+//  +-----------------------------------------------------------------------------+
+void Thread::start()
+{
+	t = std::thread( [this]() { run(); } );
+}
+
+void WinThread::start()
+{
+	t = std::thread( [this]() { run(); } );
+#ifdef _MSC_VER
+	setPriority( THREAD_PRIORITY_ABOVE_NORMAL );
+#endif
+}
+
+void WinThread::setPriority( int p )
+{
+#ifdef _MSC_VER
+	SetThreadPriority( (HANDLE)t.native_handle(), p );
+#else
+	(void)p; // priorities need privileges on POSIX systems; keep the default
+#endif
+}
+
+void Thread::setAffinity( int core )
+{
+	if (core < 0) return;
+#ifdef _MSC_VER
+	SetThreadAffinityMask( (HANDLE)t.native_handle(), (DWORD_PTR)1 << (core & 63) );
+#elif defined(__linux__)
+	cpu_set_t cpuset;
+	CPU_ZERO( &cpuset );
+	CPU_SET( core, &cpuset );
+	pthread_setaffinity_np( t.native_handle(), sizeof( cpu_set_t ), &cpuset );
+#endif
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  Jobmanager.                                                          LH2'20|
+//  +-----------------------------------------------------------------------------+
+JobManager* JobManager::m_JobManager = 0;
+thread_local int JobManager::threadIdx = 0;
+static bool pinJobThreads = false;
+
+void JobThread::CreateAndStartThread( unsigned int threadId )
+{
+	m_ThreadID = threadId;
+	m_Thread = std::thread( [this]() { BackgroundTask(); } );
+	if (!pinJobThreads) return;
+	// pin worker n to logical core n; the main thread is left to the OS
+#ifdef _MSC_VER
+	SetThreadAffinityMask( (HANDLE)m_Thread.native_handle(), (DWORD_PTR)1 << (threadId & 63) );
+#elif defined(__linux__)
+	cpu_set_t cpuset;
+	CPU_ZERO( &cpuset );
+	CPU_SET( threadId, &cpuset );
+	pthread_setaffinity_np( m_Thread.native_handle(), sizeof( cpu_set_t ), &cpuset );
+#endif
+}
+
+void JobThread::WaitForThreadToStop()
+{
+	if (m_Thread.joinable()) m_Thread.join();
+}
+
+void JobThread::BackgroundTask()
+{
+	JobManager* manager = JobManager::m_JobManager;
+	JobManager::threadIdx = m_ThreadID;
+	SeedRandom( 0x12345678 + m_ThreadID * 0x9e3779b9 ); // decorrelate RandomUInt per worker
+	while (!manager->m_Exit)
+	{
+		if (manager->RunOneJob( m_ThreadID )) continue;
+		// nothing to do; sleep until new jobs arrive
+		std::unique_lock<std::mutex> lock( manager->m_SleepLock );
+		manager->m_WakeUp.wait( lock, [manager]() { return manager->m_Exit || manager->m_Queued > 0; } );
+	}
+}
+
+void Job::RunCodeWrapper()
+{
+	Main();
+}
+
+JobManager::JobManager( unsigned int threads ) : m_NumThreads( max( 1u, threads ) )
+{
+	m_Queues = new JobQueue[m_NumThreads];
+}
+
+JobManager::~JobManager()
+{
+	{
+		std::lock_guard<std::mutex> lock( m_SleepLock );
+		m_Exit = true;
+	}
+	m_WakeUp.notify_all();
+	for (unsigned int i = 1; i < m_NumThreads; i++) m_JobThreadList[i].WaitForThreadToStop();
+	delete[] m_JobThreadList;
+	delete[] m_Queues;
+}
+
+void JobManager::CreateJobManager( unsigned int numThreads, bool pinThreads )
+{
+	pinJobThreads = pinThreads;
+	m_JobManager = new JobManager( numThreads );
+	// slot 0 is the main thread, which helps out when it waits for jobs
+	m_JobManager->m_JobThreadList = new JobThread[m_JobManager->m_NumThreads];
+	for (unsigned int i = 1; i < m_JobManager->m_NumThreads; i++) m_JobManager->m_JobThreadList[i].CreateAndStartThread( i );
+}
+
+void JobManager::SetNumThreads( unsigned int numThreads )
+{
+	// must not be called while jobs are in flight
+	if (numThreads == 0) { uint c; GetProcessorCount( c, numThreads ); }
+	if (m_JobManager && m_JobManager->m_NumThreads == max( 1u, numThreads )) return;
+	delete m_JobManager;
+	CreateJobManager( numThreads, pinJobThreads );
+}
+
+void JobManager::AddJob2( Job* a_Job )
+{
+	m_JobList.push_back( a_Job );
+}
+
+void JobManager::RunJobs()
+{
+	for (Job* job : m_JobList) Submit( [job]() { job->RunCodeWrapper(); }, &m_JobListCounter );
+	m_JobList.clear();
+	Wait( m_JobListCounter );
+}
+
+void JobManager::Submit( const Task& task, JobCounter* counter )
+{
+	if (counter) counter->pending.fetch_add( 1, std::memory_order_relaxed );
+	// workers push to their own deque; other threads distribute round-robin
+	uint slot = threadIdx > 0 ? threadIdx : (m_NextQueue++ % m_NumThreads);
+	{
+		std::lock_guard<std::mutex> lock( m_Queues[slot].lock );
+		m_Queues[slot].jobs.push_back( { task, counter } );
+	}
+	{
+		std::lock_guard<std::mutex> lock( m_SleepLock );
+		m_Queued++;
+	}
+	m_WakeUp.notify_one();
+}
+
+bool JobManager::PopJob( unsigned int threadId, QueuedJob& job )
+{
+	JobQueue& queue = m_Queues[threadId];
+	std::lock_guard<std::mutex> lock( queue.lock );
+	if (queue.jobs.empty()) return false;
+	job = std::move( queue.jobs.back() );
+	queue.jobs.pop_back();
+	return true;
+}
+
+bool JobManager::StealJob( unsigned int threadId, QueuedJob& job )
+{
+	for (unsigned int i = 1; i < m_NumThreads; i++)
+	{
+		JobQueue& queue = m_Queues[(threadId + i) % m_NumThreads];
+		std::unique_lock<std::mutex> lock( queue.lock, std::try_to_lock );
+		if (!lock.owns_lock() || queue.jobs.empty()) continue;
+		job = std::move( queue.jobs.front() );
+		queue.jobs.pop_front();
+		return true;
+	}
+	return false;
+}
+
+bool JobManager::RunOneJob( unsigned int threadId )
+{
+	QueuedJob job;
+	if (!PopJob( threadId, job ) && !StealJob( threadId, job )) return false;
+	m_Queued--;
+	{
+		PROFILE_SPAN( "Job" );
+		job.task();
+	}
+	if (job.counter) job.counter->pending.fetch_sub( 1, std::memory_order_release );
+	return true;
+}
+
+void JobManager::Wait( JobCounter& counter )
+{
+	// help executing jobs until the counter drops to zero
+	while (!counter.Done()) if (!RunOneJob( threadIdx )) std::this_thread::yield();
+}
+
+void JobManager::ParallelFor( int first, int last, int grain, const std::function<void( int, int )>& body )
+{
+	if (last <= first) return;
+	// default grain: roughly four chunks per thread for load balancing
+	if (grain < 1) grain = max( 1, (last - first) / (int)(m_NumThreads * 4) );
+	if (last - first <= grain || m_NumThreads == 1) { body( first, last ); return; }
+	JobCounter counter;
+	for (int i = first; i < last; i += grain)
+	{
+		const int end = min( last, i + grain );
+		Submit( [&body, i, end]() { body( i, end ); }, &counter );
+	}
+	Wait( counter );
+}
+
+#ifdef _MSC_VER
+DWORD CountSetBits( ULONG_PTR bitMask )
+{
+	DWORD LSHIFT = sizeof( ULONG_PTR ) * 8 - 1, bitSetCount = 0;
+	ULONG_PTR bitTest = (ULONG_PTR)1 << LSHIFT;
+	for (DWORD i = 0; i <= LSHIFT; ++i) bitSetCount += ((bitMask & bitTest) ? 1 : 0), bitTest /= 2;
+	return bitSetCount;
+}
+#endif
+
+void JobManager::GetProcessorCount( uint& cores, uint& logical )
+{
+	cores = logical = 0;
+#ifdef _MSC_VER
+	// https://github.com/GPUOpen-LibrariesAndSDKs/cpu-core-counts
+	char* buffer = NULL;
+	DWORD len = 0;
+	if (FALSE == GetLogicalProcessorInformationEx( RelationAll, (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)buffer, &len ))
+	{
+		if (GetLastError() == ERROR_INSUFFICIENT_BUFFER)
+		{
+			buffer = (char*)malloc( len );
+			if (GetLogicalProcessorInformationEx( RelationAll, (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)buffer, &len ))
+			{
+				DWORD offset = 0;
+				char* ptr = buffer;
+				while (ptr < buffer + len)
+				{
+					PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX pi = (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)ptr;
+					if (pi->Relationship == RelationProcessorCore)
+					{
+						cores++;
+						for (size_t g = 0; g < pi->Processor.GroupCount; ++g)
+							logical += CountSetBits( pi->Processor.GroupMask[g].Mask );
+					}
+					ptr += pi->Size;
+				}
+			}
+			free( buffer );
+		}
+	}
+#endif
+	// portable fallback; does not distinguish between physical and logical cores
+	if (logical == 0) logical = max( 1u, std::thread::hardware_concurrency() );
+	if (cores == 0) cores = logical;
+}
+
+JobManager* JobManager::GetJobManager()
+{
+	if (!m_JobManager)
+	{
+		uint c, l;
+		GetProcessorCount( c, l );
+		CreateJobManager( l );
+	}
+	return m_JobManager;
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  JobGraph.                                                            LH2'20|
+//  +-----------------------------------------------------------------------------+
+JobGraph::~JobGraph()
+{
+	Clear();
+}
+
+void JobGraph::Clear()
+{
+	for (Node* node : nodes) delete node;
+	nodes.clear();
+}
+
+int JobGraph::Add( const JobManager::Task& task )
+{
+	Node* node = new Node();
+	node->task = task;
+	nodes.push_back( node );
+	return (int)nodes.size() - 1;
+}
+
+void JobGraph::Precede( const int before, const int after )
+{
+	nodes[before]->successors.push_back( after );
+	nodes[after]->dependencies++;
+}
+
+void JobGraph::Schedule( const int idx, JobCounter* counter )
+{
+	JobManager::GetJobManager()->Submit( [this, idx, counter]() {
+		Node* node = nodes[idx];
+		node->task();
+		// release successors; the last predecessor to finish schedules the successor
+		for (int s : node->successors) if (nodes[s]->remaining.fetch_sub( 1 ) == 1) Schedule( s, counter );
+	}, counter );
+}
+
+void JobGraph::Run()
+{
+	JobCounter counter;
+	for (Node* node : nodes) node->remaining = node->dependencies;
+	for (int s = (int)nodes.size(), i = 0; i < s; i++) if (nodes[i]->dependencies == 0) Schedule( i, &counter );
+	JobManager::GetJobManager()->Wait( counter );
+}
+
+//  +-----------------------------------------------------------------------------+
+//  |  MappedFile implementation.                                           LH2'20|
+//  +-----------------------------------------------------------------------------+
+bool MappedFile::Open( const char* fileName, const bool copyOnWrite )
+{
+	Close();
+#ifdef _MSC_VER
+	file = CreateFileA( fileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL );
+	if (file == INVALID_HANDLE_VALUE) { file = nullptr; return false; }
+	LARGE_INTEGER fileSize;
+	GetFileSizeEx( file, &fileSize );
+	size = (size_t)fileSize.QuadPart;
+	if (size == 0) return true;
+	mapping = CreateFileMappingA( file, NULL, copyOnWrite ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, NULL );
+	if (mapping) data = (const char*)MapViewOfFile( mapping, copyOnWrite ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0 );
+#else
+	fd = open( fileName, O_RDONLY );
+	if (fd < 0) return false;
+	struct stat s;
+	fstat( fd, &s );
+	size = (size_t)s.st_size;
+	if (size == 0) return true;
+	void* view = mmap( 0, size, copyOnWrite ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_PRIVATE, fd, 0 );
+	if (view != MAP_FAILED) data = (const char*)view;
+#endif
+	if (!data) { Close(); return false; }
+	return true;
+}
+
+void MappedFile::Close()
+{
+#ifdef _MSC_VER
+	if (data) UnmapViewOfFile( data );
+	if (mapping) CloseHandle( mapping );
+	if (file) CloseHandle( file );
+	file = mapping = nullptr;
+#else
+	if (data) munmap( (void*)data, size );
+	if (fd >= 0) close( fd );
+	fd = -1;
+#endif
+	data = nullptr;
+	size = 0;
+}
+
 //  +-----------------------------------------------------------------------------+
 //  |  GLTextRenderer implementation.                                       LH2'20|
 //  +-----------------------------------------------------------------------------+
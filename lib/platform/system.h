@@ -20,13 +20,18 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <fstream>
+#include <functional>
 #include <half.hpp>
 #ifdef _MSC_VER
 #include <ppl.h>
 #endif
+#include <mutex>
 #include <string>
 #include <thread>
 #include <vector>
@@ -60,6 +65,38 @@ using namespace half_float;
 #define FREE64( x ) free( x )
 #endif
 
+// span profiler: while tracing is enabled, ProfileSpans (PROFILE_SPAN) are recorded
+// in a ring buffer per thread, without locking. WriteTrace stores the spans in the Chrome
+// trace format (chrome://tracing, ui.perfetto.dev); call it when no jobs are in flight.
+// Modules that link their own copy of this code share the state of the application via
+// Attach. Define NO_PROFILER to compile the spans out.
+class Profiler
+{
+public:
+	enum { RINGSIZE = 16384 };				// spans per thread; the oldest spans are overwritten
+	struct Span { const char* name; int64_t start, end; };
+	struct Ring { Span span[RINGSIZE]; std::atomic<uint> head = 0; int thread = 0; };
+	struct State
+	{
+		std::atomic<bool> enabled = false;
+		std::mutex lock;					// guards the ring list; taken once per thread and module
+		vector<Ring*> rings;
+		std::map<std::thread::id, int> threadIds;
+		const chrono::high_resolution_clock::time_point epoch = chrono::high_resolution_clock::now();
+	};
+	static State* GetState() { if (!state) state = new State(); return state; }
+	static void Attach( State* shared ) { state = shared; }
+	static void Enable( const bool on ) { GetState()->enabled = on; }
+	static bool Enabled() { return GetState()->enabled.load( std::memory_order_relaxed ); }
+	static int64_t Ticks( const chrono::high_resolution_clock::time_point t ) { return chrono::duration_cast<chrono::nanoseconds>(t - GetState()->epoch).count(); }
+	static int64_t Now() { return Ticks( chrono::high_resolution_clock::now() ); }
+	static void Record( const char* name, const int64_t start, const int64_t end );
+	static bool WriteTrace( const char* fileName );
+private:
+	static inline State* state = 0;
+	static inline thread_local Ring* ring = 0;
+};
+
 // timer
 struct Timer
 {
@@ -74,6 +111,120 @@ struct Timer
 	chrono::high_resolution_clock::time_point start;
 };
 
+// Timer that is recorded as a span from construction to destruction while the profiler
+// is enabled; plain Timers are never recorded. The name must remain valid until the
+// trace is written
+class ProfileSpan : public Timer
+{
+public:
+	ProfileSpan( const char* spanName ) : name( Profiler::Enabled() ? spanName : 0 ) {}
+#ifndef NO_PROFILER
+	~ProfileSpan() { if (name) Profiler::Record( name, Profiler::Ticks( start ), Profiler::Now() ); }
+#endif
+private:
+	const char* name;
+};
+#ifdef NO_PROFILER
+#define PROFILE_SPAN( name )
+#else
+#define PROFILE_SPAN_( name, line ) ProfileSpan profileSpan##line( name )
+#define PROFILE_SPAN_LINE( name, line ) PROFILE_SPAN_( name, line )
+#define PROFILE_SPAN( name ) PROFILE_SPAN_LINE( name, __LINE__ )
+#endif
+
+// per-phase statistics for the CPU cores: each thread counts events and accumulates
+// phase times in its own cache line, without locking; Merge sums the threads when a
+// frame is complete and clears the counters. Each module has its own set. Hot loops
+// count in a plain Counters instance of their own and Flush it once per job. Phases
+// that are too short to time individually are sampled: only the events of sampled
+// work items (e.g. one pixel in SAMPLERATE) are timed, and Flush distributes the
+// measured job time over the phases in the proportions observed in the samples.
+class PhaseStats
+{
+public:
+	enum { PRIMARY = 0, BOUNCE1, DEEP, SHADOW, SHADE, RENDER, PHASES };
+	struct Totals
+	{
+		uint64_t count[PHASES];			// events, e.g. rays traced, per phase
+		float seconds[PHASES];			// time per phase, summed over the threads
+		uint threads;					// number of threads that recorded anything
+	};
+	struct Counters
+	{
+		uint64_t count[PHASES] = {};	// events, per phase
+		int64_t ticks[PHASES] = {};		// time of the events of sampled work items, per phase
+		int64_t sampleTicks = 0;		// total time of the sampled work items
+		int64_t sampleStart = 0;
+		bool sampling = false;
+		void BeginSample( const bool sample ) { if ((sampling = sample)) sampleStart = Now(); }
+		void EndSample() { if (sampling) sampleTicks += Now() - sampleStart, sampling = false; }
+		int64_t Start() const { return sampling ? Now() : 0; }
+		void Stop( const int phase, const int64_t start ) { if (sampling) ticks[phase] += Now() - start; }
+	};
+	enum { SAMPLERATE = 16 };
+	static bool Sampled( const int x, const int y ) { return ((x + y) & (SAMPLERATE - 1)) == 0; }
+	static int64_t Now() { return chrono::duration_cast<chrono::nanoseconds>( chrono::steady_clock::now().time_since_epoch() ).count(); }
+	static void Count( const int phase, const uint n = 1 ) { Local().count[phase] += n; }
+	static void Flush( Counters& c, const float renderSeconds );
+	static void AddTime( const int phase, const float t ) { Local().seconds[phase] += t; }
+	static int TracePhase( const uint depth ) { return depth == 0 ? PRIMARY : depth == 1 ? BOUNCE1 : DEEP; }
+	static Totals Merge();
+private:
+	struct ALIGN( 64 ) Slot { uint64_t count[PHASES]; double seconds[PHASES]; };
+	static Slot& Local() { if (!local) local = Register(); return *local; }
+	static Slot* Register();
+	static inline thread_local Slot* local = 0;
+	static inline vector<Slot*> slots;	// never freed: threads of a replaced job pool may still own one
+	static inline std::mutex slotLock;
+};
+
+// RAII timer: adds its lifetime to a phase of the calling thread
+class ScopedTimer
+{
+public:
+	ScopedTimer( const int phase ) : phase( phase ), start( chrono::high_resolution_clock::now() ) {}
+	~ScopedTimer() { PhaseStats::AddTime( phase, chrono::duration<float>( chrono::high_resolution_clock::now() - start ).count() ); }
+private:
+	const int phase;
+	const chrono::high_resolution_clock::time_point start;
+};
+
+// linear allocator for transient data: Alloc bumps an offset, Reset releases everything
+// at once. When a block is full a larger one is chained; Reset merges the chain into a
+// single block, so a steady workload settles on one block without further heap traffic.
+class Arena
+{
+public:
+	Arena( const size_t initialSize = 1 << 20 ) : initialSize( initialSize ) {}
+	~Arena() { for (Block& b : blocks) FREE64( b.data ); }
+	void* Alloc( const size_t bytes, const size_t alignment = 64 );
+	template <class T> T* Alloc( const size_t count ) { return (T*)Alloc( count * sizeof( T ), max( alignof( T ), (size_t)16 ) ); }
+	void Reset();
+	size_t Capacity() const { size_t total = 0; for (const Block& b : blocks) total += b.size; return total; }
+private:
+	struct Block { uchar* data; size_t size; };
+	vector<Block> blocks;
+	size_t used = 0;						// bytes used in the last block
+	const size_t initialSize;
+};
+
+// per-frame memory: one arena for the render thread, and a scratch arena per thread, e.g.
+// for the jobs of ParallelFor. EndFrame resets all of them; call it when no jobs are in
+// flight. A scratch arena is released when its thread exits, e.g. when SetNumThreads
+// replaces the workers. Like PhaseStats, each module that links this code has its own.
+class FrameMemory
+{
+public:
+	static Arena& Frame() { static Arena arena; return arena; }
+	static Arena& Scratch();
+	static void EndFrame();
+private:
+	struct ScratchOwner { Arena* arena; ~ScratchOwner(); };		// zero-initialized, as a thread_local
+	static inline thread_local ScratchOwner scratch;
+	static inline vector<Arena*> scratchArenas;
+	static inline std::mutex scratchLock;
+};
+
 // convenience functions
 #define wrap(x,a,b) (((x)>=(a))?((x)<=(b)?(x):((x)-((b)-(a)))):((x)+((b)-(a))))
 __inline float sqr( const float x ) { return x * x; }
@@ -167,6 +318,7 @@ void MarkAsNotDirty() { Changed(); } \
 private: uint64_t crc64 = CLEARCRC64; uint dirty = 0; \
 
 // rng
+void SeedRandom( uint seed );
 uint RandomUInt();
 uint RandomUInt( uint& seed );
 float RandomFloat();
@@ -217,6 +369,172 @@ public:
 	uint width = 0, height = 0;
 };
 
+// Render target in host memory, for rendering without a window or OpenGL context.
+// DEFAULT targets store 8-bit RGBA pixels, in the layout that the cores upload to
+// a GLTexture; FLOAT targets store linear (HDR) colors.
+class HostTarget
+{
+public:
+	enum { DEFAULT = 0, FLOAT = 1 };
+	// constructor / destructor
+	HostTarget( uint w, uint h, uint type = DEFAULT );
+	~HostTarget() { FREE64( pixels ); FREE64( hdrPixels ); }
+	HostTarget( const HostTarget& ) = delete;	// owns its pixel buffers
+	HostTarget& operator=( const HostTarget& ) = delete;
+	// methods
+	void CopyFrom( const uint* src );
+	void CopyFrom( const float4* src );
+	bool Save( const char* fileName ) const;
+	float RMSE( const char* referenceFile ) const; // -1 if the reference can not be loaded or differs in size
+	// public data members
+public:
+	uint width = 0, height = 0, type = DEFAULT;
+	uint* pixels = nullptr;				// DEFAULT targets
+	float4* hdrPixels = nullptr;		// FLOAT targets
+};
+
+// Low-level thread class
+class Thread
+{
+public:
+	virtual ~Thread() { join(); }
+	void start();
+	void join() { if (t.joinable()) t.join(); }
+	virtual void run() {};
+	void setAffinity( int core );
+	std::thread::native_handle_type handle() { return t.native_handle(); }
+private:
+	std::thread t;
+};
+
+// Legacy thread class of the GPU cores, which run an endless render loop on it.
+// Unlike Thread, destruction detaches instead of joining, so shutdown doesn't hang.
+class WinThread
+{
+public:
+	virtual ~WinThread() { if (t.joinable()) t.detach(); }
+	void start();
+	virtual void run() {};
+	void setPriority( int p );
+	std::thread::native_handle_type handle() { return t.native_handle(); }
+private:
+	std::thread t;
+};
+
+// Nils's jobmanager, made portable and extended with work stealing.
+// Jobs are executed by a pool of worker threads; each worker owns a deque. The
+// owner pops from the back (LIFO, cache friendly), idle workers steal from the
+// front of other deques. A thread that waits for work to complete (e.g. the
+// main thread in RunJobs or ParallelFor) helps executing jobs while it waits.
+class Job
+{
+public:
+	virtual ~Job() = default;
+	virtual void Main() = 0;
+protected:
+	friend class JobManager;
+	void RunCodeWrapper();
+};
+struct JobCounter
+{
+	std::atomic<int> pending = 0;		// number of jobs that did not complete yet
+	bool Done() const { return pending.load( std::memory_order_acquire ) == 0; }
+};
+class JobThread
+{
+public:
+	void CreateAndStartThread( unsigned int threadId );
+	void WaitForThreadToStop();
+	void BackgroundTask();
+	std::thread m_Thread;
+	int m_ThreadID;
+};
+class JobManager	// singleton class!
+{
+public:
+	typedef std::function<void()> Task;
+protected:
+	struct QueuedJob { Task task; JobCounter* counter; };
+	struct JobQueue
+	{
+		std::mutex lock;
+		std::deque<QueuedJob> jobs;
+	};
+	JobManager( unsigned int numThreads );
+public:
+	~JobManager();
+	static void CreateJobManager( unsigned int numThreads, bool pinThreads = false );
+	static void SetNumThreads( unsigned int numThreads ); // replaces the pool; 0 for one thread per logical processor
+	static JobManager* GetJobManager();
+	static void GetProcessorCount( uint& cores, uint& logical );
+	static int ThreadIndex() { return threadIdx; } // 0 for the main (or any non-worker) thread
+	// legacy interface: queue jobs, then run them all
+	void AddJob2( Job* a_Job );
+	void RunJobs();
+	// task interface
+	void Submit( const Task& task, JobCounter* counter = 0 );
+	void Wait( JobCounter& counter );
+	void ParallelFor( int first, int last, int grain, const std::function<void( int, int )>& body );
+	unsigned int GetNumThreads() { return m_NumThreads; }
+	int MaxConcurrent() { return m_NumThreads; }
+protected:
+	friend class JobThread;
+	bool RunOneJob( unsigned int threadId );
+	bool PopJob( unsigned int threadId, QueuedJob& job );
+	bool StealJob( unsigned int threadId, QueuedJob& job );
+	static JobManager* m_JobManager;
+	static thread_local int threadIdx;
+	vector<Job*> m_JobList;
+	JobCounter m_JobListCounter;
+	JobQueue* m_Queues = 0;						// one deque per thread; slot 0 is used by non-worker threads
+	std::mutex m_SleepLock;
+	std::condition_variable m_WakeUp;
+	std::atomic<int> m_Queued = 0;				// jobs sitting in any of the queues
+	std::atomic<bool> m_Exit = false;
+	std::atomic<uint> m_NextQueue = 0;			// round-robin slot for jobs submitted by non-worker threads
+	unsigned int m_NumThreads;					// worker threads + the main thread
+	JobThread* m_JobThreadList = 0;
+};
+
+// Minimal task graph: a set of tasks with 'happens-before' relations, executed by the JobManager.
+class JobGraph
+{
+public:
+	~JobGraph();
+	int Add( const JobManager::Task& task );
+	void Precede( const int before, const int after );
+	void Run();
+	void Clear();
+private:
+	struct Node
+	{
+		JobManager::Task task;
+		vector<int> successors;
+		int dependencies = 0;
+		std::atomic<int> remaining = 0;
+	};
+	void Schedule( const int idx, JobCounter* counter );
+	vector<Node*> nodes;
+};
+
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	MappedFile( const char* fileName, const bool copyOnWrite = false ) { Open( fileName, copyOnWrite ); }
+	~MappedFile() { Close(); }
+	bool Open( const char* fileName, const bool copyOnWrite = false );
+	void Close();
+	const char* data = nullptr;			// view of the file contents; writes (copy-on-write views only) never reach the file
+	size_t size = 0;
+private:
+#ifdef _MSC_VER
+	void* file = nullptr, *mapping = nullptr;
+#else
+	int fd = -1;
+#endif
+};
+
 class GLTexture
 {
 public:
@@ -231,10 +549,20 @@ public:
 	void Load( const char* fileName, int filter = GL_NEAREST );
 	void CopyFrom( Bitmap* src );
 	void CopyTo( Bitmap* dst );
+	// zero-copy upload for CPU cores: render into the buffer returned by MapPixels, then
+	// call UploadPixels. MapPixels returns 0 if persistent mapping is not available.
+	uint* MapPixels();
+	void UploadPixels();
 	// public data members
 public:
 	GLuint ID = 0;
 	uint width = 0, height = 0;
+private:
+	// double-buffered persistent mapped pixel buffer objects, with a fence per buffer
+	GLuint pbo[2] = {};
+	uint* mapped[2] = {};
+	GLsync fence[2] = {};
+	uint current = 0;
 };
 
 class Shader;
@@ -0,0 +1,440 @@
+/* sbvhbuilder.h - Copyright 2019/2020 Utrecht University
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+	   http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#pragma once
+
+#include "platform.h"
+
+/**
+  * Spatial split BVH builder (Stich et al., 2009). Next to the binned object splits of BVHNode, every node
+  * considers splitting space itself: triangles that straddle the plane are clipped and referenced from both
+  * children. Overlap between siblings drops, which pays off for scenes with long or large triangles, at the cost
+  * of a slower build and duplicated triangle indices.
+  *
+  * Shared by the CPU cores: Triangle is the triangle class of the core (with bounds, v0, v1 and v2), Node its
+  * BVHNode (with bounds, isLeaf, left, first, count and splitAxis).
+  */
+template <class Triangle, class Node>
+class SBVHBuilder
+{
+public:
+	/** Spatial splits are only tried when the children of the object split overlap more than this, relative to the root */
+	static constexpr float ALPHA = 1e-5f;
+	static const int BINCOUNT = 32;
+	static const int MAXDEPTH = 48;
+
+	/** The budget is the number of extra triangle references, as a fraction of the triangle count */
+	SBVHBuilder(const Triangle* triangles, int triangleIndex, int triangleCount, float budget);
+	/** Builds the nodes and the triangle references; the caller owns the arrays */
+	void Build(Node*& pool, int& poolPtr, int*& triangleIndices, int& indexCount);
+private:
+	struct Reference {
+		aabb bounds;
+		int triangle;
+	};
+	struct Split {
+		float cost = std::numeric_limits<float>::max();
+		int axis = -1;
+		bool spatial = false;
+		/** Object splits: last bin on the left side, with the centroid range; spatial splits: the plane */
+		int bin = -1;
+		float position = 0;
+		float scale = 0;
+		aabb leftBounds;
+		aabb rightBounds;
+		int leftCount = 0;
+		int rightCount = 0;
+	};
+	struct BuildBin {
+		aabb bounds;
+		int count = 0;
+		int entries = 0;
+		int exits = 0;
+	};
+
+	const Triangle* triangles;
+	int triangleIndex;
+	int triangleCount;
+	int maxReferences;
+	int referenceCount;
+	float rootArea;
+	vector<Node> nodes;
+	vector<int> indices;
+
+	void Subdivide(int nodeIdx, vector<Reference>& references, int depth);
+	void MakeLeaf(int nodeIdx, const vector<Reference>& references);
+	Split FindObjectSplit(const vector<Reference>& references) const;
+	Split FindSpatialSplit(const vector<Reference>& references, const aabb& bounds) const;
+	void PerformObjectSplit(const Split& split, const vector<Reference>& references, vector<Reference>& left, vector<Reference>& right) const;
+	void PerformSpatialSplit(const Split& split, const vector<Reference>& references, vector<Reference>& left, vector<Reference>& right);
+	/** Bounds of the part of a reference between two planes on an axis */
+	aabb Clip(const Reference& reference, int axis, float lo, float hi) const;
+	static float GetVertexAxisValue(int axis, const float4& vertex);
+	static bool IsEmptyBounds(const aabb& bounds);
+};
+
+template <class Triangle, class Node>
+float SBVHBuilder<Triangle, Node>::GetVertexAxisValue(int axis, const float4& vertex) {
+	if (axis == 0) {
+		return vertex.x;
+	}
+	else if (axis == 1) {
+		return vertex.y;
+	}
+	else {
+		return vertex.z;
+	}
+}
+
+template <class Triangle, class Node>
+bool SBVHBuilder<Triangle, Node>::IsEmptyBounds(const aabb& bounds) {
+	return bounds.bmin[0] > bounds.bmax[0] || bounds.bmin[1] > bounds.bmax[1] || bounds.bmin[2] > bounds.bmax[2];
+}
+
+template <class Triangle, class Node>
+SBVHBuilder<Triangle, Node>::SBVHBuilder(const Triangle* triangles, int triangleIndex, int triangleCount, float budget) {
+	this->triangles = triangles;
+	this->triangleIndex = triangleIndex;
+	this->triangleCount = triangleCount;
+	this->maxReferences = triangleCount + (int)(max(0.0f, budget) * triangleCount);
+	this->referenceCount = triangleCount;
+	this->rootArea = 0;
+}
+
+template <class Triangle, class Node>
+void SBVHBuilder<Triangle, Node>::Build(Node*& pool, int& poolPtr, int*& triangleIndices, int& indexCount) {
+	vector<Reference> references(this->triangleCount);
+	aabb rootBounds;
+	rootBounds.Reset();
+	for (int i = 0; i < this->triangleCount; i++) {
+		references[i].triangle = this->triangleIndex + i;
+		references[i].bounds = this->triangles[this->triangleIndex + i].bounds;
+		rootBounds.Grow(references[i].bounds);
+	}
+	this->rootArea = rootBounds.Area();
+
+	this->nodes.clear();
+	this->nodes.reserve(this->triangleCount * 2);
+	this->nodes.resize(1);
+	this->nodes[0].bounds = rootBounds;
+	this->indices.clear();
+	this->indices.reserve(this->maxReferences);
+	this->Subdivide(0, references, 0);
+
+	pool = new Node[this->nodes.size()];
+	std::copy(this->nodes.begin(), this->nodes.end(), pool);
+	poolPtr = (int)this->nodes.size();
+	triangleIndices = new int[this->indices.size()];
+	std::copy(this->indices.begin(), this->indices.end(), triangleIndices);
+	indexCount = (int)this->indices.size();
+
+	vector<Node>().swap(this->nodes);
+	vector<int>().swap(this->indices);
+}
+
+template <class Triangle, class Node>
+void SBVHBuilder<Triangle, Node>::Subdivide(int nodeIdx, vector<Reference>& references, int depth) {
+	int count = (int)references.size();
+	if (count <= 2) {
+		this->MakeLeaf(nodeIdx, references);
+		return;
+	}
+
+	Split best = this->FindObjectSplit(references);
+
+	/** Spatial splits only help where the children of the object split overlap, and only while the budget lasts */
+	if (depth < MAXDEPTH && this->referenceCount < this->maxReferences) {
+		aabb overlap = best.leftBounds.Intersection(best.rightBounds);
+		float overlapArea = (best.axis == -1 || IsEmptyBounds(overlap)) ? 0 : overlap.Area();
+		if (best.axis == -1 || overlapArea > ALPHA * this->rootArea) {
+			Split spatial = this->FindSpatialSplit(references, this->nodes[nodeIdx].bounds);
+			int duplicates = spatial.leftCount + spatial.rightCount - count;
+			if (spatial.cost < best.cost && this->referenceCount + duplicates <= this->maxReferences) {
+				best = spatial;
+			}
+		}
+	}
+
+	/** SAH termination */
+	if (best.axis == -1 || best.cost >= this->nodes[nodeIdx].bounds.Area() * count) {
+		this->MakeLeaf(nodeIdx, references);
+		return;
+	}
+
+	vector<Reference> left, right;
+	if (best.spatial) {
+		this->PerformSpatialSplit(best, references, left, right);
+	}
+	else {
+		this->PerformObjectSplit(best, references, left, right);
+	}
+	if (left.empty() || right.empty()) {
+		this->MakeLeaf(nodeIdx, references);
+		return;
+	}
+	vector<Reference>().swap(references);
+
+	/** Children are stored in pairs, like the regular build; the vector may move, so work with indices */
+	int leftIdx = (int)this->nodes.size();
+	this->nodes.resize(this->nodes.size() + 2);
+	this->nodes[nodeIdx].left = leftIdx;
+	this->nodes[nodeIdx].isLeaf = false;
+	this->nodes[nodeIdx].splitAxis = best.axis;
+	this->nodes[nodeIdx].first = 0;
+	this->nodes[nodeIdx].count = 0;
+
+	aabb leftBounds, rightBounds;
+	leftBounds.Reset();
+	rightBounds.Reset();
+	for (const Reference& reference : left) { leftBounds.Grow(reference.bounds); }
+	for (const Reference& reference : right) { rightBounds.Grow(reference.bounds); }
+	this->nodes[leftIdx].bounds = leftBounds;
+	this->nodes[leftIdx + 1].bounds = rightBounds;
+
+	this->Subdivide(leftIdx, left, depth + 1);
+	this->Subdivide(leftIdx + 1, right, depth + 1);
+}
+
+template <class Triangle, class Node>
+void SBVHBuilder<Triangle, Node>::MakeLeaf(int nodeIdx, const vector<Reference>& references) {
+	Node* node = &this->nodes[nodeIdx];
+	node->isLeaf = true;
+	node->first = (int)this->indices.size();
+	node->count = (int)references.size();
+	node->splitAxis = 0;
+	for (const Reference& reference : references) {
+		this->indices.push_back(reference.triangle);
+	}
+}
+
+template <class Triangle, class Node>
+typename SBVHBuilder<Triangle, Node>::Split SBVHBuilder<Triangle, Node>::FindObjectSplit(const vector<Reference>& references) const {
+	Split best;
+	BuildBin bins[BINCOUNT];
+	aabb rightBounds[BINCOUNT];
+	int rightCounts[BINCOUNT];
+
+	aabb centroidBounds;
+	centroidBounds.Reset();
+	for (const Reference& reference : references) { centroidBounds.Grow(reference.bounds.Center()); }
+
+	for (int axis = 0; axis < 3; axis++) {
+		float cbmin = centroidBounds.bmin[axis];
+		float cbmax = centroidBounds.bmax[axis];
+		if (abs(cbmax - cbmin) <= EPSILON) { continue; }
+		float k1 = (BINCOUNT * (1 - EPSILON)) / (cbmax - cbmin);
+
+		/** Fill the bins with the references */
+		for (int i = 0; i < BINCOUNT; i++) { bins[i] = BuildBin(); }
+		for (const Reference& reference : references) {
+			int binID = min(BINCOUNT - 1, (int)(k1 * (reference.bounds.Center(axis) - cbmin)));
+			bins[binID].count++;
+			bins[binID].bounds.Grow(reference.bounds);
+		}
+
+		/** Sweep from the right, then evaluate the planes from the left */
+		rightBounds[BINCOUNT - 1] = bins[BINCOUNT - 1].bounds;
+		rightCounts[BINCOUNT - 1] = bins[BINCOUNT - 1].count;
+		for (int i = BINCOUNT - 2; i > 0; i--) {
+			rightBounds[i] = rightBounds[i + 1].Union(bins[i].bounds);
+			rightCounts[i] = rightCounts[i + 1] + bins[i].count;
+		}
+		aabb leftBounds;
+		leftBounds.Reset();
+		int leftCount = 0;
+		for (int i = 0; i < BINCOUNT - 1; i++) {
+			leftBounds.Grow(bins[i].bounds);
+			leftCount += bins[i].count;
+			int rightCount = rightCounts[i + 1];
+			if (leftCount == 0 || rightCount == 0) { continue; }
+
+			float cost = leftBounds.Area() * leftCount + rightBounds[i + 1].Area() * rightCount;
+			if (cost < best.cost) {
+				best.cost = cost;
+				best.axis = axis;
+				best.spatial = false;
+				best.bin = i;
+				best.position = cbmin;
+				best.scale = k1;
+				best.leftBounds = leftBounds;
+				best.rightBounds = rightBounds[i + 1];
+				best.leftCount = leftCount;
+				best.rightCount = rightCount;
+			}
+		}
+	}
+	return best;
+}
+
+template <class Triangle, class Node>
+typename SBVHBuilder<Triangle, Node>::Split SBVHBuilder<Triangle, Node>::FindSpatialSplit(const vector<Reference>& references, const aabb& bounds) const {
+	Split best;
+	BuildBin bins[BINCOUNT];
+	aabb rightBounds[BINCOUNT];
+	int rightCounts[BINCOUNT];
+
+	for (int axis = 0; axis < 3; axis++) {
+		float lo = bounds.bmin[axis];
+		float extent = bounds.bmax[axis] - lo;
+		if (extent <= EPSILON) { continue; }
+		float binWidth = extent / BINCOUNT;
+		float invWidth = 1 / binWidth;
+
+		/** Clip each reference against the bins it spans; entries and exits count it once on each side */
+		for (int i = 0; i < BINCOUNT; i++) { bins[i] = BuildBin(); }
+		for (const Reference& reference : references) {
+			int firstBin = clamp((int)((reference.bounds.bmin[axis] - lo) * invWidth), 0, BINCOUNT - 1);
+			int lastBin = clamp((int)((reference.bounds.bmax[axis] - lo) * invWidth), firstBin, BINCOUNT - 1);
+			for (int b = firstBin; b <= lastBin; b++) {
+				float binMin = lo + b * binWidth;
+				float binMax = (b == BINCOUNT - 1) ? bounds.bmax[axis] : lo + (b + 1) * binWidth;
+				aabb clipped = (firstBin == lastBin) ? reference.bounds : this->Clip(reference, axis, binMin, binMax);
+				if (!IsEmptyBounds(clipped)) { bins[b].bounds.Grow(clipped); }
+			}
+			bins[firstBin].entries++;
+			bins[lastBin].exits++;
+		}
+
+		rightBounds[BINCOUNT - 1] = bins[BINCOUNT - 1].bounds;
+		rightCounts[BINCOUNT - 1] = bins[BINCOUNT - 1].exits;
+		for (int i = BINCOUNT - 2; i > 0; i--) {
+			rightBounds[i] = rightBounds[i + 1].Union(bins[i].bounds);
+			rightCounts[i] = rightCounts[i + 1] + bins[i].exits;
+		}
+		aabb leftBounds;
+		leftBounds.Reset();
+		int leftCount = 0;
+		for (int i = 0; i < BINCOUNT - 1; i++) {
+			leftBounds.Grow(bins[i].bounds);
+			leftCount += bins[i].entries;
+			int rightCount = rightCounts[i + 1];
+			if (leftCount == 0 || rightCount == 0) { continue; }
+
+			float cost = leftBounds.Area() * leftCount + rightBounds[i + 1].Area() * rightCount;
+			if (cost < best.cost) {
+				best.cost = cost;
+				best.axis = axis;
+				best.spatial = true;
+				best.bin = i;
+				best.position = lo + (i + 1) * binWidth;
+				best.leftBounds = leftBounds;
+				best.rightBounds = rightBounds[i + 1];
+				best.leftCount = leftCount;
+				best.rightCount = rightCount;
+			}
+		}
+	}
+	return best;
+}
+
+template <class Triangle, class Node>
+void SBVHBuilder<Triangle, Node>::PerformObjectSplit(const Split& split, const vector<Reference>& references, vector<Reference>& left, vector<Reference>& right) const {
+	left.reserve(split.leftCount);
+	right.reserve(split.rightCount);
+	for (const Reference& reference : references) {
+		int binID = min(BINCOUNT - 1, (int)(split.scale * (reference.bounds.Center(split.axis) - split.position)));
+		if (binID <= split.bin) {
+			left.push_back(reference);
+		}
+		else {
+			right.push_back(reference);
+		}
+	}
+}
+
+template <class Triangle, class Node>
+void SBVHBuilder<Triangle, Node>::PerformSpatialSplit(const Split& split, const vector<Reference>& references, vector<Reference>& left, vector<Reference>& right) {
+	int axis = split.axis;
+	float position = split.position;
+	aabb leftBounds = split.leftBounds;
+	aabb rightBounds = split.rightBounds;
+	int leftCount = split.leftCount;
+	int rightCount = split.rightCount;
+	left.reserve(leftCount);
+	right.reserve(rightCount);
+
+	for (const Reference& reference : references) {
+		if (reference.bounds.bmax[axis] <= position) {
+			left.push_back(reference);
+			continue;
+		}
+		if (reference.bounds.bmin[axis] >= position) {
+			right.push_back(reference);
+			continue;
+		}
+
+		/** Unsplitting: keep a straddling reference whole on one side when that is cheaper than duplicating it */
+		aabb leftUnion = leftBounds.Union(reference.bounds);
+		aabb rightUnion = rightBounds.Union(reference.bounds);
+		float splitCost = leftBounds.Area() * leftCount + rightBounds.Area() * rightCount;
+		float leftCost = leftUnion.Area() * leftCount + rightBounds.Area() * (rightCount - 1);
+		float rightCost = leftBounds.Area() * (leftCount - 1) + rightUnion.Area() * rightCount;
+		if (leftCost < splitCost && leftCost <= rightCost) {
+			left.push_back(reference);
+			leftBounds = leftUnion;
+			rightCount--;
+			continue;
+		}
+		if (rightCost < splitCost) {
+			right.push_back(reference);
+			rightBounds = rightUnion;
+			leftCount--;
+			continue;
+		}
+
+		Reference lower = { this->Clip(reference, axis, -std::numeric_limits<float>::max(), position), reference.triangle };
+		Reference upper = { this->Clip(reference, axis, position, std::numeric_limits<float>::max()), reference.triangle };
+		bool hasLower = !IsEmptyBounds(lower.bounds);
+		bool hasUpper = !IsEmptyBounds(upper.bounds);
+		if (hasLower && hasUpper) {
+			left.push_back(lower);
+			right.push_back(upper);
+			this->referenceCount++;
+		}
+		else if (hasLower) {
+			left.push_back(lower);
+		}
+		else {
+			right.push_back(hasUpper ? upper : reference);
+		}
+	}
+}
+
+template <class Triangle, class Node>
+aabb SBVHBuilder<Triangle, Node>::Clip(const Reference& reference, int axis, float lo, float hi) const {
+	const Triangle* triangle = &this->triangles[reference.triangle];
+	const float4 vertices[3] = { triangle->v0, triangle->v1, triangle->v2 };
+
+	/** Grow over the vertices inside the slab and the points where the edges cross its planes */
+	aabb bounds;
+	bounds.Reset();
+	for (int i = 0; i < 3; i++) {
+		const float4& a = vertices[i];
+		const float4& b = vertices[(i + 1) % 3];
+		float pa = GetVertexAxisValue(axis, a);
+		float pb = GetVertexAxisValue(axis, b);
+		if (pa >= lo && pa <= hi) { bounds.Grow(a); }
+		if ((pa < lo && pb > lo) || (pa > lo && pb < lo)) { bounds.Grow(a + (b - a) * ((lo - pa) / (pb - pa))); }
+		if ((pa < hi && pb > hi) || (pa > hi && pb < hi)) { bounds.Grow(a + (b - a) * ((hi - pa) / (pb - pa))); }
+	}
+
+	/** The reference may already be clipped by earlier splits */
+	bounds = bounds.Intersection(reference.bounds);
+	bounds.bmin[axis] = max(bounds.bmin[axis], lo);
+	bounds.bmax[axis] = min(bounds.bmax[axis], hi);
+	return bounds;
+}
+
+// EOF